@@ -456,6 +456,7 @@ static int ram_save_block(QEMUFile *f, bool last_stage)
             uint8_t *p;
             int cont = (block == last_sent_block) ?
                 RAM_SAVE_FLAG_CONTINUE : 0;
+            bool send_async = true;
 
             p = memory_region_get_ram_ptr(mr) + offset;
 
@@ -473,13 +474,19 @@ static int ram_save_block(QEMUFile *f, bool last_stage)
                                               offset, cont, last_stage);
                 if (!last_stage) {
                     p = get_cached_data(XBZRLE.cache, current_addr);
+                    /* the cache entry may be replaced before it is sent */
+                    send_async = false;
                 }
             }
 
             /* XBZRLE overflow or normal page */
             if (bytes_sent == -1) {
                 bytes_sent = save_block_hdr(f, block, offset, cont, RAM_SAVE_FLAG_PAGE);
-                qemu_put_buffer(f, p, TARGET_PAGE_SIZE);
+                if (send_async) {
+                    qemu_put_buffer_async(f, p, TARGET_PAGE_SIZE);
+                } else {
+                    qemu_put_buffer(f, p, TARGET_PAGE_SIZE);
+                }
                 bytes_sent += TARGET_PAGE_SIZE;
                 acct_info.norm_pages++;
             }
@@ -642,6 +649,8 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
         i++;
     }
 
+    /* Pages queued by reference must be sent before blocks can be freed */
+    qemu_fflush(f);
     qemu_mutex_unlock_ramlist();
 
     if (ret < 0) {
@@ -676,6 +685,7 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
     }
     migration_end();
 
+    qemu_fflush(f);
     qemu_mutex_unlock_ramlist();
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
 
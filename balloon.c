@@ -34,10 +34,12 @@
 
 static QEMUBalloonEvent *balloon_event_fn;
 static QEMUBalloonStatus *balloon_stat_fn;
+static QEMUBalloonPageFree *balloon_free_fn;
 static void *balloon_opaque;
 
 int qemu_add_balloon_handler(QEMUBalloonEvent *event_func,
-                             QEMUBalloonStatus *stat_func, void *opaque)
+                             QEMUBalloonStatus *stat_func,
+                             QEMUBalloonPageFree *free_func, void *opaque)
 {
     if (balloon_event_fn || balloon_stat_fn || balloon_opaque) {
         /* We're already registered one balloon handler.  How many can
@@ -48,6 +50,7 @@ int qemu_add_balloon_handler(QEMUBalloonEvent *event_func,
     }
     balloon_event_fn = event_func;
     balloon_stat_fn = stat_func;
+    balloon_free_fn = free_func;
     balloon_opaque = opaque;
     return 0;
 }
@@ -59,6 +62,7 @@ void qemu_remove_balloon_handler(void *opaque)
     }
     balloon_event_fn = NULL;
     balloon_stat_fn = NULL;
+    balloon_free_fn = NULL;
     balloon_opaque = NULL;
 }
 
@@ -81,6 +85,14 @@ static int qemu_balloon_status(BalloonInfo *info)
     return 1;
 }
 
+bool qemu_balloon_page_free(ram_addr_t addr, ram_addr_t size)
+{
+    if (!balloon_free_fn) {
+        return false;
+    }
+    return balloon_free_fn(balloon_opaque, addr, size);
+}
+
 void qemu_balloon_changed(int64_t actual)
 {
     QObject *data;
@@ -54,6 +54,8 @@
 typedef enum {
     BDRV_REQ_COPY_ON_READ = 0x1,
     BDRV_REQ_ZERO_WRITE   = 0x2,
+    /* VM state beyond the end of the device, not guest I/O */
+    BDRV_REQ_VMSTATE      = 0x4,
 } BdrvRequestFlags;
 
 static void bdrv_dev_change_media_cb(BlockDriverState *bs, bool load);
@@ -1950,6 +1952,7 @@ typedef struct RwCo {
     int nb_sectors;
     QEMUIOVector *qiov;
     bool is_write;
+    BdrvRequestFlags flags;
     int ret;
 } RwCo;
 
@@ -1959,10 +1962,12 @@ static void coroutine_fn bdrv_rw_co_entry(void *opaque)
 
     if (!rwco->is_write) {
         rwco->ret = bdrv_co_do_readv(rwco->bs, rwco->sector_num,
-                                     rwco->nb_sectors, rwco->qiov, 0);
+                                     rwco->nb_sectors, rwco->qiov,
+                                     rwco->flags);
     } else {
         rwco->ret = bdrv_co_do_writev(rwco->bs, rwco->sector_num,
-                                      rwco->nb_sectors, rwco->qiov, 0);
+                                      rwco->nb_sectors, rwco->qiov,
+                                      rwco->flags);
     }
 }
 
@@ -1970,7 +1975,7 @@ static void coroutine_fn bdrv_rw_co_entry(void *opaque)
  * Process a synchronous request using coroutines
  */
 static int bdrv_rw_co(BlockDriverState *bs, int64_t sector_num, uint8_t *buf,
-                      int nb_sectors, bool is_write)
+                      int nb_sectors, bool is_write, BdrvRequestFlags flags)
 {
     QEMUIOVector qiov;
     struct iovec iov = {
@@ -1984,6 +1989,7 @@ static int bdrv_rw_co(BlockDriverState *bs, int64_t sector_num, uint8_t *buf,
         .nb_sectors = nb_sectors,
         .qiov = &qiov,
         .is_write = is_write,
+        .flags = flags,
         .ret = NOT_DONE,
     };
 
@@ -1994,7 +2000,7 @@ static int bdrv_rw_co(BlockDriverState *bs, int64_t sector_num, uint8_t *buf,
      * will not fire; so the I/O throttling function has to be disabled here
      * if it has been enabled.
      */
-    if (bs->io_limits_enabled) {
+    if (bs->io_limits_enabled && !(flags & BDRV_REQ_VMSTATE)) {
         fprintf(stderr, "Disabling I/O throttling on '%s' due "
                         "to synchronous I/O.\n", bdrv_get_device_name(bs));
         bdrv_io_limits_disable(bs);
@@ -2017,7 +2023,7 @@ static int bdrv_rw_co(BlockDriverState *bs, int64_t sector_num, uint8_t *buf,
 int bdrv_read(BlockDriverState *bs, int64_t sector_num,
               uint8_t *buf, int nb_sectors)
 {
-    return bdrv_rw_co(bs, sector_num, buf, nb_sectors, false);
+    return bdrv_rw_co(bs, sector_num, buf, nb_sectors, false, 0);
 }
 
 /* Just like bdrv_read(), but with I/O throttling temporarily disabled */
@@ -2043,11 +2049,11 @@ int bdrv_read_unthrottled(BlockDriverState *bs, int64_t sector_num,
 int bdrv_write(BlockDriverState *bs, int64_t sector_num,
                const uint8_t *buf, int nb_sectors)
 {
-    return bdrv_rw_co(bs, sector_num, (uint8_t *)buf, nb_sectors, true);
+    return bdrv_rw_co(bs, sector_num, (uint8_t *)buf, nb_sectors, true, 0);
 }
 
-int bdrv_pread(BlockDriverState *bs, int64_t offset,
-               void *buf, int count1)
+static int bdrv_pread_flags(BlockDriverState *bs, int64_t offset,
+                            void *buf, int count1, BdrvRequestFlags flags)
 {
     uint8_t tmp_buf[BDRV_SECTOR_SIZE];
     int len, nb_sectors, count;
@@ -2061,7 +2067,7 @@ int bdrv_pread(BlockDriverState *bs, int64_t offset,
         len = count;
     sector_num = offset >> BDRV_SECTOR_BITS;
     if (len > 0) {
-        if ((ret = bdrv_read(bs, sector_num, tmp_buf, 1)) < 0)
+        if ((ret = bdrv_rw_co(bs, sector_num, tmp_buf, 1, false, flags)) < 0)
             return ret;
         memcpy(buf, tmp_buf + (offset & (BDRV_SECTOR_SIZE - 1)), len);
         count -= len;
@@ -2074,7 +2080,8 @@ int bdrv_pread(BlockDriverState *bs, int64_t offset,
     /* read the sectors "in place" */
     nb_sectors = count >> BDRV_SECTOR_BITS;
     if (nb_sectors > 0) {
-        if ((ret = bdrv_read(bs, sector_num, buf, nb_sectors)) < 0)
+        ret = bdrv_rw_co(bs, sector_num, buf, nb_sectors, false, flags);
+        if (ret < 0)
             return ret;
         sector_num += nb_sectors;
         len = nb_sectors << BDRV_SECTOR_BITS;
@@ -2084,15 +2091,16 @@ int bdrv_pread(BlockDriverState *bs, int64_t offset,
 
     /* add data from the last sector */
     if (count > 0) {
-        if ((ret = bdrv_read(bs, sector_num, tmp_buf, 1)) < 0)
+        if ((ret = bdrv_rw_co(bs, sector_num, tmp_buf, 1, false, flags)) < 0)
             return ret;
         memcpy(buf, tmp_buf, count);
     }
     return count1;
 }
 
-int bdrv_pwrite(BlockDriverState *bs, int64_t offset,
-                const void *buf, int count1)
+static int bdrv_pwrite_flags(BlockDriverState *bs, int64_t offset,
+                             const void *buf, int count1,
+                             BdrvRequestFlags flags)
 {
     uint8_t tmp_buf[BDRV_SECTOR_SIZE];
     int len, nb_sectors, count;
@@ -2106,10 +2114,10 @@ int bdrv_pwrite(BlockDriverState *bs, int64_t offset,
         len = count;
     sector_num = offset >> BDRV_SECTOR_BITS;
     if (len > 0) {
-        if ((ret = bdrv_read(bs, sector_num, tmp_buf, 1)) < 0)
+        if ((ret = bdrv_rw_co(bs, sector_num, tmp_buf, 1, false, flags)) < 0)
             return ret;
         memcpy(tmp_buf + (offset & (BDRV_SECTOR_SIZE - 1)), buf, len);
-        if ((ret = bdrv_write(bs, sector_num, tmp_buf, 1)) < 0)
+        if ((ret = bdrv_rw_co(bs, sector_num, tmp_buf, 1, true, flags)) < 0)
             return ret;
         count -= len;
         if (count == 0)
@@ -2121,7 +2129,9 @@ int bdrv_pwrite(BlockDriverState *bs, int64_t offset,
     /* write the sectors "in place" */
     nb_sectors = count >> BDRV_SECTOR_BITS;
     if (nb_sectors > 0) {
-        if ((ret = bdrv_write(bs, sector_num, buf, nb_sectors)) < 0)
+        ret = bdrv_rw_co(bs, sector_num, (uint8_t *)buf, nb_sectors, true,
+                         flags);
+        if (ret < 0)
             return ret;
         sector_num += nb_sectors;
         len = nb_sectors << BDRV_SECTOR_BITS;
@@ -2131,15 +2141,44 @@ int bdrv_pwrite(BlockDriverState *bs, int64_t offset,
 
     /* add data from the last sector */
     if (count > 0) {
-        if ((ret = bdrv_read(bs, sector_num, tmp_buf, 1)) < 0)
+        if ((ret = bdrv_rw_co(bs, sector_num, tmp_buf, 1, false, flags)) < 0)
             return ret;
         memcpy(tmp_buf, buf, count);
-        if ((ret = bdrv_write(bs, sector_num, tmp_buf, 1)) < 0)
+        if ((ret = bdrv_rw_co(bs, sector_num, tmp_buf, 1, true, flags)) < 0)
             return ret;
     }
     return count1;
 }
 
+int bdrv_pread(BlockDriverState *bs, int64_t offset, void *buf, int count)
+{
+    return bdrv_pread_flags(bs, offset, buf, count, 0);
+}
+
+int bdrv_pwrite(BlockDriverState *bs, int64_t offset, const void *buf,
+                int count)
+{
+    return bdrv_pwrite_flags(bs, offset, buf, count, 0);
+}
+
+/*
+ * Access the VM state area that image formats keep after the end of the
+ * device.  Unlike setting bs->growable, this lifts the bounds check for
+ * these requests only, so the guest cannot get past the end of its disk
+ * while a live snapshot is being saved.
+ */
+int bdrv_pread_vmstate(BlockDriverState *bs, int64_t offset, void *buf,
+                       int count)
+{
+    return bdrv_pread_flags(bs, offset, buf, count, BDRV_REQ_VMSTATE);
+}
+
+int bdrv_pwrite_vmstate(BlockDriverState *bs, int64_t offset,
+                        const void *buf, int count)
+{
+    return bdrv_pwrite_flags(bs, offset, buf, count, BDRV_REQ_VMSTATE);
+}
+
 /*
  * Writes to the file and ensures that no writes are reordered across this
  * request (acts as a barrier)
@@ -2244,16 +2283,20 @@ static int coroutine_fn bdrv_co_do_readv(BlockDriverState *bs,
     if (!drv) {
         return -ENOMEDIUM;
     }
-    if (bdrv_check_request(bs, sector_num, nb_sectors)) {
+    if (flags & BDRV_REQ_VMSTATE) {
+        if (!bdrv_is_inserted(bs) || sector_num < 0) {
+            return -EIO;
+        }
+    } else if (bdrv_check_request(bs, sector_num, nb_sectors)) {
         return -EIO;
     }
 
     /* throttling disk read I/O */
-    if (bs->io_limits_enabled) {
+    if (bs->io_limits_enabled && !(flags & BDRV_REQ_VMSTATE)) {
         bdrv_io_limits_intercept(bs, false, nb_sectors);
     }
 
-    if (bs->copy_on_read) {
+    if (bs->copy_on_read && !(flags & BDRV_REQ_VMSTATE)) {
         flags |= BDRV_REQ_COPY_ON_READ;
     }
     if (flags & BDRV_REQ_COPY_ON_READ) {
@@ -2357,12 +2400,16 @@ static int coroutine_fn bdrv_co_do_writev(BlockDriverState *bs,
     if (bs->read_only) {
         return -EACCES;
     }
-    if (bdrv_check_request(bs, sector_num, nb_sectors)) {
+    if (flags & BDRV_REQ_VMSTATE) {
+        if (!bdrv_is_inserted(bs) || sector_num < 0) {
+            return -EIO;
+        }
+    } else if (bdrv_check_request(bs, sector_num, nb_sectors)) {
         return -EIO;
     }
 
     /* throttling disk write I/O */
-    if (bs->io_limits_enabled) {
+    if (bs->io_limits_enabled && !(flags & BDRV_REQ_VMSTATE)) {
         bdrv_io_limits_intercept(bs, true, nb_sectors);
     }
 
@@ -2382,11 +2429,13 @@ static int coroutine_fn bdrv_co_do_writev(BlockDriverState *bs,
         ret = bdrv_co_flush(bs);
     }
 
-    if (bs->dirty_bitmap) {
+    /* the VM state is not part of the disk contents */
+    if (bs->dirty_bitmap && !(flags & BDRV_REQ_VMSTATE)) {
         bdrv_set_dirty(bs, sector_num, nb_sectors);
     }
 
-    if (bs->wr_highest_sector < sector_num + nb_sectors - 1) {
+    if (bs->wr_highest_sector < sector_num + nb_sectors - 1 &&
+        !(flags & BDRV_REQ_VMSTATE)) {
         bs->wr_highest_sector = sector_num + nb_sectors - 1;
     }
 
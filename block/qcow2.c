@@ -1609,30 +1609,18 @@ static int qcow2_save_vmstate(BlockDriverState *bs, const uint8_t *buf,
                               int64_t pos, int size)
 {
     BDRVQcowState *s = bs->opaque;
-    int growable = bs->growable;
-    int ret;
 
     BLKDBG_EVENT(bs->file, BLKDBG_VMSTATE_SAVE);
-    bs->growable = 1;
-    ret = bdrv_pwrite(bs, qcow2_vm_state_offset(s) + pos, buf, size);
-    bs->growable = growable;
-
-    return ret;
+    return bdrv_pwrite_vmstate(bs, qcow2_vm_state_offset(s) + pos, buf, size);
 }
 
 static int qcow2_load_vmstate(BlockDriverState *bs, uint8_t *buf,
                               int64_t pos, int size)
 {
     BDRVQcowState *s = bs->opaque;
-    int growable = bs->growable;
-    int ret;
 
     BLKDBG_EVENT(bs->file, BLKDBG_VMSTATE_LOAD);
-    bs->growable = 1;
-    ret = bdrv_pread(bs, qcow2_vm_state_offset(s) + pos, buf, size);
-    bs->growable = growable;
-
-    return ret;
+    return bdrv_pread_vmstate(bs, qcow2_vm_state_offset(s) + pos, buf, size);
 }
 
 static QEMUOptionParameter qcow2_create_options[] = {
@@ -145,6 +145,10 @@ char *target_strerror(int err);
 int get_osversion(void);
 void fork_start(void);
 void fork_end(int child);
+void cpu_exec_start(CPUState *cpu);
+void cpu_exec_end(CPUState *cpu);
+void start_exclusive(void);
+void end_exclusive(void);
 
 #include "qemu/log.h"
 
@@ -77,8 +77,10 @@ static void cpu_exec_nocache(CPUArchState *env, int max_cycles,
            the TB starts executing.  */
         cpu_pc_from_tb(env, tb);
     }
+    tb_lock();
     tb_phys_invalidate(tb, -1);
     tb_free(tb);
+    tb_unlock();
 }
 
 static TranslationBlock *tb_find_slow(CPUArchState *env,
@@ -86,23 +88,25 @@ static TranslationBlock *tb_find_slow(CPUArchState *env,
                                       target_ulong cs_base,
                                       uint64_t flags)
 {
-    TranslationBlock *tb, **ptb1;
+    TranslationBlock *tb;
     unsigned int h;
     tb_page_addr_t phys_pc, phys_page1;
     target_ulong virt_page2;
 
-    tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
+    tcg_ctx.tb_invalidated_flag = 0;
 
-    /* find translated block using physical mappings */
+    /* find translated block using physical mappings; this does not take
+       tb_lock, as blocks only enter the hash table once complete */
     phys_pc = get_page_addr_code(env, pc);
     phys_page1 = phys_pc & TARGET_PAGE_MASK;
     h = tb_phys_hash_func(phys_pc);
-    ptb1 = &tcg_ctx.tb_ctx.tb_phys_hash[h];
+    tb = tb_ctx.tb_phys_hash[h];
     for(;;) {
-        tb = *ptb1;
         if (!tb)
             goto not_found;
-        if (tb->pc == pc &&
+        smp_rmb();
+        if (!tb->invalid &&
+            tb->pc == pc &&
             tb->page_addr[0] == phys_page1 &&
             tb->cs_base == cs_base &&
             tb->flags == flags) {
@@ -119,19 +123,13 @@ static TranslationBlock *tb_find_slow(CPUArchState *env,
                 goto found;
             }
         }
-        ptb1 = &tb->phys_hash_next;
+        tb = tb->phys_hash_next;
     }
  not_found:
    /* if no translated code available, then translate it now */
     tb = tb_gen_code(env, pc, cs_base, flags, 0);
 
  found:
-    /* Move the last found TB to the head of the list */
-    if (likely(*ptb1)) {
-        *ptb1 = tb->phys_hash_next;
-        tb->phys_hash_next = tcg_ctx.tb_ctx.tb_phys_hash[h];
-        tcg_ctx.tb_ctx.tb_phys_hash[h] = tb;
-    }
     /* we add the TB in the virtual pc hash table */
     env->tb_jmp_cache[tb_jmp_cache_hash_func(pc)] = tb;
     return tb;
@@ -149,7 +147,7 @@ static inline TranslationBlock *tb_find_fast(CPUArchState *env)
     cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
     tb = env->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
     if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
-                 tb->flags != flags)) {
+                 tb->flags != flags || tb->invalid)) {
         tb = tb_find_slow(env, pc, cs_base, flags);
     }
     return tb;
@@ -564,16 +562,15 @@ int cpu_exec(CPUArchState *env)
 #endif
                 }
 #endif /* DEBUG_DISAS || CONFIG_DEBUG_EXEC */
-                spin_lock(&tcg_ctx.tb_ctx.tb_lock);
                 tb = tb_find_fast(env);
                 /* Note: we do it here to avoid a gcc bug on Mac OS X when
                    doing it in tb_find_slow */
-                if (tcg_ctx.tb_ctx.tb_invalidated_flag) {
+                if (tcg_ctx.tb_invalidated_flag) {
                     /* as some TB could have been invalidated because
                        of memory exceptions while generating the code, we
                        must recompute the hash index here */
                     next_tb = 0;
-                    tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
+                    tcg_ctx.tb_invalidated_flag = 0;
                 }
 #ifdef CONFIG_DEBUG_EXEC
                 qemu_log_mask(CPU_LOG_EXEC, "Trace %p [" TARGET_FMT_lx "] %s\n",
@@ -582,11 +579,21 @@ int cpu_exec(CPUArchState *env)
 #endif
                 /* see if we can patch the calling TB. When the TB
                    spans two pages, we cannot safely do a direct
-                   jump. */
+                   jump.  Another thread may have invalidated either
+                   TB since we looked them up. */
                 if (next_tb != 0 && tb->page_addr[1] == -1) {
-                    tb_add_jump((TranslationBlock *)(next_tb & ~3), next_tb & 3, tb);
+                    TranslationBlock *last_tb =
+                        (TranslationBlock *)(next_tb & ~3);
+
+                    tb_lock();
+                    if (!last_tb->invalid && !tb->invalid) {
+                        tb_add_jump(last_tb, next_tb & 3, tb);
+                    }
+                    tb_unlock();
+                }
+                if (unlikely(tb->tb_stats)) {
+                    tb->tb_stats->dispatch_count++;
                 }
-                spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
 
                 /* cpu_interrupt might be called while translating the
                    TB, but before it is linked into a potentially
@@ -598,6 +605,14 @@ int cpu_exec(CPUArchState *env)
                     tc_ptr = tb->tc_ptr;
                     /* execute the generated code */
                     next_tb = tcg_qemu_tb_exec(env, tc_ptr);
+                    if (unlikely(tb_stats_enabled) && (next_tb & 3) != 2 &&
+                        next_tb != 0) {
+                        TranslationBlock *last_tb =
+                            (TranslationBlock *)(next_tb & ~3);
+                        if (last_tb->tb_stats) {
+                            last_tb->tb_stats->unchained_exits++;
+                        }
+                    }
                     if ((next_tb & 3) == 2) {
                         /* Instruction counter expired.  */
                         int insns_left;
@@ -634,6 +649,7 @@ int cpu_exec(CPUArchState *env)
             /* Reload env after longjmp - the compiler may have smashed all
              * local variables as longjmp is marked 'noreturn'. */
             env = cpu_single_env;
+            tb_lock_reset();
         }
     } /* for(;;) */
 
@@ -23,25 +23,19 @@
 /* Disassemble TCI bytecode. */
 int print_insn_tci(bfd_vma addr, disassemble_info *info)
 {
+    tcg_target_ulong insn;
     int length;
-    uint8_t byte;
     int status;
     TCGOpcode op;
 
-    status = info->read_memory_func(addr, &byte, 1, info);
+    status = info->read_memory_func(addr, (bfd_byte *)&insn, sizeof(insn),
+                                    info);
     if (status != 0) {
         info->memory_error_func(status, addr, info);
         return -1;
     }
-    op = byte;
-
-    addr++;
-    status = info->read_memory_func(addr, &byte, 1, info);
-    if (status != 0) {
-        info->memory_error_func(status, addr, info);
-        return -1;
-    }
-    length = byte;
+    op = insn & TCI_OPC_MASK;
+    length = (insn >> TCI_LEN_SHIFT) * sizeof(insn);
 
     if (op >= tcg_op_defs_max) {
         info->fprintf_func(info->stream, "illegal opcode %d", op);
@@ -19,7 +19,9 @@
 /* we need this function in hmp.c */
 void qmp_dump_guest_memory(bool paging, const char *file, bool has_begin,
                            int64_t begin, bool has_length, int64_t length,
-                           Error **errp)
+                           bool has_format, DumpGuestMemoryFormat format,
+                           bool has_threads, int64_t threads,
+                           bool has_snapshot, bool snapshot, Error **errp)
 {
     error_set(errp, QERR_UNSUPPORTED);
 }
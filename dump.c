@@ -24,6 +24,15 @@
 #include "qapi/error.h"
 #include "qmp-commands.h"
 #include "exec/gdbstub.h"
+#include "qemu/thread.h"
+#include "qemu/main-loop.h"
+#include "qapi/qmp/qjson.h"
+#include "sysemu/balloon.h"
+
+#include <zlib.h>
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
 
 static uint16_t cpu_convert_to_target16(uint16_t val, int endian)
 {
@@ -75,12 +84,35 @@ typedef struct DumpState {
     int64_t begin;
     int64_t length;
     Error **errp;
+
+    int nr_cpus;
+
+    /* kdump-compressed format */
+    bool kdump;
+    int nr_threads;
+    size_t page_size;
+    uint8_t *note_buf;
+    size_t note_buf_offset;
+    uint64_t max_mapnr;
+    uint64_t num_dumpable;
+    bool free_excluded;
+    size_t len_dump_bitmap;         /* of each of the two bitmaps */
+    uint8_t *valid_bitmap;
+    uint8_t *dump_bitmap;
+    off_t offset_dump_bitmap;
+    off_t offset_page;
 } DumpState;
 
 static int dump_cleanup(DumpState *s)
 {
     int ret = 0;
 
+    g_free(s->note_buf);
+    s->note_buf = NULL;
+    g_free(s->valid_bitmap);
+    s->valid_bitmap = NULL;
+    g_free(s->dump_bitmap);
+    s->dump_bitmap = NULL;
     memory_mapping_list_free(&s->list);
     if (s->fd != -1) {
         close(s->fd);
@@ -268,7 +300,7 @@ static int write_elf64_note(DumpState *s)
     return 0;
 }
 
-static int write_elf64_notes(DumpState *s)
+static int write_elf64_notes(write_core_dump_function f, DumpState *s)
 {
     CPUArchState *env;
     CPUState *cpu;
@@ -278,7 +310,7 @@ static int write_elf64_notes(DumpState *s)
     for (env = first_cpu; env != NULL; env = env->next_cpu) {
         cpu = ENV_GET_CPU(env);
         id = cpu_index(cpu);
-        ret = cpu_write_elf64_note(fd_write_vmcore, env, id, s);
+        ret = cpu_write_elf64_note(f, env, id, s);
         if (ret < 0) {
             dump_error(s, "dump: failed to write elf notes.\n");
             return -1;
@@ -286,7 +318,7 @@ static int write_elf64_notes(DumpState *s)
     }
 
     for (env = first_cpu; env != NULL; env = env->next_cpu) {
-        ret = cpu_write_elf64_qemunote(fd_write_vmcore, env, s);
+        ret = cpu_write_elf64_qemunote(f, env, s);
         if (ret < 0) {
             dump_error(s, "dump: failed to write CPU status.\n");
             return -1;
@@ -320,7 +352,7 @@ static int write_elf32_note(DumpState *s)
     return 0;
 }
 
-static int write_elf32_notes(DumpState *s)
+static int write_elf32_notes(write_core_dump_function f, DumpState *s)
 {
     CPUArchState *env;
     CPUState *cpu;
@@ -330,7 +362,7 @@ static int write_elf32_notes(DumpState *s)
     for (env = first_cpu; env != NULL; env = env->next_cpu) {
         cpu = ENV_GET_CPU(env);
         id = cpu_index(cpu);
-        ret = cpu_write_elf32_note(fd_write_vmcore, env, id, s);
+        ret = cpu_write_elf32_note(f, env, id, s);
         if (ret < 0) {
             dump_error(s, "dump: failed to write elf notes.\n");
             return -1;
@@ -338,7 +370,7 @@ static int write_elf32_notes(DumpState *s)
     }
 
     for (env = first_cpu; env != NULL; env = env->next_cpu) {
-        ret = cpu_write_elf32_qemunote(fd_write_vmcore, env, s);
+        ret = cpu_write_elf32_qemunote(f, env, s);
         if (ret < 0) {
             dump_error(s, "dump: failed to write CPU status.\n");
             return -1;
@@ -557,7 +589,7 @@ static int dump_begin(DumpState *s)
         }
 
         /* write notes to vmcore */
-        if (write_elf64_notes(s) < 0) {
+        if (write_elf64_notes(fd_write_vmcore, s) < 0) {
             return -1;
         }
 
@@ -580,7 +612,7 @@ static int dump_begin(DumpState *s)
         }
 
         /* write notes to vmcore */
-        if (write_elf32_notes(s) < 0) {
+        if (write_elf32_notes(fd_write_vmcore, s) < 0) {
             return -1;
         }
     }
@@ -669,6 +701,608 @@ static int create_vmcore(DumpState *s)
     return 0;
 }
 
+/*
+ * kdump-compressed format.
+ *
+ * Every page is compressed on its own and found through its
+ * PageDescriptor, so pages can be compressed independently: a pool of
+ * threads compresses chunks of pages while the dumping thread writes out
+ * the chunks that are done, in order.
+ */
+
+#define DUMP_MAX_THREADS        64
+#define DUMP_CHUNK_PAGES        256
+#define DUMP_CHUNKS_PER_THREAD  2
+
+typedef struct DumpChunk {
+    int nr_pages;
+    uint8_t *host[DUMP_CHUNK_PAGES];
+    uint32_t size[DUMP_CHUNK_PAGES];    /* 0 for a zero page */
+    bool compressed[DUMP_CHUNK_PAGES];
+    uint8_t *data;
+    size_t data_size;
+    bool done;
+} DumpChunk;
+
+typedef struct DumpCompress {
+    QemuMutex lock;
+    QemuCond work_cond;
+    QemuCond done_cond;
+    QemuThread *threads;
+    int nr_threads;
+    size_t page_size;
+    DumpChunk *chunks;
+    int nr_chunks;
+    unsigned int submitted;
+    unsigned int started;
+    unsigned int written;
+    bool quit;
+} DumpCompress;
+
+static int dump_thread_count(void)
+{
+    long n = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return MAX(1, MIN(n, DUMP_MAX_THREADS));
+}
+
+static void dump_compress_chunk(DumpChunk *chunk, z_stream *stream,
+                                size_t page_size)
+{
+    uint8_t *out = chunk->data;
+    int i;
+
+    for (i = 0; i < chunk->nr_pages; i++) {
+        chunk->compressed[i] = false;
+        if (buffer_is_zero(chunk->host[i], page_size)) {
+            chunk->size[i] = 0;
+            continue;
+        }
+
+        /* keep the page as it is unless it gets smaller */
+        if (stream && deflateReset(stream) == Z_OK) {
+            stream->next_in = chunk->host[i];
+            stream->avail_in = page_size;
+            stream->next_out = out;
+            stream->avail_out = page_size - 1;
+            if (deflate(stream, Z_FINISH) == Z_STREAM_END) {
+                chunk->size[i] = stream->total_out;
+                chunk->compressed[i] = true;
+            }
+        }
+        if (!chunk->compressed[i]) {
+            memcpy(out, chunk->host[i], page_size);
+            chunk->size[i] = page_size;
+        }
+        out += chunk->size[i];
+    }
+    chunk->data_size = out - chunk->data;
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompress *c = opaque;
+    DumpChunk *chunk;
+    z_stream stream;
+    bool zlib_ok;
+
+    memset(&stream, 0, sizeof(stream));
+    zlib_ok = deflateInit(&stream, Z_BEST_SPEED) == Z_OK;
+
+    qemu_mutex_lock(&c->lock);
+    for (;;) {
+        while (!c->quit && c->started == c->submitted) {
+            qemu_cond_wait(&c->work_cond, &c->lock);
+        }
+        if (c->quit) {
+            break;
+        }
+        chunk = &c->chunks[c->started++ % c->nr_chunks];
+        qemu_mutex_unlock(&c->lock);
+
+        dump_compress_chunk(chunk, zlib_ok ? &stream : NULL, c->page_size);
+
+        qemu_mutex_lock(&c->lock);
+        chunk->done = true;
+        qemu_cond_signal(&c->done_cond);
+    }
+    qemu_mutex_unlock(&c->lock);
+
+    if (zlib_ok) {
+        deflateEnd(&stream);
+    }
+    return NULL;
+}
+
+static void dump_compress_start(DumpCompress *c, int nr_threads,
+                                size_t page_size)
+{
+    int i;
+
+    memset(c, 0, sizeof(*c));
+    qemu_mutex_init(&c->lock);
+    qemu_cond_init(&c->work_cond);
+    qemu_cond_init(&c->done_cond);
+    c->page_size = page_size;
+    c->nr_chunks = nr_threads * DUMP_CHUNKS_PER_THREAD;
+    c->chunks = g_new0(DumpChunk, c->nr_chunks);
+    for (i = 0; i < c->nr_chunks; i++) {
+        c->chunks[i].data = g_malloc(DUMP_CHUNK_PAGES * page_size);
+    }
+    c->nr_threads = nr_threads;
+    c->threads = g_new0(QemuThread, nr_threads);
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_create(&c->threads[i], dump_compress_thread, c,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void dump_compress_stop(DumpCompress *c)
+{
+    int i;
+
+    qemu_mutex_lock(&c->lock);
+    c->quit = true;
+    qemu_cond_broadcast(&c->work_cond);
+    qemu_mutex_unlock(&c->lock);
+
+    for (i = 0; i < c->nr_threads; i++) {
+        qemu_thread_join(&c->threads[i]);
+    }
+    for (i = 0; i < c->nr_chunks; i++) {
+        g_free(c->chunks[i].data);
+    }
+    g_free(c->chunks);
+    g_free(c->threads);
+    qemu_cond_destroy(&c->done_cond);
+    qemu_cond_destroy(&c->work_cond);
+    qemu_mutex_destroy(&c->lock);
+}
+
+/* Hand the chunk being filled to the compression threads. */
+static void dump_compress_submit(DumpCompress *c)
+{
+    qemu_mutex_lock(&c->lock);
+    c->submitted++;
+    qemu_cond_signal(&c->work_cond);
+    qemu_mutex_unlock(&c->lock);
+}
+
+static int write_buffer(DumpState *s, off_t offset, void *buf, size_t size)
+{
+    if (lseek(s->fd, offset, SEEK_SET) != offset) {
+        return -1;
+    }
+    return fd_write_vmcore(buf, size, s);
+}
+
+/*
+ * Wait for the oldest chunk in flight and write its page descriptors at
+ * *offset_desc and its data at *offset_data.
+ */
+static int dump_compress_write(DumpState *s, DumpCompress *c,
+                               off_t *offset_desc, off_t *offset_data,
+                               off_t offset_zero)
+{
+    DumpChunk *chunk = &c->chunks[c->written % c->nr_chunks];
+    PageDescriptor pd[DUMP_CHUNK_PAGES];
+    int endian = s->dump_info.d_endian;
+    off_t offset = *offset_data;
+    int i;
+
+    qemu_mutex_lock(&c->lock);
+    while (!chunk->done) {
+        qemu_cond_wait(&c->done_cond, &c->lock);
+    }
+    qemu_mutex_unlock(&c->lock);
+
+    memset(pd, 0, sizeof(pd));
+    for (i = 0; i < chunk->nr_pages; i++) {
+        if (!chunk->size[i]) {
+            /* all zero pages share one copy */
+            pd[i].offset = cpu_convert_to_target64(offset_zero, endian);
+            pd[i].size = cpu_convert_to_target32(s->page_size, endian);
+            continue;
+        }
+        pd[i].offset = cpu_convert_to_target64(offset, endian);
+        pd[i].size = cpu_convert_to_target32(chunk->size[i], endian);
+        if (chunk->compressed[i]) {
+            pd[i].flags = cpu_convert_to_target32(DUMP_DH_COMPRESSED_ZLIB,
+                                                  endian);
+        }
+        offset += chunk->size[i];
+    }
+
+    if (write_buffer(s, *offset_desc, pd,
+                     chunk->nr_pages * sizeof(PageDescriptor)) < 0) {
+        return -1;
+    }
+    if (chunk->data_size &&
+        write_buffer(s, *offset_data, chunk->data, chunk->data_size) < 0) {
+        return -1;
+    }
+    *offset_desc += chunk->nr_pages * sizeof(PageDescriptor);
+    *offset_data = offset;
+
+    qemu_mutex_lock(&c->lock);
+    chunk->done = false;
+    c->written++;
+    qemu_mutex_unlock(&c->lock);
+
+    return 0;
+}
+
+/* The part of a block that is dumped, as an offset and size within it */
+static bool get_block_range(DumpState *s, RAMBlock *block, int64_t *start,
+                            int64_t *size)
+{
+    *start = 0;
+    *size = block->length;
+    if (s->has_filter) {
+        if (block->offset >= s->begin + s->length ||
+            block->offset + block->length <= s->begin) {
+            /* This block is out of the range */
+            return false;
+        }
+
+        if (s->begin > block->offset) {
+            *start = s->begin - block->offset;
+        }
+        *size -= *start;
+        if (s->begin + s->length < block->offset + block->length) {
+            *size -= block->offset + block->length - (s->begin + s->length);
+        }
+    }
+    return true;
+}
+
+/*
+ * Every page of the blocks that are dumped exists, and goes into the
+ * dump unless the guest gave it to the balloon.
+ */
+static void prepare_dump_bitmaps(DumpState *s)
+{
+    RAMBlock *block;
+    int64_t start, size;
+    uint64_t pfn, end;
+
+    s->max_mapnr = 0;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (get_block_range(s, block, &start, &size)) {
+            end = DIV_ROUND_UP(block->offset + start + size, s->page_size);
+            s->max_mapnr = MAX(s->max_mapnr, end);
+        }
+    }
+
+    s->len_dump_bitmap = DIV_ROUND_UP(DIV_ROUND_UP(s->max_mapnr, 8),
+                                      s->page_size) * s->page_size;
+    s->valid_bitmap = g_malloc0(s->len_dump_bitmap);
+    s->dump_bitmap = g_malloc0(s->len_dump_bitmap);
+    s->num_dumpable = 0;
+    s->free_excluded = false;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (!get_block_range(s, block, &start, &size)) {
+            continue;
+        }
+        end = DIV_ROUND_UP(block->offset + start + size, s->page_size);
+        for (pfn = (block->offset + start) / s->page_size; pfn < end; pfn++) {
+            s->valid_bitmap[pfn / 8] |= 1 << (pfn % 8);
+            if (qemu_balloon_page_free(pfn * s->page_size, s->page_size)) {
+                s->free_excluded = true;
+                continue;
+            }
+            s->dump_bitmap[pfn / 8] |= 1 << (pfn % 8);
+            s->num_dumpable++;
+        }
+    }
+}
+
+static int buf_write_note(void *buf, size_t size, void *opaque)
+{
+    DumpState *s = opaque;
+
+    if (s->note_buf_offset + size > s->note_size) {
+        return -1;
+    }
+    memcpy(s->note_buf + s->note_buf_offset, buf, size);
+    s->note_buf_offset += size;
+
+    return 0;
+}
+
+static const char *dump_machine_name(DumpState *s)
+{
+    switch (s->dump_info.d_machine) {
+    case EM_X86_64:
+        return "x86_64";
+    case EM_386:
+        return "i686";
+    default:
+        return "";
+    }
+}
+
+static uint32_t dump_level(DumpState *s)
+{
+    return DUMP_LEVEL_EXCLUDE_ZERO |
+           (s->free_excluded ? DUMP_LEVEL_EXCLUDE_FREE : 0);
+}
+
+static int write_dump_header64(DumpState *s)
+{
+    DiskDumpHeader64 dh;
+    KdumpSubHeader64 kh;
+    int endian = s->dump_info.d_endian;
+    uint32_t block_size = s->page_size;
+    uint32_t sub_hdr_size, bitmap_blocks;
+    off_t offset_note;
+    qemu_timeval tv;
+
+    sub_hdr_size = DIV_ROUND_UP(sizeof(kh) + s->note_size, block_size);
+    bitmap_blocks = s->len_dump_bitmap / block_size * 2;
+    offset_note = DISKDUMP_HEADER_BLOCKS * block_size + sizeof(kh);
+
+    memset(&dh, 0, sizeof(dh));
+    memcpy(dh.signature, KDUMP_SIGNATURE, SIG_LEN);
+    dh.header_version = cpu_convert_to_target32(KDUMP_HEADER_VERSION, endian);
+    pstrcpy(dh.utsname.machine, sizeof(dh.utsname.machine),
+            dump_machine_name(s));
+    qemu_gettimeofday(&tv);
+    dh.timestamp_sec = cpu_convert_to_target64(tv.tv_sec, endian);
+    dh.timestamp_usec = cpu_convert_to_target64(tv.tv_usec, endian);
+    dh.status = cpu_convert_to_target32(DUMP_DH_COMPRESSED_ZLIB, endian);
+    dh.block_size = cpu_convert_to_target32(block_size, endian);
+    dh.sub_hdr_size = cpu_convert_to_target32(sub_hdr_size, endian);
+    dh.bitmap_blocks = cpu_convert_to_target32(bitmap_blocks, endian);
+    dh.max_mapnr = cpu_convert_to_target32(MIN(s->max_mapnr, UINT32_MAX),
+                                           endian);
+    dh.nr_cpus = cpu_convert_to_target32(s->nr_cpus, endian);
+
+    memset(&kh, 0, sizeof(kh));
+    kh.dump_level = cpu_convert_to_target32(dump_level(s), endian);
+    kh.end_pfn = cpu_convert_to_target64(s->max_mapnr, endian);
+    kh.offset_note = cpu_convert_to_target64(offset_note, endian);
+    kh.note_size = cpu_convert_to_target64(s->note_size, endian);
+    kh.end_pfn_64 = cpu_convert_to_target64(s->max_mapnr, endian);
+    kh.max_mapnr_64 = cpu_convert_to_target64(s->max_mapnr, endian);
+
+    if (write_buffer(s, 0, &dh, sizeof(dh)) < 0 ||
+        write_buffer(s, DISKDUMP_HEADER_BLOCKS * block_size, &kh,
+                     sizeof(kh)) < 0) {
+        dump_error(s, "dump: failed to write disk dump header.\n");
+        return -1;
+    }
+
+    s->note_buf = g_malloc0(s->note_size);
+    s->note_buf_offset = 0;
+    if (write_elf64_notes(buf_write_note, s) < 0) {
+        return -1;
+    }
+    if (write_buffer(s, offset_note, s->note_buf, s->note_size) < 0) {
+        dump_error(s, "dump: failed to write elf notes.\n");
+        return -1;
+    }
+
+    s->offset_dump_bitmap = (DISKDUMP_HEADER_BLOCKS + sub_hdr_size) *
+                            block_size;
+    s->offset_page = s->offset_dump_bitmap + bitmap_blocks * block_size;
+
+    return 0;
+}
+
+static int write_dump_header32(DumpState *s)
+{
+    DiskDumpHeader32 dh;
+    KdumpSubHeader32 kh;
+    int endian = s->dump_info.d_endian;
+    uint32_t block_size = s->page_size;
+    uint32_t sub_hdr_size, bitmap_blocks;
+    off_t offset_note;
+    qemu_timeval tv;
+
+    sub_hdr_size = DIV_ROUND_UP(sizeof(kh) + s->note_size, block_size);
+    bitmap_blocks = s->len_dump_bitmap / block_size * 2;
+    offset_note = DISKDUMP_HEADER_BLOCKS * block_size + sizeof(kh);
+
+    memset(&dh, 0, sizeof(dh));
+    memcpy(dh.signature, KDUMP_SIGNATURE, SIG_LEN);
+    dh.header_version = cpu_convert_to_target32(KDUMP_HEADER_VERSION, endian);
+    pstrcpy(dh.utsname.machine, sizeof(dh.utsname.machine),
+            dump_machine_name(s));
+    qemu_gettimeofday(&tv);
+    dh.timestamp_sec = cpu_convert_to_target32(tv.tv_sec, endian);
+    dh.timestamp_usec = cpu_convert_to_target32(tv.tv_usec, endian);
+    dh.status = cpu_convert_to_target32(DUMP_DH_COMPRESSED_ZLIB, endian);
+    dh.block_size = cpu_convert_to_target32(block_size, endian);
+    dh.sub_hdr_size = cpu_convert_to_target32(sub_hdr_size, endian);
+    dh.bitmap_blocks = cpu_convert_to_target32(bitmap_blocks, endian);
+    dh.max_mapnr = cpu_convert_to_target32(MIN(s->max_mapnr, UINT32_MAX),
+                                           endian);
+    dh.nr_cpus = cpu_convert_to_target32(s->nr_cpus, endian);
+
+    memset(&kh, 0, sizeof(kh));
+    kh.dump_level = cpu_convert_to_target32(dump_level(s), endian);
+    kh.end_pfn = cpu_convert_to_target32(MIN(s->max_mapnr, UINT32_MAX),
+                                         endian);
+    kh.offset_note = cpu_convert_to_target64(offset_note, endian);
+    kh.note_size = cpu_convert_to_target32(s->note_size, endian);
+    kh.end_pfn_64 = cpu_convert_to_target64(s->max_mapnr, endian);
+    kh.max_mapnr_64 = cpu_convert_to_target64(s->max_mapnr, endian);
+
+    if (write_buffer(s, 0, &dh, sizeof(dh)) < 0 ||
+        write_buffer(s, DISKDUMP_HEADER_BLOCKS * block_size, &kh,
+                     sizeof(kh)) < 0) {
+        dump_error(s, "dump: failed to write disk dump header.\n");
+        return -1;
+    }
+
+    s->note_buf = g_malloc0(s->note_size);
+    s->note_buf_offset = 0;
+    if (write_elf32_notes(buf_write_note, s) < 0) {
+        return -1;
+    }
+    if (write_buffer(s, offset_note, s->note_buf, s->note_size) < 0) {
+        dump_error(s, "dump: failed to write elf notes.\n");
+        return -1;
+    }
+
+    s->offset_dump_bitmap = (DISKDUMP_HEADER_BLOCKS + sub_hdr_size) *
+                            block_size;
+    s->offset_page = s->offset_dump_bitmap + bitmap_blocks * block_size;
+
+    return 0;
+}
+
+static int write_dump_bitmaps(DumpState *s)
+{
+    if (write_buffer(s, s->offset_dump_bitmap, s->valid_bitmap,
+                     s->len_dump_bitmap) < 0 ||
+        write_buffer(s, s->offset_dump_bitmap + s->len_dump_bitmap,
+                     s->dump_bitmap, s->len_dump_bitmap) < 0) {
+        dump_error(s, "dump: failed to write dump bitmaps.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int compare_block_offset(const void *a, const void *b)
+{
+    const RAMBlock *block_a = *(RAMBlock * const *)a;
+    const RAMBlock *block_b = *(RAMBlock * const *)b;
+
+    return block_a->offset < block_b->offset ? -1 :
+           block_a->offset > block_b->offset;
+}
+
+static int write_dump_pages(DumpState *s)
+{
+    DumpCompress c;
+    DumpChunk *chunk = NULL;
+    RAMBlock *block, **blocks;
+    int64_t start, size;
+    uint64_t pfn, end;
+    off_t offset_desc, offset_zero, offset_data;
+    uint8_t *zero_page;
+    int i, nr_blocks;
+    int ret;
+
+    /*
+     * the page descriptors are followed by the one zero page that all
+     * zero pages point to, and then by the data of the other pages
+     */
+    offset_desc = s->offset_page;
+    offset_zero = offset_desc + s->num_dumpable * sizeof(PageDescriptor);
+    offset_data = offset_zero + s->page_size;
+
+    zero_page = g_malloc0(s->page_size);
+    ret = write_buffer(s, offset_zero, zero_page, s->page_size);
+    g_free(zero_page);
+    if (ret < 0) {
+        dump_error(s, "dump: failed to save memory.\n");
+        return -1;
+    }
+
+    /* ram_list is sorted by size, but the descriptors go by page number */
+    nr_blocks = 0;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        nr_blocks++;
+    }
+    blocks = g_new(RAMBlock *, nr_blocks);
+    i = 0;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        blocks[i++] = block;
+    }
+    qsort(blocks, nr_blocks, sizeof(*blocks), compare_block_offset);
+
+    dump_compress_start(&c, s->nr_threads, s->page_size);
+    for (i = 0; i < nr_blocks; i++) {
+        block = blocks[i];
+        if (!get_block_range(s, block, &start, &size)) {
+            continue;
+        }
+        end = DIV_ROUND_UP(block->offset + start + size, s->page_size);
+        for (pfn = (block->offset + start) / s->page_size; pfn < end; pfn++) {
+            if (!(s->dump_bitmap[pfn / 8] & (1 << (pfn % 8)))) {
+                continue;
+            }
+            if (!chunk) {
+                if (c.submitted - c.written == c.nr_chunks) {
+                    ret = dump_compress_write(s, &c, &offset_desc,
+                                              &offset_data, offset_zero);
+                    if (ret < 0) {
+                        goto out;
+                    }
+                }
+                chunk = &c.chunks[c.submitted % c.nr_chunks];
+                chunk->nr_pages = 0;
+            }
+            chunk->host[chunk->nr_pages++] = block->host +
+                                             pfn * s->page_size -
+                                             block->offset;
+            if (chunk->nr_pages == DUMP_CHUNK_PAGES) {
+                dump_compress_submit(&c);
+                chunk = NULL;
+            }
+        }
+    }
+    if (chunk) {
+        dump_compress_submit(&c);
+    }
+
+    ret = 0;
+    while (c.written != c.submitted) {
+        ret = dump_compress_write(s, &c, &offset_desc, &offset_data,
+                                  offset_zero);
+        if (ret < 0) {
+            break;
+        }
+    }
+
+out:
+    dump_compress_stop(&c);
+    g_free(blocks);
+    if (ret < 0) {
+        dump_error(s, "dump: failed to save memory.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int create_kdump_vmcore(DumpState *s)
+{
+    int ret;
+
+    prepare_dump_bitmaps(s);
+
+    if (s->dump_info.d_class == ELFCLASS64) {
+        ret = write_dump_header64(s);
+    } else {
+        ret = write_dump_header32(s);
+    }
+    if (ret < 0) {
+        return -1;
+    }
+
+    ret = write_dump_bitmaps(s);
+    if (ret < 0) {
+        return -1;
+    }
+
+    ret = write_dump_pages(s);
+    if (ret < 0) {
+        return -1;
+    }
+
+    dump_completed(s);
+    return 0;
+}
+
 static ram_addr_t get_start_block(DumpState *s)
 {
     RAMBlock *block;
@@ -736,6 +1370,8 @@ static int dump_init(DumpState *s, int fd, bool paging, bool has_filter,
         nr_cpus++;
     }
 
+    s->nr_cpus = nr_cpus;
+
     ret = cpu_get_dump_info(&s->dump_info);
     if (ret < 0) {
         error_set(errp, QERR_UNSUPPORTED);
@@ -813,9 +1449,125 @@ cleanup:
     return -1;
 }
 
+static void dump_process(DumpState *s, Error **errp)
+{
+    int ret;
+
+    if (s->kdump) {
+        ret = create_kdump_vmcore(s);
+    } else {
+        ret = create_vmcore(s);
+    }
+    if (ret < 0 && !error_is_set(errp)) {
+        error_set(errp, QERR_IO_ERROR);
+    }
+}
+
+#ifndef _WIN32
+/*
+ * A snapshot dump is written by a child process, from the copy of the
+ * guest memory that fork() gives it, while the guest runs on.  The child
+ * reports an error through a pipe and exits; the parent reaps it when the
+ * pipe is closed.
+ */
+
+#define DUMP_SNAPSHOT_MSG_MAX   256
+
+typedef struct DumpSnapshot {
+    pid_t pid;
+    int fd;
+    char msg[DUMP_SNAPSHOT_MSG_MAX + 1];
+    size_t msg_len;
+} DumpSnapshot;
+
+static void dump_snapshot_read(void *opaque)
+{
+    DumpSnapshot *d = opaque;
+    QObject *data;
+    ssize_t len;
+    int status;
+
+    len = read(d->fd, d->msg + d->msg_len, DUMP_SNAPSHOT_MSG_MAX - d->msg_len);
+    if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+    if (len > 0) {
+        d->msg_len += len;
+        return;
+    }
+
+    qemu_set_fd_handler(d->fd, NULL, NULL, NULL);
+    close(d->fd);
+
+    /* Always reap the child, even when it already reported an error */
+    if (waitpid(d->pid, &status, 0) == d->pid && !d->msg_len &&
+        (!WIFEXITED(status) || WEXITSTATUS(status))) {
+        pstrcpy(d->msg, sizeof(d->msg), "the dump process failed");
+        d->msg_len = strlen(d->msg);
+    }
+
+    if (d->msg_len) {
+        d->msg[d->msg_len] = 0;
+        data = qobject_from_jsonf("{ 'error': %s }", d->msg);
+    } else {
+        data = qobject_from_jsonf("{ }");
+    }
+    monitor_protocol_event(QEVENT_DUMP_COMPLETED, data);
+    qobject_decref(data);
+
+    g_free(d);
+}
+
+static void dump_snapshot(DumpState *s, Error **errp)
+{
+    DumpSnapshot *d;
+    Error *err = NULL;
+    const char *msg;
+    size_t len;
+    int fds[2];
+    pid_t pid;
+
+    if (qemu_pipe(fds) < 0) {
+        error_set(errp, QERR_IO_ERROR);
+        dump_cleanup(s);
+        return;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        s->resume = false;
+        s->errp = &err;
+        dump_process(s, &err);
+        if (err) {
+            msg = error_get_pretty(err);
+            len = MIN(strlen(msg), DUMP_SNAPSHOT_MSG_MAX);
+            _exit(qemu_write_full(fds[1], msg, len) == len ? 1 : 2);
+        }
+        _exit(0);
+    }
+
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        error_set(errp, QERR_IO_ERROR);
+    } else {
+        d = g_malloc0(sizeof(*d));
+        d->pid = pid;
+        d->fd = fds[0];
+        qemu_set_fd_handler(d->fd, dump_snapshot_read, NULL, d);
+    }
+
+    /* the parent's copy of the guest runs on */
+    dump_cleanup(s);
+}
+#endif
+
 void qmp_dump_guest_memory(bool paging, const char *file, bool has_begin,
                            int64_t begin, bool has_length, int64_t length,
-                           Error **errp)
+                           bool has_format, DumpGuestMemoryFormat format,
+                           bool has_threads, int64_t threads,
+                           bool has_snapshot, bool snapshot, Error **errp)
 {
     const char *p;
     int fd = -1;
@@ -830,6 +1582,39 @@ void qmp_dump_guest_memory(bool paging, const char *file, bool has_begin,
         error_set(errp, QERR_MISSING_PARAMETER, "begin");
         return;
     }
+    if (!has_format) {
+        format = DUMP_GUEST_MEMORY_FORMAT_ELF;
+    }
+    if (!has_threads) {
+        threads = dump_thread_count();
+    } else if (threads < 1 || threads > DUMP_MAX_THREADS) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "threads",
+                  "a number between 1 and 64");
+        return;
+    }
+    if (!has_snapshot) {
+        snapshot = false;
+    }
+#ifdef _WIN32
+    if (snapshot) {
+        error_set(errp, QERR_UNSUPPORTED);
+        return;
+    }
+#else
+    if (snapshot && kvm_enabled() && !kvm_has_sync_mmu()) {
+        /* guest memory is not inherited by the child without it */
+        error_set(errp, QERR_KVM_MISSING_CAP, "synchronous MMU",
+                  "snapshot dump");
+        return;
+    }
+    if (snapshot && mem_path && mem_prealloc) {
+        /* -mem-prealloc maps guest RAM MAP_SHARED, so the child would see
+           the guest's writes instead of a copy-on-write snapshot */
+        error_setg(errp, "snapshot dump is not possible when guest memory "
+                   "is shared (-mem-path with -mem-prealloc)");
+        return;
+    }
+#endif
 
 #if !defined(WIN32)
     if (strstart(file, "fd:", &p)) {
@@ -853,7 +1638,18 @@ void qmp_dump_guest_memory(bool paging, const char *file, bool has_begin,
         return;
     }
 
-    s = g_malloc(sizeof(DumpState));
+    if (format != DUMP_GUEST_MEMORY_FORMAT_ELF &&
+        lseek(fd, 0, SEEK_CUR) == (off_t)-1) {
+        close(fd);
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "protocol",
+                  "a seekable file");
+        return;
+    }
+
+    s = g_malloc0(sizeof(DumpState));
+    s->kdump = format != DUMP_GUEST_MEMORY_FORMAT_ELF;
+    s->nr_threads = threads;
+    s->page_size = TARGET_PAGE_SIZE;
 
     ret = dump_init(s, fd, paging, has_begin, begin, length, errp);
     if (ret < 0) {
@@ -861,9 +1657,15 @@ void qmp_dump_guest_memory(bool paging, const char *file, bool has_begin,
         return;
     }
 
-    if (create_vmcore(s) < 0 && !error_is_set(s->errp)) {
-        error_set(errp, QERR_IO_ERROR);
+#ifndef _WIN32
+    if (snapshot) {
+        dump_snapshot(s, errp);
+        g_free(s);
+        return;
     }
+#endif
+
+    dump_process(s, errp);
 
     g_free(s);
 }
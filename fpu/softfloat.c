@@ -1858,6 +1858,52 @@ static float32 subFloat32Sigs( float32 a, float32 b, flag zSign STATUS_PARAM)
 
 }
 
+/*----------------------------------------------------------------------------
+| With round-to-nearest-even, inputs that are zero or normal and a result that
+| is finite and larger than the smallest normal number, the host FPU returns
+| the same correctly rounded result as the software code.  The host does not
+| tell us whether the result was exact, so the host is only used once the
+| sticky inexact flag is already set, which is the common case for a guest
+| that does any floating-point arithmetic at all.  Everything else (NaNs,
+| infinities, denormals, overflow, underflow, division by zero) goes to the
+| software implementation.  Hosts doing SSE2 arithmetic qualify; the x87
+| would round twice.
+*----------------------------------------------------------------------------*/
+#if defined(__SSE2_MATH__)
+#define USE_HOST_FPU 1
+#else
+#define USE_HOST_FPU 0
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} float32_host;
+
+INLINE flag float32_is_zero_or_normal(float32 a)
+{
+    int_fast16_t aExp = extractFloat32Exp(a);
+
+    return (aExp != 0 && aExp != 0xFF) || float32_is_zero(a);
+}
+
+INLINE flag float32_host_fpu_ok(float32 a, float32 b STATUS_PARAM)
+{
+    return USE_HOST_FPU
+        && STATUS(float_rounding_mode) == float_round_nearest_even
+        && (STATUS(float_exception_flags) & float_flag_inexact)
+        && float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b);
+}
+
+/* Strictly above the smallest normal, so that the result cannot have been
+   tiny before rounding either.  */
+INLINE flag float32_host_result_ok(float32 z)
+{
+    uint32_t absZ = float32_val(z) & 0x7FFFFFFF;
+
+    return absZ > 0x00800000 && absZ < 0x7F800000;
+}
+
 /*----------------------------------------------------------------------------
 | Returns the result of adding the single-precision floating-point values `a'
 | and `b'.  The operation is performed according to the IEC/IEEE Standard for
@@ -1867,6 +1913,15 @@ static float32 subFloat32Sigs( float32 a, float32 b, flag zSign STATUS_PARAM)
 float32 float32_add( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
+
+    if (float32_host_fpu_ok(a, b STATUS_VAR)) {
+        float32_host ua = { a }, ub = { b }, uz;
+        uz.h = ua.h + ub.h;
+        if (float32_host_result_ok(uz.s) || float32_is_zero(uz.s)) {
+            return uz.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -1890,6 +1945,15 @@ float32 float32_add( float32 a, float32 b STATUS_PARAM )
 float32 float32_sub( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
+
+    if (float32_host_fpu_ok(a, b STATUS_VAR)) {
+        float32_host ua = { a }, ub = { b }, uz;
+        uz.h = ua.h - ub.h;
+        if (float32_host_result_ok(uz.s) || float32_is_zero(uz.s)) {
+            return uz.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -1918,6 +1982,16 @@ float32 float32_mul( float32 a, float32 b STATUS_PARAM )
     uint64_t zSig64;
     uint32_t zSig;
 
+    if (float32_host_fpu_ok(a, b STATUS_VAR)) {
+        float32_host ua = { a }, ub = { b }, uz;
+        uz.h = ua.h * ub.h;
+        if (float32_host_result_ok(uz.s) ||
+            (float32_is_zero(uz.s) &&
+             (float32_is_zero(a) || float32_is_zero(b)))) {
+            return uz.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -1978,6 +2052,16 @@ float32 float32_div( float32 a, float32 b STATUS_PARAM )
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
     uint32_t aSig, bSig, zSig;
+
+    if (float32_host_fpu_ok(a, b STATUS_VAR) && !float32_is_zero(b)) {
+        float32_host ua = { a }, ub = { b }, uz;
+        uz.h = ua.h / ub.h;
+        if (float32_host_result_ok(uz.s) ||
+            (float32_is_zero(uz.s) && float32_is_zero(a))) {
+            return uz.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -3421,6 +3505,34 @@ static float64 subFloat64Sigs( float64 a, float64 b, flag zSign STATUS_PARAM )
 
 }
 
+typedef union {
+    float64 s;
+    double h;
+} float64_host;
+
+INLINE flag float64_is_zero_or_normal(float64 a)
+{
+    int_fast16_t aExp = extractFloat64Exp(a);
+
+    return (aExp != 0 && aExp != 0x7FF) || float64_is_zero(a);
+}
+
+INLINE flag float64_host_fpu_ok(float64 a, float64 b STATUS_PARAM)
+{
+    return USE_HOST_FPU
+        && STATUS(float_rounding_mode) == float_round_nearest_even
+        && (STATUS(float_exception_flags) & float_flag_inexact)
+        && float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b);
+}
+
+INLINE flag float64_host_result_ok(float64 z)
+{
+    uint64_t absZ = float64_val(z) & LIT64(0x7FFFFFFFFFFFFFFF);
+
+    return absZ > LIT64(0x0010000000000000)
+        && absZ < LIT64(0x7FF0000000000000);
+}
+
 /*----------------------------------------------------------------------------
 | Returns the result of adding the double-precision floating-point values `a'
 | and `b'.  The operation is performed according to the IEC/IEEE Standard for
@@ -3430,6 +3542,15 @@ static float64 subFloat64Sigs( float64 a, float64 b, flag zSign STATUS_PARAM )
 float64 float64_add( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
+
+    if (float64_host_fpu_ok(a, b STATUS_VAR)) {
+        float64_host ua = { a }, ub = { b }, uz;
+        uz.h = ua.h + ub.h;
+        if (float64_host_result_ok(uz.s) || float64_is_zero(uz.s)) {
+            return uz.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3453,6 +3574,15 @@ float64 float64_add( float64 a, float64 b STATUS_PARAM )
 float64 float64_sub( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
+
+    if (float64_host_fpu_ok(a, b STATUS_VAR)) {
+        float64_host ua = { a }, ub = { b }, uz;
+        uz.h = ua.h - ub.h;
+        if (float64_host_result_ok(uz.s) || float64_is_zero(uz.s)) {
+            return uz.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3479,6 +3609,16 @@ float64 float64_mul( float64 a, float64 b STATUS_PARAM )
     int_fast16_t aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig0, zSig1;
 
+    if (float64_host_fpu_ok(a, b STATUS_VAR)) {
+        float64_host ua = { a }, ub = { b }, uz;
+        uz.h = ua.h * ub.h;
+        if (float64_host_result_ok(uz.s) ||
+            (float64_is_zero(uz.s) &&
+             (float64_is_zero(a) || float64_is_zero(b)))) {
+            return uz.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3541,6 +3681,16 @@ float64 float64_div( float64 a, float64 b STATUS_PARAM )
     uint64_t aSig, bSig, zSig;
     uint64_t rem0, rem1;
     uint64_t term0, term1;
+
+    if (float64_host_fpu_ok(a, b STATUS_VAR) && !float64_is_zero(b)) {
+        float64_host ua = { a }, ub = { b }, uz;
+        uz.h = ua.h / ub.h;
+        if (float64_host_result_ok(uz.s) ||
+            (float64_is_zero(uz.s) && float64_is_zero(a))) {
+            return uz.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
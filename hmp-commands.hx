@@ -307,19 +307,25 @@ ETEXI
 
     {
         .name       = "savevm",
-        .args_type  = "name:s?",
-        .params     = "[tag|id]",
-        .help       = "save a VM snapshot. If no tag or id are provided, a new snapshot is created",
+        .args_type  = "live:-l,name:s?",
+        .params     = "[-l] [tag|id]",
+        .help       = "save a VM snapshot. If no tag or id are provided, a new snapshot is created"
+                      "\n\t\t\t -l to save the RAM while the VM keeps running",
         .mhandler.cmd = do_savevm,
     },
 
 STEXI
-@item savevm [@var{tag}|@var{id}]
+@item savevm [-l] [@var{tag}|@var{id}]
 @findex savevm
 Create a snapshot of the whole virtual machine. If @var{tag} is
 provided, it is used as human readable identifier. If there is already
 a snapshot with the same tag or ID, it is replaced. More info at
 @ref{vm_snapshots}.
+
+With @option{-l}, the RAM is saved while the virtual machine keeps
+running, like during a live migration; the VM is only stopped to save
+the memory it dirtied in the meantime, for about the maximum migration
+downtime.  The monitor is suspended until the snapshot is complete.
 ETEXI
 
     {
@@ -996,9 +1002,12 @@ ETEXI
 #if defined(CONFIG_HAVE_CORE_DUMP)
     {
         .name       = "dump-guest-memory",
-        .args_type  = "paging:-p,filename:F,begin:i?,length:i?",
-        .params     = "[-p] filename [begin] [length]",
+        .args_type  = "paging:-p,zlib:-z,snapshot:-s,filename:F,begin:i?,"
+                      "length:i?",
+        .params     = "[-p] [-z] [-s] filename [begin] [length]",
         .help       = "dump guest memory to file"
+                      "\n\t\t\t -z: write the kdump-compressed format"
+                      "\n\t\t\t -s: dump a snapshot while the guest runs"
                       "\n\t\t\t begin(optional): the starting physical address"
                       "\n\t\t\t length(optional): the memory size, in bytes",
         .mhandler.cmd = hmp_dump_guest_memory,
@@ -1006,12 +1015,17 @@ ETEXI
 
 
 STEXI
-@item dump-guest-memory [-p] @var{protocol} @var{begin} @var{length}
+@item dump-guest-memory [-p] [-z] [-s] @var{protocol} @var{begin} @var{length}
 @findex dump-guest-memory
 Dump guest memory to @var{protocol}. The file can be processed with crash or
 gdb.
   filename: dump file name
     paging: do paging to get guest's memory mapping
+      zlib: write the kdump-compressed format with zlib-compressed pages,
+            which crash can read but gdb cannot
+  snapshot: stop the guest only to take a copy-on-write snapshot of its
+            memory and write the dump in the background; not available
+            with -mem-path and -mem-prealloc
      begin: the starting physical address. It's optional, and should be
             specified with length together.
     length: the memory size, in bytes. It's optional, and should be specified
@@ -1596,8 +1610,9 @@ show emulated PCI device info
 show virtual to physical memory mappings (i386, SH4, SPARC, PPC, and Xtensa only)
 @item info mem
 show the active virtual memory mappings (i386 only)
-@item info jit
-show dynamic compiler info
+@item info jit [@var{count}]
+show dynamic compiler info; with -tb-stats, also show execution statistics
+for the @var{count} (default 10) most executed translation blocks
 @item info numa
 show NUMA information
 @item info kvm
@@ -399,6 +399,14 @@ void hmp_info_vnc(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, "    username: %s\n",
                            client->value->has_sasl_username ?
                            client->value->sasl_username : "none");
+            if (client->value->has_encoding) {
+                monitor_printf(mon, "    encoding: %s\n",
+                               client->value->encoding);
+            }
+            if (client->value->has_throughput) {
+                monitor_printf(mon, "  throughput: %" PRId64 " bytes/s\n",
+                               client->value->throughput);
+            }
         }
     }
 
@@ -1136,6 +1144,8 @@ void hmp_dump_guest_memory(Monitor *mon, const QDict *qdict)
 {
     Error *errp = NULL;
     int paging = qdict_get_try_bool(qdict, "paging", 0);
+    int zlib = qdict_get_try_bool(qdict, "zlib", 0);
+    int snapshot = qdict_get_try_bool(qdict, "snapshot", 0);
     const char *file = qdict_get_str(qdict, "filename");
     bool has_begin = qdict_haskey(qdict, "begin");
     bool has_length = qdict_haskey(qdict, "length");
@@ -1153,7 +1163,8 @@ void hmp_dump_guest_memory(Monitor *mon, const QDict *qdict)
     prot = g_strconcat("file:", file, NULL);
 
     qmp_dump_guest_memory(paging, prot, has_begin, begin, has_length, length,
-                          &errp);
+                          zlib, DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZLIB,
+                          false, 0, snapshot, snapshot, &errp);
     hmp_handle_error(mon, &errp);
     g_free(prot);
 }
@@ -1465,7 +1465,7 @@ static void vga_draw_text(VGACommonState *s, int full_update)
             ch_attr_ptr++;
         }
         if (cx_max != -1) {
-            dpy_gfx_update(s->ds, cx_min * cw, cy * cheight,
+            dpy_gfx_damage(s->ds, cx_min * cw, cy * cheight,
                            (cx_max - cx_min + 1) * cw, cheight);
         }
         dest += linesize * cheight;
@@ -1819,7 +1819,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         } else {
             if (y_start >= 0) {
                 /* flush to display */
-                dpy_gfx_update(s->ds, 0, y_start,
+                dpy_gfx_damage(s->ds, 0, y_start,
                                disp_width, y - y_start);
                 y_start = -1;
             }
@@ -1840,7 +1840,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
     }
     if (y_start >= 0) {
         /* flush to display */
-        dpy_gfx_update(s->ds, 0, y_start,
+        dpy_gfx_damage(s->ds, 0, y_start,
                        disp_width, y - y_start);
     }
     /* reset modified pages */
@@ -1875,7 +1875,7 @@ static void vga_draw_blank(VGACommonState *s, int full_update)
         memset(d, val, w);
         d += ds_get_linesize(s->ds);
     }
-    dpy_gfx_update(s->ds, 0, 0,
+    dpy_gfx_damage(s->ds, 0, 0,
                    s->last_scr_width, s->last_scr_height);
 }
 
@@ -24,6 +24,7 @@
 #include "sysemu/kvm.h"
 #include "exec/address-spaces.h"
 #include "qapi/visitor.h"
+#include "qemu/bitmap.h"
 
 #if defined(__linux__)
 #include <sys/mman.h>
@@ -42,6 +43,9 @@ typedef struct VirtIOBalloon
     int64_t stats_last_update;
     int64_t stats_poll_interval;
     DeviceState *qdev;
+    /* RAM inflated into the balloon, by ram address in balloon pages */
+    unsigned long *inflated;
+    long inflated_nr;
 } VirtIOBalloon;
 
 static VirtIOBalloon *to_virtio_balloon(VirtIODevice *vdev)
@@ -58,6 +62,55 @@ static void balloon_page(void *addr, int deflate)
 #endif
 }
 
+/*
+ * Remember which pages the guest gave up, so that dump-guest-memory can
+ * leave them out.  Tracking is by ram address; pages that are not RAM
+ * are skipped by the caller.
+ */
+static void balloon_track_page(VirtIOBalloon *s, ram_addr_t addr, int deflate)
+{
+    long pfn = addr >> VIRTIO_BALLOON_PFN_SHIFT;
+
+    if (!s->inflated) {
+        if (deflate) {
+            return;
+        }
+        s->inflated_nr = last_ram_offset() >> VIRTIO_BALLOON_PFN_SHIFT;
+        s->inflated = bitmap_new(s->inflated_nr);
+    }
+    if (pfn >= s->inflated_nr) {
+        return;
+    }
+    if (deflate) {
+        clear_bit(pfn, s->inflated);
+    } else {
+        set_bit(pfn, s->inflated);
+    }
+}
+
+static bool virtio_balloon_page_free(void *opaque, ram_addr_t addr,
+                                     ram_addr_t size)
+{
+    VirtIOBalloon *s = opaque;
+    long pfn = addr >> VIRTIO_BALLOON_PFN_SHIFT;
+    long end = (addr + size + (1 << VIRTIO_BALLOON_PFN_SHIFT) - 1) >>
+               VIRTIO_BALLOON_PFN_SHIFT;
+
+    if (!s->inflated || end > s->inflated_nr) {
+        return false;
+    }
+    return find_next_zero_bit(s->inflated, end, pfn) >= end;
+}
+
+/* A guest that reboots owns all of its memory again */
+static void virtio_balloon_reset(void *opaque)
+{
+    VirtIOBalloon *s = opaque;
+
+    g_free(s->inflated);
+    s->inflated = NULL;
+}
+
 static const char *balloon_stat_names[] = {
    [VIRTIO_BALLOON_S_SWAP_IN] = "stat-swap-in",
    [VIRTIO_BALLOON_S_SWAP_OUT] = "stat-swap-out",
@@ -221,6 +274,8 @@ static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
             addr = section.offset_within_region;
             balloon_page(memory_region_get_ram_ptr(section.mr) + addr,
                          !!(vq == s->dvq));
+            balloon_track_page(s, memory_region_get_ram_addr(section.mr) + addr,
+                               !!(vq == s->dvq));
         }
 
         virtqueue_push(vq, &elem, offset);
@@ -363,7 +418,8 @@ VirtIODevice *virtio_balloon_init(DeviceState *dev)
     s->vdev.get_features = virtio_balloon_get_features;
 
     ret = qemu_add_balloon_handler(virtio_balloon_to_target,
-                                   virtio_balloon_stat, s);
+                                   virtio_balloon_stat,
+                                   virtio_balloon_page_free, s);
     if (ret < 0) {
         virtio_cleanup(&s->vdev);
         return NULL;
@@ -376,6 +432,7 @@ VirtIODevice *virtio_balloon_init(DeviceState *dev)
     s->qdev = dev;
     register_savevm(dev, "virtio-balloon", -1, 1,
                     virtio_balloon_save, virtio_balloon_load, s);
+    qemu_register_reset(virtio_balloon_reset, s);
 
     object_property_add(OBJECT(dev), "guest-stats", "guest statistics",
                         balloon_stats_get_all, NULL, NULL, s, NULL);
@@ -394,6 +451,8 @@ void virtio_balloon_exit(VirtIODevice *vdev)
 
     balloon_stats_destroy_timer(s);
     qemu_remove_balloon_handler(s);
+    qemu_unregister_reset(virtio_balloon_reset, s);
+    virtio_balloon_reset(s);
     unregister_savevm(s->qdev, "virtio-balloon", s);
     virtio_cleanup(vdev);
 }
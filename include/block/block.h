@@ -166,6 +166,10 @@ int bdrv_pread(BlockDriverState *bs, int64_t offset,
                void *buf, int count);
 int bdrv_pwrite(BlockDriverState *bs, int64_t offset,
                 const void *buf, int count);
+int bdrv_pread_vmstate(BlockDriverState *bs, int64_t offset,
+                       void *buf, int count);
+int bdrv_pwrite_vmstate(BlockDriverState *bs, int64_t offset,
+                        const void *buf, int count);
 int bdrv_pwrite_sync(BlockDriverState *bs, int64_t offset,
     const void *buf, int count);
 int coroutine_fn bdrv_co_readv(BlockDriverState *bs, int64_t sector_num,
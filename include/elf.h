@@ -1224,6 +1224,7 @@ typedef struct elf64_shdr {
 #define NT_TASKSTRUCT	4
 #define NT_AUXV		6
 #define NT_PRXFPREG     0x46e62b7f      /* copied from gdb5.1/include/elf/common.h */
+#define NT_GNU_BUILD_ID	3		/* in notes named "GNU" */
 
 
 /* Note header in a PT_NOTE section */
@@ -21,6 +21,7 @@
 #define _EXEC_ALL_H_
 
 #include "qemu-common.h"
+#include "qemu/tls.h"
 
 /* allow to see translation results - the slowdown should be negligible, so we leave it */
 #define DEBUG_DISAS
@@ -133,6 +134,32 @@ static inline void tlb_flush(CPUArchState *env, int flush_global)
 #define USE_DIRECT_JUMP
 #endif
 
+typedef struct TBStatistics TBStatistics;
+
+/* Execution statistics for one guest block, kept when -tb-stats is
+   given.  They are keyed like the TB itself, so they accumulate across
+   retranslations of the same code and across tb_flush.  */
+struct TBStatistics {
+    target_ulong pc;
+    target_ulong cs_base;
+    uint64_t flags;
+
+    /* incremented by the generated code on every entry to the block */
+    uint64_t exec_count;
+    /* entries through the cpu_exec() lookup instead of a chained jump */
+    uint64_t dispatch_count;
+    /* returns to cpu_exec() through a goto_tb slot not yet chained */
+    uint64_t unchained_exits;
+    /* faults that had to restore the CPU state from inside the block */
+    uint64_t exceptions;
+    /* retranslations caused by an I/O access in icount mode */
+    uint64_t io_recompiles;
+
+    unsigned int translations;
+    unsigned int guest_size;
+    unsigned int host_size;
+};
+
 struct TranslationBlock {
     target_ulong pc;   /* simulated PC corresponding to this block (EIP + CS base) */
     target_ulong cs_base; /* CS base for this block */
@@ -166,10 +193,32 @@ struct TranslationBlock {
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
     uint32_t icount;
+    /* NULL unless the block was translated with statistics enabled */
+    TBStatistics *tb_stats;
+    /* true while the block is not reachable through the physical hash
+       and page lists, i.e. before tb_link_page() or after
+       tb_phys_invalidate() */
+    bool invalid;
 };
 
 #include "exec/spinlock.h"
 
+#define TB_MAX_REGIONS 16
+
+/* The code buffer is split into regions that are filled and recycled
+   in FIFO order.  Each region owns a contiguous slice of the buffer and
+   of the tbs[] array, so that its TBs are sorted by tc_ptr.  Only one
+   thread at a time generates code in a region, so that several threads
+   can translate at once in different regions.  */
+typedef struct TBRegion {
+    uint8_t *code_start;
+    uint8_t *code_end;  /* no TB is started at or above this address */
+    uint8_t *code_ptr;  /* end of the generated code */
+    TranslationBlock *tbs;
+    int nb_tbs;
+    bool busy;          /* a thread is generating code here */
+} TBRegion;
+
 typedef struct TBContext TBContext;
 
 struct TBContext {
@@ -177,16 +226,27 @@ struct TBContext {
     TranslationBlock *tbs;
     TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
     int nb_tbs;
-    /* any access to the tbs or the page table must use this lock */
+    TBRegion regions[TB_MAX_REGIONS];
+    int nb_regions;
+    int cur_region;
+    int region_max_blocks;
+    size_t region_size;
+    /* Taken to claim a region, and to publish a TB into the hash table
+       and page lists or to take it out again.  Lookups and code
+       generation run without it.  In user mode it nests inside the mmap
+       lock.  */
     spinlock_t tb_lock;
 
     /* statistics */
     int tb_flush_count;
+    int tb_evict_count;
     int tb_phys_invalidate_count;
-
-    int tb_invalidated_flag;
+    int smc_code_write_count;
+    int smc_data_write_count;
 };
 
+extern TBContext tb_ctx;
+
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
 {
     target_ulong tmp;
@@ -207,6 +267,12 @@ static inline unsigned int tb_phys_hash_func(tb_page_addr_t pc)
     return (pc >> 2) & (CODE_GEN_PHYS_HASH_SIZE - 1);
 }
 
+extern bool tb_stats_enabled;
+
+void tb_lock(void);
+void tb_unlock(void);
+void tb_lock_reset(void);
+void tb_fork_child(void);
 void tb_free(TranslationBlock *tb);
 void tb_flush(CPUArchState *env);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
@@ -216,9 +282,8 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 #if defined(CONFIG_TCG_INTERPRETER)
 static inline void tb_set_jmp_target1(uintptr_t jmp_addr, uintptr_t addr)
 {
-    /* patch the branch destination */
-    *(uint32_t *)jmp_addr = addr - (jmp_addr + 4);
-    /* no need to flush icache explicitly */
+    /* patch the branch destination, which TCI keeps as a host word */
+    *(uintptr_t *)jmp_addr = addr;
 }
 #elif defined(_ARCH_PPC)
 void ppc_tb_set_jmp_target(unsigned long jmp_addr, unsigned long addr);
@@ -278,10 +343,11 @@ static inline void tb_set_jmp_target(TranslationBlock *tb,
 
 #endif
 
+/* Must be called with tb_lock held.  */
 static inline void tb_add_jump(TranslationBlock *tb, int n,
                                TranslationBlock *tb_next)
 {
-    /* NOTE: this test is only needed for thread safety */
+    /* another thread may have chained the same jump meanwhile */
     if (!tb->jmp_next[n]) {
         /* patch the native jump address */
         tb_set_jmp_target(tb, n, (uintptr_t)tb_next->tc_ptr);
@@ -295,8 +361,8 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
 /* The return address may point to the start of the next instruction.
    Subtracting one gets us the call instruction itself.  */
 #if defined(CONFIG_TCG_INTERPRETER)
-extern uintptr_t tci_tb_ptr;
-# define GETPC() tci_tb_ptr
+DECLARE_TLS(uintptr_t, tci_tb_ptr);
+# define GETPC() tls_var(tci_tb_ptr)
 #elif defined(__s390__) && !defined(__s390x__)
 # define GETPC() \
     (((uintptr_t)__builtin_return_address(0) & 0x7fffffffUL) - 1)
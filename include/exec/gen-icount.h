@@ -5,8 +5,10 @@
 
 /* Helpers for instruction counting code generation.  */
 
-static TCGArg *icount_arg;
-static int icount_label;
+static DEFINE_TLS(TCGArg *, icount_arg);
+#define icount_arg tls_var(icount_arg)
+static DEFINE_TLS(int, icount_label);
+#define icount_label tls_var(icount_label)
 
 static inline void gen_icount_start(void)
 {
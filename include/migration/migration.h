@@ -45,6 +45,7 @@ struct MigrationState
     int (*get_error)(MigrationState *s);
     int (*close)(MigrationState *s);
     int (*write)(MigrationState *s, const void *buff, size_t size);
+    int (*writev)(MigrationState *s, struct iovec *iov, int iovcnt);
     void *opaque;
     MigrationParams params;
     int64_t total_time;
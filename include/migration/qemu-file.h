@@ -31,6 +31,14 @@
 typedef int (QEMUFilePutBufferFunc)(void *opaque, const uint8_t *buf,
                                     int64_t pos, int size);
 
+/* This function writes an iovec to a file at the given position.  Unlike
+ * put_buffer, the handler must have written or copied all of the data when
+ * it returns, or return a negative errno value; the buffers belong to the
+ * caller and may change as soon as it returns.
+ */
+typedef int (QEMUFileWritevBufferFunc)(void *opaque, struct iovec *iov,
+                                       int iovcnt, int64_t pos);
+
 /* Read a chunk of data from a file at the given position.  The pos argument
  * can be ignored if the file is only be used for streaming.  The number of
  * bytes actually read should be returned.
@@ -71,6 +79,7 @@ typedef struct QEMUFileOps {
     QEMUFileRateLimit *rate_limit;
     QEMUFileSetRateLimit *set_rate_limit;
     QEMUFileGetRateLimit *get_rate_limit;
+    QEMUFileWritevBufferFunc *writev_buffer;
 } QEMUFileOps;
 
 QEMUFile *qemu_fopen_ops(void *opaque, const QEMUFileOps *ops);
@@ -83,6 +92,13 @@ int qemu_get_fd(QEMUFile *f);
 int qemu_fclose(QEMUFile *f);
 int64_t qemu_ftell(QEMUFile *f);
 void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, int size);
+/*
+ * Like qemu_put_buffer, but if the file supports writev_buffer only a
+ * reference to BUF is queued.  BUF must not be freed before the next
+ * qemu_fflush; if it changes in the meantime, the new contents may be sent.
+ */
+void qemu_put_buffer_async(QEMUFile *f, const uint8_t *buf, int size);
+int qemu_fflush(QEMUFile *f);
 void qemu_put_byte(QEMUFile *f, int v);
 
 static inline void qemu_put_ubyte(QEMUFile *f, unsigned int v)
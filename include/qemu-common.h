@@ -276,6 +276,7 @@ typedef struct PCIHostDeviceAddress {
 
 void tcg_exec_init(unsigned long tb_size);
 bool tcg_enabled(void);
+void tb_stats_enable(void);
 
 void cpu_exec_init_all(void);
 
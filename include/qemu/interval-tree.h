@@ -0,0 +1,101 @@
+/*
+ * Interval tree
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct IntervalTreeNode IntervalTreeNode;
+
+/* An IntervalTree maps every point of [0, last] to a value.  The runs of
+ * points with the same value are the nodes of a balanced search tree, so
+ * that for n runs looking up a point, setting the value of a range and
+ * finding a long enough range with value 0 all take O(log n) time.
+ */
+typedef struct IntervalTree {
+    IntervalTreeNode *root;
+    uint64_t last;
+    uint32_t seed;
+} IntervalTree;
+
+struct IntervalTreeNode {
+    /* The run, which is as long as possible: its neighbours have other
+     * values.  Read-only for the users of the tree.  */
+    uint64_t start;
+    uint64_t last;
+    unsigned long value;
+
+    /* private */
+    IntervalTreeNode *left, *right;
+    uint32_t priority;
+    /* length of the longest run of zeroes in this subtree, UINT64_MAX
+     * if it does not fit */
+    uint64_t max_free;
+};
+
+/**
+ * interval_tree_init:
+ * @tree: IntervalTree to initialize.
+ * @last: Last point of the tree.
+ *
+ * Map all of [0, @last] to zero.
+ */
+void interval_tree_init(IntervalTree *tree, uint64_t last);
+
+/**
+ * interval_tree_destroy:
+ * @tree: IntervalTree to operate on.
+ *
+ * Free the nodes of the tree.
+ */
+void interval_tree_destroy(IntervalTree *tree);
+
+/**
+ * interval_tree_find:
+ * @tree: IntervalTree to operate on.
+ * @point: Point to look up, at most the last point of the tree.
+ *
+ * Return the run that contains @point.  It stays valid until the next
+ * call to interval_tree_set().
+ */
+const IntervalTreeNode *interval_tree_find(const IntervalTree *tree,
+                                           uint64_t point);
+
+/**
+ * interval_tree_set:
+ * @tree: IntervalTree to operate on.
+ * @start: First point of the range.
+ * @last: Last point of the range.
+ * @value: Value to map the range to.
+ *
+ * Map all of [@start, @last] to @value.
+ */
+void interval_tree_set(IntervalTree *tree, uint64_t start, uint64_t last,
+                       unsigned long value);
+
+/**
+ * interval_tree_find_free:
+ * @tree: IntervalTree to operate on.
+ * @start: First point of the range to search.
+ * @last: Last point of the range to search.
+ * @size: Number of points to find, not zero.
+ * @align: Alignment of the result, a power of two.
+ * @top_down: Whether to return the highest result rather than the lowest.
+ * @result: Where to return the first of the points found.
+ *
+ * Look for @size consecutive points of [@start, @last] that all map to
+ * zero, the first of them a multiple of @align.  Return whether there
+ * are any.
+ */
+bool interval_tree_find_free(const IntervalTree *tree,
+                             uint64_t start, uint64_t last,
+                             uint64_t size, uint64_t align, bool top_down,
+                             uint64_t *result);
+
+#endif
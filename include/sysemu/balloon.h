@@ -19,11 +19,17 @@
 
 typedef void (QEMUBalloonEvent)(void *opaque, ram_addr_t target);
 typedef void (QEMUBalloonStatus)(void *opaque, BalloonInfo *info);
+typedef bool (QEMUBalloonPageFree)(void *opaque, ram_addr_t addr,
+                                   ram_addr_t size);
 
 int qemu_add_balloon_handler(QEMUBalloonEvent *event_func,
-			     QEMUBalloonStatus *stat_func, void *opaque);
+			     QEMUBalloonStatus *stat_func,
+			     QEMUBalloonPageFree *free_func, void *opaque);
 void qemu_remove_balloon_handler(void *opaque);
 
+/* true if the guest gave the RAM at [addr, addr + size) to the balloon */
+bool qemu_balloon_page_free(ram_addr_t addr, ram_addr_t size);
+
 void qemu_balloon_changed(int64_t actual);
 
 #endif
@@ -14,6 +14,119 @@
 #ifndef DUMP_H
 #define DUMP_H
 
+/*
+ * The kdump-compressed format of makedumpfile ("diskdump"), in blocks of
+ * one target page:
+ *
+ *   block 0        DiskDumpHeader32/64
+ *   block 1...     KdumpSubHeader32/64, followed by the ELF notes
+ *   ...            bitmap of the pages that exist in the guest
+ *   ...            bitmap of the pages that are in the dump
+ *   ...            a PageDescriptor for each page in the dump
+ *   ...            page data, each page compressed on its own
+ *
+ * All fields are in the byte order of the target.
+ */
+#define KDUMP_SIGNATURE             "KDUMP   "
+#define SIG_LEN                     (sizeof(KDUMP_SIGNATURE) - 1)
+#define KDUMP_HEADER_VERSION        6
+#define DISKDUMP_HEADER_BLOCKS      1
+
+/* DiskDumpHeader.status and PageDescriptor.flags */
+#define DUMP_DH_COMPRESSED_ZLIB     0x1
+
+/* KdumpSubHeader.dump_level: the kinds of pages left out of the dump */
+#define DUMP_LEVEL_EXCLUDE_ZERO     0x01
+#define DUMP_LEVEL_EXCLUDE_FREE     0x10
+
+typedef struct NewUtsname {
+    char sysname[65];
+    char nodename[65];
+    char release[65];
+    char version[65];
+    char machine[65];
+    char domainname[65];
+} NewUtsname;
+
+typedef struct QEMU_PACKED DiskDumpHeader32 {
+    char signature[SIG_LEN];
+    uint32_t header_version;
+    NewUtsname utsname;
+    char pad1[2];
+    uint32_t timestamp_sec;
+    uint32_t timestamp_usec;
+    uint32_t status;
+    uint32_t block_size;
+    uint32_t sub_hdr_size;          /* in blocks */
+    uint32_t bitmap_blocks;         /* both bitmaps, in blocks */
+    uint32_t max_mapnr;             /* obsolete, see max_mapnr_64 */
+    uint32_t total_ram_blocks;
+    uint32_t device_blocks;
+    uint32_t written_blocks;
+    uint32_t current_cpu;
+    uint32_t nr_cpus;
+} DiskDumpHeader32;
+
+typedef struct QEMU_PACKED DiskDumpHeader64 {
+    char signature[SIG_LEN];
+    uint32_t header_version;
+    NewUtsname utsname;
+    char pad1[6];
+    uint64_t timestamp_sec;
+    uint64_t timestamp_usec;
+    uint32_t status;
+    uint32_t block_size;
+    uint32_t sub_hdr_size;
+    uint32_t bitmap_blocks;
+    uint32_t max_mapnr;
+    uint32_t total_ram_blocks;
+    uint32_t device_blocks;
+    uint32_t written_blocks;
+    uint32_t current_cpu;
+    uint32_t nr_cpus;
+} DiskDumpHeader64;
+
+typedef struct QEMU_PACKED KdumpSubHeader32 {
+    uint32_t phys_base;
+    uint32_t dump_level;
+    uint32_t split;
+    uint32_t start_pfn;             /* obsolete, see start_pfn_64 */
+    uint32_t end_pfn;               /* obsolete, see end_pfn_64 */
+    uint64_t offset_vmcoreinfo;
+    uint32_t size_vmcoreinfo;
+    uint64_t offset_note;
+    uint32_t note_size;
+    uint64_t offset_eraseinfo;
+    uint32_t size_eraseinfo;
+    uint64_t start_pfn_64;
+    uint64_t end_pfn_64;
+    uint64_t max_mapnr_64;
+} KdumpSubHeader32;
+
+typedef struct QEMU_PACKED KdumpSubHeader64 {
+    uint64_t phys_base;
+    uint32_t dump_level;
+    uint32_t split;
+    uint64_t start_pfn;
+    uint64_t end_pfn;
+    uint64_t offset_vmcoreinfo;
+    uint64_t size_vmcoreinfo;
+    uint64_t offset_note;
+    uint64_t note_size;
+    uint64_t offset_eraseinfo;
+    uint64_t size_eraseinfo;
+    uint64_t start_pfn_64;
+    uint64_t end_pfn_64;
+    uint64_t max_mapnr_64;
+} KdumpSubHeader64;
+
+typedef struct QEMU_PACKED PageDescriptor {
+    uint64_t offset;                /* of the page data in the file */
+    uint32_t size;                  /* of the page data */
+    uint32_t flags;                 /* DUMP_DH_COMPRESSED_*, or 0 if raw */
+    uint64_t page_flags;            /* unused */
+} PageDescriptor;
+
 typedef struct ArchDumpInfo {
     int d_machine;  /* Architecture */
     int d_endian;   /* ELFDATA2LSB or ELFDATA2MSB */
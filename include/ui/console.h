@@ -169,12 +169,36 @@ struct DisplayChangeListener {
     QLIST_ENTRY(DisplayChangeListener) next;
 };
 
+/*
+ * Screen areas redrawn by the device during the current update pass,
+ * merged into at most DPY_DAMAGE_MAX_RECTS rectangles.  They are passed
+ * on to the listeners' dpy_gfx_update when the pass is over.
+ */
+#define DPY_DAMAGE_MAX_RECTS 8
+
+typedef struct DisplayDamage {
+    int nb_rects;
+    pixman_box32_t rects[DPY_DAMAGE_MAX_RECTS];
+} DisplayDamage;
+
+/*
+ * Lets a display backend provide the pixel memory of the surfaces that
+ * QEMU allocates itself, e.g. to share them with another process.
+ * Surfaces that point into device memory are not affected.
+ */
+typedef struct DisplayAllocator {
+    void *(*alloc)(DisplayState *ds, size_t size);
+    void (*free)(DisplayState *ds, void *data);
+} DisplayAllocator;
+
 struct DisplayState {
     struct DisplaySurface *surface;
     void *opaque;
     struct QEMUTimer *gui_timer;
     bool have_gfx;
     bool have_text;
+    DisplayDamage damage;
+    const DisplayAllocator *allocator;
 
     QLIST_HEAD(, DisplayChangeListener) listeners;
 
@@ -246,6 +270,9 @@ static inline void dpy_gfx_update(DisplayState *s, int x, int y, int w, int h)
     }
 }
 
+void dpy_gfx_damage(DisplayState *s, int x, int y, int w, int h);
+void dpy_gfx_damage_flush(DisplayState *s);
+
 static inline void dpy_gfx_resize(DisplayState *s)
 {
     struct DisplayChangeListener *dcl;
@@ -483,6 +510,9 @@ static inline int vnc_display_pw_expire(DisplayState *ds, time_t expires)
 /* curses.c */
 void curses_display_init(DisplayState *ds, int full_screen);
 
+/* shm-display.c */
+void shm_display_init(DisplayState *ds, const char *path, Error **errp);
+
 /* input.c */
 int index_from_key(const char *key);
 int index_from_keycode(int code);
@@ -0,0 +1,75 @@
+/*
+ * QEMU shared memory display protocol
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_SHM_DISPLAY_H
+#define QEMU_SHM_DISPLAY_H
+
+#include <stdint.h>
+
+/*
+ * "-display shm=PATH" listens on the Unix socket PATH.  Clients do not
+ * send anything; QEMU writes a stream of messages, each a ShmDisplayHeader
+ * followed by header.size bytes of payload, in host byte order:
+ *
+ * SHM_DISPLAY_SURFACE   a new framebuffer.  The message carries a file
+ *                       descriptor (SCM_RIGHTS) to be mmap()ed read-only;
+ *                       it is opened read-only and, on Linux, sealed
+ *                       against writes and resizing.  Its first size
+ *                       bytes hold height lines of stride bytes in the
+ *                       given pixman format.  Sent on connect and
+ *                       whenever the guest changes mode.
+ * SHM_DISPLAY_UPDATE    pixels of the rectangle changed in the framebuffer
+ *                       of the last SHM_DISPLAY_SURFACE.
+ * SHM_DISPLAY_CURSOR    a new pointer shape, followed by width * height
+ *                       32-bit pixels with alpha.
+ * SHM_DISPLAY_MOUSE     the pointer moved or was hidden.
+ *
+ * Updates from a client that does not read its socket fast enough are
+ * merged, so a client always ends up with an accurate picture of the
+ * framebuffer when it catches up.
+ */
+
+#define SHM_DISPLAY_SURFACE     1
+#define SHM_DISPLAY_UPDATE      2
+#define SHM_DISPLAY_CURSOR      3
+#define SHM_DISPLAY_MOUSE       4
+
+typedef struct ShmDisplayHeader {
+    uint32_t type;
+    uint32_t size;
+} ShmDisplayHeader;
+
+typedef struct ShmDisplaySurface {
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format;
+    uint64_t size;
+} ShmDisplaySurface;
+
+typedef struct ShmDisplayUpdate {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} ShmDisplayUpdate;
+
+typedef struct ShmDisplayCursor {
+    uint32_t width;
+    uint32_t height;
+    uint32_t hot_x;
+    uint32_t hot_y;
+} ShmDisplayCursor;
+
+typedef struct ShmDisplayMouse {
+    int32_t x;
+    int32_t y;
+    uint32_t visible;
+    uint32_t pad;
+} ShmDisplayMouse;
+
+#endif
@@ -223,8 +223,6 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size)
 {
     abi_ulong addr;
     abi_ulong end_addr;
-    int prot;
-    int looped = 0;
 
     if (size > RESERVED_VA) {
         return (abi_ulong)-1;
@@ -232,29 +230,20 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size)
 
     size = HOST_PAGE_ALIGN(size);
     end_addr = start + size;
-    if (end_addr > RESERVED_VA) {
+    if (end_addr > RESERVED_VA || end_addr < start) {
         end_addr = RESERVED_VA;
     }
-    addr = end_addr - qemu_host_page_size;
 
-    while (1) {
-        if (addr > end_addr) {
-            if (looped) {
-                return (abi_ulong)-1;
-            }
-            end_addr = RESERVED_VA;
-            addr = end_addr - qemu_host_page_size;
-            looped = 1;
-            continue;
-        }
-        prot = page_get_flags(addr);
-        if (prot) {
-            end_addr = addr;
-        }
-        if (addr + size == end_addr) {
-            break;
+    /* the highest free area that ends before start + size, else the
+       highest one */
+    addr = page_find_range_empty(0, end_addr - 1, size,
+                                 qemu_host_page_size, true);
+    if (addr == (abi_ulong)-1) {
+        addr = page_find_range_empty(0, RESERVED_VA - 1, size,
+                                     qemu_host_page_size, true);
+        if (addr == (abi_ulong)-1) {
+            return (abi_ulong)-1;
         }
-        addr -= qemu_host_page_size;
     }
 
     if (start == mmap_next_start) {
@@ -292,7 +281,13 @@ abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size)
     }
 #endif
 
-    addr = start;
+    /* Try the first area from start on where no guest page is mapped:
+       unless something else of QEMU is there, the host gives it.  */
+    addr = page_find_range_empty(start, (abi_ulong)-1, size,
+                                 qemu_host_page_size, false);
+    if (addr == (abi_ulong)-1) {
+        addr = start;
+    }
     wrapped = repeat = 0;
     prev = 0;
 
@@ -581,6 +576,7 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
     page_dump(stdout);
     printf("\n");
 #endif
+    tb_cache_map(start, len, prot, flags & MAP_ANONYMOUS ? -1 : fd, offset);
     tb_invalidate_phys_range(start, start + len, 0);
     mmap_unlock();
     return start;
@@ -686,6 +682,7 @@ int target_munmap(abi_ulong start, abi_ulong len)
 
     if (ret == 0) {
         page_set_flags(start, start + len, 0);
+        tb_cache_unmap(start, len);
         tb_invalidate_phys_range(start, start + len, 0);
     }
     mmap_unlock();
@@ -764,6 +761,8 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
         prot = page_get_flags(old_addr);
         page_set_flags(old_addr, old_addr + old_size, 0);
         page_set_flags(new_addr, new_addr + new_size, prot | PAGE_VALID);
+        tb_cache_unmap(old_addr, old_size);
+        tb_cache_unmap(new_addr, new_size);
     }
     tb_invalidate_phys_range(new_addr, new_addr + new_size, 0);
     mmap_unlock();
@@ -203,6 +203,10 @@ char *target_strerror(int err);
 int get_osversion(void);
 void fork_start(void);
 void fork_end(int child);
+void cpu_exec_start(CPUState *cpu);
+void cpu_exec_end(CPUState *cpu);
+void start_exclusive(void);
+void end_exclusive(void);
 
 /* Creates the initial guest address space in the host memory space using
  * the given host start address hint and size.  The guest_start parameter
@@ -276,6 +280,19 @@ void mmap_fork_end(int child);
 /* main.c */
 extern unsigned long guest_stack_size;
 
+/* tbcache.c */
+void tb_cache_enable(const char *dir);
+void tb_cache_start(const char *cpu_model);
+void tb_cache_exit(void);
+void tb_cache_map(abi_ulong start, abi_ulong len, int prot, int fd,
+                  abi_ulong offset);
+void tb_cache_unmap(abi_ulong start, abi_ulong len);
+bool tb_cache_restore(CPUArchState *env, TranslationBlock *tb,
+                      int *code_size);
+void tb_cache_store(CPUArchState *env, TranslationBlock *tb, int code_size);
+void tb_cache_fork_start(void);
+void tb_cache_fork_end(int child);
+
 /* user access */
 
 #define VERIFY_READ 0
@@ -429,6 +446,15 @@ static inline void unlock_user(void *host_ptr, abi_ulong guest_addr,
 #endif
 }
 
+/* When the guest has the word size and byte order of the host, arrays of
+   guest pointers and longs have the layout of the host ones.  If guest
+   addresses are also host addresses (GUEST_BASE is zero), such arrays can
+   be handed to the host system calls as they are.  */
+#if !defined(DEBUG_REMAP) && TARGET_ABI_BITS == HOST_LONG_BITS && \
+    defined(TARGET_WORDS_BIGENDIAN) == defined(HOST_WORDS_BIGENDIAN)
+#define USER_HOST_LAYOUT 1
+#endif
+
 /* Return the length of a string in target memory or -TARGET_EFAULT if
    access error. */
 abi_long target_strlen(abi_ulong gaddr);
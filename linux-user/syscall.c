@@ -106,6 +106,8 @@ int __clone2(int (*fn)(void *), void *child_stack_base,
 #include "cpu-uname.h"
 
 #include "qemu.h"
+#include "tcg.h"
+#include "tcg/perf.h"
 
 #if defined(CONFIG_USE_NPTL)
 #define CLONE_NPTL_FLAGS2 (CLONE_SETTLS | \
@@ -1764,6 +1766,10 @@ static abi_long do_getsockopt(int sockfd, int level, int optname,
     return ret;
 }
 
+#ifdef USER_HOST_LAYOUT
+QEMU_BUILD_BUG_ON(sizeof(struct target_iovec) != sizeof(struct iovec));
+#endif
+
 static struct iovec *lock_iovec(int type, abi_ulong target_addr,
                                 int count, int copy)
 {
@@ -1781,6 +1787,47 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
         return NULL;
     }
 
+    /* ??? If host page size > target page size, this will result in a
+       value larger than what we can actually support.  */
+    max_len = 0x7fffffff & TARGET_PAGE_MASK;
+    total_len = 0;
+
+#ifdef USER_HOST_LAYOUT
+    /* The guest's own array can go to the host once the buffers are
+       checked.  The guest may change it before the host reads it, but
+       without GUEST_BASE it can reach the memory of QEMU anyway.  Lengths
+       that need clamping are left to the copy below.  */
+    if (GUEST_BASE == 0) {
+        vec = lock_user(VERIFY_READ, target_addr,
+                        count * sizeof(struct target_iovec), 1);
+        if (vec == NULL) {
+            errno = EFAULT;
+            return NULL;
+        }
+        for (i = 0; i < count; i++) {
+            abi_ulong base = (uintptr_t)vec[i].iov_base;
+            abi_long len = vec[i].iov_len;
+
+            if (len < 0) {
+                errno = EINVAL;
+                return NULL;
+            }
+            if (len > max_len - total_len) {
+                break;
+            }
+            if (len != 0 && !access_ok(type, base, len)) {
+                errno = EFAULT;
+                return NULL;
+            }
+            total_len += len;
+        }
+        if (i == count) {
+            return vec;
+        }
+        total_len = 0;
+    }
+#endif
+
     vec = calloc(count, sizeof(struct iovec));
     if (vec == NULL) {
         errno = ENOMEM;
@@ -1794,11 +1841,6 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
         goto fail2;
     }
 
-    /* ??? If host page size > target page size, this will result in a
-       value larger than what we can actually support.  */
-    max_len = 0x7fffffff & TARGET_PAGE_MASK;
-    total_len = 0;
-
     for (i = 0; i < count; i++) {
         abi_ulong base = tswapal(target_vec[i].iov_base);
         abi_long len = tswapal(target_vec[i].iov_len);
@@ -1839,12 +1881,19 @@ static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
     struct target_iovec *target_vec;
     int i;
 
+#ifdef USER_HOST_LAYOUT
+    /* the guest's array, passed through by lock_iovec */
+    if (vec == g2h(target_addr)) {
+        return;
+    }
+#endif
+
     target_vec = lock_user(VERIFY_READ, target_addr,
                            count * sizeof(struct target_iovec), 1);
     if (target_vec) {
         for (i = 0; i < count; i++) {
             abi_ulong base = tswapal(target_vec[i].iov_base);
-            abi_long len = tswapal(target_vec[i].iov_base);
+            abi_long len = tswapal(target_vec[i].iov_len);
             if (len < 0) {
                 break;
             }
@@ -3146,7 +3195,9 @@ static inline abi_long do_shmdt(abi_ulong shmaddr)
     for (i = 0; i < N_SHM_REGIONS; ++i) {
         if (shm_regions[i].start == shmaddr) {
             shm_regions[i].start = 0;
+            mmap_lock();
             page_set_flags(shmaddr, shmaddr + shm_regions[i].size, 0);
+            mmap_unlock();
             break;
         }
     }
@@ -4335,6 +4386,7 @@ static void *clone_func(void *arg)
     /* Wait until the parent has finshed initializing the tls state.  */
     pthread_mutex_lock(&clone_lock);
     pthread_mutex_unlock(&clone_lock);
+    tcg_register_thread();
     cpu_loop(env);
     /* never exits */
     return NULL;
@@ -4344,6 +4396,7 @@ static void *clone_func(void *arg)
 static int clone_func(void *arg)
 {
     CPUArchState *env = arg;
+    tcg_register_thread();
     cpu_loop(env);
     /* never exits */
     return 0;
@@ -5223,6 +5276,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
           thread_env = NULL;
           object_unref(OBJECT(ENV_GET_CPU(cpu_env)));
           g_free(ts);
+          tcg_unregister_thread();
           pthread_exit(NULL);
       }
 #endif
@@ -5230,6 +5284,8 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         _mcleanup();
 #endif
         gdb_exit(cpu_env, arg1);
+        perf_exit();
+        tb_cache_exit();
         _exit(arg1);
         ret = 0; /* avoid warning */
         break;
@@ -7001,6 +7057,8 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         _mcleanup();
 #endif
         gdb_exit(cpu_env, arg1);
+        perf_exit();
+        tb_cache_exit();
         ret = get_errno(exit_group(arg1));
         break;
 #endif
@@ -8831,7 +8889,15 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
             goto efault;
         }
 
-        ep = alloca(maxevents * sizeof(struct epoll_event));
+#ifdef USER_HOST_LAYOUT
+        /* the kernel can fill the guest's array itself */
+        if (sizeof(struct target_epoll_event) == sizeof(struct epoll_event)) {
+            ep = (struct epoll_event *)target_ep;
+        } else
+#endif
+        {
+            ep = alloca(maxevents * sizeof(struct epoll_event));
+        }
 
         switch (num) {
 #if defined(IMPLEMENT_EPOLL_PWAIT)
@@ -8865,7 +8931,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         default:
             ret = -TARGET_ENOSYS;
         }
-        if (!is_error(ret)) {
+        if (!is_error(ret) && (void *)ep != (void *)target_ep) {
             int i;
             for (i = 0; i < ret; i++) {
                 target_ep[i].events = tswap32(ep[i].events);
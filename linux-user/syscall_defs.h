@@ -2432,10 +2432,18 @@ typedef union target_epoll_data {
     uint64_t u64;
 } target_epoll_data_t;
 
+/* x86 has no padding before the data, as the alignment of 64-bit
+   integers is 4 on i386 and the x86_64 structure is packed to match.  */
+#if defined(TARGET_I386)
+#define TARGET_EPOLL_PACKED QEMU_PACKED
+#else
+#define TARGET_EPOLL_PACKED
+#endif
+
 struct target_epoll_event {
     uint32_t events;
     target_epoll_data_t data;
-};
+} TARGET_EPOLL_PACKED;
 #endif
 struct target_rlimit64 {
     uint64_t rlim_cur;
@@ -0,0 +1,891 @@
+/*
+ * Persistent translation cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * The blocks translated from executable file mappings are appended to a
+ * file per mapped object in the cache directory, and looked up there by
+ * later processes before translating a block again.  The object is named
+ * by its ELF build-id, or else by the identity of the file, and a block
+ * by the offset of its guest code in the object, its guest address and
+ * its CPU flags.  A block is only used if its guest code is unchanged.
+ *
+ * The host code is position independent but for the immediates that the
+ * backend reported with tcg_out_host_reloc(): addresses in the TB, in the
+ * QEMU binary and in the prologue are fixed up for the new process.  The
+ * guest addresses are not relocated, so a block is only found again when
+ * its object is mapped at the same guest address.
+ *
+ * A fresh translation must lay out exactly the same code, because
+ * cpu_restore_state() translates the block again over its code.  The
+ * fixed up immediates must therefore keep the encoding that the backend
+ * would choose for them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <link.h>
+#include <zlib.h>
+#include <glib.h>
+
+#include "qemu.h"
+#include "tcg.h"
+#include "elf.h"
+
+#if TCG_TARGET_HAS_host_relocs && defined(USE_DIRECT_JUMP)
+
+#define TB_CACHE_MAGIC          0x43425451      /* "QTBC" */
+#define TB_CACHE_ENTRY_MAGIC    0x45425451      /* "QTBE" */
+#define TB_CACHE_VERSION        1
+
+/* stop appending to a cache file past this size */
+#define TB_CACHE_FILE_MAX       (64 * 1024 * 1024)
+
+typedef struct TBCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    char config[248];           /* the QEMU binary and the CPU */
+} TBCacheHeader;
+
+/* An entry is followed by its relocations, guest code and host code,
+   and padded to 8 bytes.  */
+typedef struct TBCacheEntry {
+    uint32_t magic;
+    uint32_t len;               /* of the whole entry */
+    uint32_t crc;               /* of what follows */
+    uint32_t icount;
+    uint64_t offset;            /* of the guest code in the object */
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t flags;
+    uint16_t size;              /* of the guest code */
+    uint16_t code_size;         /* of the host code */
+    uint16_t nb_relocs;
+    uint16_t tb_next_offset[2];
+    uint16_t tb_jmp_offset[2];
+    uint16_t pad;
+} TBCacheEntry;
+
+enum {
+    TB_CACHE_BASE_TB,
+    TB_CACHE_BASE_IMAGE,
+    TB_CACHE_BASE_PROLOGUE,
+    TB_CACHE_BASE_NONE,
+};
+
+typedef struct TBCacheReloc {
+    int64_t addend;             /* to the base */
+    uint16_t offset;            /* of the immediate in the host code */
+    uint8_t type;               /* TCG_HOST_RELOC_* */
+    uint8_t base;               /* TB_CACHE_BASE_* */
+    uint32_t pad;
+} TBCacheReloc;
+
+typedef struct TBCacheFile {
+    char *key;                  /* of the object */
+    char *name;
+    bool loaded;
+    int fd;                     /* for appending, -1 if not possible */
+    dev_t dev;                  /* of fd, in case the guest closed it */
+    ino_t ino;
+    size_t size;
+    GHashTable *entries;        /* TBCacheEntry -> itself */
+} TBCacheFile;
+
+typedef struct TBCacheMap {
+    abi_ulong start;
+    abi_ulong end;
+    uint64_t offset;            /* in the object of 'start' */
+    TBCacheFile *file;
+} TBCacheMap;
+
+static char *tb_cache_dir;
+/* the bounds of the QEMU binary */
+static tcg_target_ulong tb_cache_image_start, tb_cache_image_end;
+static char tb_cache_config[sizeof(((TBCacheHeader *)0)->config)];
+static bool tb_cache_started;
+
+/* protects everything below */
+static pthread_mutex_t tb_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static GArray *tb_cache_maps;
+static GHashTable *tb_cache_files;     /* object key -> TBCacheFile */
+static unsigned long tb_cache_hits, tb_cache_misses, tb_cache_stores;
+
+static guint tb_cache_entry_hash(gconstpointer key)
+{
+    const TBCacheEntry *e = key;
+
+    /* the pc is mostly the offset plus the start of the mapping, and
+       would cancel out its low bits */
+    return (guint)(e->offset ^ (e->offset >> 32) ^ (e->flags * 31));
+}
+
+static gboolean tb_cache_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheEntry *e1 = a, *e2 = b;
+
+    return e1->offset == e2->offset && e1->pc == e2->pc &&
+           e1->cs_base == e2->cs_base && e1->flags == e2->flags;
+}
+
+static inline TBCacheReloc *tb_cache_entry_relocs(TBCacheEntry *e)
+{
+    return (TBCacheReloc *)(e + 1);
+}
+
+static inline uint8_t *tb_cache_entry_guest(TBCacheEntry *e)
+{
+    return (uint8_t *)(tb_cache_entry_relocs(e) + e->nb_relocs);
+}
+
+static inline uint8_t *tb_cache_entry_code(TBCacheEntry *e)
+{
+    return tb_cache_entry_guest(e) + e->size;
+}
+
+static bool tb_cache_entry_valid(TBCacheEntry *e, size_t room)
+{
+    TBCacheReloc *r;
+    int i, size;
+
+    if (room < sizeof(*e) || e->magic != TB_CACHE_ENTRY_MAGIC ||
+        e->len > room || (e->len & 7) ||
+        e->len < sizeof(*e) + e->nb_relocs * sizeof(TBCacheReloc) +
+                 e->size + e->code_size) {
+        return false;
+    }
+    if (e->crc != crc32(0, (uint8_t *)&e->icount,
+                        e->len - offsetof(TBCacheEntry, icount))) {
+        return false;
+    }
+
+    /* nothing may be patched outside the host code */
+    r = tb_cache_entry_relocs(e);
+    for (i = 0; i < e->nb_relocs; i++, r++) {
+        size = (r->type & ~TCG_HOST_RELOC_FAR) == TCG_HOST_RELOC_ABS64 ? 8 : 4;
+        if (r->base >= TB_CACHE_BASE_NONE ||
+            r->offset + size > e->code_size) {
+            return false;
+        }
+    }
+    for (i = 0; i < 2; i++) {
+        if ((e->tb_next_offset[i] != 0xffff &&
+             e->tb_next_offset[i] > e->code_size) ||
+            (e->tb_jmp_offset[i] != 0xffff &&
+             e->tb_jmp_offset[i] + 4 > e->code_size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Only trust what nobody else could have written.  */
+static bool tb_cache_trusted(const struct stat *st)
+{
+    return st->st_uid == geteuid() && !(st->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+static uint64_t elf_word(const uint8_t *p, int size, bool msb)
+{
+    uint64_t val = 0;
+    int i;
+
+    for (i = 0; i < size; i++) {
+        val = (val << 8) | p[msb ? i : size - 1 - i];
+    }
+    return val;
+}
+
+/* Name an ELF object by its build-id.  */
+static bool tb_cache_build_id(int fd, char *buf, size_t buf_size)
+{
+    uint8_t ehdr[64], phdr[56], notes[1024];
+    uint64_t phoff, off, filesz, namesz, descsz, pos;
+    int phentsize, phnum, i, j;
+    bool is64, msb;
+    ssize_t len;
+
+    if (pread(fd, ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+        memcmp(ehdr, ELFMAG, SELFMAG) != 0) {
+        return false;
+    }
+    is64 = ehdr[EI_CLASS] == ELFCLASS64;
+    msb = ehdr[EI_DATA] == ELFDATA2MSB;
+    phoff = elf_word(ehdr + (is64 ? 32 : 28), is64 ? 8 : 4, msb);
+    phentsize = elf_word(ehdr + (is64 ? 54 : 42), 2, msb);
+    phnum = elf_word(ehdr + (is64 ? 56 : 44), 2, msb);
+    if (phentsize < (is64 ? 56 : 32) || phnum > 64) {
+        return false;
+    }
+
+    for (i = 0; i < phnum; i++) {
+        if (pread(fd, phdr, phentsize < sizeof(phdr) ? phentsize : sizeof(phdr),
+                  phoff + i * phentsize) < (is64 ? 56 : 32) ||
+            elf_word(phdr, 4, msb) != PT_NOTE) {
+            continue;
+        }
+        off = elf_word(phdr + (is64 ? 8 : 4), is64 ? 8 : 4, msb);
+        filesz = elf_word(phdr + (is64 ? 32 : 16), is64 ? 8 : 4, msb);
+        len = pread(fd, notes, MIN(filesz, sizeof(notes)), off);
+        for (pos = 0; len > 0 && pos + 12 <= len; ) {
+            namesz = elf_word(notes + pos, 4, msb);
+            descsz = elf_word(notes + pos + 4, 4, msb);
+            off = pos + 12 + ((namesz + 3) & ~3);
+            if (off + descsz > len) {
+                break;
+            }
+            if (elf_word(notes + pos + 8, 4, msb) == NT_GNU_BUILD_ID &&
+                namesz == 4 && memcmp(notes + pos + 12, "GNU", 4) == 0 &&
+                descsz > 0 && descsz * 2 + 2 < buf_size) {
+                buf += sprintf(buf, "b-");
+                for (j = 0; j < descsz; j++) {
+                    buf += sprintf(buf, "%02x", notes[off + j]);
+                }
+                return true;
+            }
+            pos = off + ((descsz + 3) & ~3);
+        }
+    }
+    return false;
+}
+
+static TBCacheFile *tb_cache_file(int fd)
+{
+    char key[160];
+    TBCacheFile *f;
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    if (!tb_cache_build_id(fd, key, sizeof(key))) {
+        snprintf(key, sizeof(key), "i-%llx-%llx-%llx-%llx",
+                 (unsigned long long)st.st_dev,
+                 (unsigned long long)st.st_ino,
+                 (unsigned long long)st.st_size,
+                 (unsigned long long)st.st_mtime);
+    }
+
+    f = g_hash_table_lookup(tb_cache_files, key);
+    if (!f) {
+        f = g_new0(TBCacheFile, 1);
+        f->key = g_strdup(key);
+        f->fd = -1;
+        f->entries = g_hash_table_new(tb_cache_entry_hash,
+                                      tb_cache_entry_equal);
+        g_hash_table_insert(tb_cache_files, f->key, f);
+    }
+    return f;
+}
+
+/* Forget the executable mappings in [start, start + len).  */
+static void tb_cache_unmap_locked(abi_ulong start, abi_ulong len)
+{
+    TBCacheMap *m;
+    int i;
+
+    for (i = tb_cache_maps->len - 1; i >= 0; i--) {
+        m = &g_array_index(tb_cache_maps, TBCacheMap, i);
+        if (m->start < start + len && start < m->end) {
+            g_array_remove_index_fast(tb_cache_maps, i);
+        }
+    }
+}
+
+void tb_cache_map(abi_ulong start, abi_ulong len, int prot, int fd,
+                  abi_ulong offset)
+{
+    TBCacheMap m;
+
+    if (!tb_cache_dir || len == 0) {
+        return;
+    }
+    pthread_mutex_lock(&tb_cache_lock);
+    tb_cache_unmap_locked(start, len);
+    if (fd >= 0 && (prot & PROT_EXEC)) {
+        m.file = tb_cache_file(fd);
+        if (m.file) {
+            m.start = start;
+            m.end = start + len;
+            m.offset = offset;
+            g_array_append_val(tb_cache_maps, m);
+        }
+    }
+    pthread_mutex_unlock(&tb_cache_lock);
+}
+
+void tb_cache_unmap(abi_ulong start, abi_ulong len)
+{
+    if (!tb_cache_dir) {
+        return;
+    }
+    pthread_mutex_lock(&tb_cache_lock);
+    tb_cache_unmap_locked(start, len);
+    pthread_mutex_unlock(&tb_cache_lock);
+}
+
+/* Open the cache file, creating it with its header if needed, and read
+   the entries that other processes left in it.  */
+static void tb_cache_file_load(TBCacheFile *f)
+{
+    TBCacheHeader hdr;
+    TBCacheEntry *e;
+    uint8_t *buf, *p;
+    struct stat st;
+    char *tmp;
+    int fd;
+
+    f->loaded = true;
+    f->name = g_strdup_printf("%s/%s-%08x.tbc", tb_cache_dir, f->key,
+                              (unsigned)crc32(0, (uint8_t *)tb_cache_config,
+                                              strlen(tb_cache_config)));
+    fd = open(f->name, O_RDWR | O_APPEND | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT) {
+        /* create the file under another name first, so that nobody
+           sees it without its header */
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = TB_CACHE_MAGIC;
+        hdr.version = TB_CACHE_VERSION;
+        pstrcpy(hdr.config, sizeof(hdr.config), tb_cache_config);
+        tmp = g_strdup_printf("%s.%d", f->name, getpid());
+        fd = open(tmp, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                  0644);
+        if (fd >= 0) {
+            if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+                (link(tmp, f->name) != 0 && errno != EEXIST)) {
+                close(fd);
+                fd = -1;
+            }
+            unlink(tmp);
+            if (fd >= 0) {
+                close(fd);
+                fd = open(f->name, O_RDWR | O_APPEND | O_NOFOLLOW | O_CLOEXEC);
+            }
+        }
+        g_free(tmp);
+    }
+    if (fd < 0) {
+        return;
+    }
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        !tb_cache_trusted(&st) || st.st_size < sizeof(hdr)) {
+        close(fd);
+        return;
+    }
+    f->size = MIN(st.st_size, TB_CACHE_FILE_MAX);
+    buf = g_malloc(f->size);
+    if (pread(fd, buf, f->size, 0) != f->size) {
+        g_free(buf);
+        close(fd);
+        return;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.magic != TB_CACHE_MAGIC || hdr.version != TB_CACHE_VERSION ||
+        strncmp(hdr.config, tb_cache_config, sizeof(hdr.config)) != 0) {
+        g_free(buf);
+        close(fd);
+        return;
+    }
+
+    /* a partly written entry ends the file for us */
+    for (p = buf + sizeof(hdr); p < buf + f->size; p += e->len) {
+        e = (TBCacheEntry *)p;
+        if (!tb_cache_entry_valid(e, buf + f->size - p)) {
+            break;
+        }
+        if (!g_hash_table_lookup(f->entries, e)) {
+            g_hash_table_insert(f->entries, e, e);
+        }
+    }
+    f->size = st.st_size;
+    f->fd = fd;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+}
+
+/* Whether the cache file descriptor is still ours: the guest does not
+   know about it, and may have closed it and reused its number.  */
+static bool tb_cache_file_open(TBCacheFile *f)
+{
+    struct stat st;
+
+    if (f->fd < 0) {
+        return false;
+    }
+    if (fstat(f->fd, &st) != 0 || st.st_dev != f->dev || st.st_ino != f->ino) {
+        f->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+/* Find the mapping of the guest code of a block, and the offset of the
+   code in its object.  */
+static TBCacheMap *tb_cache_find_map(target_ulong pc, target_ulong size,
+                                     uint64_t *offset)
+{
+    TBCacheMap *m;
+    int i;
+
+    for (i = 0; i < tb_cache_maps->len; i++) {
+        m = &g_array_index(tb_cache_maps, TBCacheMap, i);
+        if (pc >= m->start && pc < m->end && size <= m->end - pc) {
+            if (!m->file->loaded) {
+                tb_cache_file_load(m->file);
+            }
+            *offset = m->offset + (pc - m->start);
+            return m;
+        }
+    }
+    return NULL;
+}
+
+/* Whether blocks can be translated the way another process would.  */
+static bool tb_cache_usable(CPUArchState *env, TranslationBlock *tb)
+{
+    return tb_cache_started && tb->cflags == 0 && !tb_stats_enabled &&
+           !singlestep && !env->singlestep_enabled &&
+           QTAILQ_EMPTY(&env->breakpoints);
+}
+
+/* Whether the backend would encode 'value' the way it was encoded at
+   'ptr', and store it there.  */
+static bool tb_cache_patch(uint8_t *ptr, int type, tcg_target_long value)
+{
+    tcg_target_long disp;
+
+    if (type & TCG_HOST_RELOC_FAR) {
+        /* the movi of the address starts 1 to 4 bytes before 'ptr',
+           and the branch was too far from there */
+        disp = value - (tcg_target_long)ptr;
+        if (disp - 4 == (int32_t)(disp - 4) ||
+            disp + 1 == (int32_t)(disp + 1)) {
+            return false;
+        }
+    }
+    switch (type & ~TCG_HOST_RELOC_FAR) {
+    case TCG_HOST_RELOC_ABS32:
+        if (value == 0 ||
+            (TCG_TARGET_REG_BITS == 64 && value != (uint32_t)value)) {
+            return false;
+        }
+        *(uint32_t *)ptr = value;
+        return true;
+    case TCG_HOST_RELOC_ABS32S:
+        if (value == (uint32_t)value || value != (int32_t)value) {
+            return false;
+        }
+        *(uint32_t *)ptr = value;
+        return true;
+    case TCG_HOST_RELOC_ABS64:
+        if (value == (uint32_t)value || value == (int32_t)value) {
+            return false;
+        }
+        memcpy(ptr, &value, sizeof(value));
+        return true;
+    case TCG_HOST_RELOC_PCREL32:
+        disp = value - (tcg_target_long)(ptr + 4);
+        if (disp != (int32_t)disp) {
+            return false;
+        }
+        *(uint32_t *)ptr = disp;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static tcg_target_long tb_cache_base(TranslationBlock *tb, int base)
+{
+    switch (base) {
+    case TB_CACHE_BASE_TB:
+        return (tcg_target_long)tb;
+    case TB_CACHE_BASE_IMAGE:
+        return tb_cache_image_start;
+    case TB_CACHE_BASE_PROLOGUE:
+        return (tcg_target_long)tcg_ctx.code_gen_prologue;
+    default:
+        return 0;
+    }
+}
+
+bool tb_cache_restore(CPUArchState *env, TranslationBlock *tb,
+                      int *code_size)
+{
+    TBCacheEntry key, *e = NULL;
+    TBCacheReloc *r;
+    TBCacheMap *m;
+    int i;
+
+    if (!tb_cache_usable(env, tb)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&tb_cache_lock);
+    m = tb_cache_find_map(tb->pc, 1, &key.offset);
+    if (m) {
+        key.pc = tb->pc;
+        key.cs_base = tb->cs_base;
+        key.flags = tb->flags;
+        e = g_hash_table_lookup(m->file->entries, &key);
+    }
+    if (e) {
+        tb_cache_hits++;
+    } else {
+        tb_cache_misses++;
+    }
+    pthread_mutex_unlock(&tb_cache_lock);
+
+    /* entries are never freed */
+    if (!e || page_check_range(tb->pc, e->size, PAGE_READ) != 0 ||
+        memcmp(g2h(tb->pc), tb_cache_entry_guest(e), e->size) != 0) {
+        return false;
+    }
+
+    memcpy(tb->tc_ptr, tb_cache_entry_code(e), e->code_size);
+    r = tb_cache_entry_relocs(e);
+    for (i = 0; i < e->nb_relocs; i++, r++) {
+        if (!tb_cache_patch(tb->tc_ptr + r->offset, r->type,
+                            tb_cache_base(tb, r->base) + r->addend)) {
+            return false;
+        }
+    }
+    flush_icache_range((tcg_target_ulong)tb->tc_ptr,
+                       (tcg_target_ulong)tb->tc_ptr + e->code_size);
+
+    tb->size = e->size;
+    tb->icount = e->icount;
+    for (i = 0; i < 2; i++) {
+        tb->tb_next_offset[i] = e->tb_next_offset[i];
+        tb->tb_jmp_offset[i] = e->tb_jmp_offset[i];
+    }
+    *code_size = e->code_size;
+    return true;
+}
+
+/* Which known area of the host 'value' points to.  */
+static int tb_cache_classify(TranslationBlock *tb, tcg_target_long value)
+{
+    tcg_target_ulong v = value;
+
+    if (v >= (tcg_target_ulong)tb && v < (tcg_target_ulong)(tb + 1)) {
+        return TB_CACHE_BASE_TB;
+    }
+    if (v >= tb_cache_image_start && v < tb_cache_image_end) {
+        return TB_CACHE_BASE_IMAGE;
+    }
+    if (v >= (tcg_target_ulong)tcg_ctx.code_gen_prologue &&
+        v < (tcg_target_ulong)tcg_ctx.code_gen_prologue + 1024) {
+        return TB_CACHE_BASE_PROLOGUE;
+    }
+    return TB_CACHE_BASE_NONE;
+}
+
+static bool tb_cache_is_host_ptr(TCGContext *s, tcg_target_long value)
+{
+    int i;
+
+    for (i = 0; i < s->nb_host_ptrs; i++) {
+        if (s->host_ptrs[i] == value) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Check that the host addresses that need fixing up only appear in the
+   code as the immediates of the recorded relocations: count the places
+   where their low 32 bits appear.  */
+static bool tb_cache_relocs_complete(TCGContext *s, const uint8_t *code,
+                                     int code_size, const uint32_t *vals,
+                                     int nb_vals)
+{
+    uint32_t filter[64] = { 0 };
+    int count[TCG_MAX_HOST_PTRS + TCG_MAX_HOST_RELOCS];
+    uint32_t v;
+    int i, j;
+
+    for (i = 0; i < nb_vals; i++) {
+        filter[vals[i] % 2048 / 32] |= 1u << (vals[i] % 32);
+        count[i] = 0;
+        for (j = 0; j < s->nb_host_relocs; j++) {
+            if ((uint32_t)s->host_relocs[j].value == vals[i] &&
+                !(s->host_relocs[j].type == TCG_HOST_RELOC_PCREL32)) {
+                count[i]++;
+            }
+        }
+    }
+    for (i = 0; i + 4 <= code_size; i++) {
+        memcpy(&v, code + i, 4);
+        if (!(filter[v % 2048 / 32] & (1u << (v % 32)))) {
+            continue;
+        }
+        for (j = 0; j < nb_vals; j++) {
+            if (vals[j] == v) {
+                count[j]--;
+            }
+        }
+    }
+    for (i = 0; i < nb_vals; i++) {
+        if (count[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void tb_cache_store(CPUArchState *env, TranslationBlock *tb, int code_size)
+{
+    TCGContext *s = &tcg_ctx;
+    uint32_t vals[TCG_MAX_HOST_PTRS + TCG_MAX_HOST_RELOCS];
+    TBCacheEntry key, *e, *old;
+    TBCacheReloc *r;
+    TCGHostReloc *hr;
+    TBCacheMap *m;
+    int i, base, nb_vals = 0, nb_relocs = 0;
+    size_t len;
+
+    if (!tb_cache_usable(env, tb) ||
+        s->nb_host_ptrs < 0 || s->nb_host_ptrs > TCG_MAX_HOST_PTRS ||
+        s->nb_host_relocs < 0 || s->nb_host_relocs > TCG_MAX_HOST_RELOCS) {
+        return;
+    }
+
+    /* other processes cannot use pointers to our heap */
+    for (i = 0; i < s->nb_host_ptrs; i++) {
+        if (tb_cache_classify(tb, s->host_ptrs[i]) == TB_CACHE_BASE_NONE) {
+            return;
+        }
+        vals[nb_vals++] = s->host_ptrs[i];
+    }
+    for (i = 0; i < s->nb_host_relocs; i++) {
+        hr = &s->host_relocs[i];
+        base = tb_cache_classify(tb, hr->value);
+        if (hr->type == TCG_HOST_RELOC_PCREL32 ||
+            (hr->type & TCG_HOST_RELOC_FAR)) {
+            /* calls and jumps out of the TB */
+            if (base == TB_CACHE_BASE_NONE) {
+                return;
+            }
+        } else if (base == TB_CACHE_BASE_TB) {
+            /* exit_tb and the trace countdown */
+            vals[nb_vals++] = hr->value;
+        } else if (base != TB_CACHE_BASE_NONE &&
+                   !tb_cache_is_host_ptr(s, hr->value)) {
+            /* probably not an address, but too close to be sure */
+            return;
+        }
+        if (base != TB_CACHE_BASE_NONE) {
+            nb_relocs++;
+        }
+    }
+    if (!tb_cache_relocs_complete(s, tb->tc_ptr, code_size, vals, nb_vals)) {
+        return;
+    }
+
+    len = sizeof(*e) + nb_relocs * sizeof(*r) + tb->size + code_size;
+    len = (len + 7) & ~7;
+    e = g_malloc0(len);
+    e->magic = TB_CACHE_ENTRY_MAGIC;
+    e->len = len;
+    e->icount = tb->icount;
+    e->pc = tb->pc;
+    e->cs_base = tb->cs_base;
+    e->flags = tb->flags;
+    e->size = tb->size;
+    e->code_size = code_size;
+    e->nb_relocs = nb_relocs;
+    for (i = 0; i < 2; i++) {
+        e->tb_next_offset[i] = tb->tb_next_offset[i];
+        e->tb_jmp_offset[i] = tb->tb_jmp_offset[i];
+    }
+    r = tb_cache_entry_relocs(e);
+    for (i = 0; i < s->nb_host_relocs; i++) {
+        hr = &s->host_relocs[i];
+        base = tb_cache_classify(tb, hr->value);
+        if (base != TB_CACHE_BASE_NONE) {
+            r->addend = hr->value - tb_cache_base(tb, base);
+            r->offset = hr->offset;
+            r->type = hr->type;
+            r->base = base;
+            r++;
+        }
+    }
+    memcpy(tb_cache_entry_guest(e), g2h(tb->pc), tb->size);
+    memcpy(tb_cache_entry_code(e), tb->tc_ptr, code_size);
+
+    pthread_mutex_lock(&tb_cache_lock);
+    m = tb_cache_find_map(tb->pc, tb->size, &e->offset);
+    if (!m || m->file->size >= TB_CACHE_FILE_MAX ||
+        !tb_cache_file_open(m->file)) {
+        pthread_mutex_unlock(&tb_cache_lock);
+        g_free(e);
+        return;
+    }
+    memcpy(&key, e, sizeof(key));
+    old = g_hash_table_lookup(m->file->entries, &key);
+    if (old && old->size == e->size &&
+        memcmp(tb_cache_entry_guest(old), tb_cache_entry_guest(e),
+               e->size) == 0) {
+        /* another thread translated the same block */
+        pthread_mutex_unlock(&tb_cache_lock);
+        g_free(e);
+        return;
+    }
+    e->crc = crc32(0, (uint8_t *)&e->icount,
+                   e->len - offsetof(TBCacheEntry, icount));
+    /* a single write, so that the entries of several processes do not
+       interleave */
+    if (write(m->file->fd, e, e->len) == e->len) {
+        m->file->size += e->len;
+        g_hash_table_replace(m->file->entries, e, e);
+        tb_cache_stores++;
+    } else {
+        g_free(e);
+    }
+    pthread_mutex_unlock(&tb_cache_lock);
+}
+
+/* Translating threads may hold tb_cache_lock without any other lock, so
+   fork() must take it too.  */
+void tb_cache_fork_start(void)
+{
+    pthread_mutex_lock(&tb_cache_lock);
+}
+
+void tb_cache_fork_end(int child)
+{
+    if (child) {
+        pthread_mutex_init(&tb_cache_lock, NULL);
+    } else {
+        pthread_mutex_unlock(&tb_cache_lock);
+    }
+}
+
+void tb_cache_enable(const char *dir)
+{
+    struct stat st;
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "qemu: cannot create translation cache %s: %s\n",
+                dir, strerror(errno));
+        return;
+    }
+    /* the cache holds host code that we run */
+    if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) ||
+        !tb_cache_trusted(&st)) {
+        fprintf(stderr, "qemu: not using translation cache %s: it must be "
+                "a directory owned by the user and writable by nobody "
+                "else\n", dir);
+        return;
+    }
+    tb_cache_dir = g_strdup(dir);
+    tb_cache_maps = g_array_new(FALSE, FALSE, sizeof(TBCacheMap));
+    tb_cache_files = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+/* The program comes first.  */
+static int tb_cache_find_image(struct dl_phdr_info *info, size_t size,
+                               void *opaque)
+{
+    tcg_target_ulong start, end;
+    int i;
+
+    tb_cache_image_start = -1;
+    tb_cache_image_end = 0;
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+            start = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+            end = start + info->dlpi_phdr[i].p_memsz;
+            tb_cache_image_start = MIN(tb_cache_image_start, start);
+            tb_cache_image_end = MAX(tb_cache_image_end, end);
+        }
+    }
+    return 1;
+}
+
+void tb_cache_start(const char *cpu_model)
+{
+    struct stat st;
+
+    if (!tb_cache_dir || stat("/proc/self/exe", &st) != 0) {
+        return;
+    }
+    dl_iterate_phdr(tb_cache_find_image, NULL);
+    if (tb_cache_image_start >= tb_cache_image_end) {
+        return;
+    }
+    snprintf(tb_cache_config, sizeof(tb_cache_config),
+             "qemu-%s %s %llx-%llx-%llx-%llx cpu=%s base=%lx",
+             TARGET_ARCH, QEMU_VERSION,
+             (unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+             (unsigned long long)st.st_size, (unsigned long long)st.st_mtime,
+             cpu_model,
+             tcg_target_guest_base_in_code() ? (unsigned long)GUEST_BASE : 0);
+    tcg_ctx.record_host_relocs = true;
+    tb_cache_started = true;
+}
+
+void tb_cache_exit(void)
+{
+    if (tb_cache_started && qemu_log_enabled()) {
+        qemu_log("translation cache: %lu hits, %lu misses, %lu stored\n",
+                 tb_cache_hits, tb_cache_misses, tb_cache_stores);
+    }
+}
+
+#else
+
+void tb_cache_map(abi_ulong start, abi_ulong len, int prot, int fd,
+                  abi_ulong offset)
+{
+}
+
+void tb_cache_unmap(abi_ulong start, abi_ulong len)
+{
+}
+
+bool tb_cache_restore(CPUArchState *env, TranslationBlock *tb,
+                      int *code_size)
+{
+    return false;
+}
+
+void tb_cache_store(CPUArchState *env, TranslationBlock *tb, int code_size)
+{
+}
+
+void tb_cache_fork_start(void)
+{
+}
+
+void tb_cache_fork_end(int child)
+{
+}
+
+void tb_cache_enable(const char *dir)
+{
+    fprintf(stderr, "qemu: the translation cache is not supported "
+            "on this host\n");
+}
+
+void tb_cache_start(const char *cpu_model)
+{
+}
+
+void tb_cache_exit(void)
+{
+}
+
+#endif
@@ -40,6 +40,11 @@ static int fd_write(MigrationState *s, const void * buf, size_t size)
     return write(s->fd, buf, size);
 }
 
+static int fd_writev(MigrationState *s, struct iovec *iov, int iovcnt)
+{
+    return writev(s->fd, iov, iovcnt);
+}
+
 static int fd_close(MigrationState *s)
 {
     struct stat st;
@@ -77,6 +82,7 @@ void fd_start_outgoing_migration(MigrationState *s, const char *fdname, Error **
 
     s->get_error = fd_errno;
     s->write = fd_write;
+    s->writev = fd_writev;
     s->close = fd_close;
 
     migrate_fd_connect(s);
@@ -15,6 +15,7 @@
 
 #include "qemu-common.h"
 #include "qemu/sockets.h"
+#include "qemu/iov.h"
 #include "migration/migration.h"
 #include "migration/qemu-file.h"
 #include "block/block.h"
@@ -39,6 +40,11 @@ static int socket_write(MigrationState *s, const void * buf, size_t size)
     return send(s->fd, buf, size, 0);
 }
 
+static int socket_writev(MigrationState *s, struct iovec *iov, int iovcnt)
+{
+    return iov_send(s->fd, iov, iovcnt, 0, iov_size(iov, iovcnt));
+}
+
 static int tcp_close(MigrationState *s)
 {
     int r = 0;
@@ -69,6 +75,7 @@ void tcp_start_outgoing_migration(MigrationState *s, const char *host_port, Erro
 {
     s->get_error = socket_errno;
     s->write = socket_write;
+    s->writev = socket_writev;
     s->close = tcp_close;
 
     s->fd = inet_nonblocking_connect(host_port, tcp_wait_for_connect, s, errp);
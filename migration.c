@@ -20,6 +20,7 @@
 #include "sysemu/sysemu.h"
 #include "block/block.h"
 #include "qemu/sockets.h"
+#include "qemu/iov.h"
 #include "migration/block.h"
 #include "qemu/thread.h"
 #include "qmp-commands.h"
@@ -313,6 +314,32 @@ static ssize_t migrate_fd_put_buffer(MigrationState *s, const void *data,
     return ret;
 }
 
+/*
+ * Write what the transport takes without blocking, so that the caller can
+ * keep the iothread lock.  Returns -EAGAIN if nothing could be written.
+ */
+static ssize_t migrate_fd_writev(MigrationState *s, struct iovec *iov,
+                                 int iovcnt)
+{
+    ssize_t ret;
+    int err = 0;
+
+    if (s->state != MIG_STATE_ACTIVE) {
+        return -EIO;
+    }
+
+    socket_set_nonblock(s->fd);
+    do {
+        ret = s->writev(s, iov, iovcnt);
+    } while (ret == -1 && ((err = s->get_error(s)) == EINTR));
+    socket_set_block(s->fd);
+
+    if (ret == -1) {
+        ret = (err == EAGAIN || err == EWOULDBLOCK) ? -EAGAIN : -err;
+    }
+    return ret;
+}
+
 static void migrate_fd_cancel(MigrationState *s)
 {
     if (s->state != MIG_STATE_ACTIVE)
@@ -544,35 +571,45 @@ static ssize_t buffered_flush(MigrationState *s)
     return offset;
 }
 
-static int buffered_put_buffer(void *opaque, const uint8_t *buf,
-                               int64_t pos, int size)
+/*
+ * Guest pages queued with qemu_put_buffer_async are sent straight from guest
+ * memory when nothing is buffered and the transport has room; whatever it
+ * does not take is copied and sent by buffered_flush.
+ */
+static int buffered_writev_buffer(void *opaque, struct iovec *iov, int iovcnt,
+                                  int64_t pos)
 {
     MigrationState *s = opaque;
-    ssize_t error;
+    size_t size = iov_size(iov, iovcnt);
+    size_t offset = 0;
+    ssize_t ret;
 
-    DPRINTF("putting %d bytes at %" PRId64 "\n", size, pos);
+    DPRINTF("putting %zu bytes at %" PRId64 "\n", size, pos);
 
-    error = qemu_file_get_error(s->file);
-    if (error) {
-        DPRINTF("flush when error, bailing: %s\n", strerror(-error));
-        return error;
+    ret = qemu_file_get_error(s->file);
+    if (ret) {
+        DPRINTF("flush when error, bailing: %s\n", strerror(-ret));
+        return ret;
     }
 
-    if (size <= 0) {
-        return size;
+    if (s->writev && !s->buffer_size && s->bytes_xfer < s->xfer_limit) {
+        ret = migrate_fd_writev(s, iov, iovcnt);
+        if (ret < 0 && ret != -EAGAIN) {
+            DPRINTF("error writing data, %zd\n", ret);
+            return ret;
+        }
+        if (ret > 0) {
+            offset = ret;
+            s->bytes_xfer += ret;
+        }
     }
 
-    if (size > (s->buffer_capacity - s->buffer_size)) {
-        DPRINTF("increasing buffer capacity from %zu by %zu\n",
-                s->buffer_capacity, size + 1024);
-
-        s->buffer_capacity += size + 1024;
-
+    if (size - offset > s->buffer_capacity - s->buffer_size) {
+        s->buffer_capacity += size - offset + 1024;
         s->buffer = g_realloc(s->buffer, s->buffer_capacity);
     }
-
-    memcpy(s->buffer + s->buffer_size, buf, size);
-    s->buffer_size += size;
+    iov_to_buf(iov, iovcnt, offset, s->buffer + s->buffer_size, size - offset);
+    s->buffer_size += size - offset;
 
     return size;
 }
@@ -760,7 +797,7 @@ out:
 
 static const QEMUFileOps buffered_file_ops = {
     .get_fd =         buffered_get_fd,
-    .put_buffer =     buffered_put_buffer,
+    .writev_buffer =  buffered_writev_buffer,
     .close =          buffered_close,
     .rate_limit =     buffered_rate_limit,
     .get_rate_limit = buffered_get_rate_limit,
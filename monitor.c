@@ -463,6 +463,7 @@ static const char *monitor_event_names[] = {
     [QEVENT_WAKEUP] = "WAKEUP",
     [QEVENT_BALLOON_CHANGE] = "BALLOON_CHANGE",
     [QEVENT_SPICE_MIGRATE_COMPLETED] = "SPICE_MIGRATE_COMPLETED",
+    [QEVENT_DUMP_COMPLETED] = "DUMP_COMPLETED",
 };
 QEMU_BUILD_BUG_ON(ARRAY_SIZE(monitor_event_names) != QEVENT_MAX)
 
@@ -893,6 +894,10 @@ static void do_info_registers(Monitor *mon, const QDict *qdict)
 static void do_info_jit(Monitor *mon, const QDict *qdict)
 {
     dump_exec_info((FILE *)mon, monitor_fprintf);
+    if (tb_stats_enabled) {
+        dump_tb_stats((FILE *)mon, monitor_fprintf,
+                      qdict_get_try_int(qdict, "count", 10));
+    }
 }
 
 static void do_info_history(Monitor *mon, const QDict *qdict)
@@ -2542,9 +2547,10 @@ static mon_cmd_t info_cmds[] = {
     },
     {
         .name       = "jit",
-        .args_type  = "",
-        .params     = "",
-        .help       = "show dynamic compiler info",
+        .args_type  = "count:i?",
+        .params     = "[count]",
+        .help       = "show dynamic compiler info and, with -tb-stats, "
+                      "the 'count' hottest TBs",
         .mhandler.cmd = do_info_jit,
     },
     {
@@ -799,7 +799,7 @@ ETEXI
 DEF("display", HAS_ARG, QEMU_OPTION_display,
     "-display sdl[,frame=on|off][,alt_grab=on|off][,ctrl_grab=on|off]\n"
     "            [,window_close=on|off]|curses|none|\n"
-    "            vnc=<display>[,<optargs>]\n"
+    "            vnc=<display>[,<optargs>]|shm=<path>\n"
     "                select display type\n", QEMU_ARCH_ALL)
 STEXI
 @item -display @var{type}
@@ -824,6 +824,12 @@ only affects what is done with video output; -nographic also changes
 the destination of the serial and parallel port data.
 @item vnc
 Start a VNC server on display <arg>
+@item shm
+Export the display to local viewers through shared memory. QEMU listens
+on the Unix socket <path> and passes connecting viewers a file descriptor
+of the framebuffer, which they map, followed by notifications of the
+changed areas and of the mouse pointer. No pixel data is encoded or sent
+over the socket. The protocol is described in @file{include/ui/shm-display.h}.
 @end table
 ETEXI
 
@@ -1214,6 +1220,20 @@ This can be really helpful to save bandwidth when playing videos. Disabling
 adaptive encodings allows to restore the original static behavior of encodings
 like Tight.
 
+@item fixed-encoding
+
+Always use the encoding preferred by the client.  By default, QEMU measures
+the throughput of each connection and the cost of each encoding, and sends
+every update with the encoding and compression level, among those supported
+by the client, that gets it to the client fastest.
+
+@item tile=@var{pixels}
+
+Set the width of the tiles in which screen changes are tracked: 16
+(the default), 32 or 64 pixels.  Wider tiles make dirty tracking cheaper
+on large displays, at the cost of sending a little more unchanged data
+around each update.
+
 @item share=[allow-exclusive|force-shared|ignore]
 
 Set display sharing policy.  'allow-exclusive' allows clients to ask
@@ -2481,6 +2501,42 @@ STEXI
 Run the emulation in single step mode.
 ETEXI
 
+DEF("perfmap", 0, QEMU_OPTION_perfmap, \
+    "-perfmap        generate a /tmp/perf-${pid}.map file for perf\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -perfmap
+@findex -perfmap
+Generate a map file for Linux perf tools that will allow basic profiling
+information to be broken down into basic blocks of translated guest code.
+The map is rewritten from scratch whenever the translation cache is flushed.
+ETEXI
+
+DEF("jitdump", 0, QEMU_OPTION_jitdump, \
+    "-jitdump        generate a jit-${pid}.dump file for perf\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -jitdump
+@findex -jitdump
+Generate a dump file for Linux perf tools that maps basic blocks of
+translated guest code to the host code generated for them, including the
+host code itself.  Record with @code{perf record -k 1} and merge the dump
+with @code{perf inject --jit} before running @code{perf report}.
+ETEXI
+
+DEF("tb-stats", 0, QEMU_OPTION_tb_stats, \
+    "-tb-stats       gather per translation block execution statistics\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tb-stats
+@findex -tb-stats
+Make every translated block count its executions and record why control
+left it: through the main loop instead of a chained jump, through a fault,
+or through an I/O retranslation in icount mode.  The hottest blocks can be
+listed with @code{info jit} in the monitor or with @code{query-tb-stats}
+in QMP.  The counters slow down execution slightly.
+ETEXI
+
 DEF("S", 0, QEMU_OPTION_S, \
     "-S              freeze CPU at startup (use 'c' to start execution)\n",
     QEMU_ARCH_ALL)
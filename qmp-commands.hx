@@ -765,8 +765,10 @@ EQMP
 
     {
         .name       = "dump-guest-memory",
-        .args_type  = "paging:b,protocol:s,begin:i?,end:i?",
-        .params     = "-p protocol [begin] [length]",
+        .args_type  = "paging:b,protocol:s,begin:i?,end:i?,format:s?,"
+                      "threads:i?,snapshot:b?",
+        .params     = "-p protocol [begin] [length] [format] [threads]"
+                      " [snapshot]",
         .help       = "dump guest memory to file",
         .user_print = monitor_user_noop,
         .mhandler.cmd_new = qmp_marshal_input_dump_guest_memory,
@@ -787,12 +789,25 @@ Arguments:
            with length together (json-int)
 - "length": the memory size, in bytes. It's optional, and should be specified
             with begin together (json-int)
+- "format": "elf" (the default) or "kdump-zlib" for the compressed format of
+            makedumpfile, which needs a regular file (json-string, optional)
+- "threads": number of threads compressing pages, by default one per host
+             CPU (json-int, optional)
+- "snapshot": write the dump from a copy-on-write snapshot of the memory
+              while the guest keeps running; DUMP_COMPLETED is emitted when
+              it is done.  Not available with -mem-path and -mem-prealloc,
+              which share guest memory (json-bool, optional)
 
 Example:
 
 -> { "execute": "dump-guest-memory", "arguments": { "protocol": "fd:dump" } }
 <- { "return": {} }
 
+-> { "execute": "dump-guest-memory",
+     "arguments": { "paging": false, "protocol": "file:/tmp/vmcore",
+                    "format": "kdump-zlib", "snapshot": true } }
+<- { "return": {} }
+
 Notes:
 
 (1) All boolean arguments default to false
@@ -2144,6 +2159,49 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_query_kvm,
     },
 
+SQMP
+query-tb-stats
+--------------
+
+Show execution statistics of the most executed translated blocks.  QEMU
+must have been started with -tb-stats.
+
+Arguments:
+
+- "count": maximum number of blocks to return, default 10 (json-int, optional)
+
+Return a json-array of json-objects, most executed first, each with:
+
+- "pc": guest program counter at the start of the block (json-int)
+- "cs-base": code segment base the block was translated for (json-int)
+- "flags": CPU state flags the block was translated for (json-int)
+- "exec-count": number of times the block was entered (json-int)
+- "dispatch-count": entries through the main loop lookup (json-int)
+- "unchained-exits": returns to the main loop through an unchained
+                     direct jump slot (json-int)
+- "exceptions": faults taken inside the block (json-int)
+- "io-recompiles": retranslations forced by I/O in icount mode (json-int)
+- "translations": number of times the block was translated (json-int)
+- "guest-size": size of the guest code in bytes (json-int)
+- "host-size": size of the latest host code in bytes (json-int)
+
+Example:
+
+-> { "execute": "query-tb-stats", "arguments": { "count": 1 } }
+<- { "return": [ { "pc": 1048576, "cs-base": 0, "flags": 64,
+                   "exec-count": 2281337, "dispatch-count": 1024,
+                   "unchained-exits": 12, "exceptions": 0,
+                   "io-recompiles": 0, "translations": 1,
+                   "guest-size": 28, "host-size": 161 } ] }
+
+EQMP
+
+    {
+        .name       = "query-tb-stats",
+        .args_type  = "count:i?",
+        .mhandler.cmd_new = qmp_marshal_input_query_tb_stats,
+    },
+
 SQMP
 query-status
 ------------
@@ -2262,6 +2320,10 @@ Clients are described by a json-object, each one contain the following:
 - "service": client's port number (json-string)
 - "x509_dname": TLS dname (json-string, optional)
 - "sasl_username": SASL username (json-string, optional)
+- "encoding": encoding picked by the adaptive encoding selection for the
+              last update (json-string, optional)
+- "throughput": measured connection throughput in bytes per second
+                (json-int, optional)
 
 Example:
 
@@ -2277,7 +2339,9 @@ Example:
             {
                "host":"127.0.0.1",
                "service":"50401",
-               "family":"ipv4"
+               "family":"ipv4",
+               "encoding":"zlib-6",
+               "throughput":11780000
             }
          ]
       }
@@ -38,6 +38,7 @@
 #include "exec/memory.h"
 #include "qmp-commands.h"
 #include "trace.h"
+#include "block/coroutine.h"
 #include "qemu/bitops.h"
 
 #define SELF_ANNOUNCE_ROUNDS 5
@@ -113,6 +114,7 @@ void qemu_announce_self(void)
 /* savevm/loadvm support */
 
 #define IO_BUF_SIZE 32768
+#define MAX_IOV_SIZE MIN(IOV_MAX, 64)
 
 struct QEMUFile {
     const QEMUFileOps *ops;
@@ -125,6 +127,12 @@ struct QEMUFile {
     int buf_size; /* 0 when writing */
     uint8_t buf[IO_BUF_SIZE];
 
+    /* With writev_buffer, the data to write: pieces of buf and buffers
+     * queued by qemu_put_buffer_async, async_size bytes of the latter */
+    struct iovec iov[MAX_IOV_SIZE];
+    unsigned int iovcnt;
+    int async_size;
+
     int last_error;
 };
 
@@ -391,21 +399,189 @@ fail:
     return NULL;
 }
 
+/*
+ * The VM state of a snapshot is written and read in large aligned chunks,
+ * BDRV_VMSTATE_CHUNKS of them in flight at once.  Each request runs in its
+ * own coroutine, so that the image format can overlap the I/O instead of
+ * waiting for every 32 KB of the QEMUFile buffer in turn.
+ */
+#define BDRV_VMSTATE_CHUNK_SIZE (1024 * 1024)
+#define BDRV_VMSTATE_CHUNKS     8
+
+typedef struct QEMUFileBdrv QEMUFileBdrv;
+
+typedef struct QEMUFileBdrvChunk {
+    QEMUFileBdrv *s;
+    uint8_t *buf;
+    int64_t pos;
+    int size;       /* writes: bytes queued; reads: result of the read */
+    bool busy;
+} QEMUFileBdrvChunk;
+
+struct QEMUFileBdrv {
+    BlockDriverState *bs;
+    QEMUFileBdrvChunk chunks[BDRV_VMSTATE_CHUNKS];
+    int cur;        /* chunk being filled, or consumed for reads */
+    int in_flight;
+    bool reading;   /* read-ahead started */
+    int error;      /* first write error */
+};
+
+static void coroutine_fn bdrv_vmstate_write_entry(void *opaque)
+{
+    QEMUFileBdrvChunk *c = opaque;
+    QEMUFileBdrv *s = c->s;
+    int ret;
+
+    ret = bdrv_save_vmstate(s->bs, c->buf, c->pos, c->size);
+    if (ret < 0 && !s->error) {
+        s->error = ret;
+    }
+    c->size = 0;
+    c->busy = false;
+    s->in_flight--;
+}
+
+static void coroutine_fn bdrv_vmstate_read_entry(void *opaque)
+{
+    QEMUFileBdrvChunk *c = opaque;
+    QEMUFileBdrv *s = c->s;
+
+    c->size = bdrv_load_vmstate(s->bs, c->buf, c->pos,
+                                BDRV_VMSTATE_CHUNK_SIZE);
+    c->busy = false;
+    s->in_flight--;
+}
+
+static void bdrv_vmstate_submit(QEMUFileBdrvChunk *c, CoroutineEntry *entry)
+{
+    Coroutine *co;
+
+    c->busy = true;
+    c->s->in_flight++;
+    co = qemu_coroutine_create(entry);
+    qemu_coroutine_enter(co, c);
+}
+
+static void bdrv_vmstate_wait(QEMUFileBdrvChunk *c)
+{
+    while (c->busy) {
+        qemu_aio_wait();
+    }
+}
+
+static void bdrv_vmstate_drain(QEMUFileBdrv *s)
+{
+    while (s->in_flight) {
+        qemu_aio_wait();
+    }
+}
+
 static int block_put_buffer(void *opaque, const uint8_t *buf,
                            int64_t pos, int size)
 {
-    bdrv_save_vmstate(opaque, buf, pos, size);
-    return size;
+    QEMUFileBdrv *s = opaque;
+    QEMUFileBdrvChunk *c = &s->chunks[s->cur];
+    int done = 0, l;
+
+    while (done < size) {
+        if (c->size == 0) {
+            c->pos = pos + done;
+        }
+        assert(c->pos + c->size == pos + done);
+        l = MIN(size - done, BDRV_VMSTATE_CHUNK_SIZE - c->size);
+        memcpy(c->buf + c->size, buf + done, l);
+        c->size += l;
+        done += l;
+        if (c->size == BDRV_VMSTATE_CHUNK_SIZE) {
+            bdrv_vmstate_submit(c, bdrv_vmstate_write_entry);
+            s->cur = (s->cur + 1) % BDRV_VMSTATE_CHUNKS;
+            c = &s->chunks[s->cur];
+            bdrv_vmstate_wait(c);
+        }
+    }
+    return s->error ? s->error : size;
+}
+
+static int block_writev_buffer(void *opaque, struct iovec *iov, int iovcnt,
+                               int64_t pos)
+{
+    int i, ret = 0;
+
+    for (i = 0; i < iovcnt && ret >= 0; i++) {
+        ret = block_put_buffer(opaque, iov[i].iov_base, pos, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+    return ret;
+}
+
+/* Start reading ahead from the chunk that contains POS */
+static void bdrv_vmstate_read_ahead(QEMUFileBdrv *s, int64_t pos)
+{
+    int64_t start = pos - pos % BDRV_VMSTATE_CHUNK_SIZE;
+    int i;
+
+    bdrv_vmstate_drain(s);
+    for (i = 0; i < BDRV_VMSTATE_CHUNKS; i++) {
+        s->chunks[i].pos = start + (int64_t)i * BDRV_VMSTATE_CHUNK_SIZE;
+        bdrv_vmstate_submit(&s->chunks[i], bdrv_vmstate_read_entry);
+    }
+    s->cur = 0;
+    s->reading = true;
 }
 
 static int block_get_buffer(void *opaque, uint8_t *buf, int64_t pos, int size)
 {
-    return bdrv_load_vmstate(opaque, buf, pos, size);
+    QEMUFileBdrv *s = opaque;
+    QEMUFileBdrvChunk *c = &s->chunks[s->cur];
+    int offset, len;
+
+    if (!s->reading || pos < c->pos ||
+        pos >= c->pos + BDRV_VMSTATE_CHUNK_SIZE) {
+        bdrv_vmstate_read_ahead(s, pos);
+        c = &s->chunks[s->cur];
+    }
+    bdrv_vmstate_wait(c);
+    if (c->size < 0) {
+        return c->size;
+    }
+
+    offset = pos - c->pos;
+    len = MIN(size, c->size - offset);
+    if (len <= 0) {
+        return 0;
+    }
+    memcpy(buf, c->buf + offset, len);
+
+    if (offset + len == BDRV_VMSTATE_CHUNK_SIZE) {
+        /* Consumed, reuse it for the chunk after the last one queued */
+        c->pos += (int64_t)BDRV_VMSTATE_CHUNKS * BDRV_VMSTATE_CHUNK_SIZE;
+        bdrv_vmstate_submit(c, bdrv_vmstate_read_entry);
+        s->cur = (s->cur + 1) % BDRV_VMSTATE_CHUNKS;
+    }
+    return len;
 }
 
 static int bdrv_fclose(void *opaque)
 {
-    return bdrv_flush(opaque);
+    QEMUFileBdrv *s = opaque;
+    QEMUFileBdrvChunk *c = &s->chunks[s->cur];
+    int i, ret;
+
+    if (!s->reading && c->size) {
+        bdrv_vmstate_submit(c, bdrv_vmstate_write_entry);
+    }
+    bdrv_vmstate_drain(s);
+
+    ret = s->error;
+    if (ret == 0) {
+        ret = bdrv_flush(s->bs);
+    }
+    for (i = 0; i < BDRV_VMSTATE_CHUNKS; i++) {
+        qemu_vfree(s->chunks[i].buf);
+    }
+    g_free(s);
+    return ret;
 }
 
 static const QEMUFileOps bdrv_read_ops = {
@@ -414,15 +590,26 @@ static const QEMUFileOps bdrv_read_ops = {
 };
 
 static const QEMUFileOps bdrv_write_ops = {
-    .put_buffer = block_put_buffer,
-    .close =      bdrv_fclose
+    .put_buffer =    block_put_buffer,
+    .writev_buffer = block_writev_buffer,
+    .close =         bdrv_fclose
 };
 
 static QEMUFile *qemu_fopen_bdrv(BlockDriverState *bs, int is_writable)
 {
+    QEMUFileBdrv *s;
+    int i;
+
+    s = g_malloc0(sizeof(QEMUFileBdrv));
+    s->bs = bs;
+    for (i = 0; i < BDRV_VMSTATE_CHUNKS; i++) {
+        s->chunks[i].s = s;
+        s->chunks[i].buf = qemu_blockalign(bs, BDRV_VMSTATE_CHUNK_SIZE);
+    }
+
     if (is_writable)
-        return qemu_fopen_ops(bs, &bdrv_write_ops);
-    return qemu_fopen_ops(bs, &bdrv_read_ops);
+        return qemu_fopen_ops(s, &bdrv_write_ops);
+    return qemu_fopen_ops(s, &bdrv_read_ops);
 }
 
 QEMUFile *qemu_fopen_ops(void *opaque, const QEMUFileOps *ops)
@@ -452,24 +639,53 @@ static void qemu_file_set_error(QEMUFile *f, int ret)
 
 /** Flushes QEMUFile buffer
  *
+ * Errors are recorded in the file and returned.
  */
-static int qemu_fflush(QEMUFile *f)
+int qemu_fflush(QEMUFile *f)
 {
     int ret = 0;
 
-    if (!f->ops->put_buffer)
+    if (!f->is_write) {
         return 0;
+    }
 
-    if (f->is_write && f->buf_index > 0) {
+    if (f->ops->writev_buffer) {
+        if (f->iovcnt > 0) {
+            ret = f->ops->writev_buffer(f->opaque, f->iov, f->iovcnt,
+                                        f->buf_offset);
+            if (ret >= 0) {
+                f->buf_offset += f->buf_index + f->async_size;
+            }
+        }
+        f->iovcnt = 0;
+        f->async_size = 0;
+    } else if (f->ops->put_buffer && f->buf_index > 0) {
         ret = f->ops->put_buffer(f->opaque, f->buf, f->buf_offset, f->buf_index);
         if (ret >= 0) {
             f->buf_offset += f->buf_index;
         }
-        f->buf_index = 0;
+    }
+    f->buf_index = 0;
+    if (ret < 0) {
+        qemu_file_set_error(f, ret);
     }
     return ret;
 }
 
+static void add_to_iovec(QEMUFile *f, const uint8_t *buf, int size)
+{
+    struct iovec *last = f->iovcnt > 0 ? &f->iov[f->iovcnt - 1] : NULL;
+
+    /* coalesce with the previous piece if adjacent */
+    if (last && buf == (uint8_t *)last->iov_base + last->iov_len) {
+        last->iov_len += size;
+    } else {
+        f->iov[f->iovcnt].iov_base = (uint8_t *)buf;
+        f->iov[f->iovcnt].iov_len = size;
+        f->iovcnt++;
+    }
+}
+
 static void qemu_fill_buffer(QEMUFile *f)
 {
     int len;
@@ -556,19 +772,45 @@ void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, int size)
             l = size;
         memcpy(f->buf + f->buf_index, buf, l);
         f->is_write = 1;
+        if (f->ops->writev_buffer) {
+            add_to_iovec(f, f->buf + f->buf_index, l);
+        }
         f->buf_index += l;
         buf += l;
         size -= l;
-        if (f->buf_index >= IO_BUF_SIZE) {
-            int ret = qemu_fflush(f);
-            if (ret < 0) {
-                qemu_file_set_error(f, ret);
+        if (f->buf_index >= IO_BUF_SIZE || f->iovcnt >= MAX_IOV_SIZE) {
+            if (qemu_fflush(f) < 0) {
                 break;
             }
         }
     }
 }
 
+void qemu_put_buffer_async(QEMUFile *f, const uint8_t *buf, int size)
+{
+    if (f->last_error) {
+        return;
+    }
+
+    if (!f->ops->writev_buffer) {
+        qemu_put_buffer(f, buf, size);
+        return;
+    }
+
+    if (f->is_write == 0 && f->buf_index > 0) {
+        fprintf(stderr,
+                "Attempted to write to buffer while read buffer is not empty\n");
+        abort();
+    }
+
+    f->is_write = 1;
+    add_to_iovec(f, buf, size);
+    f->async_size += size;
+    if (f->iovcnt >= MAX_IOV_SIZE) {
+        qemu_fflush(f);
+    }
+}
+
 void qemu_put_byte(QEMUFile *f, int v)
 {
     if (f->last_error) {
@@ -581,13 +823,14 @@ void qemu_put_byte(QEMUFile *f, int v)
         abort();
     }
 
-    f->buf[f->buf_index++] = v;
+    f->buf[f->buf_index] = v;
     f->is_write = 1;
-    if (f->buf_index >= IO_BUF_SIZE) {
-        int ret = qemu_fflush(f);
-        if (ret < 0) {
-            qemu_file_set_error(f, ret);
-        }
+    if (f->ops->writev_buffer) {
+        add_to_iovec(f, f->buf + f->buf_index, 1);
+    }
+    f->buf_index++;
+    if (f->buf_index >= IO_BUF_SIZE || f->iovcnt >= MAX_IOV_SIZE) {
+        qemu_fflush(f);
     }
 }
 
@@ -677,7 +920,7 @@ int64_t qemu_ftell(QEMUFile *f)
 {
     /* buf_offset excludes buffer for writing but includes it for reading */
     if (f->is_write) {
-        return f->buf_offset + f->buf_index;
+        return f->buf_offset + f->buf_index + f->async_size;
     } else {
         return f->buf_offset - f->buf_size + f->buf_index;
     }
@@ -2109,17 +2352,187 @@ static int del_existing_snapshots(Monitor *mon, const char *name)
     return 0;
 }
 
+/*
+ * Creates the snapshots in all images that support them; only BS gets the
+ * VM state.
+ */
+static void savevm_create_snapshots(Monitor *mon, BlockDriverState *bs,
+                                    QEMUSnapshotInfo *sn,
+                                    uint64_t vm_state_size)
+{
+    BlockDriverState *bs1;
+    int ret;
+
+    bs1 = NULL;
+    while ((bs1 = bdrv_next(bs1))) {
+        if (bdrv_can_snapshot(bs1)) {
+            /* Write VM state size only to the image that contains the state */
+            sn->vm_state_size = (bs == bs1 ? vm_state_size : 0);
+            ret = bdrv_snapshot_create(bs1, sn);
+            if (ret < 0) {
+                monitor_printf(mon, "Error while creating snapshot on '%s'\n",
+                               bdrv_get_device_name(bs1));
+            }
+        }
+    }
+}
+
+/*
+ * A live snapshot saves RAM while the VM keeps running, like a migration
+ * does, and only stops the VM once the remaining dirty memory can be
+ * written within the maximum migration downtime.  The saving runs from a
+ * timer, so that the VM and the monitor's main loop get to run between
+ * two iterations.
+ */
+#define SAVEVM_LIVE_INTERVAL    10      /* ms between two iterations */
+#define SAVEVM_LIVE_MEASURE     100     /* ms between bandwidth estimates */
+#define SAVEVM_LIVE_MAX_PASSES  2       /* give up converging after writing
+                                           this many times the RAM size */
+
+typedef struct SaveVMLiveState {
+    Monitor *mon;
+    bool suspended;
+    BlockDriverState *bs;
+    QEMUSnapshotInfo sn;
+    QEMUFile *f;
+    QEMUTimer *timer;
+    Error *blocker;
+    int64_t measure_time;
+    int64_t measure_pos;
+    int64_t max_pos;
+    uint64_t max_size;
+} SaveVMLiveState;
+
+static SaveVMLiveState *savevm_live;
+
+static void savevm_live_finish(SaveVMLiveState *s, int ret)
+{
+    uint64_t vm_state_size;
+    int ret2;
+
+    vm_state_size = qemu_ftell(s->f);
+    ret2 = qemu_fclose(s->f);
+    if (ret == 0) {
+        ret = ret2;
+    }
+    if (ret < 0) {
+        qemu_savevm_state_cancel();
+        monitor_printf(s->mon, "Error %d while writing VM\n", ret);
+    } else {
+        savevm_create_snapshots(s->mon, s->bs, &s->sn, vm_state_size);
+    }
+
+    if (s->suspended) {
+        monitor_resume(s->mon);
+    }
+    migrate_del_blocker(s->blocker);
+    error_free(s->blocker);
+    qemu_free_timer(s->timer);
+    g_free(s);
+    savevm_live = NULL;
+}
+
+static void savevm_live_iterate(void *opaque)
+{
+    SaveVMLiveState *s = opaque;
+    int64_t now = qemu_get_clock_ms(rt_clock);
+    int64_t pos = qemu_ftell(s->f);
+    uint64_t pending;
+    int saved_vm_running;
+    int ret;
+
+    if (now >= s->measure_time + SAVEVM_LIVE_MEASURE) {
+        double bandwidth = (double)(pos - s->measure_pos) /
+                           (now - s->measure_time);
+
+        s->max_size = bandwidth * migrate_max_downtime() / 1000000;
+        s->measure_time = now;
+        s->measure_pos = pos;
+    }
+
+    pending = qemu_savevm_state_pending(s->f, s->max_size);
+    if (pending && pending >= s->max_size && pos < s->max_pos) {
+        ret = qemu_savevm_state_iterate(s->f);
+        if (ret >= 0) {
+            qemu_mod_timer(s->timer, qemu_get_clock_ms(rt_clock) +
+                           SAVEVM_LIVE_INTERVAL);
+            return;
+        }
+        savevm_live_finish(s, ret);
+        return;
+    }
+
+    saved_vm_running = runstate_is_running();
+    vm_stop(RUN_STATE_SAVE_VM);
+    s->sn.vm_clock_nsec = qemu_get_clock_ns(vm_clock);
+    ret = qemu_savevm_state_complete(s->f);
+    savevm_live_finish(s, ret);
+    if (saved_vm_running) {
+        vm_start();
+    }
+}
+
+static void savevm_live_start(Monitor *mon, BlockDriverState *bs,
+                              QEMUSnapshotInfo *sn)
+{
+    SaveVMLiveState *s;
+    MigrationParams params = {
+        .blk = 0,
+        .shared = 0
+    };
+    int ret;
+
+    s = g_malloc0(sizeof(*s));
+    s->mon = mon;
+    s->bs = bs;
+    s->sn = *sn;
+    s->f = qemu_fopen_bdrv(bs, 1);
+
+    ret = qemu_savevm_state_begin(s->f, &params);
+    if (ret < 0) {
+        qemu_savevm_state_cancel();
+        qemu_fclose(s->f);
+        g_free(s);
+        monitor_printf(mon, "Error %d while writing VM\n", ret);
+        return;
+    }
+
+    /* Migration and other snapshots would share the dirty log with us */
+    error_setg(&s->blocker, "A live snapshot is in progress");
+    migrate_add_blocker(s->blocker);
+
+    if (monitor_suspend(mon) < 0) {
+        monitor_printf(mon, "terminal does not allow synchronous "
+                       "savevm, continuing detached\n");
+    } else {
+        s->suspended = true;
+    }
+
+    s->measure_time = qemu_get_clock_ms(rt_clock);
+    s->measure_pos = qemu_ftell(s->f);
+    s->max_pos = s->measure_pos + SAVEVM_LIVE_MAX_PASSES * ram_bytes_total();
+    s->timer = qemu_new_timer_ms(rt_clock, savevm_live_iterate, s);
+    qemu_mod_timer(s->timer, s->measure_time);
+    savevm_live = s;
+}
+
 void do_savevm(Monitor *mon, const QDict *qdict)
 {
-    BlockDriverState *bs, *bs1;
+    BlockDriverState *bs;
     QEMUSnapshotInfo sn1, *sn = &sn1, old_sn1, *old_sn = &old_sn1;
-    int ret;
+    int ret, ret2;
     QEMUFile *f;
     int saved_vm_running;
     uint64_t vm_state_size;
     qemu_timeval tv;
     struct tm tm;
     const char *name = qdict_get_try_str(qdict, "name");
+    int live = qdict_get_try_bool(qdict, "live", 0);
+
+    if (savevm_live) {
+        monitor_printf(mon, "A live snapshot is already in progress\n");
+        return;
+    }
 
     /* Verify if there is a device that doesn't support snapshots and is writable */
     bs = NULL;
@@ -2143,7 +2556,20 @@ void do_savevm(Monitor *mon, const QDict *qdict)
     }
 
     saved_vm_running = runstate_is_running();
-    vm_stop(RUN_STATE_SAVE_VM);
+    if (live && saved_vm_running) {
+        if (migration_is_active(migrate_get_current())) {
+            monitor_printf(mon, "Cannot take a live snapshot during "
+                           "migration\n");
+            return;
+        }
+        if (qemu_savevm_state_blocked(NULL)) {
+            monitor_printf(mon, "Error %d while writing VM\n", -EINVAL);
+            return;
+        }
+    } else {
+        live = 0;
+        vm_stop(RUN_STATE_SAVE_VM);
+    }
 
     memset(sn, 0, sizeof(*sn));
 
@@ -2172,6 +2598,11 @@ void do_savevm(Monitor *mon, const QDict *qdict)
         goto the_end;
     }
 
+    if (live) {
+        savevm_live_start(mon, bs, sn);
+        return;
+    }
+
     /* save the VM state */
     f = qemu_fopen_bdrv(bs, 1);
     if (!f) {
@@ -2180,29 +2611,20 @@ void do_savevm(Monitor *mon, const QDict *qdict)
     }
     ret = qemu_savevm_state(f);
     vm_state_size = qemu_ftell(f);
-    qemu_fclose(f);
+    ret2 = qemu_fclose(f);
+    if (ret == 0) {
+        ret = ret2;
+    }
     if (ret < 0) {
         monitor_printf(mon, "Error %d while writing VM\n", ret);
         goto the_end;
     }
 
     /* create the snapshots */
-
-    bs1 = NULL;
-    while ((bs1 = bdrv_next(bs1))) {
-        if (bdrv_can_snapshot(bs1)) {
-            /* Write VM state size only to the image that contains the state */
-            sn->vm_state_size = (bs == bs1 ? vm_state_size : 0);
-            ret = bdrv_snapshot_create(bs1, sn);
-            if (ret < 0) {
-                monitor_printf(mon, "Error while creating snapshot on '%s'\n",
-                               bdrv_get_device_name(bs1));
-            }
-        }
-    }
+    savevm_create_snapshots(mon, bs, sn, vm_state_size);
 
  the_end:
-    if (saved_vm_running)
+    if (saved_vm_running && !live)
         vm_start();
 }
 
@@ -2238,6 +2660,11 @@ int load_vmstate(const char *name)
     QEMUFile *f;
     int ret;
 
+    if (savevm_live) {
+        error_report("A live snapshot is in progress");
+        return -EBUSY;
+    }
+
     bs_vm_state = bdrv_snapshots();
     if (!bs_vm_state) {
         error_report("No block device supports snapshots");
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Time a build with a cross-compiled make under qemu-arm: without the
+# translation cache, with an empty cache and with the cache that the
+# previous run filled.
+#
+# usage: tb-cache-bench.sh QEMU SYSROOT DIR [MAKE-ARGS...]
+#
+# SYSROOT is an ARM root file system with make and a toolchain, and DIR
+# the directory to build, relative to SYSROOT.  The programs that make
+# starts are run through binfmt_misc, which must be set up to run the
+# same QEMU binary for ARM executables (see qemu-binfmt-conf.sh).  They
+# find the cache and the root file system in QEMU_TB_CACHE and
+# QEMU_LD_PREFIX.
+
+if [ $# -lt 3 ]; then
+    echo "usage: $0 QEMU SYSROOT DIR [MAKE-ARGS...]" >&2
+    exit 1
+fi
+qemu=$1
+sysroot=$2
+dir=$3
+shift 3
+
+cache=`mktemp -d ${TMPDIR:-/tmp}/tb-cache.XXXXXX` || exit 1
+trap 'rm -rf "$cache"' EXIT
+
+now() {
+    date +%s.%N
+}
+
+# run_make LABEL [MAKE-ARGS...]: clean without the cache, so that the
+# cold run starts with an empty one, then time the build
+run_make() {
+    label=$1
+    shift
+    env -u QEMU_TB_CACHE "$qemu" -L "$sysroot" "$sysroot/usr/bin/make" -s -C "$sysroot/$dir" \
+        "$@" clean > /dev/null 2>&1
+    start=`now`
+    if ! "$qemu" -L "$sysroot" "$sysroot/usr/bin/make" -s -C "$sysroot/$dir" \
+            "$@" > /dev/null; then
+        echo "$label: make failed" >&2
+        exit 1
+    fi
+    end=`now`
+    awk "BEGIN { printf \"%-10s %8.2f s\\n\", \"$label\", $end - $start }"
+}
+
+export QEMU_LD_PREFIX="$sysroot"
+unset QEMU_TB_CACHE
+run_make uncached "$@"
+
+export QEMU_TB_CACHE="$cache"
+run_make cold "$@"
+run_make warm "$@"
+du -sh "$cache" | awk '{ print "cache size", $1 }'
@@ -0,0 +1,170 @@
+#!/usr/bin/env python
+#
+# Benchmark the VNC websocket transport like a noVNC client uses it:
+# RFB over binary websocket frames, masked on the client side.  Request
+# full raw framebuffer updates and report the throughput, the number of
+# websocket frames QEMU sent, and optionally the CPU time QEMU spent and
+# an MD5 of the pixels, to compare two QEMU binaries.  With a guest whose
+# screen does not change, the MD5 must be the same for both.
+#
+# usage: vnc-ws-bench.py [-r ROUNDS] [-p QEMU-PID] [-m] [HOST:]PORT
+#
+# PORT is the websocket port given to -vnc ...,websocket=PORT.  Any guest
+# will do, since the updates are full screen; a large VBE mode makes the
+# updates bigger.
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+
+import base64
+import getopt
+import hashlib
+import os
+import socket
+import struct
+import sys
+import time
+
+class WebSocket(object):
+    def __init__(self, host, port):
+        self.sock = socket.create_connection((host, port))
+        key = base64.b64encode(os.urandom(16)).decode()
+        self.sock.sendall(('GET / HTTP/1.1\r\n'
+                           'Host: %s\r\n'
+                           'Upgrade: websocket\r\n'
+                           'Connection: Upgrade\r\n'
+                           'Sec-WebSocket-Key: %s\r\n'
+                           'Sec-WebSocket-Version: 13\r\n'
+                           'Sec-WebSocket-Protocol: binary\r\n'
+                           '\r\n' % (host, key)).encode())
+        reply = b''
+        while b'\r\n\r\n' not in reply:
+            c = self.sock.recv(1)
+            if not c:
+                raise EOFError
+            reply += c
+        if not reply.startswith(b'HTTP/1.1 101'):
+            raise Exception('websocket handshake failed')
+        self.left = 0           # payload bytes left in the current frame
+        self.frames = 0
+
+    def _recv_exact(self, n):
+        buf = bytearray()
+        while len(buf) < n:
+            c = self.sock.recv(n - len(buf))
+            if not c:
+                raise EOFError
+            buf += c
+        return buf
+
+    def _next_frame(self):
+        b0, b1 = self._recv_exact(2)
+        if b0 != 0x82 or b1 & 0x80:
+            raise Exception('unexpected frame header %02x %02x' % (b0, b1))
+        n = b1 & 0x7f
+        if n == 126:
+            n = struct.unpack('>H', bytes(self._recv_exact(2)))[0]
+        elif n == 127:
+            n = struct.unpack('>Q', bytes(self._recv_exact(8)))[0]
+        self.frames += 1
+        self.left = n
+
+    def read(self, n, keep=True, digest=None):
+        """Read n bytes of RFB data, optionally only feeding a digest."""
+        buf = bytearray()
+        while n:
+            if not self.left:
+                self._next_frame()
+                continue
+            c = self.sock.recv(min(n, self.left, 1 << 20))
+            if not c:
+                raise EOFError
+            if digest:
+                digest.update(c)
+            if keep:
+                buf += c
+            n -= len(c)
+            self.left -= len(c)
+        return bytes(buf)
+
+    def send(self, data):
+        mask = bytearray(os.urandom(4))
+        payload = bytearray(data)
+        for i in range(len(payload)):
+            payload[i] ^= mask[i % 4]
+        if len(payload) < 126:
+            header = struct.pack('>BB', 0x82, 0x80 | len(payload))
+        else:
+            header = struct.pack('>BBH', 0x82, 0x80 | 126, len(payload))
+        self.sock.sendall(header + bytes(mask) + bytes(payload))
+
+def cpu_ticks(pid):
+    f = open('/proc/%d/stat' % pid)
+    fields = f.read().rsplit(')', 1)[1].split()
+    f.close()
+    return int(fields[11]) + int(fields[12])   # utime + stime
+
+def bench(ws, rounds, md5):
+    ws.read(12)
+    ws.send(b'RFB 003.008\n')
+    n = bytearray(ws.read(1))[0]
+    ws.read(n)                                  # security types
+    ws.send(b'\x01')                            # none
+    ws.read(4)                                  # security result
+    ws.send(b'\x01')                            # shared
+    width, height = struct.unpack('>HH', ws.read(4))
+    ws.read(16)                                 # pixel format
+    n = struct.unpack('>I', ws.read(4))[0]
+    ws.read(n)                                  # name
+    # 32 bpp true colour, raw encoding only
+    ws.send(struct.pack('>BxxxBBBBHHHBBBxxx',
+                        0, 32, 24, 0, 1, 255, 255, 255, 16, 8, 0))
+    ws.send(struct.pack('>BxHi', 2, 1, 0))
+
+    digest = hashlib.md5() if md5 else None
+    total = 0
+    start = time.time()
+    for r in range(rounds):
+        ws.send(struct.pack('>BBHHHH', 3, 0, 0, 0, width, height))
+        msg, nrects = struct.unpack('>BxH', ws.read(4))
+        if msg != 0:
+            raise Exception('unexpected message type %d' % msg)
+        for i in range(nrects):
+            x, y, w, h, enc = struct.unpack('>HHHHi', ws.read(12))
+            if enc != 0:
+                raise Exception('unexpected encoding %d' % enc)
+            ws.read(w * h * 4, False, digest)
+            total += w * h * 4
+    elapsed = time.time() - start
+    print('%dx%d, %d rounds: %.1f MB in %.2f s, %.0f MB/s, %d websocket frames'
+          % (width, height, rounds, total / 1e6, elapsed,
+             total / 1e6 / elapsed, ws.frames))
+    if md5:
+        print('pixels md5 %s' % digest.hexdigest())
+
+def main():
+    rounds = 40
+    pid = None
+    md5 = False
+    opts, args = getopt.getopt(sys.argv[1:], 'r:p:m')
+    for o, a in opts:
+        if o == '-r':
+            rounds = int(a)
+        elif o == '-p':
+            pid = int(a)
+        elif o == '-m':
+            md5 = True
+    if len(args) != 1:
+        sys.stderr.write('usage: %s [-r ROUNDS] [-p QEMU-PID] [-m] '
+                         '[HOST:]PORT\n' % sys.argv[0])
+        sys.exit(1)
+    host, _, port = args[0].rpartition(':')
+    ws = WebSocket(host or '127.0.0.1', int(port))
+    if pid:
+        ticks = cpu_ticks(pid)
+    bench(ws, rounds, md5)
+    if pid:
+        print('qemu cpu time %d ticks' % (cpu_ticks(pid) - ticks))
+
+if __name__ == '__main__':
+    main()
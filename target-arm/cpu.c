@@ -120,11 +120,16 @@ static void arm_cpu_reset(CPUState *s)
     set_float_detect_tininess(float_tininess_before_rounding,
                               &env->vfp.standard_fp_status);
     tlb_flush(env, 1);
+#ifndef CONFIG_USER_ONLY
     /* Reset is a state change for some CPUARMState fields which we
      * bake assumptions about into translated code, so we need to
-     * tb_flush().
+     * tb_flush().  In user mode emulation a CPU is only reset when it
+     * is created for a new guest thread, before the parent's state is
+     * copied into it; flushing there would pull the translated code
+     * from under the threads that are still running.
      */
     tb_flush(env);
+#endif
 }
 
 static inline void set_feature(CPUARMState *env, int feature)
@@ -51,6 +51,9 @@ DEF_HELPER_1(logicq_cc, i32, i64)
 DEF_HELPER_FLAGS_3(sel_flags, TCG_CALL_NO_RWG_SE,
                    i32, i32, i32, i32)
 DEF_HELPER_2(exception, void, env, i32)
+#ifdef CONFIG_USER_ONLY
+DEF_HELPER_5(strex, i32, env, i32, i32, i32, i32)
+#endif
 DEF_HELPER_1(wfi, void, env)
 
 DEF_HELPER_3(cpsr_write, void, env, i32, i32)
@@ -50,6 +50,96 @@ uint32_t HELPER(neon_tbl)(CPUARMState *env, uint32_t ireg, uint32_t def,
     return val;
 }
 
+#if defined(CONFIG_USER_ONLY)
+
+/* Store exclusive for user mode emulation.  The store succeeds if the
+   memory still holds the value seen by the load exclusive, which is
+   checked and updated with a single host compare-and-swap so that
+   threads running concurrently on other host CPUs cannot interleave.
+   Returns the status written to Rd: 0 on success, 1 on failure.  */
+uint32_t HELPER(strex)(CPUARMState *env, uint32_t addr, uint32_t lo,
+                       uint32_t hi, uint32_t size)
+{
+    uint32_t len = 1 << size;
+    void *p = g2h(addr);
+    uint32_t oldw[2], neww[2];
+    uint64_t old64, new64;
+    bool ok;
+
+    ok = addr == env->exclusive_addr;
+    env->exclusive_addr = -1;
+    if (!ok) {
+        return 1;
+    }
+    if (page_check_range(addr, len, PAGE_READ | PAGE_WRITE) < 0) {
+        env->cp15.c6_data = addr;
+        raise_exception(env, EXCP_DATA_ABORT);
+    }
+
+    if (addr & (len - 1)) {
+        /* Unaligned exclusive accesses fault on real hardware; keep
+           accepting them, but without any atomicity guarantee.  */
+        switch (size) {
+        case 0:
+        case 1:
+            ok = (size ? lduw_p(p) : ldub_p(p)) == env->exclusive_val;
+            break;
+        default:
+            ok = ldl_p(p) == env->exclusive_val &&
+                 (size == 2 || ldl_p(p + 4) == env->exclusive_high);
+            break;
+        }
+        if (ok) {
+            switch (size) {
+            case 0:
+                stb_p(p, lo);
+                break;
+            case 1:
+                stw_p(p, lo);
+                break;
+            case 3:
+                stl_p(p + 4, hi);
+                /* fall through */
+            case 2:
+                stl_p(p, lo);
+                break;
+            }
+        }
+        return !ok;
+    }
+
+    switch (size) {
+    case 0:
+        ok = __sync_bool_compare_and_swap((uint8_t *)p,
+                                          (uint8_t)env->exclusive_val,
+                                          (uint8_t)lo);
+        break;
+    case 1:
+        ok = __sync_bool_compare_and_swap((uint16_t *)p,
+                                          tswap16(env->exclusive_val),
+                                          tswap16(lo));
+        break;
+    case 2:
+        ok = __sync_bool_compare_and_swap((uint32_t *)p,
+                                          tswap32(env->exclusive_val),
+                                          tswap32(lo));
+        break;
+    default:
+        /* Rt goes to the lower address whatever the endianness.  */
+        oldw[0] = tswap32(env->exclusive_val);
+        oldw[1] = tswap32(env->exclusive_high);
+        neww[0] = tswap32(lo);
+        neww[1] = tswap32(hi);
+        memcpy(&old64, oldw, 8);
+        memcpy(&new64, neww, 8);
+        ok = __sync_bool_compare_and_swap((uint64_t *)p, old64, new64);
+        break;
+    }
+    return !ok;
+}
+
+#endif
+
 #if !defined(CONFIG_USER_ONLY)
 
 #include "exec/softmmu_exec.h"
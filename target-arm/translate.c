@@ -68,7 +68,8 @@ typedef struct DisasContext {
     int vec_stride;
 } DisasContext;
 
-static uint32_t gen_opc_condexec_bits[OPC_BUF_SIZE];
+static DEFINE_TLS(uint32_t[OPC_BUF_SIZE], gen_opc_condexec_bits);
+#define gen_opc_condexec_bits tls_var(gen_opc_condexec_bits)
 
 #if defined(CONFIG_USER_ONLY)
 #define IS_USER(s) 1
@@ -82,21 +83,29 @@ static uint32_t gen_opc_condexec_bits[OPC_BUF_SIZE];
 #define DISAS_SWI 5
 
 static TCGv_ptr cpu_env;
-/* We reuse the same 64-bit temporaries for efficiency.  */
-static TCGv_i64 cpu_V0, cpu_V1, cpu_M0;
+/* We reuse the same 64-bit temporaries for efficiency.  They are
+   allocated anew for each block, by each thread that translates.  */
+static DEFINE_TLS(TCGv_i64, cpu_V0);
+#define cpu_V0 tls_var(cpu_V0)
+static DEFINE_TLS(TCGv_i64, cpu_V1);
+#define cpu_V1 tls_var(cpu_V1)
+static DEFINE_TLS(TCGv_i64, cpu_M0);
+#define cpu_M0 tls_var(cpu_M0)
 static TCGv_i32 cpu_R[16];
 static TCGv_i32 cpu_CF, cpu_NF, cpu_VF, cpu_ZF;
 static TCGv_i32 cpu_exclusive_addr;
 static TCGv_i32 cpu_exclusive_val;
 static TCGv_i32 cpu_exclusive_high;
-#ifdef CONFIG_USER_ONLY
-static TCGv_i32 cpu_exclusive_test;
-static TCGv_i32 cpu_exclusive_info;
-#endif
 
 /* FIXME:  These should be removed.  */
-static TCGv cpu_F0s, cpu_F1s;
-static TCGv_i64 cpu_F0d, cpu_F1d;
+static DEFINE_TLS(TCGv, cpu_F0s);
+#define cpu_F0s tls_var(cpu_F0s)
+static DEFINE_TLS(TCGv, cpu_F1s);
+#define cpu_F1s tls_var(cpu_F1s)
+static DEFINE_TLS(TCGv_i64, cpu_F0d);
+#define cpu_F0d tls_var(cpu_F0d)
+static DEFINE_TLS(TCGv_i64, cpu_F1d);
+#define cpu_F1d tls_var(cpu_F1d)
 
 #include "exec/gen-icount.h"
 
@@ -127,12 +136,6 @@ void arm_translate_init(void)
         offsetof(CPUARMState, exclusive_val), "exclusive_val");
     cpu_exclusive_high = tcg_global_mem_new_i32(TCG_AREG0,
         offsetof(CPUARMState, exclusive_high), "exclusive_high");
-#ifdef CONFIG_USER_ONLY
-    cpu_exclusive_test = tcg_global_mem_new_i32(TCG_AREG0,
-        offsetof(CPUARMState, exclusive_test), "exclusive_test");
-    cpu_exclusive_info = tcg_global_mem_new_i32(TCG_AREG0,
-        offsetof(CPUARMState, exclusive_info), "exclusive_info");
-#endif
 
 #define GEN_HELPER 2
 #include "helper.h"
@@ -2642,17 +2645,10 @@ static int disas_vfp_insn(CPUARMState * env, DisasContext *s, uint32_t insn)
                     tmp = load_reg(s, rd);
                     if (insn & (1 << 23)) {
                         /* VDUP */
-                        if (size == 0) {
-                            gen_neon_dup_u8(tmp, 0);
-                        } else if (size == 1) {
-                            gen_neon_dup_low16(tmp);
-                        }
-                        for (n = 0; n <= pass * 2; n++) {
-                            tmp2 = tcg_temp_new_i32();
-                            tcg_gen_mov_i32(tmp2, tmp);
-                            neon_store_reg(rn, n, tmp2);
-                        }
-                        neon_store_reg(rn, n, tmp);
+                        tcg_gen_vec_dup_i32(size, cpu_env,
+                                            vfp_reg_offset(1, rn),
+                                            pass ? 16 : 8, tmp);
+                        tcg_temp_free_i32(tmp);
                     } else {
                         /* VMOV */
                         switch (size) {
@@ -4434,6 +4430,96 @@ static const uint8_t neon_2rm_sizes[] = {
     [NEON_2RM_VCVT_UF] = 0x4,
 };
 
+/* Expand a three registers of the same length op that has a generic
+   vector equivalent.  Return false to use the 32-bit chunk code.  */
+static bool gen_neon_3r_vec(int op, int u, int size, int q,
+                            int rd, int rn, int rm)
+{
+    int oprsz = q ? 16 : 8;
+    long dofs = vfp_reg_offset(1, rd);
+    long aofs = vfp_reg_offset(1, rn);
+    long bofs = vfp_reg_offset(1, rm);
+
+    /* On a D register these are one or two scalar ops, which the
+       optimizer can keep in host registers across instructions.  */
+    if (!q && (op == NEON_3R_LOGIC
+               || (op == NEON_3R_VADD_VSUB && size >= 2))) {
+        return false;
+    }
+
+    switch (op) {
+    case NEON_3R_VADD_VSUB:
+        if (u) {
+            tcg_gen_vec_sub(size, cpu_env, dofs, aofs, bofs, oprsz);
+        } else {
+            tcg_gen_vec_add(size, cpu_env, dofs, aofs, bofs, oprsz);
+        }
+        return true;
+    case NEON_3R_LOGIC:
+        switch ((u << 2) | size) {
+        case 0: /* VAND */
+            tcg_gen_vec_and(cpu_env, dofs, aofs, bofs, oprsz);
+            return true;
+        case 1: /* VBIC */
+            tcg_gen_vec_andc(cpu_env, dofs, aofs, bofs, oprsz);
+            return true;
+        case 2: /* VORR */
+            tcg_gen_vec_or(cpu_env, dofs, aofs, bofs, oprsz);
+            return true;
+        case 4: /* VEOR */
+            tcg_gen_vec_xor(cpu_env, dofs, aofs, bofs, oprsz);
+            return true;
+        }
+        return false;
+    case NEON_3R_VTST_VCEQ:
+        if (u) { /* VCEQ */
+            tcg_gen_vec_cmpeq(size, cpu_env, dofs, aofs, bofs, oprsz);
+            return true;
+        }
+        return false;
+    case NEON_3R_VCGT:
+        if (!u) { /* signed VCGT */
+            tcg_gen_vec_cmpgt(size, cpu_env, dofs, aofs, bofs, oprsz);
+            return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+/* Likewise for VSHR and VSHL by immediate; SHIFT is negative for right
+   shifts, as in the caller.  */
+static bool gen_neon_shifti_vec(int op, int u, int size, int q,
+                                int rd, int rm, int shift)
+{
+    int oprsz = q ? 16 : 8;
+    int bits = 8 << size;
+    long dofs = vfp_reg_offset(1, rd);
+    long aofs = vfp_reg_offset(1, rm);
+
+    switch (op) {
+    case 0: /* VSHR */
+        if (!u) {
+            tcg_gen_vec_sari(size, cpu_env, dofs, aofs,
+                             MIN(-shift, bits - 1), oprsz);
+        } else if (-shift == bits) {
+            tcg_gen_vec_dupi(3, cpu_env, dofs, oprsz, 0);
+        } else {
+            tcg_gen_vec_shri(size, cpu_env, dofs, aofs, -shift, oprsz);
+        }
+        return true;
+    case 5: /* VSHL; VSLI inserts */
+        if (!u) {
+            tcg_gen_vec_shli(size, cpu_env, dofs, aofs, shift, oprsz);
+            return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
 /* Translate a NEON data processing instruction.  Return nonzero if the
    instruction is invalid.
    We process data in a mixture of 32-bit and 64-bit chunks.
@@ -4475,6 +4561,9 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
         if (q && ((rd | rn | rm) & 1)) {
             return 1;
         }
+        if (gen_neon_3r_vec(op, u, size, q, rd, rn, rm)) {
+            return 0;
+        }
         if (size == 3 && op != NEON_3R_LOGIC) {
             /* 64-bit element instructions. */
             for (pass = 0; pass < (q ? 2 : 1); pass++) {
@@ -4948,6 +5037,9 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
                    element size in bits.  */
                 if (op <= 4)
                     shift = shift - (1 << (size + 3));
+                if (gen_neon_shifti_vec(op, u, size, q, rd, rm, shift)) {
+                    return 0;
+                }
                 if (size == 3) {
                     count = q + 1;
                 } else {
@@ -6190,11 +6282,8 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
                     else
                         gen_neon_dup_low16(tmp);
                 }
-                for (pass = 0; pass < (q ? 4 : 2); pass++) {
-                    tmp2 = tcg_temp_new_i32();
-                    tcg_gen_mov_i32(tmp2, tmp);
-                    neon_store_reg(rd, pass, tmp2);
-                }
+                tcg_gen_vec_dup_i32(2, cpu_env, vfp_reg_offset(1, rd),
+                                    q ? 16 : 8, tmp);
                 tcg_temp_free_i32(tmp);
             } else {
                 return 1;
@@ -6443,8 +6532,9 @@ static void gen_logicq_cc(TCGv_i64 val)
    regular stores.
 
    In system emulation mode only one CPU will be running at once, so
-   this sequence is effectively atomic.  In user emulation mode we
-   throw an exception and handle the atomic operation elsewhere.  */
+   this sequence is effectively atomic.  In user emulation mode the
+   other threads keep running, so the store is a host compare-and-swap
+   done by a helper.  */
 static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
                                TCGv addr, int size)
 {
@@ -6486,10 +6576,22 @@ static void gen_clrex(DisasContext *s)
 static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
                                 TCGv addr, int size)
 {
-    tcg_gen_mov_i32(cpu_exclusive_test, addr);
-    tcg_gen_movi_i32(cpu_exclusive_info,
-                     size | (rd << 4) | (rt << 8) | (rt2 << 12));
-    gen_exception_insn(s, 4, EXCP_STREX);
+    TCGv tmp, tmp2, tmp3;
+
+    /* The helper raises a data abort if the page is not writable.  */
+    gen_set_condexec(s);
+    gen_set_pc_im(s->pc - 4);
+    tmp = load_reg(s, rt);
+    if (size == 3) {
+        tmp2 = load_reg(s, rt2);
+    } else {
+        tmp2 = tcg_const_i32(0);
+    }
+    tmp3 = tcg_const_i32(size);
+    gen_helper_strex(tmp, cpu_env, addr, tmp, tmp2, tmp3);
+    tcg_temp_free_i32(tmp3);
+    tcg_temp_free_i32(tmp2);
+    store_reg(s, rd, tmp);
 }
 #else
 static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
@@ -51,24 +51,43 @@
 
 /* global register indexes */
 static TCGv_ptr cpu_env;
-static TCGv cpu_A0, cpu_cc_src, cpu_cc_dst, cpu_cc_tmp;
+static TCGv cpu_cc_src, cpu_cc_dst, cpu_cc_tmp;
 static TCGv_i32 cpu_cc_op;
 static TCGv cpu_regs[CPU_NB_REGS];
-/* local temps */
-static TCGv cpu_T[2], cpu_T3;
+/* local temps, allocated anew for each block by each thread that
+   translates */
+static DEFINE_TLS(TCGv, cpu_A0);
+#define cpu_A0 tls_var(cpu_A0)
+static DEFINE_TLS(TCGv[2], cpu_T);
+#define cpu_T tls_var(cpu_T)
+static DEFINE_TLS(TCGv, cpu_T3);
+#define cpu_T3 tls_var(cpu_T3)
 /* local register indexes (only used inside old micro ops) */
-static TCGv cpu_tmp0, cpu_tmp4;
-static TCGv_ptr cpu_ptr0, cpu_ptr1;
-static TCGv_i32 cpu_tmp2_i32, cpu_tmp3_i32;
-static TCGv_i64 cpu_tmp1_i64;
-static TCGv cpu_tmp5;
-
-static uint8_t gen_opc_cc_op[OPC_BUF_SIZE];
+static DEFINE_TLS(TCGv, cpu_tmp0);
+#define cpu_tmp0 tls_var(cpu_tmp0)
+static DEFINE_TLS(TCGv, cpu_tmp4);
+#define cpu_tmp4 tls_var(cpu_tmp4)
+static DEFINE_TLS(TCGv_ptr, cpu_ptr0);
+#define cpu_ptr0 tls_var(cpu_ptr0)
+static DEFINE_TLS(TCGv_ptr, cpu_ptr1);
+#define cpu_ptr1 tls_var(cpu_ptr1)
+static DEFINE_TLS(TCGv_i32, cpu_tmp2_i32);
+#define cpu_tmp2_i32 tls_var(cpu_tmp2_i32)
+static DEFINE_TLS(TCGv_i32, cpu_tmp3_i32);
+#define cpu_tmp3_i32 tls_var(cpu_tmp3_i32)
+static DEFINE_TLS(TCGv_i64, cpu_tmp1_i64);
+#define cpu_tmp1_i64 tls_var(cpu_tmp1_i64)
+static DEFINE_TLS(TCGv, cpu_tmp5);
+#define cpu_tmp5 tls_var(cpu_tmp5)
+
+static DEFINE_TLS(uint8_t[OPC_BUF_SIZE], gen_opc_cc_op);
+#define gen_opc_cc_op tls_var(gen_opc_cc_op)
 
 #include "exec/gen-icount.h"
 
 #ifdef TARGET_X86_64
-static int x86_64_hregs;
+static DEFINE_TLS(int, x86_64_hregs);
+#define x86_64_hregs tls_var(x86_64_hregs)
 #endif
 
 typedef struct DisasContext {
@@ -3169,6 +3188,77 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0x63] = SSE42_OP(pcmpistri),
 };
 
+/* Expand the common integer MMX/SSE ops inline, on OPRSZ bytes.
+   Return false if B needs its helper.  */
+static bool gen_sse_vec(int b, int oprsz, int op1_offset, int op2_offset)
+{
+    switch (b) {
+    case 0xfc ... 0xfe: /* paddb, paddw, paddl */
+        tcg_gen_vec_add(b - 0xfc, cpu_env, op1_offset, op1_offset,
+                        op2_offset, oprsz);
+        break;
+    case 0xd4: /* paddq */
+        tcg_gen_vec_add(3, cpu_env, op1_offset, op1_offset, op2_offset,
+                        oprsz);
+        break;
+    case 0xf8 ... 0xfb: /* psubb, psubw, psubl, psubq */
+        tcg_gen_vec_sub(b - 0xf8, cpu_env, op1_offset, op1_offset,
+                        op2_offset, oprsz);
+        break;
+    case 0x74 ... 0x76: /* pcmpeqb, pcmpeqw, pcmpeql */
+        tcg_gen_vec_cmpeq(b - 0x74, cpu_env, op1_offset, op1_offset,
+                          op2_offset, oprsz);
+        break;
+    case 0x64 ... 0x66: /* pcmpgtb, pcmpgtw, pcmpgtl */
+        tcg_gen_vec_cmpgt(b - 0x64, cpu_env, op1_offset, op1_offset,
+                          op2_offset, oprsz);
+        break;
+    case 0xdb: /* pand */
+        tcg_gen_vec_and(cpu_env, op1_offset, op1_offset, op2_offset, oprsz);
+        break;
+    case 0xdf: /* pandn */
+        tcg_gen_vec_andc(cpu_env, op1_offset, op2_offset, op1_offset, oprsz);
+        break;
+    case 0xeb: /* por */
+        tcg_gen_vec_or(cpu_env, op1_offset, op1_offset, op2_offset, oprsz);
+        break;
+    case 0xef: /* pxor */
+        tcg_gen_vec_xor(cpu_env, op1_offset, op1_offset, op2_offset, oprsz);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/* Likewise for the shifts by immediate of group 12-14, where VECE is 1
+   to 3 and OP the modrm reg field.  Larger counts than the element
+   width clear the element, or fill it with its sign.  */
+static bool gen_sse_shifti_vec(int vece, int op, int val, int oprsz,
+                               int offset)
+{
+    int bits = 8 << vece;
+
+    switch (op) {
+    case 2: /* psrl */
+    case 6: /* psll */
+        if (val >= bits) {
+            tcg_gen_vec_dupi(3, cpu_env, offset, oprsz, 0);
+        } else if (op == 2) {
+            tcg_gen_vec_shri(vece, cpu_env, offset, offset, val, oprsz);
+        } else {
+            tcg_gen_vec_shli(vece, cpu_env, offset, offset, val, oprsz);
+        }
+        return true;
+    case 4: /* psra */
+        tcg_gen_vec_sari(vece, cpu_env, offset, offset, MIN(val, bits - 1),
+                         oprsz);
+        return true;
+    default:
+        return false;
+    }
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -3564,6 +3654,22 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
 	        goto illegal_op;
             }
             val = cpu_ldub_code(env, s->pc++);
+            sse_fn_epp = sse_op_table2[((b - 1) & 3) * 8 +
+                                       (((modrm >> 3)) & 7)][b1];
+            if (!sse_fn_epp) {
+                goto illegal_op;
+            }
+            if (is_xmm) {
+                rm = (modrm & 7) | REX_B(s);
+                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
+            } else {
+                rm = (modrm & 7);
+                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
+            }
+            if (gen_sse_shifti_vec((b & 0xff) - 0x70, (modrm >> 3) & 7, val,
+                                   is_xmm ? 16 : 8, op2_offset)) {
+                break;
+            }
             if (is_xmm) {
                 gen_op_movl_T0_im(val);
                 tcg_gen_st32_tl(cpu_T[0], cpu_env, offsetof(CPUX86State,xmm_t0.XMM_L(0)));
@@ -3577,18 +3683,6 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                 tcg_gen_st32_tl(cpu_T[0], cpu_env, offsetof(CPUX86State,mmx_t0.MMX_L(1)));
                 op1_offset = offsetof(CPUX86State,mmx_t0);
             }
-            sse_fn_epp = sse_op_table2[((b - 1) & 3) * 8 +
-                                       (((modrm >> 3)) & 7)][b1];
-            if (!sse_fn_epp) {
-                goto illegal_op;
-            }
-            if (is_xmm) {
-                rm = (modrm & 7) | REX_B(s);
-                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
-            } else {
-                rm = (modrm & 7);
-                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
-            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op2_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op1_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4185,6 +4279,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (gen_sse_vec(b, is_xmm ? 16 : 8, op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
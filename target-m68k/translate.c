@@ -141,7 +141,8 @@ typedef struct DisasContext {
 
 /* XXX: move that elsewhere */
 /* ??? Fix exceptions.  */
-static void *gen_throws_exception;
+static DEFINE_TLS(void *, gen_throws_exception);
+#define gen_throws_exception tls_var(gen_throws_exception)
 #define gen_last_qop NULL
 
 #define OS_BYTE 0
@@ -333,6 +333,37 @@ HELPER_ST_ATOMIC(sc, lw, sw, 0x3)
 HELPER_ST_ATOMIC(scd, ld, sd, 0x7)
 #endif
 #undef HELPER_ST_ATOMIC
+#else
+/* In user mode emulation the other threads keep running on other host
+   CPUs, so the conditional store is a host compare-and-swap against the
+   value seen by the load linked.  */
+#define HELPER_ST_ATOMIC(name, type, bits, almask)                            \
+target_ulong helper_##name(CPUMIPSState *env, target_ulong arg1,              \
+                           target_ulong arg2, int mem_idx)                    \
+{                                                                             \
+    target_ulong lladdr = env->lladdr;                                        \
+                                                                              \
+    if (arg2 & almask) {                                                      \
+        env->CP0_BadVAddr = arg2;                                             \
+        helper_raise_exception(env, EXCP_AdES);                               \
+    }                                                                         \
+    env->lladdr = -1;                                                         \
+    if (arg2 != lladdr) {                                                     \
+        return 0;                                                             \
+    }                                                                         \
+    if (page_check_range(arg2, almask + 1, PAGE_READ | PAGE_WRITE) < 0) {     \
+        env->CP0_BadVAddr = arg2;                                             \
+        helper_raise_exception(env, EXCP_TLBS);                               \
+    }                                                                         \
+    return __sync_bool_compare_and_swap((type *)g2h(arg2),                    \
+                                        tswap##bits(env->llval),              \
+                                        tswap##bits(arg1));                   \
+}
+HELPER_ST_ATOMIC(sc, uint32_t, 32, 0x3)
+#ifdef TARGET_MIPS64
+HELPER_ST_ATOMIC(scd, uint64_t, 64, 0x7)
+#endif
+#undef HELPER_ST_ATOMIC
 #endif
 
 #ifdef TARGET_WORDS_BIGENDIAN
@@ -150,7 +150,8 @@ static char cpu_reg_names[32][4];
 static TCGv_i64 regs[16];
 static TCGv_i64 fregs[16];
 
-static uint8_t gen_opc_cc_op[OPC_BUF_SIZE];
+static DEFINE_TLS(uint8_t[OPC_BUF_SIZE], gen_opc_cc_op);
+#define gen_opc_cc_op tls_var(gen_opc_cc_op)
 
 void s390x_translate_init(void)
 {
@@ -67,7 +67,8 @@ static TCGv cpu_fregs[32];
 /* internal register indexes */
 static TCGv cpu_flags, cpu_delayed_pc;
 
-static uint32_t gen_opc_hflags[OPC_BUF_SIZE];
+static DEFINE_TLS(uint32_t[OPC_BUF_SIZE], gen_opc_hflags);
+#define gen_opc_hflags tls_var(gen_opc_hflags)
 
 #include "exec/gen-icount.h"
 
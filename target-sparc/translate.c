@@ -61,8 +61,10 @@ static TCGv cpu_wim;
 /* Floating point registers */
 static TCGv_i64 cpu_fpr[TARGET_DPREGS];
 
-static target_ulong gen_opc_npc[OPC_BUF_SIZE];
-static target_ulong gen_opc_jump_pc[2];
+static DEFINE_TLS(target_ulong[OPC_BUF_SIZE], gen_opc_npc);
+#define gen_opc_npc tls_var(gen_opc_npc)
+static DEFINE_TLS(target_ulong[2], gen_opc_jump_pc);
+#define gen_opc_jump_pc tls_var(gen_opc_jump_pc)
 
 #include "exec/gen-icount.h"
 
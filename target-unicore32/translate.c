@@ -52,8 +52,14 @@ static TCGv_ptr cpu_env;
 static TCGv_i32 cpu_R[32];
 
 /* FIXME:  These should be removed.  */
-static TCGv cpu_F0s, cpu_F1s;
-static TCGv_i64 cpu_F0d, cpu_F1d;
+static DEFINE_TLS(TCGv, cpu_F0s);
+#define cpu_F0s tls_var(cpu_F0s)
+static DEFINE_TLS(TCGv, cpu_F1s);
+#define cpu_F1s tls_var(cpu_F1s)
+static DEFINE_TLS(TCGv_i64, cpu_F0d);
+#define cpu_F0d tls_var(cpu_F0d)
+static DEFINE_TLS(TCGv_i64, cpu_F1d);
+#define cpu_F1d tls_var(cpu_F1d)
 
 #include "exec/gen-icount.h"
 
@@ -79,7 +85,8 @@ void uc32_translate_init(void)
 #include "helper.h"
 }
 
-static int num_temps;
+static DEFINE_TLS(int, num_temps);
+#define num_temps tls_var(num_temps)
 
 /* Allocate a temporary variable.  */
 static TCGv_i32 new_tmp(void)
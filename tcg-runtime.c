@@ -83,3 +83,86 @@ uint64_t tcg_helper_remu_i64(uint64_t arg1, uint64_t arg2)
 {
     return arg1 % arg2;
 }
+
+/* Vector helpers, for the element sizes and hosts that have no vector
+   opcodes.  The destination is either disjoint from the sources or the
+   same as one of them, so each element can be written in place.  */
+
+#define VEC_BINARY_LOOP(U, S, OP)                               \
+    do {                                                        \
+        U *pd = d, *pa = a, *pb = b;                            \
+        int i;                                                  \
+                                                                \
+        for (i = 0; i < TCG_VEC_OPRSZ(desc) / sizeof(U); i++) { \
+            pd[i] = OP(U, S, pa[i], pb[i]);                     \
+        }                                                       \
+    } while (0)
+
+#define VEC_SHIFT_LOOP(U, S, OP)                                \
+    do {                                                        \
+        U *pd = d, *pa = a;                                     \
+        int i;                                                  \
+                                                                \
+        for (i = 0; i < TCG_VEC_OPRSZ(desc) / sizeof(U); i++) { \
+            pd[i] = OP(U, S, pa[i], TCG_VEC_IMM(desc));         \
+        }                                                       \
+    } while (0)
+
+#define VEC_SWITCH(LOOP, OP)                    \
+    switch (TCG_VEC_VECE(desc)) {               \
+    case 0:                                     \
+        LOOP(uint8_t, int8_t, OP);              \
+        break;                                  \
+    case 1:                                     \
+        LOOP(uint16_t, int16_t, OP);            \
+        break;                                  \
+    case 2:                                     \
+        LOOP(uint32_t, int32_t, OP);            \
+        break;                                  \
+    default:                                    \
+        LOOP(uint64_t, int64_t, OP);            \
+        break;                                  \
+    }
+
+#define VEC_ADD(U, S, x, y)     ((x) + (y))
+#define VEC_SUB(U, S, x, y)     ((x) - (y))
+#define VEC_CMPEQ(U, S, x, y)   (-(U)((x) == (y)))
+#define VEC_CMPGT(U, S, x, y)   (-(U)((S)(x) > (S)(y)))
+#define VEC_SHL(U, S, x, sh)    ((U)((x) << (sh)))
+#define VEC_SHR(U, S, x, sh)    ((x) >> (sh))
+#define VEC_SAR(U, S, x, sh)    ((S)(x) >> (sh))
+
+void tcg_helper_vec_add(void *d, void *a, void *b, uint32_t desc)
+{
+    VEC_SWITCH(VEC_BINARY_LOOP, VEC_ADD);
+}
+
+void tcg_helper_vec_sub(void *d, void *a, void *b, uint32_t desc)
+{
+    VEC_SWITCH(VEC_BINARY_LOOP, VEC_SUB);
+}
+
+void tcg_helper_vec_cmpeq(void *d, void *a, void *b, uint32_t desc)
+{
+    VEC_SWITCH(VEC_BINARY_LOOP, VEC_CMPEQ);
+}
+
+void tcg_helper_vec_cmpgt(void *d, void *a, void *b, uint32_t desc)
+{
+    VEC_SWITCH(VEC_BINARY_LOOP, VEC_CMPGT);
+}
+
+void tcg_helper_vec_shli(void *d, void *a, uint32_t desc)
+{
+    VEC_SWITCH(VEC_SHIFT_LOOP, VEC_SHL);
+}
+
+void tcg_helper_vec_shri(void *d, void *a, uint32_t desc)
+{
+    VEC_SWITCH(VEC_SHIFT_LOOP, VEC_SHR);
+}
+
+void tcg_helper_vec_sari(void *d, void *a, uint32_t desc)
+{
+    VEC_SWITCH(VEC_SHIFT_LOOP, VEC_SAR);
+}
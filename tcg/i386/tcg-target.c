@@ -239,6 +239,7 @@ static inline int tcg_target_const_match(tcg_target_long val,
 
 #define P_EXT		0x100		/* 0x0f opcode prefix */
 #define P_DATA16	0x200		/* 0x66 opcode prefix */
+#define P_SIMDF3	0x8000		/* 0xf3 opcode prefix */
 #if TCG_TARGET_REG_BITS == 64
 # define P_ADDR32	0x400		/* 0x67 opcode prefix */
 # define P_REXW		0x800		/* Set REX.W = 1 */
@@ -294,9 +295,31 @@ static inline int tcg_target_const_match(tcg_target_long val,
 #define OPC_TESTL	(0x85)
 #define OPC_XCHG_ax_r32	(0x90)
 
+/* SSE2, for the vector ops.  The packed integer ops are the byte form;
+   the word, dword and (except for paddq) qword forms follow it.  */
+#define OPC_MOVDQU_VxWx	(0x6f | P_EXT | P_SIMDF3)
+#define OPC_MOVDQU_WxVx	(0x7f | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_VqWq	(0x7e | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_WqVq	(0xd6 | P_EXT | P_DATA16)
+#define OPC_PADDB	(0xfc | P_EXT | P_DATA16)
+#define OPC_PADDQ	(0xd4 | P_EXT | P_DATA16)
+#define OPC_PAND	(0xdb | P_EXT | P_DATA16)
+#define OPC_PANDN	(0xdf | P_EXT | P_DATA16)
+#define OPC_PCMPEQB	(0x74 | P_EXT | P_DATA16)
+#define OPC_PCMPGTB	(0x64 | P_EXT | P_DATA16)
+#define OPC_POR		(0xeb | P_EXT | P_DATA16)
+#define OPC_PSHIFTW_Ib	(0x71 | P_EXT | P_DATA16) /* D, Q: 0x72, 0x73 */
+#define OPC_PSUBB	(0xf8 | P_EXT | P_DATA16)
+#define OPC_PXOR	(0xef | P_EXT | P_DATA16)
+
 #define OPC_GRP3_Ev	(0xf7)
 #define OPC_GRP5	(0xff)
 
+/* Opcode extensions for OPC_PSHIFTW_Ib and the following.  */
+#define PSHIFT_SRL 2
+#define PSHIFT_SRA 4
+#define PSHIFT_SLL 6
+
 /* Group 1 opcode extensions for 0x80-0x83.
    These are also used as modifiers for OPC_ARITH.  */
 #define ARITH_ADD 0
@@ -377,6 +400,9 @@ static void tcg_out_opc(TCGContext *s, int opc, int r, int rm, int x)
     if (opc & P_ADDR32) {
         tcg_out8(s, 0x67);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    }
 
     rex = 0;
     rex |= (opc & P_REXW) >> 8;		/* REX.W */
@@ -407,6 +433,9 @@ static void tcg_out_opc(TCGContext *s, int opc)
     if (opc & P_DATA16) {
         tcg_out8(s, 0x66);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    }
     if (opc & P_EXT) {
         tcg_out8(s, 0x0f);
     }
@@ -546,12 +575,15 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
         return;
     } else if (arg == (uint32_t)arg || type == TCG_TYPE_I32) {
         tcg_out_opc(s, OPC_MOVL_Iv + LOWREGMASK(ret), 0, ret, 0);
+        tcg_out_host_reloc(s, TCG_HOST_RELOC_ABS32, (uint32_t)arg);
         tcg_out32(s, arg);
     } else if (arg == (int32_t)arg) {
         tcg_out_modrm(s, OPC_MOVL_EvIz + P_REXW, 0, ret);
+        tcg_out_host_reloc(s, TCG_HOST_RELOC_ABS32S, arg);
         tcg_out32(s, arg);
     } else {
         tcg_out_opc(s, OPC_MOVL_Iv + P_REXW + LOWREGMASK(ret), 0, ret, 0);
+        tcg_out_host_reloc(s, TCG_HOST_RELOC_ABS64, arg);
         tcg_out32(s, arg);
         tcg_out32(s, arg >> 31 >> 1);
     }
@@ -981,9 +1013,11 @@ static void tcg_out_branch(TCGContext *s, int call, tcg_target_long dest)
 
     if (disp == (int32_t)disp) {
         tcg_out_opc(s, call ? OPC_CALL_Jz : OPC_JMP_long, 0, 0, 0);
+        tcg_out_host_reloc(s, TCG_HOST_RELOC_PCREL32, dest);
         tcg_out32(s, disp);
     } else {
         tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_R10, dest);
+        tcg_out_host_reloc_far(s);
         tcg_out_modrm(s, OPC_GRP5,
                       call ? EXT5_CALLN_Ev : EXT5_JMPN_Ev, TCG_REG_R10);
     }
@@ -1129,6 +1163,13 @@ static inline void setup_guest_base_seg(void)
 static inline void setup_guest_base_seg(void) { }
 #endif /* SOFTMMU */
 
+#ifndef CONFIG_SOFTMMU
+bool tcg_target_guest_base_in_code(void)
+{
+    return GUEST_BASE && !guest_base_flags;
+}
+#endif
+
 static void tcg_out_qemu_ld_direct(TCGContext *s, int datalo, int datahi,
                                    int base, tcg_target_long ofs, int seg,
                                    int sizeop)
@@ -1662,6 +1703,83 @@ void tcg_out_tb_finalize(TCGContext *s)
 }
 #endif  /* CONFIG_SOFTMMU */
 
+#if TCG_TARGET_HAS_vec
+/* The vector ops go through %xmm0 and %xmm1.  Nothing else in the
+   generated code uses the SSE registers, and calls clobber them.  */
+#define TCG_TMP_XMM0 0
+#define TCG_TMP_XMM1 1
+
+static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc, const TCGArg *args)
+{
+    int base = args[0], vece = args[5];
+    tcg_target_long dofs = args[1], aofs = args[2], bofs = args[3];
+    int ld = args[4] == 8 ? OPC_MOVQ_VqWq : OPC_MOVDQU_VxWx;
+    int st = args[4] == 8 ? OPC_MOVQ_WqVq : OPC_MOVDQU_WxVx;
+    int insn, ext;
+
+    switch (opc) {
+    case INDEX_op_vec_mov:
+        tcg_out_modrm_offset(s, ld, TCG_TMP_XMM0, base, aofs);
+        break;
+
+    case INDEX_op_vec_shli:
+        ext = PSHIFT_SLL;
+        goto do_shift;
+    case INDEX_op_vec_shri:
+        ext = PSHIFT_SRL;
+        goto do_shift;
+    case INDEX_op_vec_sari:
+        ext = PSHIFT_SRA;
+    do_shift:
+        tcg_out_modrm_offset(s, ld, TCG_TMP_XMM0, base, aofs);
+        tcg_out_modrm(s, OPC_PSHIFTW_Ib + vece - 1, ext, TCG_TMP_XMM0);
+        tcg_out8(s, bofs);
+        break;
+
+    case INDEX_op_vec_andc:
+        /* pandn computes ~dest & src.  */
+        tcg_out_modrm_offset(s, ld, TCG_TMP_XMM0, base, bofs);
+        tcg_out_modrm_offset(s, ld, TCG_TMP_XMM1, base, aofs);
+        tcg_out_modrm(s, OPC_PANDN, TCG_TMP_XMM0, TCG_TMP_XMM1);
+        break;
+
+    default:
+        switch (opc) {
+        case INDEX_op_vec_add:
+            insn = vece == 3 ? OPC_PADDQ : OPC_PADDB + vece;
+            break;
+        case INDEX_op_vec_sub:
+            insn = OPC_PSUBB + vece;
+            break;
+        case INDEX_op_vec_and:
+            insn = OPC_PAND;
+            break;
+        case INDEX_op_vec_or:
+            insn = OPC_POR;
+            break;
+        case INDEX_op_vec_xor:
+            insn = OPC_PXOR;
+            break;
+        case INDEX_op_vec_cmpeq:
+            insn = OPC_PCMPEQB + vece;
+            break;
+        case INDEX_op_vec_cmpgt:
+            insn = OPC_PCMPGTB + vece;
+            break;
+        default:
+            tcg_abort();
+        }
+        /* The legacy SSE encodings fault on unaligned memory operands,
+           so both sources go through registers.  */
+        tcg_out_modrm_offset(s, ld, TCG_TMP_XMM0, base, aofs);
+        tcg_out_modrm_offset(s, ld, TCG_TMP_XMM1, base, bofs);
+        tcg_out_modrm(s, insn, TCG_TMP_XMM0, TCG_TMP_XMM1);
+        break;
+    }
+    tcg_out_modrm_offset(s, st, TCG_TMP_XMM0, base, dofs);
+}
+#endif
+
 static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
                               const TCGArg *args, const int *const_args)
 {
@@ -2019,6 +2137,23 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         break;
 
+#if TCG_TARGET_HAS_vec
+    case INDEX_op_vec_mov:
+    case INDEX_op_vec_add:
+    case INDEX_op_vec_sub:
+    case INDEX_op_vec_and:
+    case INDEX_op_vec_or:
+    case INDEX_op_vec_xor:
+    case INDEX_op_vec_andc:
+    case INDEX_op_vec_cmpeq:
+    case INDEX_op_vec_cmpgt:
+    case INDEX_op_vec_shli:
+    case INDEX_op_vec_shri:
+    case INDEX_op_vec_sari:
+        tcg_out_vec_op(s, opc, args);
+        break;
+#endif
+
     default:
         tcg_abort();
     }
@@ -2134,6 +2269,21 @@ static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_movcond_i64, { "r", "r", "re", "r", "0" } },
 #endif
 
+#if TCG_TARGET_HAS_vec
+    { INDEX_op_vec_mov, { "r" } },
+    { INDEX_op_vec_add, { "r" } },
+    { INDEX_op_vec_sub, { "r" } },
+    { INDEX_op_vec_and, { "r" } },
+    { INDEX_op_vec_or, { "r" } },
+    { INDEX_op_vec_xor, { "r" } },
+    { INDEX_op_vec_andc, { "r" } },
+    { INDEX_op_vec_cmpeq, { "r" } },
+    { INDEX_op_vec_cmpgt, { "r" } },
+    { INDEX_op_vec_shli, { "r" } },
+    { INDEX_op_vec_shri, { "r" } },
+    { INDEX_op_vec_sari, { "r" } },
+#endif
+
 #if TCG_TARGET_REG_BITS == 64
     { INDEX_op_qemu_ld8u, { "r", "L" } },
     { INDEX_op_qemu_ld8s, { "r", "L" } },
@@ -93,6 +93,16 @@ typedef enum {
 #define TCG_TARGET_HAS_deposit_i32      1
 #define TCG_TARGET_HAS_movcond_i32      1
 
+/* The vector ops use SSE2, which every x86_64 host has.  */
+#if TCG_TARGET_REG_BITS == 64 || defined(__SSE2__)
+#define TCG_TARGET_HAS_vec              1
+#else
+#define TCG_TARGET_HAS_vec              0
+#endif
+
+/* tcg_out_movi() and tcg_out_branch() report their immediates.  */
+#define TCG_TARGET_HAS_host_relocs      1
+
 #if TCG_TARGET_REG_BITS == 64
 #define TCG_TARGET_HAS_div2_i64         1
 #define TCG_TARGET_HAS_rot_i64          1
@@ -97,6 +97,8 @@ typedef enum {
 #define TCG_TARGET_HAS_movcond_i32      0
 #endif
 
+#define TCG_TARGET_HAS_vec              0
+
 /* optional instructions only implemented on MIPS32R2 */
 #if defined(__mips_isa_rev) && (__mips_isa_rev >= 2)
 #define TCG_TARGET_HAS_bswap16_i32      1
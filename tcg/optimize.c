@@ -49,22 +49,26 @@ struct tcg_temp_info {
     tcg_target_ulong mask;
 };
 
-static struct tcg_temp_info temps[TCG_MAX_TEMPS];
+/* The optimizer runs in every thread that generates code.  */
+static DEFINE_TLS(struct tcg_temp_info[TCG_MAX_TEMPS], temp_info);
+#define temp_info tls_var(temp_info)
 
 /* Reset TEMP's state to TCG_TEMP_UNDEF.  If TEMP only had one copy, remove
    the copy flag from the left temp.  */
 static void reset_temp(TCGArg temp)
 {
-    if (temps[temp].state == TCG_TEMP_COPY) {
-        if (temps[temp].prev_copy == temps[temp].next_copy) {
-            temps[temps[temp].next_copy].state = TCG_TEMP_UNDEF;
+    if (temp_info[temp].state == TCG_TEMP_COPY) {
+        if (temp_info[temp].prev_copy == temp_info[temp].next_copy) {
+            temp_info[temp_info[temp].next_copy].state = TCG_TEMP_UNDEF;
         } else {
-            temps[temps[temp].next_copy].prev_copy = temps[temp].prev_copy;
-            temps[temps[temp].prev_copy].next_copy = temps[temp].next_copy;
+            temp_info[temp_info[temp].next_copy].prev_copy =
+                temp_info[temp].prev_copy;
+            temp_info[temp_info[temp].prev_copy].next_copy =
+                temp_info[temp].next_copy;
         }
     }
-    temps[temp].state = TCG_TEMP_UNDEF;
-    temps[temp].mask = -1;
+    temp_info[temp].state = TCG_TEMP_UNDEF;
+    temp_info[temp].mask = -1;
 }
 
 /* Reset all temporaries, given that there are NB_TEMPS of them.  */
@@ -72,8 +76,8 @@ static void reset_all_temps(int nb_temps)
 {
     int i;
     for (i = 0; i < nb_temps; i++) {
-        temps[i].state = TCG_TEMP_UNDEF;
-        temps[i].mask = -1;
+        temp_info[i].state = TCG_TEMP_UNDEF;
+        temp_info[i].mask = -1;
     }
 }
 
@@ -107,7 +111,8 @@ static TCGArg find_better_copy(TCGContext *s, TCGArg temp)
     }
 
     /* Search for a global first. */
-    for (i = temps[temp].next_copy ; i != temp ; i = temps[i].next_copy) {
+    for (i = temp_info[temp].next_copy ; i != temp ;
+         i = temp_info[i].next_copy) {
         if (i < s->nb_globals) {
             return i;
         }
@@ -115,7 +120,8 @@ static TCGArg find_better_copy(TCGContext *s, TCGArg temp)
 
     /* If it is a temp, search for a temp local. */
     if (!s->temps[temp].temp_local) {
-        for (i = temps[temp].next_copy ; i != temp ; i = temps[i].next_copy) {
+        for (i = temp_info[temp].next_copy ; i != temp ;
+             i = temp_info[i].next_copy) {
             if (s->temps[i].temp_local) {
                 return i;
             }
@@ -134,12 +140,13 @@ static bool temps_are_copies(TCGArg arg1, TCGArg arg2)
         return true;
     }
 
-    if (temps[arg1].state != TCG_TEMP_COPY
-        || temps[arg2].state != TCG_TEMP_COPY) {
+    if (temp_info[arg1].state != TCG_TEMP_COPY
+        || temp_info[arg2].state != TCG_TEMP_COPY) {
         return false;
     }
 
-    for (i = temps[arg1].next_copy ; i != arg1 ; i = temps[i].next_copy) {
+    for (i = temp_info[arg1].next_copy ; i != arg1 ;
+         i = temp_info[i].next_copy) {
         if (i == arg2) {
             return true;
         }
@@ -152,20 +159,20 @@ static void tcg_opt_gen_mov(TCGContext *s, TCGArg *gen_args,
                             TCGArg dst, TCGArg src)
 {
     reset_temp(dst);
-    temps[dst].mask = temps[src].mask;
-    assert(temps[src].state != TCG_TEMP_CONST);
+    temp_info[dst].mask = temp_info[src].mask;
+    assert(temp_info[src].state != TCG_TEMP_CONST);
 
     if (s->temps[src].type == s->temps[dst].type) {
-        if (temps[src].state != TCG_TEMP_COPY) {
-            temps[src].state = TCG_TEMP_COPY;
-            temps[src].next_copy = src;
-            temps[src].prev_copy = src;
+        if (temp_info[src].state != TCG_TEMP_COPY) {
+            temp_info[src].state = TCG_TEMP_COPY;
+            temp_info[src].next_copy = src;
+            temp_info[src].prev_copy = src;
         }
-        temps[dst].state = TCG_TEMP_COPY;
-        temps[dst].next_copy = temps[src].next_copy;
-        temps[dst].prev_copy = src;
-        temps[temps[dst].next_copy].prev_copy = dst;
-        temps[src].next_copy = dst;
+        temp_info[dst].state = TCG_TEMP_COPY;
+        temp_info[dst].next_copy = temp_info[src].next_copy;
+        temp_info[dst].prev_copy = src;
+        temp_info[temp_info[dst].next_copy].prev_copy = dst;
+        temp_info[src].next_copy = dst;
     }
 
     gen_args[0] = dst;
@@ -175,9 +182,9 @@ static void tcg_opt_gen_mov(TCGContext *s, TCGArg *gen_args,
 static void tcg_opt_gen_movi(TCGArg *gen_args, TCGArg dst, TCGArg val)
 {
     reset_temp(dst);
-    temps[dst].state = TCG_TEMP_CONST;
-    temps[dst].val = val;
-    temps[dst].mask = val;
+    temp_info[dst].state = TCG_TEMP_CONST;
+    temp_info[dst].val = val;
+    temp_info[dst].mask = val;
     gen_args[0] = dst;
     gen_args[1] = val;
 }
@@ -387,18 +394,21 @@ static bool do_constant_folding_cond_eq(TCGCond c)
 static TCGArg do_constant_folding_cond(TCGOpcode op, TCGArg x,
                                        TCGArg y, TCGCond c)
 {
-    if (temps[x].state == TCG_TEMP_CONST && temps[y].state == TCG_TEMP_CONST) {
+    if (temp_info[x].state == TCG_TEMP_CONST &&
+        temp_info[y].state == TCG_TEMP_CONST) {
         switch (op_bits(op)) {
         case 32:
-            return do_constant_folding_cond_32(temps[x].val, temps[y].val, c);
+            return do_constant_folding_cond_32(temp_info[x].val,
+                                               temp_info[y].val, c);
         case 64:
-            return do_constant_folding_cond_64(temps[x].val, temps[y].val, c);
+            return do_constant_folding_cond_64(temp_info[x].val,
+                                               temp_info[y].val, c);
         default:
             tcg_abort();
         }
     } else if (temps_are_copies(x, y)) {
         return do_constant_folding_cond_eq(c);
-    } else if (temps[y].state == TCG_TEMP_CONST && temps[y].val == 0) {
+    } else if (temp_info[y].state == TCG_TEMP_CONST && temp_info[y].val == 0) {
         switch (c) {
         case TCG_COND_LTU:
             return 0;
@@ -419,14 +429,16 @@ static TCGArg do_constant_folding_cond2(TCGArg *p1, TCGArg *p2, TCGCond c)
     TCGArg al = p1[0], ah = p1[1];
     TCGArg bl = p2[0], bh = p2[1];
 
-    if (temps[bl].state == TCG_TEMP_CONST
-        && temps[bh].state == TCG_TEMP_CONST) {
-        uint64_t b = ((uint64_t)temps[bh].val << 32) | (uint32_t)temps[bl].val;
+    if (temp_info[bl].state == TCG_TEMP_CONST
+        && temp_info[bh].state == TCG_TEMP_CONST) {
+        uint64_t b = ((uint64_t)temp_info[bh].val << 32) |
+                     (uint32_t)temp_info[bl].val;
 
-        if (temps[al].state == TCG_TEMP_CONST
-            && temps[ah].state == TCG_TEMP_CONST) {
+        if (temp_info[al].state == TCG_TEMP_CONST
+            && temp_info[ah].state == TCG_TEMP_CONST) {
             uint64_t a;
-            a = ((uint64_t)temps[ah].val << 32) | (uint32_t)temps[al].val;
+            a = ((uint64_t)temp_info[ah].val << 32) |
+                (uint32_t)temp_info[al].val;
             return do_constant_folding_cond_64(a, b, c);
         }
         if (b == 0) {
@@ -450,8 +462,8 @@ static bool swap_commutative(TCGArg dest, TCGArg *p1, TCGArg *p2)
 {
     TCGArg a1 = *p1, a2 = *p2;
     int sum = 0;
-    sum += temps[a1].state == TCG_TEMP_CONST;
-    sum -= temps[a2].state == TCG_TEMP_CONST;
+    sum += temp_info[a1].state == TCG_TEMP_CONST;
+    sum -= temp_info[a2].state == TCG_TEMP_CONST;
 
     /* Prefer the constant in second argument, and then the form
        op a, a, b, which is better handled on non-RISC hosts. */
@@ -466,10 +478,10 @@ static bool swap_commutative(TCGArg dest, TCGArg *p1, TCGArg *p2)
 static bool swap_commutative2(TCGArg *p1, TCGArg *p2)
 {
     int sum = 0;
-    sum += temps[p1[0]].state == TCG_TEMP_CONST;
-    sum += temps[p1[1]].state == TCG_TEMP_CONST;
-    sum -= temps[p2[0]].state == TCG_TEMP_CONST;
-    sum -= temps[p2[1]].state == TCG_TEMP_CONST;
+    sum += temp_info[p1[0]].state == TCG_TEMP_CONST;
+    sum += temp_info[p1[1]].state == TCG_TEMP_CONST;
+    sum -= temp_info[p2[0]].state == TCG_TEMP_CONST;
+    sum -= temp_info[p2[1]].state == TCG_TEMP_CONST;
     if (sum > 0) {
         TCGArg t;
         t = p1[0], p1[0] = p2[0], p2[0] = t;
@@ -509,13 +521,13 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             int nb_oargs = args[0] >> 16;
             int nb_iargs = args[0] & 0xffff;
             for (i = nb_oargs + 1; i < nb_oargs + nb_iargs + 1; i++) {
-                if (temps[args[i]].state == TCG_TEMP_COPY) {
+                if (temp_info[args[i]].state == TCG_TEMP_COPY) {
                     args[i] = find_better_copy(s, args[i]);
                 }
             }
         } else {
             for (i = def->nb_oargs; i < def->nb_oargs + def->nb_iargs; i++) {
-                if (temps[args[i]].state == TCG_TEMP_COPY) {
+                if (temp_info[args[i]].state == TCG_TEMP_COPY) {
                     args[i] = find_better_copy(s, args[i]);
                 }
             }
@@ -582,8 +594,8 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
         CASE_OP_32_64(sar):
         CASE_OP_32_64(rotl):
         CASE_OP_32_64(rotr):
-            if (temps[args[1]].state == TCG_TEMP_CONST
-                && temps[args[1]].val == 0) {
+            if (temp_info[args[1]].state == TCG_TEMP_CONST
+                && temp_info[args[1]].val == 0) {
                 s->gen_opc_buf[op_index] = op_to_movi(op);
                 tcg_opt_gen_movi(gen_args, args[0], 0);
                 args += 3;
@@ -606,12 +618,12 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
         CASE_OP_32_64(rotr):
         CASE_OP_32_64(or):
         CASE_OP_32_64(xor):
-            if (temps[args[1]].state == TCG_TEMP_CONST) {
+            if (temp_info[args[1]].state == TCG_TEMP_CONST) {
                 /* Proceed with possible constant folding. */
                 break;
             }
-            if (temps[args[2]].state == TCG_TEMP_CONST
-                && temps[args[2]].val == 0) {
+            if (temp_info[args[2]].state == TCG_TEMP_CONST
+                && temp_info[args[2]].val == 0) {
                 if (temps_are_copies(args[0], args[1])) {
                     s->gen_opc_buf[op_index] = INDEX_op_nop;
                 } else {
@@ -632,21 +644,21 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
         affected = -1;
         switch (op) {
         CASE_OP_32_64(ext8s):
-            if ((temps[args[1]].mask & 0x80) != 0) {
+            if ((temp_info[args[1]].mask & 0x80) != 0) {
                 break;
             }
         CASE_OP_32_64(ext8u):
             mask = 0xff;
             goto and_const;
         CASE_OP_32_64(ext16s):
-            if ((temps[args[1]].mask & 0x8000) != 0) {
+            if ((temp_info[args[1]].mask & 0x8000) != 0) {
                 break;
             }
         CASE_OP_32_64(ext16u):
             mask = 0xffff;
             goto and_const;
         case INDEX_op_ext32s_i64:
-            if ((temps[args[1]].mask & 0x80000000) != 0) {
+            if ((temp_info[args[1]].mask & 0x80000000) != 0) {
                 break;
             }
         case INDEX_op_ext32u_i64:
@@ -654,47 +666,47 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             goto and_const;
 
         CASE_OP_32_64(and):
-            mask = temps[args[2]].mask;
-            if (temps[args[2]].state == TCG_TEMP_CONST) {
+            mask = temp_info[args[2]].mask;
+            if (temp_info[args[2]].state == TCG_TEMP_CONST) {
         and_const:
-                affected = temps[args[1]].mask & ~mask;
+                affected = temp_info[args[1]].mask & ~mask;
             }
-            mask = temps[args[1]].mask & mask;
+            mask = temp_info[args[1]].mask & mask;
             break;
 
         CASE_OP_32_64(sar):
-            if (temps[args[2]].state == TCG_TEMP_CONST) {
-                mask = ((tcg_target_long)temps[args[1]].mask
-                        >> temps[args[2]].val);
+            if (temp_info[args[2]].state == TCG_TEMP_CONST) {
+                mask = ((tcg_target_long)temp_info[args[1]].mask
+                        >> temp_info[args[2]].val);
             }
             break;
 
         CASE_OP_32_64(shr):
-            if (temps[args[2]].state == TCG_TEMP_CONST) {
-                mask = temps[args[1]].mask >> temps[args[2]].val;
+            if (temp_info[args[2]].state == TCG_TEMP_CONST) {
+                mask = temp_info[args[1]].mask >> temp_info[args[2]].val;
             }
             break;
 
         CASE_OP_32_64(shl):
-            if (temps[args[2]].state == TCG_TEMP_CONST) {
-                mask = temps[args[1]].mask << temps[args[2]].val;
+            if (temp_info[args[2]].state == TCG_TEMP_CONST) {
+                mask = temp_info[args[1]].mask << temp_info[args[2]].val;
             }
             break;
 
         CASE_OP_32_64(neg):
             /* Set to 1 all bits to the left of the rightmost.  */
-            mask = -(temps[args[1]].mask & -temps[args[1]].mask);
+            mask = -(temp_info[args[1]].mask & -temp_info[args[1]].mask);
             break;
 
         CASE_OP_32_64(deposit):
             tmp = ((1ull << args[4]) - 1);
-            mask = ((temps[args[1]].mask & ~(tmp << args[3]))
-                    | ((temps[args[2]].mask & tmp) << args[3]));
+            mask = ((temp_info[args[1]].mask & ~(tmp << args[3]))
+                    | ((temp_info[args[2]].mask & tmp) << args[3]));
             break;
 
         CASE_OP_32_64(or):
         CASE_OP_32_64(xor):
-            mask = temps[args[1]].mask | temps[args[2]].mask;
+            mask = temp_info[args[1]].mask | temp_info[args[2]].mask;
             break;
 
         CASE_OP_32_64(setcond):
@@ -702,7 +714,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             break;
 
         CASE_OP_32_64(movcond):
-            mask = temps[args[3]].mask | temps[args[4]].mask;
+            mask = temp_info[args[3]].mask | temp_info[args[4]].mask;
             break;
 
         default:
@@ -721,13 +733,13 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             assert(def->nb_oargs == 1);
             if (temps_are_copies(args[0], args[1])) {
                 s->gen_opc_buf[op_index] = INDEX_op_nop;
-            } else if (temps[args[1]].state != TCG_TEMP_CONST) {
+            } else if (temp_info[args[1]].state != TCG_TEMP_CONST) {
                 s->gen_opc_buf[op_index] = op_to_mov(op);
                 tcg_opt_gen_mov(s, gen_args, args[0], args[1]);
                 gen_args += 2;
             } else {
                 s->gen_opc_buf[op_index] = op_to_movi(op);
-                tcg_opt_gen_movi(gen_args, args[0], temps[args[1]].val);
+                tcg_opt_gen_movi(gen_args, args[0], temp_info[args[1]].val);
                 gen_args += 2;
             }
             args += def->nb_iargs + 1;
@@ -738,8 +750,8 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
         switch (op) {
         CASE_OP_32_64(and):
         CASE_OP_32_64(mul):
-            if ((temps[args[2]].state == TCG_TEMP_CONST
-                && temps[args[2]].val == 0)) {
+            if ((temp_info[args[2]].state == TCG_TEMP_CONST
+                && temp_info[args[2]].val == 0)) {
                 s->gen_opc_buf[op_index] = op_to_movi(op);
                 tcg_opt_gen_movi(gen_args, args[0], 0);
                 args += 3;
@@ -797,7 +809,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                 s->gen_opc_buf[op_index] = INDEX_op_nop;
                 break;
             }
-            if (temps[args[1]].state != TCG_TEMP_CONST) {
+            if (temp_info[args[1]].state != TCG_TEMP_CONST) {
                 tcg_opt_gen_mov(s, gen_args, args[0], args[1]);
                 gen_args += 2;
                 args += 2;
@@ -807,7 +819,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                let movi case handle it. */
             op = op_to_movi(op);
             s->gen_opc_buf[op_index] = op;
-            args[1] = temps[args[1]].val;
+            args[1] = temp_info[args[1]].val;
             /* fallthrough */
         CASE_OP_32_64(movi):
             tcg_opt_gen_movi(gen_args, args[0], args[1]);
@@ -823,9 +835,9 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
         CASE_OP_32_64(ext16u):
         case INDEX_op_ext32s_i64:
         case INDEX_op_ext32u_i64:
-            if (temps[args[1]].state == TCG_TEMP_CONST) {
+            if (temp_info[args[1]].state == TCG_TEMP_CONST) {
                 s->gen_opc_buf[op_index] = op_to_movi(op);
-                tmp = do_constant_folding(op, temps[args[1]].val, 0);
+                tmp = do_constant_folding(op, temp_info[args[1]].val, 0);
                 tcg_opt_gen_movi(gen_args, args[0], tmp);
                 gen_args += 2;
                 args += 2;
@@ -849,11 +861,11 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
         CASE_OP_32_64(eqv):
         CASE_OP_32_64(nand):
         CASE_OP_32_64(nor):
-            if (temps[args[1]].state == TCG_TEMP_CONST
-                && temps[args[2]].state == TCG_TEMP_CONST) {
+            if (temp_info[args[1]].state == TCG_TEMP_CONST
+                && temp_info[args[2]].state == TCG_TEMP_CONST) {
                 s->gen_opc_buf[op_index] = op_to_movi(op);
-                tmp = do_constant_folding(op, temps[args[1]].val,
-                                          temps[args[2]].val);
+                tmp = do_constant_folding(op, temp_info[args[1]].val,
+                                          temp_info[args[2]].val);
                 tcg_opt_gen_movi(gen_args, args[0], tmp);
                 gen_args += 2;
                 args += 3;
@@ -862,12 +874,12 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             goto do_default;
 
         CASE_OP_32_64(deposit):
-            if (temps[args[1]].state == TCG_TEMP_CONST
-                && temps[args[2]].state == TCG_TEMP_CONST) {
+            if (temp_info[args[1]].state == TCG_TEMP_CONST
+                && temp_info[args[2]].state == TCG_TEMP_CONST) {
                 s->gen_opc_buf[op_index] = op_to_movi(op);
                 tmp = ((1ull << args[4]) - 1);
-                tmp = (temps[args[1]].val & ~(tmp << args[3]))
-                      | ((temps[args[2]].val & tmp) << args[3]);
+                tmp = (temp_info[args[1]].val & ~(tmp << args[3]))
+                      | ((temp_info[args[2]].val & tmp) << args[3]);
                 tcg_opt_gen_movi(gen_args, args[0], tmp);
                 gen_args += 2;
                 args += 5;
@@ -907,9 +919,10 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             if (tmp != 2) {
                 if (temps_are_copies(args[0], args[4-tmp])) {
                     s->gen_opc_buf[op_index] = INDEX_op_nop;
-                } else if (temps[args[4-tmp]].state == TCG_TEMP_CONST) {
+                } else if (temp_info[args[4-tmp]].state == TCG_TEMP_CONST) {
                     s->gen_opc_buf[op_index] = op_to_movi(op);
-                    tcg_opt_gen_movi(gen_args, args[0], temps[args[4-tmp]].val);
+                    tcg_opt_gen_movi(gen_args, args[0],
+                                     temp_info[args[4-tmp]].val);
                     gen_args += 2;
                 } else {
                     s->gen_opc_buf[op_index] = op_to_mov(op);
@@ -923,14 +936,14 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
 
         case INDEX_op_add2_i32:
         case INDEX_op_sub2_i32:
-            if (temps[args[2]].state == TCG_TEMP_CONST
-                && temps[args[3]].state == TCG_TEMP_CONST
-                && temps[args[4]].state == TCG_TEMP_CONST
-                && temps[args[5]].state == TCG_TEMP_CONST) {
-                uint32_t al = temps[args[2]].val;
-                uint32_t ah = temps[args[3]].val;
-                uint32_t bl = temps[args[4]].val;
-                uint32_t bh = temps[args[5]].val;
+            if (temp_info[args[2]].state == TCG_TEMP_CONST
+                && temp_info[args[3]].state == TCG_TEMP_CONST
+                && temp_info[args[4]].state == TCG_TEMP_CONST
+                && temp_info[args[5]].state == TCG_TEMP_CONST) {
+                uint32_t al = temp_info[args[2]].val;
+                uint32_t ah = temp_info[args[3]].val;
+                uint32_t bl = temp_info[args[4]].val;
+                uint32_t bh = temp_info[args[5]].val;
                 uint64_t a = ((uint64_t)ah << 32) | al;
                 uint64_t b = ((uint64_t)bh << 32) | bl;
                 TCGArg rl, rh;
@@ -957,10 +970,10 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             goto do_default;
 
         case INDEX_op_mulu2_i32:
-            if (temps[args[2]].state == TCG_TEMP_CONST
-                && temps[args[3]].state == TCG_TEMP_CONST) {
-                uint32_t a = temps[args[2]].val;
-                uint32_t b = temps[args[3]].val;
+            if (temp_info[args[2]].state == TCG_TEMP_CONST
+                && temp_info[args[3]].state == TCG_TEMP_CONST) {
+                uint32_t a = temp_info[args[2]].val;
+                uint32_t b = temp_info[args[3]].val;
                 uint64_t r = (uint64_t)a * b;
                 TCGArg rl, rh;
 
@@ -991,10 +1004,10 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                     s->gen_opc_buf[op_index] = INDEX_op_nop;
                 }
             } else if ((args[4] == TCG_COND_LT || args[4] == TCG_COND_GE)
-                       && temps[args[2]].state == TCG_TEMP_CONST
-                       && temps[args[3]].state == TCG_TEMP_CONST
-                       && temps[args[2]].val == 0
-                       && temps[args[3]].val == 0) {
+                       && temp_info[args[2]].state == TCG_TEMP_CONST
+                       && temp_info[args[3]].state == TCG_TEMP_CONST
+                       && temp_info[args[2]].val == 0
+                       && temp_info[args[3]].val == 0) {
                 /* Simplify LT/GE comparisons vs zero to a single compare
                    vs the high word of the input.  */
                 reset_all_temps(nb_temps);
@@ -1017,10 +1030,10 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                 tcg_opt_gen_movi(gen_args, args[0], tmp);
                 gen_args += 2;
             } else if ((args[5] == TCG_COND_LT || args[5] == TCG_COND_GE)
-                       && temps[args[3]].state == TCG_TEMP_CONST
-                       && temps[args[4]].state == TCG_TEMP_CONST
-                       && temps[args[3]].val == 0
-                       && temps[args[4]].val == 0) {
+                       && temp_info[args[3]].state == TCG_TEMP_CONST
+                       && temp_info[args[4]].state == TCG_TEMP_CONST
+                       && temp_info[args[3]].val == 0
+                       && temp_info[args[4]].val == 0) {
                 /* Simplify LT/GE comparisons vs zero to a single compare
                    vs the high word of the input.  */
                 s->gen_opc_buf[op_index] = INDEX_op_setcond_i32;
@@ -1081,10 +1094,418 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
     return gen_args;
 }
 
+/* Loads and stores of CPU state fields, i.e. ld/st with env as the base,
+   are tracked within a basic block.  A load from a field whose value is
+   still held by a temp becomes a move from that temp, and a store to a
+   field that is stored again before anything can observe it is dropped.
+   Dead moves are later removed by the liveness analysis.
+
+   Frontends free and reuse their temps right after storing them, so a
+   temp holding a field is renamed when it is overwritten.  */
+
+#define MAX_ENV_SLOTS 32
+
+/* Bound the extra temps, which may need a stack slot each.  */
+#define MAX_ENV_RENAMES 32
+
+struct tcg_env_slot {
+    tcg_target_long offset;
+    TCGOpcode st_op;            /* st_i32 or st_i64, 0 if unused */
+    TCGArg val;                 /* temp holding the field, or -1 */
+    int store_index;            /* pending store op, or -1 */
+};
+
+static DEFINE_TLS(struct tcg_env_slot[MAX_ENV_SLOTS], env_slots);
+#define env_slots tls_var(env_slots)
+static DEFINE_TLS(int, env_slots_next);
+#define env_slots_next tls_var(env_slots_next)
+static DEFINE_TLS(TCGArg[TCG_MAX_TEMPS], env_renames);
+#define env_renames tls_var(env_renames)
+static DEFINE_TLS(int, env_nb_renames);
+#define env_nb_renames tls_var(env_nb_renames)
+
+static void reset_env_slots(void)
+{
+    memset(env_slots, 0, sizeof(env_slots));
+}
+
+/* Plain temps are dead at the end of a basic block, so they can go
+   back to their own names.  */
+static void reset_env_renames(TCGContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_temps; i++) {
+        env_renames[i] = i;
+    }
+}
+
+/* Something may read any field: keep the pending stores.  */
+static void flush_env_stores(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_ENV_SLOTS; i++) {
+        env_slots[i].store_index = -1;
+    }
+}
+
+static int env_access_size(TCGOpcode op)
+{
+    switch (op) {
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(st8):
+        return 1;
+    CASE_OP_32_64(ld16u):
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(st16):
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_st_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_st32_i64:
+        return 4;
+    case INDEX_op_ld_i64:
+    case INDEX_op_st_i64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/* Number of memory sources of a vector op, 0 for other ops.  */
+static int env_vec_sources(TCGOpcode op)
+{
+    switch (op) {
+    case INDEX_op_vec_mov:
+    case INDEX_op_vec_shli:
+    case INDEX_op_vec_shri:
+    case INDEX_op_vec_sari:
+        return 1;
+    case INDEX_op_vec_add:
+    case INDEX_op_vec_sub:
+    case INDEX_op_vec_and:
+    case INDEX_op_vec_or:
+    case INDEX_op_vec_xor:
+    case INDEX_op_vec_andc:
+    case INDEX_op_vec_cmpeq:
+    case INDEX_op_vec_cmpgt:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+static bool env_access_is_store(TCGOpcode op)
+{
+    switch (op) {
+    CASE_OP_32_64(st8):
+    CASE_OP_32_64(st16):
+    case INDEX_op_st_i32:
+    case INDEX_op_st32_i64:
+    case INDEX_op_st_i64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool env_slot_overlaps(struct tcg_env_slot *slot,
+                              tcg_target_long offset, int size)
+{
+    int slot_size = slot->st_op == INDEX_op_st_i64 ? 8 : 4;
+
+    return slot->st_op
+        && offset < slot->offset + slot_size
+        && slot->offset < offset + size;
+}
+
+/* Forget the fields overlapping [OFFSET, OFFSET + SIZE).  */
+static void clobber_env_slots(tcg_target_long offset, int size)
+{
+    int i;
+
+    for (i = 0; i < MAX_ENV_SLOTS; i++) {
+        if (env_slot_overlaps(&env_slots[i], offset, size)) {
+            env_slots[i].st_op = 0;
+        }
+    }
+}
+
+/* The fields overlapping [OFFSET, OFFSET + SIZE) are read from memory,
+   so their pending stores are needed.  */
+static void read_env_slots(tcg_target_long offset, int size)
+{
+    int i;
+
+    for (i = 0; i < MAX_ENV_SLOTS; i++) {
+        if (env_slot_overlaps(&env_slots[i], offset, size)) {
+            env_slots[i].store_index = -1;
+        }
+    }
+}
+
+static bool env_val_in_use(TCGArg temp)
+{
+    int i;
+
+    for (i = 0; i < MAX_ENV_SLOTS; i++) {
+        if (env_slots[i].st_op && env_slots[i].val == temp) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* TEMP is about to be overwritten, so it no longer holds any field.  */
+static void clobber_env_val(TCGArg temp)
+{
+    int i;
+
+    for (i = 0; i < MAX_ENV_SLOTS; i++) {
+        if (env_slots[i].st_op && env_slots[i].val == temp) {
+            env_slots[i].val = -1;
+        }
+    }
+}
+
+/* Pick the temp that receives a new value of TEMP.  */
+static TCGArg rename_env_output(TCGContext *s, TCGArg temp)
+{
+    TCGTemp *ts = &s->temps[temp];
+    TCGArg cur = env_renames[temp];
+
+    if (!env_val_in_use(cur)) {
+        return cur;
+    }
+    env_renames[temp] = temp;
+    if (temp != cur && !env_val_in_use(temp)) {
+        return temp;
+    }
+    /* Only plain temps die at the end of the basic block, and the
+       halves of a 64-bit temp on a 32-bit host must stay together.  */
+    if (temp < s->nb_globals || ts->temp_local || ts->base_type != ts->type
+        || env_nb_renames >= MAX_ENV_RENAMES
+        || s->nb_temps >= TCG_MAX_TEMPS) {
+        clobber_env_val(temp);
+        return temp;
+    }
+    ts = &s->temps[s->nb_temps];
+    ts->base_type = s->temps[temp].type;
+    ts->type = s->temps[temp].type;
+    ts->temp_allocated = 1;
+    ts->temp_local = 0;
+    ts->fixed_reg = 0;
+    ts->name = NULL;
+    env_renames[temp] = s->nb_temps;
+    env_renames[s->nb_temps] = s->nb_temps;
+    env_nb_renames++;
+    return s->nb_temps++;
+}
+
+static struct tcg_env_slot *find_env_slot(tcg_target_long offset,
+                                          TCGOpcode st_op)
+{
+    int i;
+
+    for (i = 0; i < MAX_ENV_SLOTS; i++) {
+        if (env_slots[i].st_op == st_op && env_slots[i].offset == offset) {
+            return &env_slots[i];
+        }
+    }
+    return NULL;
+}
+
+static void new_env_slot(tcg_target_long offset, TCGOpcode st_op,
+                         TCGArg val, int store_index)
+{
+    struct tcg_env_slot *slot = NULL;
+    int i;
+
+    for (i = 0; i < MAX_ENV_SLOTS; i++) {
+        if (!env_slots[i].st_op) {
+            slot = &env_slots[i];
+            break;
+        }
+    }
+    if (!slot) {
+        /* Evicting a slot only loses an opportunity; its store stays.  */
+        slot = &env_slots[env_slots_next];
+        env_slots_next = (env_slots_next + 1) % MAX_ENV_SLOTS;
+    }
+    slot->offset = offset;
+    slot->st_op = st_op;
+    slot->val = val;
+    slot->store_index = store_index;
+}
+
+static bool temp_is_env(TCGContext *s, TCGArg temp)
+{
+    return s->temps[temp].fixed_reg && s->temps[temp].reg == TCG_AREG0;
+}
+
+/* The register allocator loads globals lazily from their canonical
+   slot, which is a read we do not see; never drop stores there.  */
+static bool env_field_backs_global(TCGContext *s, tcg_target_long offset,
+                                   int size)
+{
+    TCGTemp *ts;
+    int i;
+
+    for (i = 0; i < s->nb_globals; i++) {
+        ts = &s->temps[i];
+        if (ts->fixed_reg) {
+            continue;
+        }
+        if (ts->mem_reg != TCG_AREG0) {
+            return true;
+        }
+        if (offset < ts->mem_offset + (ts->type == TCG_TYPE_I64 ? 8 : 4)
+            && ts->mem_offset < offset + size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static TCGArg *tcg_env_forwarding(TCGContext *s, uint16_t *tcg_opc_ptr,
+                                  TCGArg *args, TCGOpDef *tcg_op_defs)
+{
+    int i, nb_ops, op_index, nb_args, nb_oargs, nb_iargs, size, nb_srcs;
+    TCGOpcode op, st_op;
+    const TCGOpDef *def;
+    TCGArg *gen_args, *oargs;
+    struct tcg_env_slot *slot;
+
+    env_nb_renames = 0;
+    reset_env_slots();
+    reset_env_renames(s);
+
+    nb_ops = tcg_opc_ptr - s->gen_opc_buf;
+    gen_args = args;
+    for (op_index = 0; op_index < nb_ops; op_index++) {
+        op = s->gen_opc_buf[op_index];
+        def = &tcg_op_defs[op];
+        oargs = args;
+        if (op == INDEX_op_call) {
+            oargs = args + 1;
+            nb_oargs = args[0] >> 16;
+            nb_iargs = args[0] & 0xffff;
+            nb_args = nb_oargs + nb_iargs + 3;
+        } else if (op == INDEX_op_nopn) {
+            nb_oargs = nb_iargs = 0;
+            nb_args = args[0];
+        } else {
+            nb_oargs = def->nb_oargs;
+            nb_iargs = def->nb_iargs;
+            nb_args = def->nb_args;
+        }
+
+        for (i = nb_oargs; i < nb_oargs + nb_iargs; i++) {
+            if (oargs[i] != TCG_CALL_DUMMY_ARG) {
+                oargs[i] = env_renames[oargs[i]];
+            }
+        }
+        if (op == INDEX_op_discard) {
+            args[0] = env_renames[args[0]];
+            clobber_env_val(args[0]);
+        }
+
+        size = env_access_size(op);
+        nb_srcs = env_vec_sources(op);
+        if (nb_srcs) {
+            /* Vector ops read and write CPU state in memory: base, dofs,
+               aofs, bofs, oprsz.  */
+            if (!temp_is_env(s, args[0])) {
+                reset_env_slots();
+            } else {
+                read_env_slots(args[2], args[4]);
+                if (nb_srcs > 1) {
+                    read_env_slots(args[3], args[4]);
+                }
+                clobber_env_slots(args[1], args[4]);
+            }
+        } else if (size == 0) {
+            if (op == INDEX_op_call ||
+                (def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS))) {
+                /* Helpers take env and may access any field; memory
+                   accesses may fault and exits leave the TB.  */
+                reset_env_slots();
+            }
+            if (def->flags & TCG_OPF_BB_END) {
+                reset_env_renames(s);
+            }
+        } else if (!temp_is_env(s, args[1])) {
+            /* The pointer may alias any field.  */
+            if (env_access_is_store(op)) {
+                reset_env_slots();
+            } else {
+                flush_env_stores();
+            }
+        } else if (env_access_is_store(op)) {
+            st_op = (op == INDEX_op_st_i32 || op == INDEX_op_st_i64) ? op : 0;
+            slot = st_op ? find_env_slot(args[2], st_op) : NULL;
+            if (slot && slot->store_index >= 0) {
+                /* The previous store is dead; it kept its arguments.  */
+                s->gen_opc_buf[slot->store_index] = INDEX_op_nop3;
+            }
+            clobber_env_slots(args[2], size);
+            if (st_op) {
+                new_env_slot(args[2], st_op, args[0],
+                             env_field_backs_global(s, args[2], size)
+                             ? -1 : op_index);
+            }
+        } else {
+            st_op = op == INDEX_op_ld_i32 ? INDEX_op_st_i32
+                  : op == INDEX_op_ld_i64 ? INDEX_op_st_i64 : 0;
+            slot = st_op ? find_env_slot(args[2], st_op) : NULL;
+            if (slot && slot->val != (TCGArg)-1) {
+                /* The field is still held by a temp, and memory is not
+                   read at all.  */
+                gen_args[0] = rename_env_output(s, args[0]);
+                if (gen_args[0] == slot->val) {
+                    s->gen_opc_buf[op_index] = INDEX_op_nop;
+                } else {
+                    s->gen_opc_buf[op_index] = op_to_mov(op);
+                    gen_args[1] = slot->val;
+                    gen_args += 2;
+                }
+                args += nb_args;
+                continue;
+            }
+            read_env_slots(args[2], size);
+            if (st_op) {
+                args[0] = rename_env_output(s, args[0]);
+                if (slot) {
+                    slot->val = args[0];
+                } else {
+                    new_env_slot(args[2], st_op, args[0], -1);
+                }
+                nb_oargs = 0;
+            }
+        }
+
+        for (i = 0; i < nb_oargs; i++) {
+            oargs[i] = rename_env_output(s, oargs[i]);
+        }
+
+        for (i = 0; i < nb_args; i++) {
+            gen_args[i] = args[i];
+        }
+        args += nb_args;
+        gen_args += nb_args;
+    }
+
+    return gen_args;
+}
+
 TCGArg *tcg_optimize(TCGContext *s, uint16_t *tcg_opc_ptr,
         TCGArg *args, TCGOpDef *tcg_op_defs)
 {
     TCGArg *res;
     res = tcg_constant_folding(s, tcg_opc_ptr, args, tcg_op_defs);
+    res = tcg_env_forwarding(s, tcg_opc_ptr, args, tcg_op_defs);
     return res;
 }
@@ -0,0 +1,296 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump generation.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef CONFIG_LINUX
+#include <sys/mman.h>
+#endif
+
+#include "qemu-common.h"
+#define NO_CPU_IO_DEFS
+#include "cpu.h"
+#include "disas/disas.h"
+#include "elf.h"
+#include "tcg/perf.h"
+
+#ifndef O_NOFOLLOW
+#define O_NOFOLLOW 0
+#endif
+
+static FILE *perfmap;
+static FILE *jitdump;
+static void *jitdump_marker;
+static uint64_t jitdump_code_index;
+
+static FILE *safe_fopen_w(const char *path)
+{
+    FILE *f;
+    int fd;
+
+    /* Avoid being fooled by a symlink planted in a shared directory.  */
+    fd = qemu_open(path, O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+    if (fd == -1) {
+        return NULL;
+    }
+    f = fdopen(fd, "w+");
+    if (f == NULL) {
+        close(fd);
+    }
+    return f;
+}
+
+void perf_enable_perfmap(void)
+{
+    char map_file[32];
+
+    snprintf(map_file, sizeof(map_file), "/tmp/perf-%d.map", getpid());
+    perfmap = safe_fopen_w(map_file);
+    if (perfmap == NULL) {
+        fprintf(stderr, "qemu: could not open %s: %s\n",
+                map_file, strerror(errno));
+        return;
+    }
+    /* perf only reads the map after recording, so there is no need to
+       push every line out as it is written.  */
+    setvbuf(perfmap, NULL, _IOFBF, 64 * 1024);
+}
+
+/* The jitdump format, as understood by "perf inject --jit".  See
+   tools/perf/Documentation/jitdump-specification.txt in the Linux
+   kernel sources.  */
+#define JITHEADER_MAGIC     0x4A695444
+#define JITHEADER_VERSION   1
+
+enum {
+    JIT_CODE_LOAD = 0,
+    JIT_CODE_CLOSE = 3,
+};
+
+struct jitheader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct jr_prefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jr_code_load {
+    struct jr_prefix p;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+/* perf matches the records against its samples, so the clock must
+   be the one selected with "perf record -k mono".  */
+static uint64_t get_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Take the machine from our own executable so that perf can pick the
+   right disassembler for the code bytes in the dump.  */
+static uint32_t get_e_machine(void)
+{
+    union {
+        Elf32_Ehdr h32;
+        Elf64_Ehdr h64;
+    } elf_header;
+    uint32_t e_machine = EM_NONE;
+    FILE *exe;
+    size_t n;
+
+    exe = fopen("/proc/self/exe", "r");
+    if (exe == NULL) {
+        return e_machine;
+    }
+    n = fread(&elf_header, 1, sizeof(elf_header), exe);
+    fclose(exe);
+    if (n < sizeof(elf_header.h32) ||
+        memcmp(elf_header.h32.e_ident, ELFMAG, SELFMAG) != 0) {
+        return e_machine;
+    }
+    /* e_machine sits at the same offset in both classes.  */
+    return elf_header.h32.e_machine;
+}
+
+void perf_enable_jitdump(void)
+{
+    struct jitheader header;
+    char jitdump_file[32];
+
+    snprintf(jitdump_file, sizeof(jitdump_file), "jit-%d.dump", getpid());
+    jitdump = safe_fopen_w(jitdump_file);
+    if (jitdump == NULL) {
+        fprintf(stderr, "qemu: could not open %s: %s\n",
+                jitdump_file, strerror(errno));
+        return;
+    }
+
+#ifdef CONFIG_LINUX
+    /* "perf record" notices the file through this executable mapping,
+       and "perf inject" then merges the records into perf.data.  */
+    jitdump_marker = mmap(NULL, getpagesize(), PROT_READ | PROT_EXEC,
+                          MAP_PRIVATE, fileno(jitdump), 0);
+    if (jitdump_marker == MAP_FAILED) {
+        fprintf(stderr, "qemu: could not map %s: %s\n",
+                jitdump_file, strerror(errno));
+        fclose(jitdump);
+        jitdump = NULL;
+        jitdump_marker = NULL;
+        return;
+    }
+#endif
+
+    memset(&header, 0, sizeof(header));
+    header.magic = JITHEADER_MAGIC;
+    header.version = JITHEADER_VERSION;
+    header.total_size = sizeof(header);
+    header.elf_mach = get_e_machine();
+    header.pid = getpid();
+    header.timestamp = get_timestamp();
+    fwrite(&header, sizeof(header), 1, jitdump);
+}
+
+static const char *guest_symbol(uint64_t guest_pc)
+{
+    const char *symbol = lookup_symbol((target_ulong)guest_pc);
+
+    return symbol[0] ? symbol : NULL;
+}
+
+void perf_report_code(uint64_t guest_pc, size_t guest_size,
+                      const void *start, size_t host_size)
+{
+    const char *symbol;
+    char name[128];
+
+    if (!perfmap && !jitdump) {
+        return;
+    }
+
+    symbol = guest_symbol(guest_pc);
+    if (symbol) {
+        snprintf(name, sizeof(name), "guest-0x%" PRIx64 " [%zu] %s",
+                 guest_pc, guest_size, symbol);
+    } else {
+        snprintf(name, sizeof(name), "guest-0x%" PRIx64 " [%zu]",
+                 guest_pc, guest_size);
+    }
+
+    if (perfmap) {
+        fprintf(perfmap, "%" PRIxPTR " %zx %s\n",
+                (uintptr_t)start, host_size, name);
+    }
+
+    if (jitdump) {
+        struct jr_code_load load;
+        size_t name_len = strlen(name) + 1;
+
+        load.p.id = JIT_CODE_LOAD;
+        load.p.total_size = sizeof(load) + name_len + host_size;
+        load.p.timestamp = get_timestamp();
+        load.pid = getpid();
+        load.tid = qemu_get_thread_id();
+        load.vma = (uintptr_t)start;
+        load.code_addr = (uintptr_t)start;
+        load.code_size = host_size;
+        load.code_index = jitdump_code_index++;
+        /* The code bytes let "perf annotate" disassemble the TB.  */
+        fwrite(&load, sizeof(load), 1, jitdump);
+        fwrite(name, name_len, 1, jitdump);
+        fwrite(start, host_size, 1, jitdump);
+    }
+}
+
+void perf_report_flush(void)
+{
+    /* The map has no notion of time, so a stale entry would be blamed
+       for samples in whatever code later reuses its address.  Start
+       over instead.  The jitdump records carry a timestamp, and perf
+       already lets a newer load shadow an older one at the same
+       address.  */
+    if (perfmap) {
+        fflush(perfmap);
+        rewind(perfmap);
+        if (ftruncate(fileno(perfmap), 0) != 0) {
+            fprintf(stderr, "qemu: could not truncate perf map: %s\n",
+                    strerror(errno));
+        }
+    }
+}
+
+void perf_report_unmap(const void *start, size_t size)
+{
+    GString *kept;
+    char line[256];
+    uintptr_t addr;
+
+    /* As in perf_report_flush, only the map needs to forget the old
+       code; rewrite it without the lines that fall in the range.  */
+    if (!perfmap) {
+        return;
+    }
+    kept = g_string_new(NULL);
+    fflush(perfmap);
+    rewind(perfmap);
+    while (fgets(line, sizeof(line), perfmap)) {
+        addr = strtoull(line, NULL, 16);
+        if (addr < (uintptr_t)start || addr - (uintptr_t)start >= size) {
+            g_string_append(kept, line);
+        }
+    }
+    rewind(perfmap);
+    if (ftruncate(fileno(perfmap), 0) != 0) {
+        fprintf(stderr, "qemu: could not truncate perf map: %s\n",
+                strerror(errno));
+    }
+    fwrite(kept->str, 1, kept->len, perfmap);
+    g_string_free(kept, TRUE);
+}
+
+void perf_exit(void)
+{
+    if (perfmap) {
+        fclose(perfmap);
+        perfmap = NULL;
+    }
+
+    if (jitdump) {
+        struct jr_prefix close_record;
+
+        close_record.id = JIT_CODE_CLOSE;
+        close_record.total_size = sizeof(close_record);
+        close_record.timestamp = get_timestamp();
+        fwrite(&close_record, sizeof(close_record), 1, jitdump);
+#ifdef CONFIG_LINUX
+        munmap(jitdump_marker, getpagesize());
+        jitdump_marker = NULL;
+#endif
+        fclose(jitdump);
+        jitdump = NULL;
+    }
+}
@@ -0,0 +1,37 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump generation.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef TCG_PERF_H
+#define TCG_PERF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Start writing perf-<pid>.map to the system temporary directory.  */
+void perf_enable_perfmap(void);
+
+/* Start writing jit-<pid>.dump to the current working directory.  */
+void perf_enable_jitdump(void);
+
+/* Add information about a newly generated TB covering 'guest_size'
+   bytes of guest code at 'guest_pc', translated to 'host_size' bytes
+   of host code at 'start'.  */
+void perf_report_code(uint64_t guest_pc, size_t guest_size,
+                      const void *start, size_t host_size);
+
+/* Retire every entry reported so far; called when the code buffer
+   is flushed and addresses are about to be reused.  */
+void perf_report_flush(void);
+
+/* Retire the entries for code in ['start', 'start' + 'size'); called
+   when part of the code buffer is about to be reused.  */
+void perf_report_unmap(const void *start, size_t size);
+
+/* Close the output files.  */
+void perf_exit(void);
+
+#endif /* TCG_PERF_H */
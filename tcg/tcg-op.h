@@ -2727,3 +2727,306 @@ static inline void tcg_gen_qemu_st64(TCGv_i64 arg, TCGv addr, int mem_index)
                                                  TCGV_PTR_TO_NAT(A), (B))
 #define tcg_gen_ext_i32_ptr(R, A) tcg_gen_ext_i32_i64(TCGV_PTR_TO_NAT(R), (A))
 #endif /* TCG_TARGET_REG_BITS != 32 */
+
+/* Vector operations on OPRSZ bytes (8 or 16) at offsets from BASE, with
+   elements of 1 << VECE bytes; see tcg/README.  Element sizes that the
+   vector opcodes do not take are expanded here.  */
+
+static inline void tcg_gen_vec_op(TCGOpcode opc, TCGv_ptr base,
+                                  tcg_target_long dofs, tcg_target_long aofs,
+                                  TCGArg bofs, int oprsz, int vece)
+{
+    *tcg_ctx.gen_opc_ptr++ = opc;
+    *tcg_ctx.gen_opparam_ptr++ = GET_TCGV_PTR(base);
+    *tcg_ctx.gen_opparam_ptr++ = dofs;
+    *tcg_ctx.gen_opparam_ptr++ = aofs;
+    *tcg_ctx.gen_opparam_ptr++ = bofs;
+    *tcg_ctx.gen_opparam_ptr++ = oprsz;
+    *tcg_ctx.gen_opparam_ptr++ = vece;
+}
+
+/* Call a tcg-runtime.c vector helper on NB_PTRS operands.  */
+static inline void tcg_gen_vec_call(void *func, TCGv_ptr base,
+                                    tcg_target_long dofs, tcg_target_long aofs,
+                                    tcg_target_long bofs, int nb_ptrs,
+                                    uint32_t desc)
+{
+    tcg_target_long ofs[3] = { dofs, aofs, bofs };
+    TCGv_ptr ptr[3];
+    TCGv_i32 t_desc;
+    TCGArg args[4];
+    int i, sizemask = 0;
+
+    for (i = 0; i < nb_ptrs; i++) {
+        ptr[i] = tcg_temp_new_ptr();
+        tcg_gen_addi_ptr(ptr[i], base, ofs[i]);
+        args[i] = GET_TCGV_PTR(ptr[i]);
+        sizemask |= tcg_gen_sizemask(i + 1, TCG_TARGET_REG_BITS == 64, 0);
+    }
+    t_desc = tcg_const_i32(desc);
+    args[i] = GET_TCGV_I32(t_desc);
+    /* the helpers write CPU state through their pointers, never a global */
+    tcg_gen_helperN(func, TCG_CALL_NO_RWG, sizemask, TCG_CALL_DUMMY_ARG,
+                    nb_ptrs + 1, args);
+    tcg_temp_free_i32(t_desc);
+    for (i = 0; i < nb_ptrs; i++) {
+        tcg_temp_free_ptr(ptr[i]);
+    }
+}
+
+/* Apply FN to each 64-bit chunk; without B when FN is NULL.  */
+static inline void tcg_gen_vec_expand_i64(void (*fn)(TCGv_i64, TCGv_i64,
+                                                     TCGv_i64),
+                                          TCGv_ptr base, tcg_target_long dofs,
+                                          tcg_target_long aofs,
+                                          tcg_target_long bofs, int oprsz)
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    int i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(t0, base, aofs + i);
+        if (fn) {
+            tcg_gen_ld_i64(t1, base, bofs + i);
+            fn(t0, t0, t1);
+        }
+        tcg_gen_st_i64(t0, base, dofs + i);
+    }
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t0);
+}
+
+static inline void tcg_gen_vec_expand_i64i(void (*fn)(TCGv_i64, TCGv_i64,
+                                                      int64_t),
+                                           TCGv_ptr base, tcg_target_long dofs,
+                                           tcg_target_long aofs, int64_t c,
+                                           int oprsz)
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    int i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(t0, base, aofs + i);
+        fn(t0, t0, c);
+        tcg_gen_st_i64(t0, base, dofs + i);
+    }
+    tcg_temp_free_i64(t0);
+}
+
+static inline void tcg_gen_vec_mov(TCGv_ptr base, tcg_target_long dofs,
+                                   tcg_target_long aofs, int oprsz)
+{
+    if (TCG_TARGET_HAS_vec) {
+        tcg_gen_vec_op(INDEX_op_vec_mov, base, dofs, aofs, 0, oprsz, 0);
+    } else {
+        tcg_gen_vec_expand_i64(NULL, base, dofs, aofs, 0, oprsz);
+    }
+}
+
+static inline void tcg_gen_vec_add(int vece, TCGv_ptr base,
+                                   tcg_target_long dofs, tcg_target_long aofs,
+                                   tcg_target_long bofs, int oprsz)
+{
+    if (TCG_TARGET_HAS_vec) {
+        tcg_gen_vec_op(INDEX_op_vec_add, base, dofs, aofs, bofs, oprsz, vece);
+    } else if (vece == 3) {
+        tcg_gen_vec_expand_i64(tcg_gen_add_i64, base, dofs, aofs, bofs, oprsz);
+    } else {
+        tcg_gen_vec_call(tcg_helper_vec_add, base, dofs, aofs, bofs, 3,
+                         TCG_VEC_DESC(oprsz, vece, 0));
+    }
+}
+
+static inline void tcg_gen_vec_sub(int vece, TCGv_ptr base,
+                                   tcg_target_long dofs, tcg_target_long aofs,
+                                   tcg_target_long bofs, int oprsz)
+{
+    if (TCG_TARGET_HAS_vec) {
+        tcg_gen_vec_op(INDEX_op_vec_sub, base, dofs, aofs, bofs, oprsz, vece);
+    } else if (vece == 3) {
+        tcg_gen_vec_expand_i64(tcg_gen_sub_i64, base, dofs, aofs, bofs, oprsz);
+    } else {
+        tcg_gen_vec_call(tcg_helper_vec_sub, base, dofs, aofs, bofs, 3,
+                         TCG_VEC_DESC(oprsz, vece, 0));
+    }
+}
+
+static inline void tcg_gen_vec_and(TCGv_ptr base, tcg_target_long dofs,
+                                   tcg_target_long aofs, tcg_target_long bofs,
+                                   int oprsz)
+{
+    if (TCG_TARGET_HAS_vec) {
+        tcg_gen_vec_op(INDEX_op_vec_and, base, dofs, aofs, bofs, oprsz, 0);
+    } else {
+        tcg_gen_vec_expand_i64(tcg_gen_and_i64, base, dofs, aofs, bofs, oprsz);
+    }
+}
+
+static inline void tcg_gen_vec_or(TCGv_ptr base, tcg_target_long dofs,
+                                  tcg_target_long aofs, tcg_target_long bofs,
+                                  int oprsz)
+{
+    if (TCG_TARGET_HAS_vec) {
+        tcg_gen_vec_op(INDEX_op_vec_or, base, dofs, aofs, bofs, oprsz, 0);
+    } else {
+        tcg_gen_vec_expand_i64(tcg_gen_or_i64, base, dofs, aofs, bofs, oprsz);
+    }
+}
+
+static inline void tcg_gen_vec_xor(TCGv_ptr base, tcg_target_long dofs,
+                                   tcg_target_long aofs, tcg_target_long bofs,
+                                   int oprsz)
+{
+    if (TCG_TARGET_HAS_vec) {
+        tcg_gen_vec_op(INDEX_op_vec_xor, base, dofs, aofs, bofs, oprsz, 0);
+    } else {
+        tcg_gen_vec_expand_i64(tcg_gen_xor_i64, base, dofs, aofs, bofs, oprsz);
+    }
+}
+
+static inline void tcg_gen_vec_andc(TCGv_ptr base, tcg_target_long dofs,
+                                    tcg_target_long aofs, tcg_target_long bofs,
+                                    int oprsz)
+{
+    if (TCG_TARGET_HAS_vec) {
+        tcg_gen_vec_op(INDEX_op_vec_andc, base, dofs, aofs, bofs, oprsz, 0);
+    } else {
+        tcg_gen_vec_expand_i64(tcg_gen_andc_i64, base, dofs, aofs, bofs,
+                               oprsz);
+    }
+}
+
+static inline void tcg_gen_vec_cmpeq(int vece, TCGv_ptr base,
+                                     tcg_target_long dofs,
+                                     tcg_target_long aofs,
+                                     tcg_target_long bofs, int oprsz)
+{
+    if (TCG_TARGET_HAS_vec && vece <= 2) {
+        tcg_gen_vec_op(INDEX_op_vec_cmpeq, base, dofs, aofs, bofs, oprsz,
+                       vece);
+    } else {
+        tcg_gen_vec_call(tcg_helper_vec_cmpeq, base, dofs, aofs, bofs, 3,
+                         TCG_VEC_DESC(oprsz, vece, 0));
+    }
+}
+
+static inline void tcg_gen_vec_cmpgt(int vece, TCGv_ptr base,
+                                     tcg_target_long dofs,
+                                     tcg_target_long aofs,
+                                     tcg_target_long bofs, int oprsz)
+{
+    if (TCG_TARGET_HAS_vec && vece <= 2) {
+        tcg_gen_vec_op(INDEX_op_vec_cmpgt, base, dofs, aofs, bofs, oprsz,
+                       vece);
+    } else {
+        tcg_gen_vec_call(tcg_helper_vec_cmpgt, base, dofs, aofs, bofs, 3,
+                         TCG_VEC_DESC(oprsz, vece, 0));
+    }
+}
+
+/* The shift count must be less than the element width.  */
+static inline void tcg_gen_vec_shli(int vece, TCGv_ptr base,
+                                    tcg_target_long dofs, tcg_target_long aofs,
+                                    int shift, int oprsz)
+{
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    if (TCG_TARGET_HAS_vec && vece >= 1) {
+        tcg_gen_vec_op(INDEX_op_vec_shli, base, dofs, aofs, shift, oprsz,
+                       vece);
+    } else if (vece == 3) {
+        tcg_gen_vec_expand_i64i(tcg_gen_shli_i64, base, dofs, aofs, shift,
+                                oprsz);
+    } else {
+        tcg_gen_vec_call(tcg_helper_vec_shli, base, dofs, aofs, 0, 2,
+                         TCG_VEC_DESC(oprsz, vece, shift));
+    }
+}
+
+static inline void tcg_gen_vec_shri(int vece, TCGv_ptr base,
+                                    tcg_target_long dofs, tcg_target_long aofs,
+                                    int shift, int oprsz)
+{
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    if (TCG_TARGET_HAS_vec && vece >= 1) {
+        tcg_gen_vec_op(INDEX_op_vec_shri, base, dofs, aofs, shift, oprsz,
+                       vece);
+    } else if (vece == 3) {
+        tcg_gen_vec_expand_i64i(tcg_gen_shri_i64, base, dofs, aofs, shift,
+                                oprsz);
+    } else {
+        tcg_gen_vec_call(tcg_helper_vec_shri, base, dofs, aofs, 0, 2,
+                         TCG_VEC_DESC(oprsz, vece, shift));
+    }
+}
+
+static inline void tcg_gen_vec_sari(int vece, TCGv_ptr base,
+                                    tcg_target_long dofs, tcg_target_long aofs,
+                                    int shift, int oprsz)
+{
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    if (TCG_TARGET_HAS_vec && vece >= 1 && vece <= 2) {
+        tcg_gen_vec_op(INDEX_op_vec_sari, base, dofs, aofs, shift, oprsz,
+                       vece);
+    } else if (vece == 3) {
+        tcg_gen_vec_expand_i64i(tcg_gen_sari_i64, base, dofs, aofs, shift,
+                                oprsz);
+    } else {
+        tcg_gen_vec_call(tcg_helper_vec_sari, base, dofs, aofs, 0, 2,
+                         TCG_VEC_DESC(oprsz, vece, shift));
+    }
+}
+
+/* Replicate the low 1 << VECE bytes of VAL into every element.  A pair
+   of 64-bit stores is as fast as any vector sequence.  */
+static inline void tcg_gen_vec_dup_i32(int vece, TCGv_ptr base,
+                                       tcg_target_long dofs, int oprsz,
+                                       TCGv_i32 val)
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    int i;
+
+    tcg_gen_extu_i32_i64(t0, val);
+    switch (vece) {
+    case 0:
+        tcg_gen_ext8u_i64(t0, t0);
+        tcg_gen_muli_i64(t0, t0, 0x0101010101010101ull);
+        break;
+    case 1:
+        tcg_gen_ext16u_i64(t0, t0);
+        tcg_gen_muli_i64(t0, t0, 0x0001000100010001ull);
+        break;
+    default:
+        tcg_gen_deposit_i64(t0, t0, t0, 32, 32);
+        break;
+    }
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_st_i64(t0, base, dofs + i);
+    }
+    tcg_temp_free_i64(t0);
+}
+
+static inline void tcg_gen_vec_dupi(int vece, TCGv_ptr base,
+                                    tcg_target_long dofs, int oprsz,
+                                    uint64_t val)
+{
+    TCGv_i64 t0;
+    int i;
+
+    switch (vece) {
+    case 0:
+        val = (uint8_t)val * 0x0101010101010101ull;
+        break;
+    case 1:
+        val = (uint16_t)val * 0x0001000100010001ull;
+        break;
+    case 2:
+        val = (uint32_t)val * 0x0000000100000001ull;
+        break;
+    }
+    t0 = tcg_const_i64(val);
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_st_i64(t0, base, dofs + i);
+    }
+    tcg_temp_free_i64(t0);
+}
@@ -158,6 +158,20 @@ DEF(eqv_i64, 1, 2, 0, IMPL64 | IMPL(TCG_TARGET_HAS_eqv_i64))
 DEF(nand_i64, 1, 2, 0, IMPL64 | IMPL(TCG_TARGET_HAS_nand_i64))
 DEF(nor_i64, 1, 2, 0, IMPL64 | IMPL(TCG_TARGET_HAS_nor_i64))
 
+/* vector ops on memory: base; dofs, aofs, bofs or imm, oprsz, vece */
+DEF(vec_mov, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(vec_add, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(vec_sub, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(vec_and, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(vec_or, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(vec_xor, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(vec_andc, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(vec_cmpeq, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(vec_cmpgt, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(vec_shli, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(vec_shri, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(vec_sari, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+
 /* QEMU specific */
 #if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
 DEF(debug_insn_start, 0, 0, 2, 0)
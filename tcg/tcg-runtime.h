@@ -15,4 +15,18 @@ int64_t tcg_helper_rem_i64(int64_t arg1, int64_t arg2);
 uint64_t tcg_helper_divu_i64(uint64_t arg1, uint64_t arg2);
 uint64_t tcg_helper_remu_i64(uint64_t arg1, uint64_t arg2);
 
+/* Operand size, element size and immediate of the vector helpers.  */
+#define TCG_VEC_DESC(oprsz, vece, imm) ((oprsz) | ((vece) << 8) | ((imm) << 16))
+#define TCG_VEC_OPRSZ(desc)            ((desc) & 0xff)
+#define TCG_VEC_VECE(desc)             (((desc) >> 8) & 0xff)
+#define TCG_VEC_IMM(desc)              ((desc) >> 16)
+
+void tcg_helper_vec_add(void *d, void *a, void *b, uint32_t desc);
+void tcg_helper_vec_sub(void *d, void *a, void *b, uint32_t desc);
+void tcg_helper_vec_cmpeq(void *d, void *a, void *b, uint32_t desc);
+void tcg_helper_vec_cmpgt(void *d, void *a, void *b, uint32_t desc);
+void tcg_helper_vec_shli(void *d, void *a, uint32_t desc);
+void tcg_helper_vec_shri(void *d, void *a, uint32_t desc);
+void tcg_helper_vec_sari(void *d, void *a, uint32_t desc);
+
 #endif
@@ -171,6 +171,33 @@ int gen_new_label(void)
     return idx;
 }
 
+/* Record the immediate about to be written at s->code_ptr.  */
+static inline void tcg_out_host_reloc(TCGContext *s, int type,
+                                      tcg_target_long value)
+{
+    int n = s->nb_host_relocs;
+
+    if (n < 0) {
+        return;
+    }
+    if (n < TCG_MAX_HOST_RELOCS) {
+        s->host_relocs[n].offset = s->code_ptr - s->code_buf;
+        s->host_relocs[n].type = type;
+        s->host_relocs[n].value = value;
+    }
+    s->nb_host_relocs = n + 1;
+}
+
+/* Mark the immediate recorded last as the address of a far branch.  */
+static inline void tcg_out_host_reloc_far(TCGContext *s)
+{
+    int n = s->nb_host_relocs;
+
+    if (n > 0 && n <= TCG_MAX_HOST_RELOCS) {
+        s->host_relocs[n - 1].type |= TCG_HOST_RELOC_FAR;
+    }
+}
+
 #include "tcg-target.c"
 
 /* pool based memory allocation */
@@ -226,6 +253,46 @@ void tcg_pool_reset(TCGContext *s)
     s->pool_current = NULL;
 }
 
+void tcg_pool_delete(TCGContext *s)
+{
+    TCGPool *p, *t;
+
+    tcg_pool_reset(s);
+    for (p = s->pool_first; p; p = t) {
+        t = p->next;
+        g_free(p);
+    }
+    s->pool_first = NULL;
+}
+
+#if defined(CONFIG_USER_ONLY)
+/* Give the calling thread a context of its own, so that it can generate
+   code while other threads do.  tcg_init_ctx has the globals, the
+   helpers and the prologue, and must not change after the first thread
+   registers.  */
+void tcg_register_thread(void)
+{
+    TCGContext *s = g_malloc(sizeof(*s));
+
+    memcpy(s, &tcg_init_ctx, sizeof(*s));
+    s->pool_first = s->pool_current = s->pool_first_large = NULL;
+    s->pool_cur = s->pool_end = NULL;
+    s->tb_invalidated_flag = 0;
+    tls_var(tcg_ctx_ptr) = s;
+}
+
+void tcg_unregister_thread(void)
+{
+    TCGContext *s = tls_var(tcg_ctx_ptr);
+
+    if (s != &tcg_init_ctx) {
+        tcg_pool_delete(s);
+        g_free(s);
+        tls_var(tcg_ctx_ptr) = &tcg_init_ctx;
+    }
+}
+#endif
+
 void tcg_context_init(TCGContext *s)
 {
     int op, total_args, n;
@@ -235,6 +302,8 @@ void tcg_context_init(TCGContext *s)
 
     memset(s, 0, sizeof(*s));
     s->nb_globals = 0;
+    s->nb_host_ptrs = -1;
+    s->nb_host_relocs = -1;
     
     /* Count total number of arguments and allocate the corresponding
        space */
@@ -256,7 +325,34 @@ void tcg_context_init(TCGContext *s)
         sorted_args += n;
         args_ct += n;
     }
-    
+
+    /* Register the runtime helpers so that the op dumps name them.  */
+#define TCG_RUNTIME_HELPER(name) \
+    tcg_register_helper(tcg_helper_ ## name, "tcg_helper_" #name)
+    TCG_RUNTIME_HELPER(div_i32);
+    TCG_RUNTIME_HELPER(rem_i32);
+    TCG_RUNTIME_HELPER(divu_i32);
+    TCG_RUNTIME_HELPER(remu_i32);
+    TCG_RUNTIME_HELPER(shl_i64);
+    TCG_RUNTIME_HELPER(shr_i64);
+    TCG_RUNTIME_HELPER(sar_i64);
+    TCG_RUNTIME_HELPER(div_i64);
+    TCG_RUNTIME_HELPER(rem_i64);
+    TCG_RUNTIME_HELPER(divu_i64);
+    TCG_RUNTIME_HELPER(remu_i64);
+#undef TCG_RUNTIME_HELPER
+
+#define TCG_VEC_HELPER(name) \
+    tcg_register_helper(tcg_helper_vec_ ## name, "tcg_helper_vec_" #name)
+    TCG_VEC_HELPER(add);
+    TCG_VEC_HELPER(sub);
+    TCG_VEC_HELPER(cmpeq);
+    TCG_VEC_HELPER(cmpgt);
+    TCG_VEC_HELPER(shli);
+    TCG_VEC_HELPER(shri);
+    TCG_VEC_HELPER(sari);
+#undef TCG_VEC_HELPER
+
     tcg_target_init(s);
 }
 
@@ -295,6 +391,7 @@ void tcg_func_start(TCGContext *s)
 
     s->gen_opc_ptr = s->gen_opc_buf;
     s->gen_opparam_ptr = s->gen_opparam_buf;
+    s->nb_host_ptrs = s->record_host_relocs ? 0 : -1;
 
 #if defined(CONFIG_QEMU_LDST_OPTIMIZATION) && defined(CONFIG_SOFTMMU)
     /* Initialize qemu_ld/st labels to assist code generation at the end of TB
@@ -590,10 +687,52 @@ int tcg_check_temp_count(void)
 }
 #endif
 
+static inline unsigned int helper_hash(TCGContext *s, tcg_target_ulong func)
+{
+    /* Function addresses are aligned, so mix the low bits away.  */
+    return ((func >> 2) * 0x9e3779b1u) & (s->helper_hash_size - 1);
+}
+
+static void helper_hash_insert(TCGContext *s, int idx)
+{
+    unsigned int h = helper_hash(s, s->helpers[idx].func);
+
+    while (s->helper_hash[h] != 0) {
+        h = (h + 1) & (s->helper_hash_size - 1);
+    }
+    s->helper_hash[h] = idx + 1;
+}
+
+static TCGHelperInfo *tcg_find_helper(TCGContext *s, tcg_target_ulong val)
+{
+    unsigned int h;
+    int idx;
+
+    if (s->helper_hash_size == 0) {
+        return NULL;
+    }
+    h = helper_hash(s, val);
+    while ((idx = s->helper_hash[h]) != 0) {
+        if (s->helpers[idx - 1].func == val) {
+            return &s->helpers[idx - 1];
+        }
+        h = (h + 1) & (s->helper_hash_size - 1);
+    }
+    return NULL;
+}
+
 void tcg_register_helper(void *func, const char *name)
 {
     TCGContext *s = &tcg_ctx;
-    int n;
+    TCGHelperInfo *th;
+    int i, n;
+
+    /* Several translators may register the same helper.  */
+    th = tcg_find_helper(s, (tcg_target_ulong)func);
+    if (th) {
+        return;
+    }
+
     if ((s->nb_helpers + 1) > s->allocated_helpers) {
         n = s->allocated_helpers;
         if (n == 0) {
@@ -607,6 +746,19 @@ void tcg_register_helper(void *func, const char *name)
     s->helpers[s->nb_helpers].func = (tcg_target_ulong)func;
     s->helpers[s->nb_helpers].name = name;
     s->nb_helpers++;
+
+    /* keep the hash table at most half full */
+    if (s->nb_helpers * 2 > s->helper_hash_size) {
+        n = s->helper_hash_size ? s->helper_hash_size * 2 : 64;
+        g_free(s->helper_hash);
+        s->helper_hash = g_malloc0(n * sizeof(int));
+        s->helper_hash_size = n;
+        for (i = 0; i < s->nb_helpers; i++) {
+            helper_hash_insert(s, i);
+        }
+    } else {
+        helper_hash_insert(s, s->nb_helpers - 1);
+    }
 }
 
 /* Note: we convert the 64 bit args to 32 bit and do some alignment
@@ -821,49 +973,6 @@ char *tcg_get_arg_str_i64(TCGContext *s, char *buf, int buf_size, TCGv_i64 arg)
     return tcg_get_arg_str_idx(s, buf, buf_size, GET_TCGV_I64(arg));
 }
 
-static int helper_cmp(const void *p1, const void *p2)
-{
-    const TCGHelperInfo *th1 = p1;
-    const TCGHelperInfo *th2 = p2;
-    if (th1->func < th2->func)
-        return -1;
-    else if (th1->func == th2->func)
-        return 0;
-    else
-        return 1;
-}
-
-/* find helper definition (Note: A hash table would be better) */
-static TCGHelperInfo *tcg_find_helper(TCGContext *s, tcg_target_ulong val)
-{
-    int m, m_min, m_max;
-    TCGHelperInfo *th;
-    tcg_target_ulong v;
-
-    if (unlikely(!s->helpers_sorted)) {
-        qsort(s->helpers, s->nb_helpers, sizeof(TCGHelperInfo), 
-              helper_cmp);
-        s->helpers_sorted = 1;
-    }
-
-    /* binary search */
-    m_min = 0;
-    m_max = s->nb_helpers - 1;
-    while (m_min <= m_max) {
-        m = (m_min + m_max) >> 1;
-        th = &s->helpers[m];
-        v = th->func;
-        if (v == val)
-            return th;
-        else if (val < v) {
-            m_max = m - 1;
-        } else {
-            m_min = m + 1;
-        }
-    }
-    return NULL;
-}
-
 static const char * const cond_name[] =
 {
     [TCG_COND_NEVER] = "never",
@@ -2341,6 +2450,7 @@ int tcg_gen_code(TCGContext *s, uint8_t *gen_code_buf)
     }
 #endif
 
+    s->nb_host_relocs = s->record_host_relocs ? 0 : -1;
     tcg_gen_code_common(s, gen_code_buf, -1);
 
     /* flush instruction cache */
@@ -2356,6 +2466,7 @@ int tcg_gen_code(TCGContext *s, uint8_t *gen_code_buf)
    Return -1 if not found. */
 int tcg_gen_code_search_pc(TCGContext *s, uint8_t *gen_code_buf, long offset)
 {
+    s->nb_host_relocs = -1;
     return tcg_gen_code_common(s, gen_code_buf, offset);
 }
 
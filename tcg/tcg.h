@@ -22,6 +22,7 @@
  * THE SOFTWARE.
  */
 #include "qemu-common.h"
+#include "qemu/tls.h"
 
 /* Target word size (must be identical to pointer size). */
 #if UINTPTR_MAX == UINT32_MAX
@@ -89,6 +90,11 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_deposit_i64_valid(ofs, len) 1
 #endif
 
+/* The backend reports the immediates it emits, see TCGHostReloc.  */
+#ifndef TCG_TARGET_HAS_host_relocs
+#define TCG_TARGET_HAS_host_relocs      0
+#endif
+
 /* Only one of DIV or DIV2 should be defined.  */
 #if defined(TCG_TARGET_HAS_div_i32)
 #define TCG_TARGET_HAS_div2_i32         0
@@ -387,6 +393,34 @@ typedef struct TCGHelperInfo {
     const char *name;
 } TCGHelperInfo;
 
+/* An immediate that the backend wrote into the generated code, so that
+   the code can be moved to another TB, or to another process, and the
+   host addresses among these immediates fixed up.  A PCREL32 immediate
+   is the distance from its own end to 'value'.  */
+enum {
+    TCG_HOST_RELOC_ABS32,       /* zero-extended 32-bit immediate */
+    TCG_HOST_RELOC_ABS32S,      /* sign-extended 32-bit immediate */
+    TCG_HOST_RELOC_ABS64,
+    TCG_HOST_RELOC_PCREL32,
+};
+/* flag for the address of a call or jump too far for PCREL32 */
+#define TCG_HOST_RELOC_FAR      0x80
+
+typedef struct TCGHostReloc {
+    uint16_t offset;            /* of the immediate in the TB's code */
+    uint8_t type;
+    tcg_target_long value;
+} TCGHostReloc;
+
+#define TCG_MAX_HOST_RELOCS 512
+#define TCG_MAX_HOST_PTRS 256
+
+#if TCG_TARGET_HAS_host_relocs && !defined(CONFIG_SOFTMMU)
+/* Whether the code holds GUEST_BASE as an immediate, rather than reaching
+   guest memory through a segment register or with GUEST_BASE == 0.  */
+bool tcg_target_guest_base_in_code(void);
+#endif
+
 typedef struct TCGContext TCGContext;
 
 struct TCGContext {
@@ -427,7 +461,10 @@ struct TCGContext {
     TCGHelperInfo *helpers;
     int nb_helpers;
     int allocated_helpers;
-    int helpers_sorted;
+    /* open addressing hash of helpers indexed by function address;
+       each entry is an index into 'helpers' plus one, 0 if empty */
+    int *helper_hash;
+    int helper_hash_size;
 
 #ifdef CONFIG_PROFILER
     /* profiling info */
@@ -469,9 +506,28 @@ struct TCGContext {
     size_t code_gen_buffer_size;
     /* threshold to flush the translated code buffer */
     size_t code_gen_buffer_max_size;
-    uint8_t *code_gen_ptr;
 
-    TBContext tb_ctx;
+    /* set when translation blocks were invalidated since cpu_exec()
+       last looked one up, so that it does not chain to a stale one */
+    int tb_invalidated_flag;
+
+    /* When set, the host addresses given to tcg_const_ptr() and the
+       immediates written by tcg_gen_code() are recorded below, -1 in the
+       counts meaning that they are not.  The counts go past the array
+       sizes when there were too many.  */
+    bool record_host_relocs;
+    int nb_host_ptrs;
+    tcg_target_long host_ptrs[TCG_MAX_HOST_PTRS];
+    int nb_host_relocs;
+    TCGHostReloc host_relocs[TCG_MAX_HOST_RELOCS];
+
+#if defined(CONFIG_TCG_INTERPRETER)
+    /* value words of the register-or-constant operands of the
+       instruction being written, see tcg/tci/tcg-target.c */
+    tcg_target_ulong *tci_const_ptr[TCI_MAX_CONSTS];
+    tcg_target_ulong tci_const_val[TCI_MAX_CONSTS];
+    int tci_nb_consts;
+#endif
 
 #if defined(CONFIG_QEMU_LDST_OPTIMIZATION) && defined(CONFIG_SOFTMMU)
     /* labels info for qemu_ld/st IRs
@@ -481,7 +537,18 @@ struct TCGContext {
 #endif
 };
 
+#if defined(CONFIG_USER_ONLY)
+/* Guest threads generate code concurrently, each with its own copy of
+   tcg_init_ctx; see tcg_register_thread().  */
+extern TCGContext tcg_init_ctx;
+DECLARE_TLS(TCGContext *, tcg_ctx_ptr);
+#define tcg_ctx (*tls_var(tcg_ctx_ptr))
+
+void tcg_register_thread(void);
+void tcg_unregister_thread(void);
+#else
 extern TCGContext tcg_ctx;
+#endif
 
 /* pool based memory allocation */
 
@@ -504,6 +571,27 @@ static inline void *tcg_malloc(int size)
     }
 }
 
+/* Note a host address that the generated code is going to use.  */
+static inline tcg_target_long tcg_host_ptr(tcg_target_long ptr)
+{
+    TCGContext *s = &tcg_ctx;
+    int i, n = s->nb_host_ptrs;
+
+    if (n < 0 || ptr == 0) {
+        return ptr;
+    }
+    for (i = 0; i < n && i < TCG_MAX_HOST_PTRS; i++) {
+        if (s->host_ptrs[i] == ptr) {
+            return ptr;
+        }
+    }
+    if (n < TCG_MAX_HOST_PTRS) {
+        s->host_ptrs[n] = ptr;
+    }
+    s->nb_host_ptrs = n + 1;
+    return ptr;
+}
+
 void tcg_context_init(TCGContext *s);
 void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
@@ -629,7 +717,8 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I32(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I32(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i32((tcg_target_long)(V)))
+#define tcg_const_ptr(V) \
+    TCGV_NAT_TO_PTR(tcg_const_i32(tcg_host_ptr((tcg_target_long)(V))))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i32((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
@@ -640,7 +729,8 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I64(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I64(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i64((tcg_target_long)(V)))
+#define tcg_const_ptr(V) \
+    TCGV_NAT_TO_PTR(tcg_const_i64(tcg_host_ptr((tcg_target_long)(V))))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i64((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
@@ -660,7 +750,6 @@ TCGArg *tcg_optimize(TCGContext *s, uint16_t *tcg_opc_ptr, TCGArg *args,
 
 /* only used for debugging purposes */
 void tcg_register_helper(void *func, const char *name);
-const char *tcg_helper_get_name(TCGContext *s, void *func);
 void tcg_dump_ops(TCGContext *s);
 
 void dump_ops(const uint16_t *opc_buf, const TCGArg *opparam_buf);
@@ -426,64 +426,39 @@ static void tcg_out_i(TCGContext *s, tcg_target_ulong v)
     s->code_ptr += sizeof(tcg_target_ulong);
 }
 
-/* Write 64 bit value. */
-static void tcg_out64(TCGContext *s, uint64_t v)
-{
-    *(uint64_t *)s->code_ptr = v;
-    s->code_ptr += sizeof(v);
-}
-
-/* Write opcode. */
+/* Write opcode. The length is filled in by tci_out_end. */
 static void tcg_out_op_t(TCGContext *s, TCGOpcode op)
 {
-    tcg_out8(s, op);
-    tcg_out8(s, 0);
+    assert(op <= TCI_OPC_MASK);
+    tcg_out_i(s, op);
+    s->tci_nb_consts = 0;
 }
 
 /* Write register. */
 static void tcg_out_r(TCGContext *s, TCGArg t0)
 {
     assert(t0 < TCG_TARGET_NB_REGS);
-    tcg_out8(s, t0);
+    tcg_out_i(s, t0);
 }
 
-/* Write register or constant (native size). */
+/* Write register or constant (native size). A value word is reserved
+   even for a register so that the length of an instruction depends only
+   on its opcode. */
 static void tcg_out_ri(TCGContext *s, int const_arg, TCGArg arg)
 {
+    assert(s->tci_nb_consts < TCI_MAX_CONSTS);
     if (const_arg) {
         assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
-        tcg_out_i(s, arg);
-    } else {
-        tcg_out_r(s, arg);
-    }
-}
-
-/* Write register or constant (32 bit). */
-static void tcg_out_ri32(TCGContext *s, int const_arg, TCGArg arg)
-{
-    if (const_arg) {
-        assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
-        tcg_out32(s, arg);
-    } else {
-        tcg_out_r(s, arg);
-    }
-}
-
-#if TCG_TARGET_REG_BITS == 64
-/* Write register or constant (64 bit). */
-static void tcg_out_ri64(TCGContext *s, int const_arg, TCGArg arg)
-{
-    if (const_arg) {
-        assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
-        tcg_out64(s, arg);
+        s->tci_const_ptr[s->tci_nb_consts] = (tcg_target_ulong *)s->code_ptr;
+        s->tci_const_val[s->tci_nb_consts] = arg;
+        s->code_ptr += sizeof(tcg_target_ulong);
     } else {
+        s->tci_const_ptr[s->tci_nb_consts] = NULL;
+        s->tci_const_val[s->tci_nb_consts] = 0;
         tcg_out_r(s, arg);
     }
+    s->tci_nb_consts++;
 }
-#endif
 
 /* Write label. */
 static void tci_out_label(TCGContext *s, TCGArg arg)
@@ -498,28 +473,43 @@ static void tci_out_label(TCGContext *s, TCGArg arg)
     }
 }
 
+/* Write the value words and complete the first word of the instruction
+   starting at old_code_ptr. */
+static void tci_out_end(TCGContext *s, uint8_t *old_code_ptr)
+{
+    int i;
+
+    for (i = 0; i < s->tci_nb_consts; i++) {
+        if (s->tci_const_ptr[i]) {
+            *s->tci_const_ptr[i] = TCI_CONST | (s->code_ptr - old_code_ptr) /
+                                   sizeof(tcg_target_ulong);
+        }
+        tcg_out_i(s, s->tci_const_val[i]);
+    }
+    s->tci_nb_consts = 0;
+    *(tcg_target_ulong *)old_code_ptr |=
+        (tcg_target_ulong)(s->code_ptr - old_code_ptr) /
+        sizeof(tcg_target_ulong) << TCI_LEN_SHIFT;
+}
+
 static void tcg_out_ld(TCGContext *s, TCGType type, TCGReg ret, TCGReg arg1,
                        tcg_target_long arg2)
 {
     uint8_t *old_code_ptr = s->code_ptr;
     if (type == TCG_TYPE_I32) {
         tcg_out_op_t(s, INDEX_op_ld_i32);
-        tcg_out_r(s, ret);
-        tcg_out_r(s, arg1);
-        tcg_out32(s, arg2);
     } else {
         assert(type == TCG_TYPE_I64);
 #if TCG_TARGET_REG_BITS == 64
         tcg_out_op_t(s, INDEX_op_ld_i64);
-        tcg_out_r(s, ret);
-        tcg_out_r(s, arg1);
-        assert(arg2 == (uint32_t)arg2);
-        tcg_out32(s, arg2);
 #else
         TODO();
 #endif
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    tcg_out_r(s, ret);
+    tcg_out_r(s, arg1);
+    tcg_out_i(s, arg2);
+    tci_out_end(s, old_code_ptr);
 }
 
 static void tcg_out_mov(TCGContext *s, TCGType type, TCGReg ret, TCGReg arg)
@@ -533,7 +523,7 @@ static void tcg_out_mov(TCGContext *s, TCGType type, TCGReg ret, TCGReg arg)
 #endif
     tcg_out_r(s, ret);
     tcg_out_r(s, arg);
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    tci_out_end(s, old_code_ptr);
 }
 
 static void tcg_out_movi(TCGContext *s, TCGType type,
@@ -544,18 +534,18 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
     if (type == TCG_TYPE_I32 || arg == arg32) {
         tcg_out_op_t(s, INDEX_op_movi_i32);
         tcg_out_r(s, t0);
-        tcg_out32(s, arg32);
+        tcg_out_i(s, arg32);
     } else {
         assert(type == TCG_TYPE_I64);
 #if TCG_TARGET_REG_BITS == 64
         tcg_out_op_t(s, INDEX_op_movi_i64);
         tcg_out_r(s, t0);
-        tcg_out64(s, arg);
+        tcg_out_i(s, arg);
 #else
         TODO();
 #endif
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    tci_out_end(s, old_code_ptr);
 }
 
 static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
@@ -567,14 +557,16 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
 
     switch (opc) {
     case INDEX_op_exit_tb:
-        tcg_out64(s, args[0]);
+        tcg_out_i(s, args[0]);
         break;
     case INDEX_op_goto_tb:
         if (s->tb_jmp_offset) {
-            /* Direct jump method. */
+            /* Direct jump method. The target starts out as the next
+               instruction, like after tb_reset_jump. */
             assert(args[0] < ARRAY_SIZE(s->tb_jmp_offset));
             s->tb_jmp_offset[args[0]] = s->code_ptr - s->code_buf;
-            tcg_out32(s, 0);
+            tcg_out_i(s, (tcg_target_ulong)s->code_ptr +
+                      sizeof(tcg_target_ulong));
         } else {
             /* Indirect jump method. */
             TODO();
@@ -591,8 +583,8 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_setcond_i32:
         tcg_out_r(s, args[0]);
         tcg_out_r(s, args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
-        tcg_out8(s, args[3]);   /* condition */
+        tcg_out_ri(s, const_args[2], args[2]);
+        tcg_out_i(s, args[3]);  /* condition */
         break;
 #if TCG_TARGET_REG_BITS == 32
     case INDEX_op_setcond2_i32:
@@ -600,16 +592,16 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
         tcg_out_r(s, args[0]);
         tcg_out_r(s, args[1]);
         tcg_out_r(s, args[2]);
-        tcg_out_ri32(s, const_args[3], args[3]);
-        tcg_out_ri32(s, const_args[4], args[4]);
-        tcg_out8(s, args[5]);   /* condition */
+        tcg_out_ri(s, const_args[3], args[3]);
+        tcg_out_ri(s, const_args[4], args[4]);
+        tcg_out_i(s, args[5]);  /* condition */
         break;
 #elif TCG_TARGET_REG_BITS == 64
     case INDEX_op_setcond_i64:
         tcg_out_r(s, args[0]);
         tcg_out_r(s, args[1]);
-        tcg_out_ri64(s, const_args[2], args[2]);
-        tcg_out8(s, args[3]);   /* condition */
+        tcg_out_ri(s, const_args[2], args[2]);
+        tcg_out_i(s, args[3]);  /* condition */
         break;
 #endif
     case INDEX_op_movi_i32:
@@ -636,8 +628,7 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_st_i64:
         tcg_out_r(s, args[0]);
         tcg_out_r(s, args[1]);
-        assert(args[2] == (uint32_t)args[2]);
-        tcg_out32(s, args[2]);
+        tcg_out_i(s, args[2]);
         break;
     case INDEX_op_add_i32:
     case INDEX_op_sub_i32:
@@ -656,17 +647,15 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_rotl_i32:     /* Optional (TCG_TARGET_HAS_rot_i32). */
     case INDEX_op_rotr_i32:     /* Optional (TCG_TARGET_HAS_rot_i32). */
         tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
+        tcg_out_ri(s, const_args[1], args[1]);
+        tcg_out_ri(s, const_args[2], args[2]);
         break;
     case INDEX_op_deposit_i32:  /* Optional (TCG_TARGET_HAS_deposit_i32). */
         tcg_out_r(s, args[0]);
         tcg_out_r(s, args[1]);
         tcg_out_r(s, args[2]);
-        assert(args[3] <= UINT8_MAX);
-        tcg_out8(s, args[3]);
-        assert(args[4] <= UINT8_MAX);
-        tcg_out8(s, args[4]);
+        tcg_out_i(s, args[3]);
+        tcg_out_i(s, args[4]);
         break;
 
 #if TCG_TARGET_REG_BITS == 64
@@ -688,21 +677,18 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_shl_i64:
     case INDEX_op_shr_i64:
     case INDEX_op_sar_i64:
-        /* TODO: Implementation of rotl_i64, rotr_i64 missing in tci.c. */
     case INDEX_op_rotl_i64:     /* Optional (TCG_TARGET_HAS_rot_i64). */
     case INDEX_op_rotr_i64:     /* Optional (TCG_TARGET_HAS_rot_i64). */
         tcg_out_r(s, args[0]);
-        tcg_out_ri64(s, const_args[1], args[1]);
-        tcg_out_ri64(s, const_args[2], args[2]);
+        tcg_out_ri(s, const_args[1], args[1]);
+        tcg_out_ri(s, const_args[2], args[2]);
         break;
     case INDEX_op_deposit_i64:  /* Optional (TCG_TARGET_HAS_deposit_i64). */
         tcg_out_r(s, args[0]);
         tcg_out_r(s, args[1]);
         tcg_out_r(s, args[2]);
-        assert(args[3] <= UINT8_MAX);
-        tcg_out8(s, args[3]);
-        assert(args[4] <= UINT8_MAX);
-        tcg_out8(s, args[4]);
+        tcg_out_i(s, args[3]);
+        tcg_out_i(s, args[4]);
         break;
     case INDEX_op_div_i64:      /* Optional (TCG_TARGET_HAS_div_i64). */
     case INDEX_op_divu_i64:     /* Optional (TCG_TARGET_HAS_div_i64). */
@@ -716,8 +702,8 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
         break;
     case INDEX_op_brcond_i64:
         tcg_out_r(s, args[0]);
-        tcg_out_ri64(s, const_args[1], args[1]);
-        tcg_out8(s, args[2]);           /* condition */
+        tcg_out_ri(s, const_args[1], args[1]);
+        tcg_out_i(s, args[2]);          /* condition */
         tci_out_label(s, args[3]);
         break;
     case INDEX_op_bswap16_i64:  /* Optional (TCG_TARGET_HAS_bswap16_i64). */
@@ -748,8 +734,8 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_rem_i32:      /* Optional (TCG_TARGET_HAS_div_i32). */
     case INDEX_op_remu_i32:     /* Optional (TCG_TARGET_HAS_div_i32). */
         tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
+        tcg_out_ri(s, const_args[1], args[1]);
+        tcg_out_ri(s, const_args[2], args[2]);
         break;
     case INDEX_op_div2_i32:     /* Optional (TCG_TARGET_HAS_div2_i32). */
     case INDEX_op_divu2_i32:    /* Optional (TCG_TARGET_HAS_div2_i32). */
@@ -768,9 +754,9 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_brcond2_i32:
         tcg_out_r(s, args[0]);
         tcg_out_r(s, args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
-        tcg_out_ri32(s, const_args[3], args[3]);
-        tcg_out8(s, args[4]);           /* condition */
+        tcg_out_ri(s, const_args[2], args[2]);
+        tcg_out_ri(s, const_args[3], args[3]);
+        tcg_out_i(s, args[4]);          /* condition */
         tci_out_label(s, args[5]);
         break;
     case INDEX_op_mulu2_i32:
@@ -782,8 +768,8 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
 #endif
     case INDEX_op_brcond_i32:
         tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out8(s, args[2]);           /* condition */
+        tcg_out_ri(s, const_args[1], args[1]);
+        tcg_out_i(s, args[2]);          /* condition */
         tci_out_label(s, args[3]);
         break;
     case INDEX_op_qemu_ld8u:
@@ -849,7 +835,7 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
         fprintf(stderr, "Missing: %s\n", tcg_op_defs[opc].name);
         tcg_abort();
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    tci_out_end(s, old_code_ptr);
 }
 
 static void tcg_out_st(TCGContext *s, TCGType type, TCGReg arg, TCGReg arg1,
@@ -858,21 +844,18 @@ static void tcg_out_st(TCGContext *s, TCGType type, TCGReg arg, TCGReg arg1,
     uint8_t *old_code_ptr = s->code_ptr;
     if (type == TCG_TYPE_I32) {
         tcg_out_op_t(s, INDEX_op_st_i32);
-        tcg_out_r(s, arg);
-        tcg_out_r(s, arg1);
-        tcg_out32(s, arg2);
     } else {
         assert(type == TCG_TYPE_I64);
 #if TCG_TARGET_REG_BITS == 64
         tcg_out_op_t(s, INDEX_op_st_i64);
-        tcg_out_r(s, arg);
-        tcg_out_r(s, arg1);
-        tcg_out32(s, arg2);
 #else
         TODO();
 #endif
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    tcg_out_r(s, arg);
+    tcg_out_r(s, arg1);
+    tcg_out_i(s, arg2);
+    tci_out_end(s, old_code_ptr);
 }
 
 /* Test if a constant matches the constraint. */
@@ -892,8 +875,8 @@ static void tcg_target_init(TCGContext *s)
     }
 #endif
 
-    /* The current code uses uint8_t for tcg operations. */
-    assert(ARRAY_SIZE(tcg_op_defs) <= UINT8_MAX);
+    /* The opcode must fit in the low bits of the first bytecode word. */
+    assert(ARRAY_SIZE(tcg_op_defs) <= TCI_OPC_MASK);
 
     /* Registers available for 32 bit operations. */
     tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0,
@@ -76,6 +76,7 @@
 #define TCG_TARGET_HAS_orc_i32          0
 #define TCG_TARGET_HAS_rot_i32          1
 #define TCG_TARGET_HAS_movcond_i32      0
+#define TCG_TARGET_HAS_vec              0
 
 #if TCG_TARGET_REG_BITS == 64
 #define TCG_TARGET_HAS_bswap16_i64      1
@@ -147,10 +148,24 @@ typedef enum {
     TCG_REG_R31,
 #endif
 #endif
-    /* Special value UINT8_MAX is used by TCI to encode constant values. */
-    TCG_CONST = UINT8_MAX
 } TCGReg;
 
+/* The bytecode is decoded at translation time into host words.  The
+   first word of an instruction holds the opcode in its low bits and the
+   number of words of the instruction above TCI_LEN_SHIFT.  Register
+   operands are indices into the register file which tcg_qemu_tb_exec()
+   keeps on its stack, so threads can run the same code.  Operands which
+   may also be constant get a word after the fixed operands; when they
+   are constant, they hold TCI_CONST plus the index of that word within
+   the instruction, and the length of an instruction only depends on its
+   opcode.  Immediates (offsets, conditions, labels, ...) are stored as
+   they are.  */
+#define TCI_OPC_MASK    0xff
+#define TCI_LEN_SHIFT   8
+#define TCI_CONST       0x100
+/* Maximum number of register-or-constant operands of an instruction */
+#define TCI_MAX_CONSTS  4
+
 void tci_disas(uint8_t opc);
 
 tcg_target_ulong tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr);
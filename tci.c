@@ -59,111 +59,7 @@ CPUArchState *env;
 /* Targets which don't use GETPC also don't need tci_tb_ptr
    which makes them a little faster. */
 #if defined(GETPC)
-uintptr_t tci_tb_ptr;
-#endif
-
-static tcg_target_ulong tci_reg[TCG_TARGET_NB_REGS];
-
-static tcg_target_ulong tci_read_reg(TCGReg index)
-{
-    assert(index < ARRAY_SIZE(tci_reg));
-    return tci_reg[index];
-}
-
-#if TCG_TARGET_HAS_ext8s_i32 || TCG_TARGET_HAS_ext8s_i64
-static int8_t tci_read_reg8s(TCGReg index)
-{
-    return (int8_t)tci_read_reg(index);
-}
-#endif
-
-#if TCG_TARGET_HAS_ext16s_i32 || TCG_TARGET_HAS_ext16s_i64
-static int16_t tci_read_reg16s(TCGReg index)
-{
-    return (int16_t)tci_read_reg(index);
-}
-#endif
-
-#if TCG_TARGET_REG_BITS == 64
-static int32_t tci_read_reg32s(TCGReg index)
-{
-    return (int32_t)tci_read_reg(index);
-}
-#endif
-
-static uint8_t tci_read_reg8(TCGReg index)
-{
-    return (uint8_t)tci_read_reg(index);
-}
-
-static uint16_t tci_read_reg16(TCGReg index)
-{
-    return (uint16_t)tci_read_reg(index);
-}
-
-static uint32_t tci_read_reg32(TCGReg index)
-{
-    return (uint32_t)tci_read_reg(index);
-}
-
-#if TCG_TARGET_REG_BITS == 64
-static uint64_t tci_read_reg64(TCGReg index)
-{
-    return tci_read_reg(index);
-}
-#endif
-
-static void tci_write_reg(TCGReg index, tcg_target_ulong value)
-{
-    assert(index < ARRAY_SIZE(tci_reg));
-    assert(index != TCG_AREG0);
-    tci_reg[index] = value;
-}
-
-static void tci_write_reg8s(TCGReg index, int8_t value)
-{
-    tci_write_reg(index, value);
-}
-
-static void tci_write_reg16s(TCGReg index, int16_t value)
-{
-    tci_write_reg(index, value);
-}
-
-#if TCG_TARGET_REG_BITS == 64
-static void tci_write_reg32s(TCGReg index, int32_t value)
-{
-    tci_write_reg(index, value);
-}
-#endif
-
-static void tci_write_reg8(TCGReg index, uint8_t value)
-{
-    tci_write_reg(index, value);
-}
-
-static void tci_write_reg16(TCGReg index, uint16_t value)
-{
-    tci_write_reg(index, value);
-}
-
-static void tci_write_reg32(TCGReg index, uint32_t value)
-{
-    tci_write_reg(index, value);
-}
-
-#if TCG_TARGET_REG_BITS == 32
-static void tci_write_reg64(uint32_t high_index, uint32_t low_index,
-                            uint64_t value)
-{
-    tci_write_reg(low_index, value);
-    tci_write_reg(high_index, value >> 32);
-}
-#elif TCG_TARGET_REG_BITS == 64
-static void tci_write_reg64(TCGReg index, uint64_t value)
-{
-    tci_write_reg(index, value);
-}
+DEFINE_TLS(uintptr_t, tci_tb_ptr);
 #endif
 
 #if TCG_TARGET_REG_BITS == 32
@@ -174,177 +70,6 @@ static uint64_t tci_uint64(uint32_t high, uint32_t low)
 }
 #endif
 
-/* Read constant (native size) from bytecode. */
-static tcg_target_ulong tci_read_i(uint8_t **tb_ptr)
-{
-    tcg_target_ulong value = *(tcg_target_ulong *)(*tb_ptr);
-    *tb_ptr += sizeof(value);
-    return value;
-}
-
-/* Read constant (32 bit) from bytecode. */
-static uint32_t tci_read_i32(uint8_t **tb_ptr)
-{
-    uint32_t value = *(uint32_t *)(*tb_ptr);
-    *tb_ptr += sizeof(value);
-    return value;
-}
-
-#if TCG_TARGET_REG_BITS == 64
-/* Read constant (64 bit) from bytecode. */
-static uint64_t tci_read_i64(uint8_t **tb_ptr)
-{
-    uint64_t value = *(uint64_t *)(*tb_ptr);
-    *tb_ptr += sizeof(value);
-    return value;
-}
-#endif
-
-/* Read indexed register (native size) from bytecode. */
-static tcg_target_ulong tci_read_r(uint8_t **tb_ptr)
-{
-    tcg_target_ulong value = tci_read_reg(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-
-/* Read indexed register (8 bit) from bytecode. */
-static uint8_t tci_read_r8(uint8_t **tb_ptr)
-{
-    uint8_t value = tci_read_reg8(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-
-#if TCG_TARGET_HAS_ext8s_i32 || TCG_TARGET_HAS_ext8s_i64
-/* Read indexed register (8 bit signed) from bytecode. */
-static int8_t tci_read_r8s(uint8_t **tb_ptr)
-{
-    int8_t value = tci_read_reg8s(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-#endif
-
-/* Read indexed register (16 bit) from bytecode. */
-static uint16_t tci_read_r16(uint8_t **tb_ptr)
-{
-    uint16_t value = tci_read_reg16(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-
-#if TCG_TARGET_HAS_ext16s_i32 || TCG_TARGET_HAS_ext16s_i64
-/* Read indexed register (16 bit signed) from bytecode. */
-static int16_t tci_read_r16s(uint8_t **tb_ptr)
-{
-    int16_t value = tci_read_reg16s(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-#endif
-
-/* Read indexed register (32 bit) from bytecode. */
-static uint32_t tci_read_r32(uint8_t **tb_ptr)
-{
-    uint32_t value = tci_read_reg32(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-
-#if TCG_TARGET_REG_BITS == 32
-/* Read two indexed registers (2 * 32 bit) from bytecode. */
-static uint64_t tci_read_r64(uint8_t **tb_ptr)
-{
-    uint32_t low = tci_read_r32(tb_ptr);
-    return tci_uint64(tci_read_r32(tb_ptr), low);
-}
-#elif TCG_TARGET_REG_BITS == 64
-/* Read indexed register (32 bit signed) from bytecode. */
-static int32_t tci_read_r32s(uint8_t **tb_ptr)
-{
-    int32_t value = tci_read_reg32s(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-
-/* Read indexed register (64 bit) from bytecode. */
-static uint64_t tci_read_r64(uint8_t **tb_ptr)
-{
-    uint64_t value = tci_read_reg64(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-#endif
-
-/* Read indexed register(s) with target address from bytecode. */
-static target_ulong tci_read_ulong(uint8_t **tb_ptr)
-{
-    target_ulong taddr = tci_read_r(tb_ptr);
-#if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
-    taddr += (uint64_t)tci_read_r(tb_ptr) << 32;
-#endif
-    return taddr;
-}
-
-/* Read indexed register or constant (native size) from bytecode. */
-static tcg_target_ulong tci_read_ri(uint8_t **tb_ptr)
-{
-    tcg_target_ulong value;
-    TCGReg r = **tb_ptr;
-    *tb_ptr += 1;
-    if (r == TCG_CONST) {
-        value = tci_read_i(tb_ptr);
-    } else {
-        value = tci_read_reg(r);
-    }
-    return value;
-}
-
-/* Read indexed register or constant (32 bit) from bytecode. */
-static uint32_t tci_read_ri32(uint8_t **tb_ptr)
-{
-    uint32_t value;
-    TCGReg r = **tb_ptr;
-    *tb_ptr += 1;
-    if (r == TCG_CONST) {
-        value = tci_read_i32(tb_ptr);
-    } else {
-        value = tci_read_reg32(r);
-    }
-    return value;
-}
-
-#if TCG_TARGET_REG_BITS == 32
-/* Read two indexed registers or constants (2 * 32 bit) from bytecode. */
-static uint64_t tci_read_ri64(uint8_t **tb_ptr)
-{
-    uint32_t low = tci_read_ri32(tb_ptr);
-    return tci_uint64(tci_read_ri32(tb_ptr), low);
-}
-#elif TCG_TARGET_REG_BITS == 64
-/* Read indexed register or constant (64 bit) from bytecode. */
-static uint64_t tci_read_ri64(uint8_t **tb_ptr)
-{
-    uint64_t value;
-    TCGReg r = **tb_ptr;
-    *tb_ptr += 1;
-    if (r == TCG_CONST) {
-        value = tci_read_i64(tb_ptr);
-    } else {
-        value = tci_read_reg64(r);
-    }
-    return value;
-}
-#endif
-
-static tcg_target_ulong tci_read_label(uint8_t **tb_ptr)
-{
-    tcg_target_ulong label = tci_read_i(tb_ptr);
-    assert(label != 0);
-    return label;
-}
-
 static bool tci_compare32(uint32_t u0, uint32_t u1, TCGCond condition)
 {
     bool result = false;
@@ -429,804 +154,698 @@ static bool tci_compare64(uint64_t u0, uint64_t u1, TCGCond condition)
     return result;
 }
 
-/* Interpret pseudo code in tb. */
-tcg_target_ulong tcg_qemu_tb_exec(CPUArchState *cpustate, uint8_t *tb_ptr)
-{
-    tcg_target_ulong next_tb = 0;
+/* Operand n of the current instruction, see tcg-target.h.  A register
+   operand indexes the register file of this call; a register-or-constant
+   operand indexes the instruction itself when it is constant.  */
+#define REG(n)      (regs[ip[n]])
+#define RI(n)       (((ip[n] & TCI_CONST) ? ip : regs)[ip[n] & ~TCI_CONST])
+#define IMM(n)      (ip[n])
 
-    env = cpustate;
-    tci_reg[TCG_AREG0] = (tcg_target_ulong)env;
-    assert(tb_ptr);
-
-    for (;;) {
-#if defined(GETPC)
-        tci_tb_ptr = (uintptr_t)tb_ptr;
-#endif
-        TCGOpcode opc = tb_ptr[0];
-#if !defined(NDEBUG)
-        uint8_t op_size = tb_ptr[1];
-        uint8_t *old_code_ptr = tb_ptr;
-#endif
-        tcg_target_ulong t0;
-        tcg_target_ulong t1;
-        tcg_target_ulong t2;
-        tcg_target_ulong label;
-        TCGCond condition;
-        target_ulong taddr;
-#ifndef CONFIG_SOFTMMU
-        tcg_target_ulong host_addr;
-#endif
-        uint8_t tmp8;
-        uint16_t tmp16;
-        uint32_t tmp32;
-        uint64_t tmp64;
 #if TCG_TARGET_REG_BITS == 32
-        uint64_t v64;
+# define REG64(n)   tci_uint64(REG((n) + 1), REG(n))
+# define RI64(n)    tci_uint64(RI((n) + 1), RI(n))
+#else
+# define REG64(n)   ((uint64_t)REG(n))
 #endif
 
-        /* Skip opcode and size entry. */
-        tb_ptr += 2;
+/* Guest address operand of qemu_ld/qemu_st starting at word n. */
+#if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
+# define ADDR(n)    ((target_ulong)tci_uint64(REG((n) + 1), REG(n)))
+# define ADDR_WORDS 2
+#else
+# define ADDR(n)    ((target_ulong)REG(n))
+# define ADDR_WORDS 1
+#endif
 
-        switch (opc) {
-        case INDEX_op_end:
-        case INDEX_op_nop:
-            break;
-        case INDEX_op_nop1:
-        case INDEX_op_nop2:
-        case INDEX_op_nop3:
-        case INDEX_op_nopn:
-        case INDEX_op_discard:
-            TODO();
-            break;
-        case INDEX_op_set_label:
-            TODO();
-            break;
-        case INDEX_op_call:
-            t0 = tci_read_ri(&tb_ptr);
-#if TCG_TARGET_REG_BITS == 32
-            tmp64 = ((helper_function)t0)(tci_read_reg(TCG_REG_R0),
-                                          tci_read_reg(TCG_REG_R1),
-                                          tci_read_reg(TCG_REG_R2),
-                                          tci_read_reg(TCG_REG_R3),
-                                          tci_read_reg(TCG_REG_R5),
-                                          tci_read_reg(TCG_REG_R6),
-                                          tci_read_reg(TCG_REG_R7),
-                                          tci_read_reg(TCG_REG_R8),
-                                          tci_read_reg(TCG_REG_R9),
-                                          tci_read_reg(TCG_REG_R10));
-            tci_write_reg(TCG_REG_R0, tmp64);
-            tci_write_reg(TCG_REG_R1, tmp64 >> 32);
+#ifdef CONFIG_SOFTMMU
+# define MEM_IDX(n) IMM(n)
+# define QEMU_LD_LEN    (3 + ADDR_WORDS)
 #else
-            tmp64 = ((helper_function)t0)(tci_read_reg(TCG_REG_R0),
-                                          tci_read_reg(TCG_REG_R1),
-                                          tci_read_reg(TCG_REG_R2),
-                                          tci_read_reg(TCG_REG_R3),
-                                          tci_read_reg(TCG_REG_R5));
-            tci_write_reg(TCG_REG_R0, tmp64);
-#endif
-            break;
-        case INDEX_op_br:
-            label = tci_read_label(&tb_ptr);
-            assert(tb_ptr == old_code_ptr + op_size);
-            tb_ptr = (uint8_t *)label;
-            continue;
-        case INDEX_op_setcond_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            condition = *tb_ptr++;
-            tci_write_reg32(t0, tci_compare32(t1, t2, condition));
-            break;
-#if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_setcond2_i32:
-            t0 = *tb_ptr++;
-            tmp64 = tci_read_r64(&tb_ptr);
-            v64 = tci_read_ri64(&tb_ptr);
-            condition = *tb_ptr++;
-            tci_write_reg32(t0, tci_compare64(tmp64, v64, condition));
-            break;
-#elif TCG_TARGET_REG_BITS == 64
-        case INDEX_op_setcond_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            condition = *tb_ptr++;
-            tci_write_reg64(t0, tci_compare64(t1, t2, condition));
-            break;
-#endif
-        case INDEX_op_mov_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
-        case INDEX_op_movi_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_i32(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
+# define QEMU_LD_LEN    (2 + ADDR_WORDS)
+# define HOST_ADDR(taddr) \
+    ((void *)((tcg_target_ulong)(taddr) + GUEST_BASE))
+#endif
 
-            /* Load/store operations (32 bit). */
+/* Length of qemu_ld64/qemu_st64, which take a register pair on 32 bit
+   hosts. */
+#define QEMU_LD64_LEN   (QEMU_LD_LEN + 64 / TCG_TARGET_REG_BITS - 1)
 
-        case INDEX_op_ld8u_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            tci_write_reg8(t0, *(uint8_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld8s_i32:
-        case INDEX_op_ld16u_i32:
-            TODO();
-            break;
-        case INDEX_op_ld16s_i32:
-            TODO();
-            break;
-        case INDEX_op_ld_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            tci_write_reg32(t0, *(uint32_t *)(t1 + t2));
-            break;
-        case INDEX_op_st8_i32:
-            t0 = tci_read_r8(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            *(uint8_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st16_i32:
-            t0 = tci_read_r16(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            *(uint16_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st_i32:
-            t0 = tci_read_r32(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            *(uint32_t *)(t1 + t2) = t0;
-            break;
+#if defined(GETPC)
+# define SAVE_PC()  (tls_var(tci_tb_ptr) = (uintptr_t)ip)
+#else
+# define SAVE_PC()  do { } while (0)
+#endif
 
-            /* Arithmetic operations (32 bit). */
+/* Every handler ends with its own indirect jump to the next one, which
+   gives the host branch predictor one jump per opcode to learn from
+   instead of a single shared one.  The handler passes the length of its
+   instruction as a constant, so finding the next instruction does not
+   have to wait for the load of the current one. */
+#define DISPATCH() \
+    do { \
+        insn = *ip; \
+        goto *dispatch[insn & TCI_OPC_MASK]; \
+    } while (0)
+#define NEXT(len) \
+    do { \
+        assert((insn >> TCI_LEN_SHIFT) == (len)); \
+        ip += (len); \
+        DISPATCH(); \
+    } while (0)
 
-        case INDEX_op_add_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 + t2);
-            break;
-        case INDEX_op_sub_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 - t2);
-            break;
-        case INDEX_op_mul_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 * t2);
-            break;
+/* Interpret pseudo code in tb. */
+tcg_target_ulong tcg_qemu_tb_exec(CPUArchState *cpustate, uint8_t *tb_ptr)
+{
+    static const void *const dispatch[TCI_OPC_MASK + 1] = {
+        [0 ... TCI_OPC_MASK] = &&op_todo,
+        [INDEX_op_call] = &&op_call,
+        [INDEX_op_br] = &&op_br,
+        [INDEX_op_exit_tb] = &&op_exit_tb,
+        [INDEX_op_goto_tb] = &&op_goto_tb,
+        [INDEX_op_setcond_i32] = &&op_setcond_i32,
+        [INDEX_op_mov_i32] = &&op_mov_i32,
+        [INDEX_op_movi_i32] = &&op_movi,
+        [INDEX_op_ld8u_i32] = &&op_ld8u_i32,
+        [INDEX_op_ld8s_i32] = &&op_ld8s_i32,
+        [INDEX_op_ld16u_i32] = &&op_ld16u_i32,
+        [INDEX_op_ld16s_i32] = &&op_ld16s_i32,
+        [INDEX_op_ld_i32] = &&op_ld_i32,
+        [INDEX_op_st8_i32] = &&op_st8,
+        [INDEX_op_st16_i32] = &&op_st16,
+        [INDEX_op_st_i32] = &&op_st32,
+        [INDEX_op_add_i32] = &&op_add_i32,
+        [INDEX_op_sub_i32] = &&op_sub_i32,
+        [INDEX_op_mul_i32] = &&op_mul_i32,
 #if TCG_TARGET_HAS_div_i32
-        case INDEX_op_div_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, (int32_t)t1 / (int32_t)t2);
-            break;
-        case INDEX_op_divu_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 / t2);
-            break;
-        case INDEX_op_rem_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, (int32_t)t1 % (int32_t)t2);
-            break;
-        case INDEX_op_remu_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 % t2);
-            break;
-#elif TCG_TARGET_HAS_div2_i32
-        case INDEX_op_div2_i32:
-        case INDEX_op_divu2_i32:
-            TODO();
-            break;
-#endif
-        case INDEX_op_and_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 & t2);
-            break;
-        case INDEX_op_or_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 | t2);
-            break;
-        case INDEX_op_xor_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 ^ t2);
-            break;
-
-            /* Shift/rotate operations (32 bit). */
-
-        case INDEX_op_shl_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 << t2);
-            break;
-        case INDEX_op_shr_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 >> t2);
-            break;
-        case INDEX_op_sar_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, ((int32_t)t1 >> t2));
-            break;
+        [INDEX_op_div_i32] = &&op_div_i32,
+        [INDEX_op_divu_i32] = &&op_divu_i32,
+        [INDEX_op_rem_i32] = &&op_rem_i32,
+        [INDEX_op_remu_i32] = &&op_remu_i32,
+#endif
+        [INDEX_op_and_i32] = &&op_and_i32,
+        [INDEX_op_or_i32] = &&op_or_i32,
+        [INDEX_op_xor_i32] = &&op_xor_i32,
+        [INDEX_op_shl_i32] = &&op_shl_i32,
+        [INDEX_op_shr_i32] = &&op_shr_i32,
+        [INDEX_op_sar_i32] = &&op_sar_i32,
 #if TCG_TARGET_HAS_rot_i32
-        case INDEX_op_rotl_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, (t1 << t2) | (t1 >> (32 - t2)));
-            break;
-        case INDEX_op_rotr_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, (t1 >> t2) | (t1 << (32 - t2)));
-            break;
+        [INDEX_op_rotl_i32] = &&op_rotl_i32,
+        [INDEX_op_rotr_i32] = &&op_rotr_i32,
 #endif
 #if TCG_TARGET_HAS_deposit_i32
-        case INDEX_op_deposit_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            t2 = tci_read_r32(&tb_ptr);
-            tmp16 = *tb_ptr++;
-            tmp8 = *tb_ptr++;
-            tmp32 = (((1 << tmp8) - 1) << tmp16);
-            tci_write_reg32(t0, (t1 & ~tmp32) | ((t2 << tmp16) & tmp32));
-            break;
-#endif
-        case INDEX_op_brcond_i32:
-            t0 = tci_read_r32(&tb_ptr);
-            t1 = tci_read_ri32(&tb_ptr);
-            condition = *tb_ptr++;
-            label = tci_read_label(&tb_ptr);
-            if (tci_compare32(t0, t1, condition)) {
-                assert(tb_ptr == old_code_ptr + op_size);
-                tb_ptr = (uint8_t *)label;
-                continue;
-            }
-            break;
+        [INDEX_op_deposit_i32] = &&op_deposit_i32,
+#endif
+        [INDEX_op_brcond_i32] = &&op_brcond_i32,
 #if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_add2_i32:
-            t0 = *tb_ptr++;
-            t1 = *tb_ptr++;
-            tmp64 = tci_read_r64(&tb_ptr);
-            tmp64 += tci_read_r64(&tb_ptr);
-            tci_write_reg64(t1, t0, tmp64);
-            break;
-        case INDEX_op_sub2_i32:
-            t0 = *tb_ptr++;
-            t1 = *tb_ptr++;
-            tmp64 = tci_read_r64(&tb_ptr);
-            tmp64 -= tci_read_r64(&tb_ptr);
-            tci_write_reg64(t1, t0, tmp64);
-            break;
-        case INDEX_op_brcond2_i32:
-            tmp64 = tci_read_r64(&tb_ptr);
-            v64 = tci_read_ri64(&tb_ptr);
-            condition = *tb_ptr++;
-            label = tci_read_label(&tb_ptr);
-            if (tci_compare64(tmp64, v64, condition)) {
-                assert(tb_ptr == old_code_ptr + op_size);
-                tb_ptr = (uint8_t *)label;
-                continue;
-            }
-            break;
-        case INDEX_op_mulu2_i32:
-            t0 = *tb_ptr++;
-            t1 = *tb_ptr++;
-            t2 = tci_read_r32(&tb_ptr);
-            tmp64 = tci_read_r32(&tb_ptr);
-            tci_write_reg64(t1, t0, t2 * tmp64);
-            break;
-#endif /* TCG_TARGET_REG_BITS == 32 */
+        [INDEX_op_setcond2_i32] = &&op_setcond2_i32,
+        [INDEX_op_add2_i32] = &&op_add2_i32,
+        [INDEX_op_sub2_i32] = &&op_sub2_i32,
+        [INDEX_op_brcond2_i32] = &&op_brcond2_i32,
+        [INDEX_op_mulu2_i32] = &&op_mulu2_i32,
+#endif
 #if TCG_TARGET_HAS_ext8s_i32
-        case INDEX_op_ext8s_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r8s(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
+        [INDEX_op_ext8s_i32] = &&op_ext8s_i32,
 #endif
 #if TCG_TARGET_HAS_ext16s_i32
-        case INDEX_op_ext16s_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16s(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
+        [INDEX_op_ext16s_i32] = &&op_ext16s_i32,
 #endif
 #if TCG_TARGET_HAS_ext8u_i32
-        case INDEX_op_ext8u_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r8(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
+        [INDEX_op_ext8u_i32] = &&op_ext8u,
 #endif
 #if TCG_TARGET_HAS_ext16u_i32
-        case INDEX_op_ext16u_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
+        [INDEX_op_ext16u_i32] = &&op_ext16u,
 #endif
 #if TCG_TARGET_HAS_bswap16_i32
-        case INDEX_op_bswap16_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16(&tb_ptr);
-            tci_write_reg32(t0, bswap16(t1));
-            break;
+        [INDEX_op_bswap16_i32] = &&op_bswap16,
 #endif
 #if TCG_TARGET_HAS_bswap32_i32
-        case INDEX_op_bswap32_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg32(t0, bswap32(t1));
-            break;
+        [INDEX_op_bswap32_i32] = &&op_bswap32,
 #endif
 #if TCG_TARGET_HAS_not_i32
-        case INDEX_op_not_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg32(t0, ~t1);
-            break;
+        [INDEX_op_not_i32] = &&op_not_i32,
 #endif
 #if TCG_TARGET_HAS_neg_i32
-        case INDEX_op_neg_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg32(t0, -t1);
-            break;
+        [INDEX_op_neg_i32] = &&op_neg_i32,
 #endif
 #if TCG_TARGET_REG_BITS == 64
-        case INDEX_op_mov_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
-        case INDEX_op_movi_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_i64(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
-
-            /* Load/store operations (64 bit). */
-
-        case INDEX_op_ld8u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            tci_write_reg8(t0, *(uint8_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld8s_i64:
-        case INDEX_op_ld16u_i64:
-        case INDEX_op_ld16s_i64:
-            TODO();
-            break;
-        case INDEX_op_ld32u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            tci_write_reg32(t0, *(uint32_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld32s_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            tci_write_reg32s(t0, *(int32_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            tci_write_reg64(t0, *(uint64_t *)(t1 + t2));
-            break;
-        case INDEX_op_st8_i64:
-            t0 = tci_read_r8(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            *(uint8_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st16_i64:
-            t0 = tci_read_r16(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            *(uint16_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st32_i64:
-            t0 = tci_read_r32(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            *(uint32_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st_i64:
-            t0 = tci_read_r64(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_i32(&tb_ptr);
-            *(uint64_t *)(t1 + t2) = t0;
-            break;
-
-            /* Arithmetic operations (64 bit). */
-
-        case INDEX_op_add_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 + t2);
-            break;
-        case INDEX_op_sub_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 - t2);
-            break;
-        case INDEX_op_mul_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 * t2);
-            break;
-#if TCG_TARGET_HAS_div_i64
-        case INDEX_op_div_i64:
-        case INDEX_op_divu_i64:
-        case INDEX_op_rem_i64:
-        case INDEX_op_remu_i64:
-            TODO();
-            break;
-#elif TCG_TARGET_HAS_div2_i64
-        case INDEX_op_div2_i64:
-        case INDEX_op_divu2_i64:
-            TODO();
-            break;
-#endif
-        case INDEX_op_and_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 & t2);
-            break;
-        case INDEX_op_or_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 | t2);
-            break;
-        case INDEX_op_xor_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 ^ t2);
-            break;
-
-            /* Shift/rotate operations (64 bit). */
-
-        case INDEX_op_shl_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 << t2);
-            break;
-        case INDEX_op_shr_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 >> t2);
-            break;
-        case INDEX_op_sar_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, ((int64_t)t1 >> t2));
-            break;
+        [INDEX_op_setcond_i64] = &&op_setcond_i64,
+        [INDEX_op_mov_i64] = &&op_mov_i64,
+        [INDEX_op_movi_i64] = &&op_movi,
+        [INDEX_op_ld8u_i64] = &&op_ld8u_i64,
+        [INDEX_op_ld8s_i64] = &&op_ld8s_i64,
+        [INDEX_op_ld16u_i64] = &&op_ld16u_i64,
+        [INDEX_op_ld16s_i64] = &&op_ld16s_i64,
+        [INDEX_op_ld32u_i64] = &&op_ld32u_i64,
+        [INDEX_op_ld32s_i64] = &&op_ld32s_i64,
+        [INDEX_op_ld_i64] = &&op_ld_i64,
+        [INDEX_op_st8_i64] = &&op_st8,
+        [INDEX_op_st16_i64] = &&op_st16,
+        [INDEX_op_st32_i64] = &&op_st32,
+        [INDEX_op_st_i64] = &&op_st_i64,
+        [INDEX_op_add_i64] = &&op_add_i64,
+        [INDEX_op_sub_i64] = &&op_sub_i64,
+        [INDEX_op_mul_i64] = &&op_mul_i64,
+        [INDEX_op_and_i64] = &&op_and_i64,
+        [INDEX_op_or_i64] = &&op_or_i64,
+        [INDEX_op_xor_i64] = &&op_xor_i64,
+        [INDEX_op_shl_i64] = &&op_shl_i64,
+        [INDEX_op_shr_i64] = &&op_shr_i64,
+        [INDEX_op_sar_i64] = &&op_sar_i64,
 #if TCG_TARGET_HAS_rot_i64
-        case INDEX_op_rotl_i64:
-        case INDEX_op_rotr_i64:
-            TODO();
-            break;
+        [INDEX_op_rotl_i64] = &&op_rotl_i64,
+        [INDEX_op_rotr_i64] = &&op_rotr_i64,
 #endif
 #if TCG_TARGET_HAS_deposit_i64
-        case INDEX_op_deposit_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            t2 = tci_read_r64(&tb_ptr);
-            tmp16 = *tb_ptr++;
-            tmp8 = *tb_ptr++;
-            tmp64 = (((1ULL << tmp8) - 1) << tmp16);
-            tci_write_reg64(t0, (t1 & ~tmp64) | ((t2 << tmp16) & tmp64));
-            break;
-#endif
-        case INDEX_op_brcond_i64:
-            t0 = tci_read_r64(&tb_ptr);
-            t1 = tci_read_ri64(&tb_ptr);
-            condition = *tb_ptr++;
-            label = tci_read_label(&tb_ptr);
-            if (tci_compare64(t0, t1, condition)) {
-                assert(tb_ptr == old_code_ptr + op_size);
-                tb_ptr = (uint8_t *)label;
-                continue;
-            }
-            break;
+        [INDEX_op_deposit_i64] = &&op_deposit_i64,
+#endif
+        [INDEX_op_brcond_i64] = &&op_brcond_i64,
 #if TCG_TARGET_HAS_ext8u_i64
-        case INDEX_op_ext8u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r8(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
+        [INDEX_op_ext8u_i64] = &&op_ext8u,
 #endif
 #if TCG_TARGET_HAS_ext8s_i64
-        case INDEX_op_ext8s_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r8s(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
+        [INDEX_op_ext8s_i64] = &&op_ext8s_i64,
 #endif
 #if TCG_TARGET_HAS_ext16s_i64
-        case INDEX_op_ext16s_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16s(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
+        [INDEX_op_ext16s_i64] = &&op_ext16s_i64,
 #endif
 #if TCG_TARGET_HAS_ext16u_i64
-        case INDEX_op_ext16u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
+        [INDEX_op_ext16u_i64] = &&op_ext16u,
 #endif
 #if TCG_TARGET_HAS_ext32s_i64
-        case INDEX_op_ext32s_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32s(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
+        [INDEX_op_ext32s_i64] = &&op_ext32s_i64,
 #endif
 #if TCG_TARGET_HAS_ext32u_i64
-        case INDEX_op_ext32u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
+        [INDEX_op_ext32u_i64] = &&op_ext32u_i64,
 #endif
 #if TCG_TARGET_HAS_bswap16_i64
-        case INDEX_op_bswap16_i64:
-            TODO();
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16(&tb_ptr);
-            tci_write_reg64(t0, bswap16(t1));
-            break;
+        [INDEX_op_bswap16_i64] = &&op_bswap16,
 #endif
 #if TCG_TARGET_HAS_bswap32_i64
-        case INDEX_op_bswap32_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg64(t0, bswap32(t1));
-            break;
+        [INDEX_op_bswap32_i64] = &&op_bswap32,
 #endif
 #if TCG_TARGET_HAS_bswap64_i64
-        case INDEX_op_bswap64_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            tci_write_reg64(t0, bswap64(t1));
-            break;
+        [INDEX_op_bswap64_i64] = &&op_bswap64_i64,
 #endif
 #if TCG_TARGET_HAS_not_i64
-        case INDEX_op_not_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            tci_write_reg64(t0, ~t1);
-            break;
+        [INDEX_op_not_i64] = &&op_not_i64,
 #endif
 #if TCG_TARGET_HAS_neg_i64
-        case INDEX_op_neg_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            tci_write_reg64(t0, -t1);
-            break;
+        [INDEX_op_neg_i64] = &&op_neg_i64,
 #endif
+        [INDEX_op_qemu_ld32u] = &&op_qemu_ld32u,
+        [INDEX_op_qemu_ld32s] = &&op_qemu_ld32s,
 #endif /* TCG_TARGET_REG_BITS == 64 */
+        [INDEX_op_qemu_ld8u] = &&op_qemu_ld8u,
+        [INDEX_op_qemu_ld8s] = &&op_qemu_ld8s,
+        [INDEX_op_qemu_ld16u] = &&op_qemu_ld16u,
+        [INDEX_op_qemu_ld16s] = &&op_qemu_ld16s,
+        [INDEX_op_qemu_ld32] = &&op_qemu_ld32u,
+        [INDEX_op_qemu_ld64] = &&op_qemu_ld64,
+        [INDEX_op_qemu_st8] = &&op_qemu_st8,
+        [INDEX_op_qemu_st16] = &&op_qemu_st16,
+        [INDEX_op_qemu_st32] = &&op_qemu_st32,
+        [INDEX_op_qemu_st64] = &&op_qemu_st64,
+    };
+    const tcg_target_ulong *ip = (const tcg_target_ulong *)tb_ptr;
+    /* TCG keeps no values in registers from one TB to the next, so each
+       call, and thus each guest thread, has a register file of its own */
+    tcg_target_ulong regs[TCG_TARGET_NB_REGS];
+    tcg_target_ulong insn;
+    target_ulong taddr;
+    uint32_t tmp32;
+    uint64_t tmp64;
+#if TCG_TARGET_REG_BITS == 32
+    uint64_t v64;
+#endif
 
-            /* QEMU specific operations. */
+    env = cpustate;
+    regs[TCG_AREG0] = (tcg_target_ulong)env;
+    assert(tb_ptr);
 
-#if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
-        case INDEX_op_debug_insn_start:
-            TODO();
-            break;
+    DISPATCH();
+
+op_todo:
+    TODO();
+
+op_call:
+    SAVE_PC();
+#if TCG_TARGET_REG_BITS == 32
+    tmp64 = ((helper_function)RI(1))(regs[TCG_REG_R0],
+                                     regs[TCG_REG_R1],
+                                     regs[TCG_REG_R2],
+                                     regs[TCG_REG_R3],
+                                     regs[TCG_REG_R5],
+                                     regs[TCG_REG_R6],
+                                     regs[TCG_REG_R7],
+                                     regs[TCG_REG_R8],
+                                     regs[TCG_REG_R9],
+                                     regs[TCG_REG_R10]);
+    regs[TCG_REG_R0] = tmp64;
+    regs[TCG_REG_R1] = tmp64 >> 32;
+#else
+    tmp64 = ((helper_function)RI(1))(regs[TCG_REG_R0],
+                                     regs[TCG_REG_R1],
+                                     regs[TCG_REG_R2],
+                                     regs[TCG_REG_R3],
+                                     regs[TCG_REG_R5]);
+    regs[TCG_REG_R0] = tmp64;
+#endif
+    NEXT(3);
+op_br:
+    assert(IMM(1) != 0);
+    ip = (const tcg_target_ulong *)IMM(1);
+    DISPATCH();
+op_exit_tb:
+    return IMM(1);
+op_goto_tb:
+    ip = (const tcg_target_ulong *)IMM(1);
+    DISPATCH();
+
+op_setcond_i32:
+    REG(1) = tci_compare32(REG(2), RI(3), IMM(4));
+    NEXT(6);
+op_mov_i32:
+    REG(1) = (uint32_t)REG(2);
+    NEXT(3);
+op_movi:
+    REG(1) = IMM(2);
+    NEXT(3);
+
+    /* Load/store operations (32 bit). */
+
+op_ld8u_i32:
+    REG(1) = *(uint8_t *)(REG(2) + IMM(3));
+    NEXT(4);
+op_ld8s_i32:
+    REG(1) = (uint32_t)*(int8_t *)(REG(2) + IMM(3));
+    NEXT(4);
+op_ld16u_i32:
+    REG(1) = *(uint16_t *)(REG(2) + IMM(3));
+    NEXT(4);
+op_ld16s_i32:
+    REG(1) = (uint32_t)*(int16_t *)(REG(2) + IMM(3));
+    NEXT(4);
+op_ld_i32:
+    REG(1) = *(uint32_t *)(REG(2) + IMM(3));
+    NEXT(4);
+op_st8:
+    *(uint8_t *)(REG(2) + IMM(3)) = REG(1);
+    NEXT(4);
+op_st16:
+    *(uint16_t *)(REG(2) + IMM(3)) = REG(1);
+    NEXT(4);
+op_st32:
+    *(uint32_t *)(REG(2) + IMM(3)) = REG(1);
+    NEXT(4);
+
+    /* Arithmetic operations (32 bit). */
+
+op_add_i32:
+    REG(1) = (uint32_t)(RI(2) + RI(3));
+    NEXT(6);
+op_sub_i32:
+    REG(1) = (uint32_t)(RI(2) - RI(3));
+    NEXT(6);
+op_mul_i32:
+    REG(1) = (uint32_t)(RI(2) * RI(3));
+    NEXT(6);
+#if TCG_TARGET_HAS_div_i32
+op_div_i32:
+    REG(1) = (uint32_t)((int32_t)RI(2) / (int32_t)RI(3));
+    NEXT(6);
+op_divu_i32:
+    REG(1) = (uint32_t)RI(2) / (uint32_t)RI(3);
+    NEXT(6);
+op_rem_i32:
+    REG(1) = (uint32_t)((int32_t)RI(2) % (int32_t)RI(3));
+    NEXT(6);
+op_remu_i32:
+    REG(1) = (uint32_t)RI(2) % (uint32_t)RI(3);
+    NEXT(6);
+#endif
+op_and_i32:
+    REG(1) = (uint32_t)(RI(2) & RI(3));
+    NEXT(6);
+op_or_i32:
+    REG(1) = (uint32_t)(RI(2) | RI(3));
+    NEXT(6);
+op_xor_i32:
+    REG(1) = (uint32_t)(RI(2) ^ RI(3));
+    NEXT(6);
+
+    /* Shift/rotate operations (32 bit). */
+
+op_shl_i32:
+    REG(1) = (uint32_t)RI(2) << (uint32_t)RI(3);
+    NEXT(6);
+op_shr_i32:
+    REG(1) = (uint32_t)RI(2) >> (uint32_t)RI(3);
+    NEXT(6);
+op_sar_i32:
+    REG(1) = (uint32_t)((int32_t)RI(2) >> (uint32_t)RI(3));
+    NEXT(6);
+#if TCG_TARGET_HAS_rot_i32
+op_rotl_i32:
+    tmp32 = RI(2);
+    REG(1) = (uint32_t)((tmp32 << RI(3)) | (tmp32 >> (32 - RI(3))));
+    NEXT(6);
+op_rotr_i32:
+    tmp32 = RI(2);
+    REG(1) = (uint32_t)((tmp32 >> RI(3)) | (tmp32 << (32 - RI(3))));
+    NEXT(6);
+#endif
+#if TCG_TARGET_HAS_deposit_i32
+op_deposit_i32:
+    tmp32 = ((1U << IMM(5)) - 1) << IMM(4);
+    REG(1) = ((uint32_t)REG(2) & ~tmp32) | ((REG(3) << IMM(4)) & tmp32);
+    NEXT(6);
+#endif
+op_brcond_i32:
+    if (tci_compare32(REG(1), RI(2), IMM(3))) {
+        assert(IMM(4) != 0);
+        ip = (const tcg_target_ulong *)IMM(4);
+        DISPATCH();
+    }
+    NEXT(6);
+#if TCG_TARGET_REG_BITS == 32
+op_setcond2_i32:
+    tmp64 = REG64(2);
+    v64 = RI64(4);
+    REG(1) = tci_compare64(tmp64, v64, IMM(6));
+    NEXT(9);
+op_add2_i32:
+    tmp64 = REG64(3) + REG64(5);
+    REG(1) = tmp64;
+    REG(2) = tmp64 >> 32;
+    NEXT(7);
+op_sub2_i32:
+    tmp64 = REG64(3) - REG64(5);
+    REG(1) = tmp64;
+    REG(2) = tmp64 >> 32;
+    NEXT(7);
+op_brcond2_i32:
+    tmp64 = REG64(1);
+    v64 = RI64(3);
+    if (tci_compare64(tmp64, v64, IMM(5))) {
+        assert(IMM(6) != 0);
+        ip = (const tcg_target_ulong *)IMM(6);
+        DISPATCH();
+    }
+    NEXT(9);
+op_mulu2_i32:
+    tmp64 = (uint64_t)REG(3) * REG(4);
+    REG(1) = tmp64;
+    REG(2) = tmp64 >> 32;
+    NEXT(5);
+#endif /* TCG_TARGET_REG_BITS == 32 */
+#if TCG_TARGET_HAS_ext8s_i32
+op_ext8s_i32:
+    REG(1) = (uint32_t)(int8_t)REG(2);
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_ext16s_i32
+op_ext16s_i32:
+    REG(1) = (uint32_t)(int16_t)REG(2);
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_ext8u_i32 || TCG_TARGET_HAS_ext8u_i64
+op_ext8u:
+    REG(1) = (uint8_t)REG(2);
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_ext16u_i32 || TCG_TARGET_HAS_ext16u_i64
+op_ext16u:
+    REG(1) = (uint16_t)REG(2);
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_bswap16_i32 || TCG_TARGET_HAS_bswap16_i64
+op_bswap16:
+    REG(1) = bswap16(REG(2));
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_bswap32_i32 || TCG_TARGET_HAS_bswap32_i64
+op_bswap32:
+    REG(1) = bswap32(REG(2));
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_not_i32
+op_not_i32:
+    REG(1) = (uint32_t)~REG(2);
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_neg_i32
+op_neg_i32:
+    REG(1) = (uint32_t)-REG(2);
+    NEXT(3);
+#endif
+#if TCG_TARGET_REG_BITS == 64
+op_setcond_i64:
+    REG(1) = tci_compare64(REG(2), RI(3), IMM(4));
+    NEXT(6);
+op_mov_i64:
+    REG(1) = REG(2);
+    NEXT(3);
+
+    /* Load/store operations (64 bit). */
+
+op_ld8u_i64:
+    REG(1) = *(uint8_t *)(REG(2) + IMM(3));
+    NEXT(4);
+op_ld8s_i64:
+    REG(1) = *(int8_t *)(REG(2) + IMM(3));
+    NEXT(4);
+op_ld16u_i64:
+    REG(1) = *(uint16_t *)(REG(2) + IMM(3));
+    NEXT(4);
+op_ld16s_i64:
+    REG(1) = *(int16_t *)(REG(2) + IMM(3));
+    NEXT(4);
+op_ld32u_i64:
+    REG(1) = *(uint32_t *)(REG(2) + IMM(3));
+    NEXT(4);
+op_ld32s_i64:
+    REG(1) = *(int32_t *)(REG(2) + IMM(3));
+    NEXT(4);
+op_ld_i64:
+    REG(1) = *(uint64_t *)(REG(2) + IMM(3));
+    NEXT(4);
+op_st_i64:
+    *(uint64_t *)(REG(2) + IMM(3)) = REG(1);
+    NEXT(4);
+
+    /* Arithmetic operations (64 bit). */
+
+op_add_i64:
+    REG(1) = RI(2) + RI(3);
+    NEXT(6);
+op_sub_i64:
+    REG(1) = RI(2) - RI(3);
+    NEXT(6);
+op_mul_i64:
+    REG(1) = RI(2) * RI(3);
+    NEXT(6);
+op_and_i64:
+    REG(1) = RI(2) & RI(3);
+    NEXT(6);
+op_or_i64:
+    REG(1) = RI(2) | RI(3);
+    NEXT(6);
+op_xor_i64:
+    REG(1) = RI(2) ^ RI(3);
+    NEXT(6);
+
+    /* Shift/rotate operations (64 bit). */
+
+op_shl_i64:
+    REG(1) = RI(2) << RI(3);
+    NEXT(6);
+op_shr_i64:
+    REG(1) = RI(2) >> RI(3);
+    NEXT(6);
+op_sar_i64:
+    REG(1) = (int64_t)RI(2) >> RI(3);
+    NEXT(6);
+#if TCG_TARGET_HAS_rot_i64
+op_rotl_i64:
+    tmp64 = RI(2);
+    REG(1) = (tmp64 << RI(3)) | (tmp64 >> (64 - RI(3)));
+    NEXT(6);
+op_rotr_i64:
+    tmp64 = RI(2);
+    REG(1) = (tmp64 >> RI(3)) | (tmp64 << (64 - RI(3)));
+    NEXT(6);
+#endif
+#if TCG_TARGET_HAS_deposit_i64
+op_deposit_i64:
+    tmp64 = ((1ULL << IMM(5)) - 1) << IMM(4);
+    REG(1) = (REG(2) & ~tmp64) | ((REG(3) << IMM(4)) & tmp64);
+    NEXT(6);
+#endif
+op_brcond_i64:
+    if (tci_compare64(REG(1), RI(2), IMM(3))) {
+        assert(IMM(4) != 0);
+        ip = (const tcg_target_ulong *)IMM(4);
+        DISPATCH();
+    }
+    NEXT(6);
+#if TCG_TARGET_HAS_ext8s_i64
+op_ext8s_i64:
+    REG(1) = (int8_t)REG(2);
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_ext16s_i64
+op_ext16s_i64:
+    REG(1) = (int16_t)REG(2);
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_ext32s_i64
+op_ext32s_i64:
+    REG(1) = (int32_t)REG(2);
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_ext32u_i64
+op_ext32u_i64:
+    REG(1) = (uint32_t)REG(2);
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_bswap64_i64
+op_bswap64_i64:
+    REG(1) = bswap64(REG(2));
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_not_i64
+op_not_i64:
+    REG(1) = ~REG(2);
+    NEXT(3);
+#endif
+#if TCG_TARGET_HAS_neg_i64
+op_neg_i64:
+    REG(1) = -REG(2);
+    NEXT(3);
+#endif
+#endif /* TCG_TARGET_REG_BITS == 64 */
+
+    /* QEMU specific operations. */
+
+op_qemu_ld8u:
+    SAVE_PC();
+    taddr = ADDR(2);
+#ifdef CONFIG_SOFTMMU
+    REG(1) = helper_ldb_mmu(env, taddr, MEM_IDX(2 + ADDR_WORDS));
 #else
-        case INDEX_op_debug_insn_start:
-            TODO();
-            break;
-#endif
-        case INDEX_op_exit_tb:
-            next_tb = *(uint64_t *)tb_ptr;
-            goto exit;
-            break;
-        case INDEX_op_goto_tb:
-            t0 = tci_read_i32(&tb_ptr);
-            assert(tb_ptr == old_code_ptr + op_size);
-            tb_ptr += (int32_t)t0;
-            continue;
-        case INDEX_op_qemu_ld8u:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+    REG(1) = *(uint8_t *)HOST_ADDR(taddr);
+#endif
+    NEXT(QEMU_LD_LEN);
+op_qemu_ld8s:
+    SAVE_PC();
+    taddr = ADDR(2);
 #ifdef CONFIG_SOFTMMU
-            tmp8 = helper_ldb_mmu(env, taddr, tci_read_i(&tb_ptr));
+    REG(1) = (int8_t)helper_ldb_mmu(env, taddr, MEM_IDX(2 + ADDR_WORDS));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            assert(taddr == host_addr);
-            tmp8 = *(uint8_t *)(host_addr + GUEST_BASE);
-#endif
-            tci_write_reg8(t0, tmp8);
-            break;
-        case INDEX_op_qemu_ld8s:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+    REG(1) = *(int8_t *)HOST_ADDR(taddr);
+#endif
+    NEXT(QEMU_LD_LEN);
+op_qemu_ld16u:
+    SAVE_PC();
+    taddr = ADDR(2);
 #ifdef CONFIG_SOFTMMU
-            tmp8 = helper_ldb_mmu(env, taddr, tci_read_i(&tb_ptr));
+    REG(1) = helper_ldw_mmu(env, taddr, MEM_IDX(2 + ADDR_WORDS));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            assert(taddr == host_addr);
-            tmp8 = *(uint8_t *)(host_addr + GUEST_BASE);
-#endif
-            tci_write_reg8s(t0, tmp8);
-            break;
-        case INDEX_op_qemu_ld16u:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+    REG(1) = tswap16(*(uint16_t *)HOST_ADDR(taddr));
+#endif
+    NEXT(QEMU_LD_LEN);
+op_qemu_ld16s:
+    SAVE_PC();
+    taddr = ADDR(2);
 #ifdef CONFIG_SOFTMMU
-            tmp16 = helper_ldw_mmu(env, taddr, tci_read_i(&tb_ptr));
+    REG(1) = (int16_t)helper_ldw_mmu(env, taddr, MEM_IDX(2 + ADDR_WORDS));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            assert(taddr == host_addr);
-            tmp16 = tswap16(*(uint16_t *)(host_addr + GUEST_BASE));
-#endif
-            tci_write_reg16(t0, tmp16);
-            break;
-        case INDEX_op_qemu_ld16s:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+    REG(1) = (int16_t)tswap16(*(uint16_t *)HOST_ADDR(taddr));
+#endif
+    NEXT(QEMU_LD_LEN);
+op_qemu_ld32u:
+    SAVE_PC();
+    taddr = ADDR(2);
 #ifdef CONFIG_SOFTMMU
-            tmp16 = helper_ldw_mmu(env, taddr, tci_read_i(&tb_ptr));
+    REG(1) = helper_ldl_mmu(env, taddr, MEM_IDX(2 + ADDR_WORDS));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            assert(taddr == host_addr);
-            tmp16 = tswap16(*(uint16_t *)(host_addr + GUEST_BASE));
+    REG(1) = tswap32(*(uint32_t *)HOST_ADDR(taddr));
 #endif
-            tci_write_reg16s(t0, tmp16);
-            break;
+    NEXT(QEMU_LD_LEN);
 #if TCG_TARGET_REG_BITS == 64
-        case INDEX_op_qemu_ld32u:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+op_qemu_ld32s:
+    SAVE_PC();
+    taddr = ADDR(2);
 #ifdef CONFIG_SOFTMMU
-            tmp32 = helper_ldl_mmu(env, taddr, tci_read_i(&tb_ptr));
+    REG(1) = (int32_t)helper_ldl_mmu(env, taddr, MEM_IDX(2 + ADDR_WORDS));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            assert(taddr == host_addr);
-            tmp32 = tswap32(*(uint32_t *)(host_addr + GUEST_BASE));
-#endif
-            tci_write_reg32(t0, tmp32);
-            break;
-        case INDEX_op_qemu_ld32s:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+    REG(1) = (int32_t)tswap32(*(uint32_t *)HOST_ADDR(taddr));
+#endif
+    NEXT(QEMU_LD_LEN);
+op_qemu_ld64:
+    SAVE_PC();
+    taddr = ADDR(2);
 #ifdef CONFIG_SOFTMMU
-            tmp32 = helper_ldl_mmu(env, taddr, tci_read_i(&tb_ptr));
+    REG(1) = helper_ldq_mmu(env, taddr, MEM_IDX(2 + ADDR_WORDS));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            assert(taddr == host_addr);
-            tmp32 = tswap32(*(uint32_t *)(host_addr + GUEST_BASE));
+    REG(1) = tswap64(*(uint64_t *)HOST_ADDR(taddr));
 #endif
-            tci_write_reg32s(t0, tmp32);
-            break;
-#endif /* TCG_TARGET_REG_BITS == 64 */
-        case INDEX_op_qemu_ld32:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+    NEXT(QEMU_LD64_LEN);
+#else
+op_qemu_ld64:
+    SAVE_PC();
+    taddr = ADDR(3);
 #ifdef CONFIG_SOFTMMU
-            tmp32 = helper_ldl_mmu(env, taddr, tci_read_i(&tb_ptr));
+    tmp64 = helper_ldq_mmu(env, taddr, MEM_IDX(3 + ADDR_WORDS));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            assert(taddr == host_addr);
-            tmp32 = tswap32(*(uint32_t *)(host_addr + GUEST_BASE));
-#endif
-            tci_write_reg32(t0, tmp32);
-            break;
-        case INDEX_op_qemu_ld64:
-            t0 = *tb_ptr++;
-#if TCG_TARGET_REG_BITS == 32
-            t1 = *tb_ptr++;
+    tmp64 = tswap64(*(uint64_t *)HOST_ADDR(taddr));
 #endif
-            taddr = tci_read_ulong(&tb_ptr);
+    REG(1) = tmp64;
+    REG(2) = tmp64 >> 32;
+    NEXT(QEMU_LD64_LEN);
+#endif /* TCG_TARGET_REG_BITS == 64 */
+op_qemu_st8:
+    SAVE_PC();
+    taddr = ADDR(2);
 #ifdef CONFIG_SOFTMMU
-            tmp64 = helper_ldq_mmu(env, taddr, tci_read_i(&tb_ptr));
+    helper_stb_mmu(env, taddr, REG(1), MEM_IDX(2 + ADDR_WORDS));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            assert(taddr == host_addr);
-            tmp64 = tswap64(*(uint64_t *)(host_addr + GUEST_BASE));
-#endif
-            tci_write_reg(t0, tmp64);
-#if TCG_TARGET_REG_BITS == 32
-            tci_write_reg(t1, tmp64 >> 32);
+    *(uint8_t *)HOST_ADDR(taddr) = REG(1);
 #endif
-            break;
-        case INDEX_op_qemu_st8:
-            t0 = tci_read_r8(&tb_ptr);
-            taddr = tci_read_ulong(&tb_ptr);
+    NEXT(QEMU_LD_LEN);
+op_qemu_st16:
+    SAVE_PC();
+    taddr = ADDR(2);
 #ifdef CONFIG_SOFTMMU
-            t2 = tci_read_i(&tb_ptr);
-            helper_stb_mmu(env, taddr, t0, t2);
+    helper_stw_mmu(env, taddr, REG(1), MEM_IDX(2 + ADDR_WORDS));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            assert(taddr == host_addr);
-            *(uint8_t *)(host_addr + GUEST_BASE) = t0;
-#endif
-            break;
-        case INDEX_op_qemu_st16:
-            t0 = tci_read_r16(&tb_ptr);
-            taddr = tci_read_ulong(&tb_ptr);
+    *(uint16_t *)HOST_ADDR(taddr) = tswap16(REG(1));
+#endif
+    NEXT(QEMU_LD_LEN);
+op_qemu_st32:
+    SAVE_PC();
+    taddr = ADDR(2);
 #ifdef CONFIG_SOFTMMU
-            t2 = tci_read_i(&tb_ptr);
-            helper_stw_mmu(env, taddr, t0, t2);
+    helper_stl_mmu(env, taddr, REG(1), MEM_IDX(2 + ADDR_WORDS));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            assert(taddr == host_addr);
-            *(uint16_t *)(host_addr + GUEST_BASE) = tswap16(t0);
-#endif
-            break;
-        case INDEX_op_qemu_st32:
-            t0 = tci_read_r32(&tb_ptr);
-            taddr = tci_read_ulong(&tb_ptr);
-#ifdef CONFIG_SOFTMMU
-            t2 = tci_read_i(&tb_ptr);
-            helper_stl_mmu(env, taddr, t0, t2);
+    *(uint32_t *)HOST_ADDR(taddr) = tswap32(REG(1));
+#endif
+    NEXT(QEMU_LD_LEN);
+op_qemu_st64:
+    SAVE_PC();
+#if TCG_TARGET_REG_BITS == 32
+    tmp64 = REG64(1);
+    taddr = ADDR(3);
+# define ST64_MEM_IDX   MEM_IDX(3 + ADDR_WORDS)
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            assert(taddr == host_addr);
-            *(uint32_t *)(host_addr + GUEST_BASE) = tswap32(t0);
-#endif
-            break;
-        case INDEX_op_qemu_st64:
-            tmp64 = tci_read_r64(&tb_ptr);
-            taddr = tci_read_ulong(&tb_ptr);
+    tmp64 = REG(1);
+    taddr = ADDR(2);
+# define ST64_MEM_IDX   MEM_IDX(2 + ADDR_WORDS)
+#endif
 #ifdef CONFIG_SOFTMMU
-            t2 = tci_read_i(&tb_ptr);
-            helper_stq_mmu(env, taddr, tmp64, t2);
+    helper_stq_mmu(env, taddr, tmp64, ST64_MEM_IDX);
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            assert(taddr == host_addr);
-            *(uint64_t *)(host_addr + GUEST_BASE) = tswap64(tmp64);
-#endif
-            break;
-        default:
-            TODO();
-            break;
-        }
-        assert(tb_ptr == old_code_ptr + op_size);
-    }
-exit:
-    return next_tb;
+    *(uint64_t *)HOST_ADDR(taddr) = tswap64(tmp64);
+#endif
+    NEXT(QEMU_LD64_LEN);
 }
@@ -0,0 +1,259 @@
+/*
+ * QTest testcase for the shared memory display
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "libqtest.h"
+#include "ui/shm-display.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Bochs VBE interface of the standard VGA */
+#define VBE_DISPI_IOPORT_INDEX      0x1ce
+#define VBE_DISPI_IOPORT_DATA       0x1cf
+#define VBE_DISPI_INDEX_XRES        0x1
+#define VBE_DISPI_INDEX_YRES        0x2
+#define VBE_DISPI_INDEX_BPP         0x3
+#define VBE_DISPI_INDEX_ENABLE      0x4
+#define VBE_DISPI_ENABLED           0x01
+
+/* the 64 KB VGA window at 0xa0000 maps bank 0 of the video memory */
+#define VGA_WINDOW                  0xa0000
+
+#define WIDTH   64
+#define HEIGHT  48
+
+static char *socket_path;
+static int sock = -1;
+
+/* the client's view of the display */
+static ShmDisplaySurface surface;
+static uint32_t *fb;
+
+static void vbe_write(uint16_t index, uint16_t val)
+{
+    outw(VBE_DISPI_IOPORT_INDEX, index);
+    outw(VBE_DISPI_IOPORT_DATA, val);
+}
+
+static uint32_t pattern(int x, int y, int frame)
+{
+    return ((x * 4) << 16) | ((y * 5) << 8) | (frame * 0x40 + ((x ^ y) & 0x3f));
+}
+
+static void draw(int x0, int y0, int w, int h, int frame)
+{
+    uint8_t line[WIDTH * 4];
+    uint32_t pixel;
+    int x, y;
+
+    for (y = y0; y < y0 + h; y++) {
+        for (x = x0; x < x0 + w; x++) {
+            /* the guest's framebuffer is little endian x8r8g8b8 */
+            pixel = pattern(x, y, frame);
+            line[(x - x0) * 4 + 0] = pixel;
+            line[(x - x0) * 4 + 1] = pixel >> 8;
+            line[(x - x0) * 4 + 2] = pixel >> 16;
+            line[(x - x0) * 4 + 3] = 0;
+        }
+        memwrite(VGA_WINDOW + (y * WIDTH + x0) * 4, line, w * 4);
+    }
+}
+
+static void read_full(void *buf, size_t size)
+{
+    uint8_t *p = buf;
+    ssize_t ret;
+
+    while (size) {
+        ret = read(sock, p, size);
+        g_assert_cmpint(ret, >, 0);
+        p += ret;
+        size -= ret;
+    }
+}
+
+/*
+ * Read one message into a buffer the caller frees.  SURFACE messages
+ * replace the mapping of the framebuffer.
+ */
+static uint32_t read_msg(void **payload)
+{
+    union {
+        struct cmsghdr cmsg;
+        char control[CMSG_SPACE(sizeof(int))];
+    } u;
+    ShmDisplayHeader hdr;
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t ret;
+    int fd = -1;
+
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.control;
+    msg.msg_controllen = sizeof(u.control);
+    ret = recvmsg(sock, &msg, MSG_WAITALL);
+    g_assert_cmpint(ret, ==, sizeof(hdr));
+    if (msg.msg_controllen && u.cmsg.cmsg_level == SOL_SOCKET &&
+        u.cmsg.cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(&u.cmsg), sizeof(int));
+    }
+
+    *payload = g_malloc(hdr.size);
+    read_full(*payload, hdr.size);
+
+    if (hdr.type == SHM_DISPLAY_SURFACE) {
+        g_assert_cmpint(hdr.size, ==, sizeof(surface));
+        g_assert_cmpint(fd, >=, 0);
+        if (fb) {
+            munmap(fb, surface.size);
+        }
+        memcpy(&surface, *payload, sizeof(surface));
+        fb = mmap(NULL, surface.size, PROT_READ, MAP_SHARED, fd, 0);
+        g_assert(fb != MAP_FAILED);
+        close(fd);
+    } else {
+        g_assert_cmpint(fd, ==, -1);
+    }
+    return hdr.type;
+}
+
+/*
+ * Read messages until the updates received since the last surface of
+ * the expected size cover the rectangle.
+ */
+static void wait_update(int x, int y, int w, int h)
+{
+    int x1 = WIDTH, y1 = HEIGHT, x2 = 0, y2 = 0;
+    ShmDisplayUpdate *u;
+    void *payload;
+
+    while (x1 > x || y1 > y || x2 < x + w || y2 < y + h) {
+        switch (read_msg(&payload)) {
+        case SHM_DISPLAY_SURFACE:
+            x1 = WIDTH, y1 = HEIGHT, x2 = 0, y2 = 0;
+            break;
+        case SHM_DISPLAY_UPDATE:
+            u = payload;
+            if (surface.width == WIDTH && surface.height == HEIGHT) {
+                x1 = MIN(x1, u->x);
+                y1 = MIN(y1, u->y);
+                x2 = MAX(x2, u->x + u->width);
+                y2 = MAX(y2, u->y + u->height);
+            }
+            break;
+        }
+        g_free(payload);
+    }
+}
+
+static bool frame_matches(int rx, int ry, int rw, int rh, int frame)
+{
+    uint32_t expected, actual;
+    int x, y, f;
+
+    if (!fb || surface.width != WIDTH || surface.height != HEIGHT) {
+        return false;
+    }
+    g_assert_cmpint(surface.stride, >=, WIDTH * 4);
+    g_assert_cmpint(surface.size, >=, surface.stride * HEIGHT);
+    for (y = 0; y < HEIGHT; y++) {
+        for (x = 0; x < WIDTH; x++) {
+            f = (x >= rx && x < rx + rw && y >= ry && y < ry + rh) ? frame : 0;
+            expected = pattern(x, y, f);
+            actual = fb[y * (surface.stride / 4) + x] & 0xffffff;
+            if (actual != expected) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Updates sent before the guest drew may still be queued in the socket,
+ * so give the display a few of them to catch up.
+ */
+static void wait_frame(int rx, int ry, int rw, int rh, int frame)
+{
+    int i;
+
+    for (i = 0; !frame_matches(rx, ry, rw, rh, frame); i++) {
+        g_assert_cmpint(i, <, 16);
+        wait_update(rx, ry, rw, rh);
+    }
+}
+
+static void test_connect(void)
+{
+    struct sockaddr_un addr;
+
+    draw(0, 0, WIDTH, HEIGHT, 0);
+
+    sock = socket(PF_UNIX, SOCK_STREAM, 0);
+    g_assert_cmpint(sock, >=, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    g_assert_cmpint(connect(sock, (struct sockaddr *)&addr,
+                            sizeof(addr)), ==, 0);
+
+    wait_frame(0, 0, WIDTH, HEIGHT, 0);
+}
+
+static void test_update(void)
+{
+    draw(8, 16, 24, 8, 1);
+    wait_frame(8, 16, 24, 8, 1);
+}
+
+int main(int argc, char **argv)
+{
+    QTestState *s;
+    char *args;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    socket_path = g_strdup_printf("/tmp/qtest-shm-display-%d.sock", getpid());
+    args = g_strdup_printf("-vga std -display shm=%s", socket_path);
+    s = qtest_start(args);
+
+    /*
+     * There is no BIOS: set a 64x48x32 VBE mode, enable all planes for
+     * writes through the window and turn the display on.
+     */
+    vbe_write(VBE_DISPI_INDEX_XRES, WIDTH);
+    vbe_write(VBE_DISPI_INDEX_YRES, HEIGHT);
+    vbe_write(VBE_DISPI_INDEX_BPP, 32);
+    vbe_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED);
+    outb(0x3c4, 0x02);
+    outb(0x3c5, 0x0f);
+    outb(0x3c0, 0x20);
+
+    qtest_add_func("/shm-display/connect", test_connect);
+    qtest_add_func("/shm-display/update", test_update);
+    ret = g_test_run();
+
+    if (sock >= 0) {
+        close(sock);
+    }
+    qtest_quit(s);
+    unlink(socket_path);
+    g_free(socket_path);
+    g_free(args);
+
+    return ret;
+}
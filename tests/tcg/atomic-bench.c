@@ -0,0 +1,154 @@
+/*
+ * Microbenchmark of atomic read-modify-write operations from several
+ * threads.
+ *
+ * Each thread increments shared counters of 1, 2, 4 and 8 bytes with
+ * atomic builtins, which the compiler turns into ldrex/strex on ARM,
+ * ll/sc on MIPS and locked instructions on x86.  Run it natively and
+ * under qemu-linux-user, and compare the time of one increment.  The
+ * counters are checked at the end, so that it is also a test of the
+ * atomicity of their emulation.
+ *
+ * usage: atomic-bench [THREADS [ITERATIONS]]
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MAX_THREADS 64
+
+#define fail_unless(x)                                              \
+do {                                                                \
+    if (!(x)) {                                                     \
+        fprintf(stderr, "FAILED at %s:%d\n", __FILE__, __LINE__);   \
+        exit(EXIT_FAILURE);                                         \
+    }                                                               \
+} while (0)
+
+static volatile uint8_t counter8;
+static volatile uint16_t counter16;
+static volatile uint32_t counter32;
+static volatile uint64_t counter64;
+static volatile uint32_t counter_cas;
+static int nb_threads = 4;
+static long iterations = 1000000;
+
+static int64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *add8(void *arg)
+{
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        __sync_fetch_and_add(&counter8, 1);
+    }
+    return NULL;
+}
+
+static void *add16(void *arg)
+{
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        __sync_fetch_and_add(&counter16, 1);
+    }
+    return NULL;
+}
+
+static void *add32(void *arg)
+{
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        __sync_fetch_and_add(&counter32, 1);
+    }
+    return NULL;
+}
+
+/* 32-bit MIPS has no 64-bit ll/sc */
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_8
+static void *add64(void *arg)
+{
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        __sync_fetch_and_add(&counter64, 1);
+    }
+    return NULL;
+}
+#endif
+
+/* An explicit compare-and-swap loop, as lock-free code writes it */
+static void *cas32(void *arg)
+{
+    uint32_t old;
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        do {
+            old = counter_cas;
+        } while (!__sync_bool_compare_and_swap(&counter_cas, old, old + 1));
+    }
+    return NULL;
+}
+
+static void bench(const char *name, void *(*fn)(void *))
+{
+    pthread_t threads[MAX_THREADS];
+    int64_t start;
+    int i;
+
+    start = now();
+    for (i = 0; i < nb_threads; i++) {
+        fail_unless(pthread_create(&threads[i], NULL, fn, NULL) == 0);
+    }
+    for (i = 0; i < nb_threads; i++) {
+        fail_unless(pthread_join(threads[i], NULL) == 0);
+    }
+    printf("%-16s %8.1f ns\n", name,
+           (double)(now() - start) / (iterations * nb_threads));
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t total;
+
+    if (argc > 1) {
+        nb_threads = atoi(argv[1]);
+        fail_unless(nb_threads > 0 && nb_threads <= MAX_THREADS);
+    }
+    if (argc > 2) {
+        iterations = atol(argv[2]);
+        fail_unless(iterations > 0);
+    }
+    total = (uint64_t)iterations * nb_threads;
+
+    bench("add 8 bit", add8);
+    bench("add 16 bit", add16);
+    bench("add 32 bit", add32);
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_8
+    bench("add 64 bit", add64);
+#endif
+    bench("cmpxchg 32 bit", cas32);
+
+    fail_unless(counter8 == (uint8_t)total);
+    fail_unless(counter16 == (uint16_t)total);
+    fail_unless(counter32 == (uint32_t)total);
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_8
+    fail_unless(counter64 == total);
+#endif
+    fail_unless(counter_cas == (uint32_t)total);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,194 @@
+/*
+ * Microbenchmark of the system calls that pass buffers to the kernel.
+ *
+ * Run it natively and under qemu-linux-user, and compare the time of one
+ * call.  The data that goes through the calls is checked, so that it is
+ * also a small test of their emulation.
+ *
+ * usage: syscall-bench [ITERATIONS]
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#define NVEC 16
+#define VEC_SIZE 256
+#define NEVENTS 4
+
+#define fail_unless(x)                                              \
+do {                                                                \
+    if (!(x)) {                                                     \
+        fprintf(stderr, "FAILED at %s:%d\n", __FILE__, __LINE__);   \
+        exit(EXIT_FAILURE);                                         \
+    }                                                               \
+} while (0)
+
+static char out_buf[NVEC][VEC_SIZE];
+static char in_buf[NVEC][VEC_SIZE];
+static struct iovec out_vec[NVEC];
+static struct iovec in_vec[NVEC];
+static long iterations = 100000;
+
+static int64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(const char *name, int64_t start)
+{
+    printf("%-16s %8.0f ns\n", name, (double)(now() - start) / iterations);
+}
+
+static void fill(int seed)
+{
+    int i, j;
+
+    for (i = 0; i < NVEC; i++) {
+        for (j = 0; j < VEC_SIZE; j++) {
+            out_buf[i][j] = seed + i * 7 + j;
+        }
+    }
+    memset(in_buf, 0, sizeof(in_buf));
+}
+
+static void check(void)
+{
+    fail_unless(memcmp(out_buf, in_buf, sizeof(out_buf)) == 0);
+}
+
+static void bench_pipe(void)
+{
+    int fds[2];
+    int64_t start;
+    long i;
+
+    fail_unless(pipe(fds) == 0);
+    fill(getpid());
+    start = now();
+    for (i = 0; i < iterations; i++) {
+        fail_unless(writev(fds[1], out_vec, NVEC) == sizeof(out_buf));
+        fail_unless(readv(fds[0], in_vec, NVEC) == sizeof(in_buf));
+    }
+    check();
+    report("writev+readv", start);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void bench_file(void)
+{
+    char name[] = "/tmp/syscall-bench.XXXXXX";
+    int fd = mkstemp(name);
+    int64_t start;
+    long i;
+
+    fail_unless(fd >= 0);
+    unlink(name);
+    fill(getpid());
+    start = now();
+    for (i = 0; i < iterations; i++) {
+        fail_unless(pwrite(fd, out_buf, sizeof(out_buf), i % 8 * 4096)
+                    == sizeof(out_buf));
+        fail_unless(pread(fd, in_buf, sizeof(in_buf), i % 8 * 4096)
+                    == sizeof(in_buf));
+    }
+    check();
+    report("pwrite+pread", start);
+    close(fd);
+}
+
+static void bench_socket(void)
+{
+    struct msghdr out_msg, in_msg;
+    int fds[2];
+    int64_t start;
+    long i;
+
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    memset(&out_msg, 0, sizeof(out_msg));
+    out_msg.msg_iov = out_vec;
+    out_msg.msg_iovlen = NVEC;
+    memset(&in_msg, 0, sizeof(in_msg));
+    in_msg.msg_iov = in_vec;
+    in_msg.msg_iovlen = NVEC;
+    fill(getpid());
+    start = now();
+    for (i = 0; i < iterations; i++) {
+        fail_unless(sendmsg(fds[0], &out_msg, 0) == sizeof(out_buf));
+        fail_unless(recvmsg(fds[1], &in_msg, MSG_WAITALL) == sizeof(in_buf));
+    }
+    check();
+    report("sendmsg+recvmsg", start);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void bench_epoll(void)
+{
+    struct epoll_event ev, events[NEVENTS];
+    int fds[NEVENTS][2];
+    int epfd, i, n;
+    int64_t start;
+    long j;
+
+    epfd = epoll_create(NEVENTS);
+    fail_unless(epfd >= 0);
+    for (i = 0; i < NEVENTS; i++) {
+        fail_unless(pipe(fds[i]) == 0);
+        fail_unless(write(fds[i][1], "x", 1) == 1);
+        ev.events = EPOLLIN;
+        ev.data.u64 = 0x100000000ULL * i + 0x5a5a;
+        fail_unless(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i][0], &ev) == 0);
+    }
+    start = now();
+    for (j = 0; j < iterations; j++) {
+        n = epoll_wait(epfd, events, NEVENTS, 0);
+        fail_unless(n == NEVENTS);
+    }
+    report("epoll_wait", start);
+    for (i = 0; i < n; i++) {
+        fail_unless(events[i].events == EPOLLIN);
+        fail_unless((uint32_t)events[i].data.u64 == 0x5a5a);
+        fail_unless(events[i].data.u64 >> 32 < NEVENTS);
+    }
+    for (i = 0; i < NEVENTS; i++) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+    close(epfd);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    if (argc > 1) {
+        iterations = atol(argv[1]);
+        fail_unless(iterations > 0);
+    }
+    for (i = 0; i < NVEC; i++) {
+        out_vec[i].iov_base = out_buf[i];
+        out_vec[i].iov_len = VEC_SIZE;
+        in_vec[i].iov_base = in_buf[i];
+        in_vec[i].iov_len = VEC_SIZE;
+    }
+    bench_pipe();
+    bench_file();
+    bench_socket();
+    bench_epoll();
+    return EXIT_SUCCESS;
+}
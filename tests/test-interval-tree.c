@@ -0,0 +1,196 @@
+/*
+ * Interval tree unit-tests.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include "qemu/interval-tree.h"
+
+#define SHADOW_SIZE 1024
+
+/* Check that the runs of the tree cover [0, last] in order, that no two
+ * neighbours have the same value, and that they agree with 'shadow'.
+ */
+static void check_runs(IntervalTree *tree, const unsigned long *shadow)
+{
+    const IntervalTreeNode *n, *prev = NULL;
+    uint64_t point = 0, i;
+
+    for (;;) {
+        n = interval_tree_find(tree, point);
+        g_assert_cmpuint(n->start, ==, point);
+        g_assert_cmpuint(n->last, >=, n->start);
+        if (prev) {
+            g_assert_cmpuint(n->value, !=, prev->value);
+        }
+        for (i = n->start; shadow && i <= n->last; i++) {
+            g_assert_cmpuint(shadow[i], ==, n->value);
+        }
+        if (n->last == tree->last) {
+            break;
+        }
+        prev = n;
+        point = n->last + 1;
+    }
+}
+
+/* The answer of interval_tree_find_free(), the slow way.  */
+static bool shadow_find_free(const unsigned long *shadow,
+                             uint64_t start, uint64_t last,
+                             uint64_t size, uint64_t align, bool top_down,
+                             uint64_t *result)
+{
+    uint64_t addr, i;
+    int64_t a;
+
+    for (a = top_down ? last : start;
+         top_down ? a >= (int64_t)start : a <= (int64_t)last;
+         a += top_down ? -1 : 1) {
+        addr = a;
+        if (addr % align || addr + size - 1 > last) {
+            continue;
+        }
+        for (i = addr; i < addr + size && shadow[i] == 0; i++) {
+        }
+        if (i == addr + size) {
+            *result = addr;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void test_interval_tree_init(void)
+{
+    IntervalTree tree;
+    const IntervalTreeNode *n;
+    uint64_t addr;
+
+    interval_tree_init(&tree, 0xffff);
+    n = interval_tree_find(&tree, 0x1234);
+    g_assert_cmpuint(n->start, ==, 0);
+    g_assert_cmpuint(n->last, ==, 0xffff);
+    g_assert_cmpuint(n->value, ==, 0);
+    g_assert(interval_tree_find_free(&tree, 0, 0xffff, 0x10000, 1, true,
+                                     &addr));
+    g_assert_cmpuint(addr, ==, 0);
+    g_assert(!interval_tree_find_free(&tree, 1, 0xffff, 0x10000, 1, true,
+                                      &addr));
+    interval_tree_destroy(&tree);
+}
+
+static void test_interval_tree_merge(void)
+{
+    IntervalTree tree;
+    const IntervalTreeNode *n;
+
+    interval_tree_init(&tree, 0xffff);
+    interval_tree_set(&tree, 0x1000, 0x1fff, 5);
+    interval_tree_set(&tree, 0x3000, 0x3fff, 5);
+    check_runs(&tree, NULL);
+    n = interval_tree_find(&tree, 0x2000);
+    g_assert_cmpuint(n->start, ==, 0x2000);
+    g_assert_cmpuint(n->last, ==, 0x2fff);
+
+    /* filling the hole joins the three runs */
+    interval_tree_set(&tree, 0x2000, 0x2fff, 5);
+    n = interval_tree_find(&tree, 0x1000);
+    g_assert_cmpuint(n->start, ==, 0x1000);
+    g_assert_cmpuint(n->last, ==, 0x3fff);
+    g_assert_cmpuint(n->value, ==, 5);
+
+    /* and punching one splits it again */
+    interval_tree_set(&tree, 0x2800, 0x2800, 7);
+    check_runs(&tree, NULL);
+    n = interval_tree_find(&tree, 0x2801);
+    g_assert_cmpuint(n->start, ==, 0x2801);
+    g_assert_cmpuint(n->last, ==, 0x3fff);
+    g_assert_cmpuint(n->value, ==, 5);
+
+    interval_tree_set(&tree, 0, 0xffff, 0);
+    n = interval_tree_find(&tree, 0);
+    g_assert_cmpuint(n->last, ==, 0xffff);
+    interval_tree_destroy(&tree);
+}
+
+static void test_interval_tree_full_range(void)
+{
+    IntervalTree tree;
+    const IntervalTreeNode *n;
+    uint64_t addr;
+
+    interval_tree_init(&tree, UINT64_MAX);
+    g_assert(interval_tree_find_free(&tree, 0, UINT64_MAX, UINT64_MAX,
+                                     1, true, &addr));
+    g_assert_cmpuint(addr, ==, 1);
+
+    interval_tree_set(&tree, UINT64_MAX - 0xfff, UINT64_MAX, 1);
+    n = interval_tree_find(&tree, UINT64_MAX);
+    g_assert_cmpuint(n->start, ==, UINT64_MAX - 0xfff);
+    check_runs(&tree, NULL);
+
+    g_assert(interval_tree_find_free(&tree, 0, UINT64_MAX, 0x2000,
+                                     0x1000, true, &addr));
+    g_assert_cmpuint(addr, ==, UINT64_MAX - 0x2fff);
+    g_assert(interval_tree_find_free(&tree, 0x10, UINT64_MAX, 0x2000,
+                                     0x1000, false, &addr));
+    g_assert_cmpuint(addr, ==, 0x1000);
+    interval_tree_destroy(&tree);
+}
+
+static void test_interval_tree_random(void)
+{
+    IntervalTree tree;
+    unsigned long shadow[SHADOW_SIZE] = { 0 };
+    uint64_t start, last, size, align, addr, expected, i;
+    bool top_down, found;
+    int iter, j;
+
+    interval_tree_init(&tree, SHADOW_SIZE - 1);
+    for (iter = 0; iter < 2000; iter++) {
+        start = g_test_rand_int_range(0, SHADOW_SIZE);
+        last = start + g_test_rand_int_range(0, 64);
+        if (last >= SHADOW_SIZE) {
+            last = SHADOW_SIZE - 1;
+        }
+        /* few values, so that runs get merged */
+        j = g_test_rand_int_range(0, 4);
+        for (i = start; i <= last; i++) {
+            shadow[i] = j;
+        }
+        interval_tree_set(&tree, start, last, j);
+        check_runs(&tree, shadow);
+
+        for (j = 0; j < 4; j++) {
+            start = g_test_rand_int_range(0, SHADOW_SIZE);
+            last = g_test_rand_int_range(start, SHADOW_SIZE);
+            size = g_test_rand_int_range(1, 32);
+            align = 1 << g_test_rand_int_range(0, 4);
+            top_down = g_test_rand_bit();
+            found = shadow_find_free(shadow, start, last, size, align,
+                                     top_down, &expected);
+            g_assert_cmpint(interval_tree_find_free(&tree, start, last,
+                                                    size, align, top_down,
+                                                    &addr), ==, found);
+            if (found) {
+                g_assert_cmpuint(addr, ==, expected);
+            }
+        }
+    }
+    interval_tree_destroy(&tree);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-tree/init", test_interval_tree_init);
+    g_test_add_func("/interval-tree/merge", test_interval_tree_merge);
+    g_test_add_func("/interval-tree/full-range",
+                    test_interval_tree_full_range);
+    g_test_add_func("/interval-tree/random", test_interval_tree_random);
+    g_test_run();
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Check the host FPU fast path of softfloat against the software code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The fast path is only taken when the inexact flag is already set, so
+ * every operation is done twice: once with inexact set, which may use the
+ * host FPU, and once with no flags set, which always goes through the
+ * software implementation.  Results and flags must agree bit for bit.
+ */
+
+#include <glib.h>
+#include <stdint.h>
+#include "fpu/softfloat.h"
+
+typedef struct {
+    const char *path;
+    float32 (*op)(float32, float32, float_status *);
+} Float32Test;
+
+typedef struct {
+    const char *path;
+    float64 (*op)(float64, float64, float_status *);
+} Float64Test;
+
+static const Float32Test float32_tests[] = {
+    { "/softfloat/float32/add", float32_add },
+    { "/softfloat/float32/sub", float32_sub },
+    { "/softfloat/float32/mul", float32_mul },
+    { "/softfloat/float32/div", float32_div },
+};
+
+static const Float64Test float64_tests[] = {
+    { "/softfloat/float64/add", float64_add },
+    { "/softfloat/float64/sub", float64_sub },
+    { "/softfloat/float64/mul", float64_mul },
+    { "/softfloat/float64/div", float64_div },
+};
+
+/* Mostly normal numbers with exponents that keep results in range, plus
+   values close to overflow and underflow and the special encodings.  */
+static float32 random_float32(void)
+{
+    uint32_t r = g_test_rand_int();
+    uint32_t sign = r & 0x80000000;
+    uint32_t frac = g_test_rand_int() & 0x007FFFFF;
+    uint32_t exp;
+
+    switch (r & 15) {
+    case 0:
+        return make_float32(sign);
+    case 1:
+        return make_float32(sign | frac);
+    case 2:
+        return make_float32(sign | 0x7F800000 | (r & 0x10 ? frac : 0));
+    case 3:
+        exp = 0xFE - (r >> 8) % 24;
+        break;
+    case 4:
+        exp = 1 + (r >> 8) % 24;
+        break;
+    default:
+        exp = 0x7F - 32 + (r >> 8) % 64;
+        break;
+    }
+    return make_float32(sign | (exp << 23) | frac);
+}
+
+static float64 random_float64(void)
+{
+    uint64_t r = ((uint64_t)g_test_rand_int() << 32) | g_test_rand_int();
+    uint64_t sign = r & LIT64(0x8000000000000000);
+    uint64_t frac = r & LIT64(0x000FFFFFFFFFFFFF);
+    uint32_t sel = g_test_rand_int();
+    uint64_t exp;
+
+    switch (sel & 15) {
+    case 0:
+        return make_float64(sign);
+    case 1:
+        return make_float64(sign | frac);
+    case 2:
+        return make_float64(sign | LIT64(0x7FF0000000000000) |
+                            (sel & 0x10 ? frac : 0));
+    case 3:
+        exp = 0x7FE - (sel >> 8) % 54;
+        break;
+    case 4:
+        exp = 1 + (sel >> 8) % 54;
+        break;
+    default:
+        exp = 0x3FF - 64 + (sel >> 8) % 128;
+        break;
+    }
+    return make_float64(sign | (exp << 52) | frac);
+}
+
+static void init_status(float_status *s, uint32_t mode, int flags)
+{
+    memset(s, 0, sizeof(*s));
+    s->float_detect_tininess = mode & 1 ? float_tininess_before_rounding
+                                        : float_tininess_after_rounding;
+    s->flush_to_zero = (mode >> 1) & 1;
+    s->flush_inputs_to_zero = (mode >> 2) & 1;
+    s->float_exception_flags = flags;
+}
+
+static int iterations(void)
+{
+    return g_test_quick() ? 200000 : 5000000;
+}
+
+static void check_float32(gconstpointer opaque)
+{
+    const Float32Test *test = opaque;
+    float_status host, soft;
+    float32 a, b, zh, zs;
+    uint32_t mode;
+    int i;
+
+    for (i = 0; i < iterations(); i++) {
+        a = random_float32();
+        b = random_float32();
+        mode = g_test_rand_int();
+        init_status(&host, mode, float_flag_inexact);
+        init_status(&soft, mode, 0);
+        zh = test->op(a, b, &host);
+        zs = test->op(a, b, &soft);
+        if (float32_val(zh) != float32_val(zs) ||
+            (uint8_t)host.float_exception_flags !=
+            (uint8_t)(soft.float_exception_flags | float_flag_inexact)) {
+            g_test_message("a=%08x b=%08x mode=%x: %08x/%02x vs %08x/%02x",
+                           float32_val(a), float32_val(b), mode & 7,
+                           float32_val(zh),
+                           (uint8_t)host.float_exception_flags,
+                           float32_val(zs),
+                           (uint8_t)soft.float_exception_flags);
+            g_assert_not_reached();
+        }
+    }
+}
+
+static void check_float64(gconstpointer opaque)
+{
+    const Float64Test *test = opaque;
+    float_status host, soft;
+    float64 a, b, zh, zs;
+    uint32_t mode;
+    int i;
+
+    for (i = 0; i < iterations(); i++) {
+        a = random_float64();
+        b = random_float64();
+        mode = g_test_rand_int();
+        init_status(&host, mode, float_flag_inexact);
+        init_status(&soft, mode, 0);
+        zh = test->op(a, b, &host);
+        zs = test->op(a, b, &soft);
+        if (float64_val(zh) != float64_val(zs) ||
+            (uint8_t)host.float_exception_flags !=
+            (uint8_t)(soft.float_exception_flags | float_flag_inexact)) {
+            g_test_message("a=%016" PRIx64 " b=%016" PRIx64 " mode=%x: "
+                           "%016" PRIx64 "/%02x vs %016" PRIx64 "/%02x",
+                           float64_val(a), float64_val(b), mode & 7,
+                           float64_val(zh),
+                           (uint8_t)host.float_exception_flags,
+                           float64_val(zs),
+                           (uint8_t)soft.float_exception_flags);
+            g_assert_not_reached();
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+    for (i = 0; i < ARRAY_SIZE(float32_tests); i++) {
+        g_test_add_data_func(float32_tests[i].path, &float32_tests[i],
+                             check_float32);
+    }
+    for (i = 0; i < ARRAY_SIZE(float64_tests); i++) {
+        g_test_add_data_func(float64_tests[i].path, &float64_tests[i],
+                             check_float64);
+    }
+    return g_test_run();
+}
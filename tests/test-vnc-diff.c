@@ -0,0 +1,280 @@
+/*
+ * VNC framebuffer diffing unit tests and refresh benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+#include <glib.h>
+#include <string.h>
+#include "qemu-common.h"
+#include "qemu/bitmap.h"
+#include "ui/vnc-diff.h"
+
+#define WIDTH   2560
+#define HEIGHT  1600
+#define CHUNKS  (WIDTH / 16)
+#define STRIDE  (WIDTH * 4)
+#define CLIENTS 8
+
+typedef struct Surface {
+    uint8_t *guest;
+    uint8_t *server;
+    unsigned long (*guest_dirty)[BITS_TO_LONGS(CHUNKS)];
+    unsigned long (*server_dirty)[BITS_TO_LONGS(CHUNKS)];
+    unsigned long (*client_dirty[CLIENTS])[BITS_TO_LONGS(CHUNKS)];
+} Surface;
+
+static Surface *surface_new(void)
+{
+    Surface *s = g_new0(Surface, 1);
+    int i;
+
+    s->guest = g_malloc0(STRIDE * HEIGHT);
+    s->server = g_malloc0(STRIDE * HEIGHT);
+    s->guest_dirty = g_malloc0(sizeof(*s->guest_dirty) * HEIGHT);
+    s->server_dirty = g_malloc0(sizeof(*s->server_dirty) * HEIGHT);
+    for (i = 0; i < CLIENTS; i++) {
+        s->client_dirty[i] = g_malloc0(sizeof(*s->guest_dirty) * HEIGHT);
+    }
+    return s;
+}
+
+static void surface_free(Surface *s)
+{
+    int i;
+
+    for (i = 0; i < CLIENTS; i++) {
+        g_free(s->client_dirty[i]);
+    }
+    g_free(s->server_dirty);
+    g_free(s->guest_dirty);
+    g_free(s->server);
+    g_free(s->guest);
+    g_free(s);
+}
+
+static void surface_mark_all(Surface *s)
+{
+    int y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        bitmap_set(s->guest_dirty[y], 0, CHUNKS);
+    }
+}
+
+/* The refresh loop as it was before vnc_diff_row() */
+static int refresh_reference(Surface *s, int nclients)
+{
+    int x, y, i, n = 0;
+
+    for (y = 0; y < HEIGHT; y++) {
+        uint8_t *guest_ptr = s->guest + y * STRIDE;
+        uint8_t *server_ptr = s->server + y * STRIDE;
+
+        if (bitmap_empty(s->guest_dirty[y], CHUNKS)) {
+            continue;
+        }
+        for (x = 0; x < CHUNKS; x++, guest_ptr += 64, server_ptr += 64) {
+            if (!test_and_clear_bit(x, s->guest_dirty[y])) {
+                continue;
+            }
+            if (memcmp(server_ptr, guest_ptr, 64) == 0) {
+                continue;
+            }
+            memcpy(server_ptr, guest_ptr, 64);
+            for (i = 0; i < nclients; i++) {
+                set_bit(x, s->client_dirty[i][y]);
+            }
+            n++;
+        }
+    }
+    return n;
+}
+
+static int refresh_diff(Surface *s, int nclients)
+{
+    int y, i, n = 0, changed;
+
+    for (y = 0; y < HEIGHT; y++) {
+        if (bitmap_empty(s->guest_dirty[y], CHUNKS)) {
+            continue;
+        }
+        changed = vnc_diff_row(s->server + y * STRIDE, s->guest + y * STRIDE,
+                               STRIDE, 64, s->guest_dirty[y],
+                               s->server_dirty[y]);
+        if (changed) {
+            n += changed;
+            for (i = 0; i < nclients; i++) {
+                bitmap_or(s->client_dirty[i][y], s->client_dirty[i][y],
+                          s->server_dirty[y], CHUNKS);
+            }
+            bitmap_zero(s->server_dirty[y], CHUNKS);
+        }
+    }
+    return n;
+}
+
+static int count_bits(const unsigned long *map, int nbits)
+{
+    int i, n = 0;
+
+    for (i = 0; i < nbits; i++) {
+        n += test_bit(i, map);
+    }
+    return n;
+}
+
+/*
+ * Diff random rows of ROW_BYTES in chunks of CHUNK_BYTES; the last chunk
+ * is partial when the row is not a multiple of the chunk size.
+ */
+static void do_test_row(int row_bytes, int chunk_bytes)
+{
+    uint8_t src[STRIDE], dst[STRIDE], ref[STRIDE];
+    unsigned long dirty[BITS_TO_LONGS(CHUNKS)];
+    unsigned long changed[BITS_TO_LONGS(CHUNKS)];
+    int nchunks = DIV_ROUND_UP(row_bytes, chunk_bytes);
+    int iter, x, i, n, expected;
+
+    for (iter = 0; iter < 1000; iter++) {
+        for (i = 0; i < row_bytes; i++) {
+            src[i] = g_test_rand_int();
+        }
+        memcpy(dst, src, row_bytes);
+        /* change single bytes in a few chunks */
+        for (i = 0; i < 20; i++) {
+            dst[g_test_rand_int_range(0, row_bytes)] ^= 0x40;
+        }
+        for (i = 0; i < ARRAY_SIZE(dirty); i++) {
+            dirty[i] = ((unsigned long)g_test_rand_int() << 31) ^
+                       g_test_rand_int();
+        }
+        /* bits past the end of the row must be left alone */
+        bitmap_set(dirty, nchunks, CHUNKS - nchunks);
+        bitmap_zero(changed, CHUNKS);
+
+        memcpy(ref, dst, row_bytes);
+        expected = 0;
+        for (x = 0; x < nchunks; x++) {
+            int ofs = x * chunk_bytes;
+            int len = MIN(chunk_bytes, row_bytes - ofs);
+
+            if (test_bit(x, dirty) && memcmp(ref + ofs, src + ofs, len)) {
+                memcpy(ref + ofs, src + ofs, len);
+                expected++;
+            }
+        }
+
+        n = vnc_diff_row(dst, src, row_bytes, chunk_bytes, dirty, changed);
+        g_assert_cmpint(n, ==, expected);
+        g_assert(memcmp(dst, ref, row_bytes) == 0);
+        g_assert_cmpint(count_bits(changed, CHUNKS), ==, n);
+        g_assert(find_first_bit(dirty, nchunks) == nchunks);
+        g_assert_cmpint(count_bits(dirty, CHUNKS), ==, CHUNKS - nchunks);
+    }
+}
+
+static void test_row(void)
+{
+    do_test_row(STRIDE, 64);
+}
+
+static void test_row_tiles(void)
+{
+    do_test_row(STRIDE, 128);
+    do_test_row(STRIDE, 256);
+    /* 1918 pixels: partial last tile */
+    do_test_row(1918 * 4, 64);
+    do_test_row(1918 * 4, 256);
+}
+
+static void test_refresh(void)
+{
+    Surface *a = surface_new(), *b = surface_new();
+    int i, y;
+
+    for (i = 0; i < 5000; i++) {
+        int ofs = g_test_rand_int_range(0, STRIDE * HEIGHT);
+        uint8_t val = g_test_rand_int();
+
+        a->guest[ofs] = b->guest[ofs] = val;
+    }
+    surface_mark_all(a);
+    surface_mark_all(b);
+    g_assert_cmpint(refresh_reference(a, CLIENTS), ==,
+                    refresh_diff(b, CLIENTS));
+    g_assert(memcmp(a->server, b->server, STRIDE * HEIGHT) == 0);
+    for (i = 0; i < CLIENTS; i++) {
+        for (y = 0; y < HEIGHT; y++) {
+            g_assert(bitmap_equal(a->client_dirty[i][y],
+                                  b->client_dirty[i][y], CHUNKS));
+        }
+    }
+    surface_free(a);
+    surface_free(b);
+}
+
+/*
+ * Refresh benchmark: a 2560x1600 surface with every chunk marked dirty,
+ * either unchanged (a guest redrawing the same picture) or fully changed.
+ */
+static void perf_refresh(bool change, int (*refresh)(Surface *, int),
+                         const char *name)
+{
+    Surface *s = surface_new();
+    unsigned int i, max = 100;
+    double duration;
+
+    g_test_timer_start();
+    for (i = 0; i < max; i++) {
+        if (change) {
+            memset(s->guest, i, STRIDE * HEIGHT);
+        }
+        surface_mark_all(s);
+        refresh(s, CLIENTS);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("%s, %s surface, %u refreshes: %f s\n", name,
+                   change ? "changed" : "idle", max, duration);
+    surface_free(s);
+}
+
+static void perf_refresh_idle_reference(void)
+{
+    perf_refresh(false, refresh_reference, "memcmp/memcpy");
+}
+
+static void perf_refresh_idle_diff(void)
+{
+    perf_refresh(false, refresh_diff, "vnc_diff_row");
+}
+
+static void perf_refresh_changed_reference(void)
+{
+    perf_refresh(true, refresh_reference, "memcmp/memcpy");
+}
+
+static void perf_refresh_changed_diff(void)
+{
+    perf_refresh(true, refresh_diff, "vnc_diff_row");
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/vnc-diff/row", test_row);
+    g_test_add_func("/vnc-diff/row/tiles", test_row_tiles);
+    g_test_add_func("/vnc-diff/refresh", test_refresh);
+    if (g_test_perf()) {
+        g_test_add_func("/perf/refresh/idle/reference",
+                        perf_refresh_idle_reference);
+        g_test_add_func("/perf/refresh/idle/diff", perf_refresh_idle_diff);
+        g_test_add_func("/perf/refresh/changed/reference",
+                        perf_refresh_changed_reference);
+        g_test_add_func("/perf/refresh/changed/diff",
+                        perf_refresh_changed_diff);
+    }
+    return g_test_run();
+}
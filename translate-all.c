@@ -34,12 +34,20 @@
 #define NO_CPU_IO_DEFS
 #include "cpu.h"
 #include "disas/disas.h"
-#include "tcg.h"
+#include "tcg-op.h"
+#include "tcg/perf.h"
 #include "qemu/timer.h"
 #include "exec/memory.h"
 #include "exec/address-spaces.h"
+#if !defined(CONFIG_USER_ONLY)
+#include "qmp-commands.h"
+#include "qapi/qmp/qerror.h"
+#endif
 #if defined(CONFIG_USER_ONLY)
+#include <sched.h>
+#include <pthread.h>
 #include "qemu.h"
+#include "qemu/interval-tree.h"
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
 #include <sys/param.h>
 #if __FreeBSD_version >= 700104
@@ -70,18 +78,24 @@
 #undef DEBUG_TB_CHECK
 #endif
 
-#define SMC_BITMAP_USE_THRESHOLD 10
+/* Self-modifying code is tracked at cache-line granularity: every page
+   holding code keeps a count of the TBs intersecting each line, so a
+   guest write only goes down the invalidation path when it actually
+   hits a line that contains translated code.  */
+#define SMC_LINE_BITS  6
+#define SMC_LINE_SIZE  (1 << SMC_LINE_BITS)
+#define SMC_PAGE_LINES (TARGET_PAGE_SIZE >> SMC_LINE_BITS)
 
 typedef struct PageDesc {
     /* list of TBs intersecting this ram page */
     TranslationBlock *first_tb;
-    /* in order to optimize self modifying code, we count the number
-       of lookups we do to a given page to use a bitmap */
+    /* number of TBs intersecting each SMC line, allocated with the
+       first TB of the page */
+    unsigned int *code_lines;
+    /* SMC statistics: writes that hit a code line, and writes to the
+       page that only touched data */
     unsigned int code_write_count;
-    uint8_t *code_bitmap;
-#if defined(CONFIG_USER_ONLY)
-    unsigned long flags;
-#endif
+    unsigned int data_write_count;
 } PageDesc;
 
 /* In system mode we want L1_MAP to be based on ram offsets,
@@ -118,18 +132,90 @@ uintptr_t qemu_host_page_mask;
    The bottom level has pointers to PageDesc.  */
 static void *l1_map[V_L1_SIZE];
 
+#if defined(CONFIG_USER_ONLY)
+#if L1_MAP_ADDR_SPACE_BITS >= 64
+# define PAGE_FLAGS_LAST UINT64_MAX
+#else
+# define PAGE_FLAGS_LAST (((uint64_t)1 << L1_MAP_ADDR_SPACE_BITS) - 1)
+#endif
+
+/* The flags of the guest pages, kept by runs of pages with the same
+   flags so that a mapping costs the same whatever its size.  They are
+   changed with both the mmap lock and page_flags_lock held, and read
+   with either of them.  */
+static IntervalTree page_flags;
+static pthread_rwlock_t page_flags_lock = PTHREAD_RWLOCK_INITIALIZER;
+#endif
+
 /* code generation context */
+#if defined(CONFIG_USER_ONLY)
+TCGContext tcg_init_ctx;
+DEFINE_TLS(TCGContext *, tcg_ctx_ptr) = &tcg_init_ctx;
+#else
 TCGContext tcg_ctx;
+#endif
+
+/* translation blocks, shared by all the contexts */
+TBContext tb_ctx;
+
+/* whether the calling thread holds tb_lock */
+static DEFINE_TLS(bool, have_tb_lock);
+#define have_tb_lock tls_var(have_tb_lock)
+
+/* the region the calling thread generated code in last, and the TB it
+   is generating code for, if any */
+static DEFINE_TLS(TBRegion *, tb_region);
+#define tb_region tls_var(tb_region)
+static DEFINE_TLS(TranslationBlock *, tb_pending);
+#define tb_pending tls_var(tb_pending)
+
+/* per-block execution statistics, see TBStatistics */
+bool tb_stats_enabled;
+static GHashTable *tb_stats_table;
 
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2);
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr);
 
+#if !defined(CONFIG_LINUX_USER)
+/* only linux-user keeps translated code across runs, see tbcache.c */
+static inline bool tb_cache_restore(CPUArchState *env, TranslationBlock *tb,
+                                    int *code_size)
+{
+    return false;
+}
+
+static inline void tb_cache_store(CPUArchState *env, TranslationBlock *tb,
+                                  int code_size)
+{
+}
+#endif
+
 void cpu_gen_init(void)
 {
     tcg_context_init(&tcg_ctx); 
 }
 
+/* Count entries to the block.  This must be emitted identically when
+   the block is retranslated to restore the CPU state, so it only depends
+   on tb->tb_stats, which is fixed for the lifetime of the TB.  */
+static void gen_tb_exec_count(TranslationBlock *tb)
+{
+    TCGv_ptr stats;
+    TCGv_i64 count;
+
+    if (!tb->tb_stats) {
+        return;
+    }
+    stats = tcg_const_ptr(tb->tb_stats);
+    count = tcg_temp_new_i64();
+    tcg_gen_ld_i64(count, stats, offsetof(TBStatistics, exec_count));
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, stats, offsetof(TBStatistics, exec_count));
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(stats);
+}
+
 /* return non zero if the very first instruction is invalid so that
    the virtual CPU can trigger an exception.
 
@@ -152,6 +238,7 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
 #endif
     tcg_func_start(s);
 
+    gen_tb_exec_count(tb);
     gen_intermediate_code(env, tb);
 
     /* generate machine code */
@@ -208,6 +295,7 @@ static int cpu_restore_state_from_tb(TranslationBlock *tb, CPUArchState *env,
 #endif
     tcg_func_start(s);
 
+    gen_tb_exec_count(tb);
     gen_intermediate_code_pc(env, tb);
 
     if (use_icount) {
@@ -254,6 +342,9 @@ bool cpu_restore_state(CPUArchState *env, uintptr_t retaddr)
 
     tb = tb_find_pc(retaddr);
     if (tb) {
+        if (tb->tb_stats) {
+            tb->tb_stats->exceptions++;
+        }
         cpu_restore_state_from_tb(tb, env, retaddr);
         return true;
     }
@@ -307,6 +398,10 @@ static void page_init(void)
     }
     qemu_host_page_mask = ~(qemu_host_page_size - 1);
 
+#if defined(CONFIG_USER_ONLY)
+    interval_tree_init(&page_flags, PAGE_FLAGS_LAST);
+#endif
+
 #if defined(CONFIG_BSD) && defined(CONFIG_USER_ONLY)
     {
 #ifdef HAVE_KINFO_GETVMMAP
@@ -428,6 +523,17 @@ static inline PageDesc *page_find(tb_page_addr_t index)
     return page_find_alloc(index, 0);
 }
 
+#if defined(CONFIG_USER_ONLY)
+/* Set the flags of the pages in [start, last].  Must be called with the
+   mmap lock held.  */
+static void page_flags_set(target_ulong start, target_ulong last, int flags)
+{
+    pthread_rwlock_wrlock(&page_flags_lock);
+    interval_tree_set(&page_flags, start, last, flags);
+    pthread_rwlock_unlock(&page_flags_lock);
+}
+#endif
+
 #if !defined(CONFIG_USER_ONLY)
 #define mmap_lock() do { } while (0)
 #define mmap_unlock() do { } while (0)
@@ -578,10 +684,39 @@ static inline void code_gen_alloc(size_t tb_size)
         (TCG_MAX_OP_SIZE * OPC_BUF_SIZE);
     tcg_ctx.code_gen_max_blocks = tcg_ctx.code_gen_buffer_size /
             CODE_GEN_AVG_BLOCK_SIZE;
-    tcg_ctx.tb_ctx.tbs =
+    tb_ctx.tbs =
             g_malloc(tcg_ctx.code_gen_max_blocks * sizeof(TranslationBlock));
 }
 
+/* Split the code buffer into regions.  Each region keeps the slack
+   that the whole buffer used to keep at its end, so that a TB started
+   below code_end always fits.  Small buffers get fewer regions; with
+   a single one, running out of space still means a full flush.  */
+static void tb_regions_init(void)
+{
+    TBContext *ctx = &tb_ctx;
+    size_t slack = TCG_MAX_OP_SIZE * OPC_BUF_SIZE;
+    int i, n;
+
+    n = tcg_ctx.code_gen_buffer_size / (4 * slack);
+    n = MAX(1, MIN(n, TB_MAX_REGIONS));
+    ctx->nb_regions = n;
+    ctx->region_size = (tcg_ctx.code_gen_buffer_size / n) &
+                       ~(size_t)(CODE_GEN_ALIGN - 1);
+    ctx->region_max_blocks = tcg_ctx.code_gen_max_blocks / n;
+    for (i = 0; i < n; i++) {
+        TBRegion *r = &ctx->regions[i];
+
+        r->code_start = tcg_ctx.code_gen_buffer + i * ctx->region_size;
+        r->code_end = r->code_start + ctx->region_size - slack;
+        r->code_ptr = r->code_start;
+        r->tbs = ctx->tbs + i * ctx->region_max_blocks;
+        r->nb_tbs = 0;
+    }
+    /* region 0 is handed out first */
+    ctx->cur_region = n - 1;
+}
+
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
    (in bytes) allocated to the translation buffer. Zero means default
    size. */
@@ -589,7 +724,7 @@ void tcg_exec_init(unsigned long tb_size)
 {
     cpu_gen_init();
     code_gen_alloc(tb_size);
-    tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+    tb_regions_init();
     tcg_register_jit(tcg_ctx.code_gen_buffer, tcg_ctx.code_gen_buffer_size);
     page_init();
 #if !defined(CONFIG_USER_ONLY) || !defined(CONFIG_USE_GUEST_BASE)
@@ -604,42 +739,212 @@ bool tcg_enabled(void)
     return tcg_ctx.code_gen_buffer != NULL;
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
-static TranslationBlock *tb_alloc(target_ulong pc)
+void tb_lock(void)
 {
-    TranslationBlock *tb;
+    spin_lock(&tb_ctx.tb_lock);
+    have_tb_lock = true;
+}
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks ||
-        (tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer) >=
-         tcg_ctx.code_gen_buffer_max_size) {
-        return NULL;
+void tb_unlock(void)
+{
+    have_tb_lock = false;
+    spin_unlock(&tb_ctx.tb_lock);
+}
+
+/* Called by cpu_exec() after a longjmp, which may have come from the
+   middle of tb_gen_code(): release tb_lock, and give back the TB and
+   the region that the thread was generating code in.  */
+void tb_lock_reset(void)
+{
+    TBRegion *r = tb_region;
+
+    if (tb_pending) {
+        if (!have_tb_lock) {
+            tb_lock();
+        }
+        if (tb_pending == &r->tbs[r->nb_tbs - 1]) {
+            r->nb_tbs--;
+            tb_ctx.nb_tbs--;
+        }
+        r->busy = false;
+        tb_pending = NULL;
+    }
+    if (have_tb_lock) {
+        tb_unlock();
+    }
+}
+
+#if defined(CONFIG_USER_ONLY)
+/* Called in the child process after fork(), where only the calling
+   thread survives: give back the regions and the TBs that the other
+   threads were generating code in.  */
+void tb_fork_child(void)
+{
+    TBRegion *r;
+    int i;
+
+    for (i = 0; i < tb_ctx.nb_regions; i++) {
+        r = &tb_ctx.regions[i];
+        if (r->busy && r->nb_tbs > 0 &&
+            r->tbs[r->nb_tbs - 1].tc_ptr == r->code_ptr) {
+            r->nb_tbs--;
+            tb_ctx.nb_tbs--;
+        }
+        r->busy = false;
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+}
+#endif
+
+static inline bool tb_region_has_room(TBRegion *r)
+{
+    return r->nb_tbs < tb_ctx.region_max_blocks && r->code_ptr < r->code_end;
+}
+
+/* Claim a region for the calling thread to generate its next TB in:
+   the one it used last, if it has room and no other thread is
+   generating code there, or else the next one in FIFO order.  In the
+   latter case the TBs that are still in the region must be thrown
+   away first, and *recycle is set.  Return NULL if all the regions
+   are busy.  Must be called with tb_lock held.  */
+static TBRegion *tb_region_claim(bool *recycle)
+{
+    TBRegion *r = tb_region;
+    int i;
+
+    *recycle = false;
+    if (!r || r->busy || !tb_region_has_room(r)) {
+        for (i = 0; i < tb_ctx.nb_regions; i++) {
+            tb_ctx.cur_region = (tb_ctx.cur_region + 1) % tb_ctx.nb_regions;
+            r = &tb_ctx.regions[tb_ctx.cur_region];
+            if (!r->busy) {
+                break;
+            }
+        }
+        if (i == tb_ctx.nb_regions) {
+            return NULL;
+        }
+        *recycle = r->nb_tbs > 0;
+    }
+    r->busy = true;
+    tb_region = r;
+    return r;
+}
+
+/* Allocate a new translation block in region 'r', which the calling
+   thread has claimed and which has room for it.  */
+static TranslationBlock *tb_alloc(TBRegion *r, target_ulong pc)
+{
+    TranslationBlock *tb;
+
+    tb = &r->tbs[r->nb_tbs];
     tb->pc = pc;
+    tb->tc_ptr = r->code_ptr;
     tb->cflags = 0;
+    tb->tb_stats = NULL;
+    tb->invalid = true;
+    /* tb_find_pc() looks at the TBs of a region without tb_lock */
+    smp_wmb();
+    r->nb_tbs++;
+    tb_ctx.nb_tbs++;
     return tb;
 }
 
+static guint tb_stats_hash(gconstpointer key)
+{
+    const TBStatistics *ts = key;
+
+    uint64_t h = (uint64_t)ts->pc ^ ((uint64_t)ts->cs_base << 7) ^ ts->flags;
+
+    return (guint)(h ^ (h >> 32));
+}
+
+static gboolean tb_stats_equal(gconstpointer a, gconstpointer b)
+{
+    const TBStatistics *ts1 = a, *ts2 = b;
+
+    return ts1->pc == ts2->pc && ts1->cs_base == ts2->cs_base &&
+           ts1->flags == ts2->flags;
+}
+
+void tb_stats_enable(void)
+{
+    if (!tb_stats_table) {
+        tb_stats_table = g_hash_table_new(tb_stats_hash, tb_stats_equal);
+    }
+    tb_stats_enabled = true;
+}
+
+static TBStatistics *tb_get_stats(target_ulong pc, target_ulong cs_base,
+                                  uint64_t flags)
+{
+    TBStatistics key, *ts;
+
+    key.pc = pc;
+    key.cs_base = cs_base;
+    key.flags = flags;
+    ts = g_hash_table_lookup(tb_stats_table, &key);
+    if (!ts) {
+        ts = g_new0(TBStatistics, 1);
+        ts->pc = pc;
+        ts->cs_base = cs_base;
+        ts->flags = flags;
+        g_hash_table_insert(tb_stats_table, ts, ts);
+    }
+    return ts;
+}
+
+/* Must be called with tb_lock held.  */
 void tb_free(TranslationBlock *tb)
 {
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
-        tcg_ctx.code_gen_ptr = tb->tc_ptr;
-        tcg_ctx.tb_ctx.nb_tbs--;
+    TBRegion *r = &tb_ctx.regions[(tb - tb_ctx.tbs) /
+                                  tb_ctx.region_max_blocks];
+
+    if (!r->busy && r->nb_tbs > 0 && tb == &r->tbs[r->nb_tbs - 1]) {
+        r->code_ptr = tb->tc_ptr;
+        r->nb_tbs--;
+        tb_ctx.nb_tbs--;
     }
 }
 
-static inline void invalidate_page_bitmap(PageDesc *p)
+static inline void invalidate_page_lines(PageDesc *p)
+{
+    g_free(p->code_lines);
+    p->code_lines = NULL;
+}
+
+/* Add DELTA to the line counts covered by part N of TB in page P.  */
+static void tb_page_lines_update(PageDesc *p, TranslationBlock *tb,
+                                 unsigned int n, int delta)
 {
-    if (p->code_bitmap) {
-        g_free(p->code_bitmap);
-        p->code_bitmap = NULL;
+    int tb_start, tb_end, i;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    if (n == 0) {
+        tb_start = tb->pc & ~TARGET_PAGE_MASK;
+        tb_end = tb_start + tb->size;
+        if (tb_end > TARGET_PAGE_SIZE) {
+            tb_end = TARGET_PAGE_SIZE;
+        }
+    } else {
+        tb_start = 0;
+        tb_end = (tb->pc + tb->size) & ~TARGET_PAGE_MASK;
+    }
+    if (tb_end <= tb_start) {
+        return;
+    }
+    if (!p->code_lines) {
+        if (delta < 0) {
+            return;
+        }
+        p->code_lines = g_new0(unsigned int, SMC_PAGE_LINES);
+    }
+    for (i = tb_start >> SMC_LINE_BITS;
+         i <= (tb_end - 1) >> SMC_LINE_BITS; i++) {
+        p->code_lines[i] += delta;
     }
-    p->code_write_count = 0;
 }
 
 /* Set to NULL all the 'first_tb' fields in all PageDescs. */
@@ -655,7 +960,7 @@ static void page_flush_tb_1(int level, void **lp)
 
         for (i = 0; i < L2_SIZE; ++i) {
             pd[i].first_tb = NULL;
-            invalidate_page_bitmap(pd + i);
+            invalidate_page_lines(pd + i);
         }
     } else {
         void **pp = *lp;
@@ -675,37 +980,60 @@ static void page_flush_tb(void)
     }
 }
 
-/* flush all the translation blocks */
-/* XXX: tb_flush is currently not thread safe */
-void tb_flush(CPUArchState *env1)
+/* flush all the translation blocks; must be called with tb_lock held
+   and, in user mode, with the other cpus stopped */
+static void tb_flush_locked(CPUArchState *env1)
 {
     CPUArchState *env;
+    unsigned long code_size = 0;
+    int i;
+
+    for (i = 0; i < tb_ctx.nb_regions; i++) {
+        TBRegion *r = &tb_ctx.regions[i];
 
+        if (r->code_ptr > r->code_start + tb_ctx.region_size) {
+            cpu_abort(env1, "Internal error: code buffer overflow\n");
+        }
+        code_size += r->code_ptr - r->code_start;
+        r->nb_tbs = 0;
+        r->code_ptr = r->code_start;
+    }
 #if defined(DEBUG_FLUSH)
     printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
-           (unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer),
-           tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.tb_ctx.nb_tbs > 0 ?
-           ((unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer)) /
-           tcg_ctx.tb_ctx.nb_tbs : 0);
+           code_size, tb_ctx.nb_tbs,
+           tb_ctx.nb_tbs > 0 ? code_size / tb_ctx.nb_tbs : 0);
 #endif
-    if ((unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer)
-        > tcg_ctx.code_gen_buffer_size) {
-        cpu_abort(env1, "Internal error: code buffer overflow\n");
-    }
-    tcg_ctx.tb_ctx.nb_tbs = 0;
+    tb_ctx.nb_tbs = 0;
+    tb_ctx.cur_region = tb_ctx.nb_regions - 1;
 
     for (env = first_cpu; env != NULL; env = env->next_cpu) {
         memset(env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof(void *));
     }
 
-    memset(tcg_ctx.tb_ctx.tb_phys_hash, 0,
+    memset(tb_ctx.tb_phys_hash, 0,
             CODE_GEN_PHYS_HASH_SIZE * sizeof(void *));
     page_flush_tb();
+    perf_report_flush();
 
-    tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
-    tcg_ctx.tb_ctx.tb_flush_count++;
+    tb_ctx.tb_flush_count++;
+}
+
+/* In user mode, other threads may be running translated code or be
+   translating into a region, so they are stopped first.  There, this
+   must be called from outside cpu_exec().  */
+void tb_flush(CPUArchState *env1)
+{
+#if defined(CONFIG_USER_ONLY)
+    start_exclusive();
+#endif
+    tb_lock();
+    tb_flush_locked(env1);
+    tb_unlock();
+#if defined(CONFIG_USER_ONLY)
+    end_exclusive();
+#endif
 }
 
 #ifdef DEBUG_TB_CHECK
@@ -735,7 +1063,7 @@ static void tb_page_check(void)
     int i, flags1, flags2;
 
     for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tcg_ctx.tb_ctx.tb_phys_hash[i]; tb != NULL;
+        for (tb = tb_ctx.tb_phys_hash[i]; tb != NULL;
                 tb = tb->phys_hash_next) {
             flags1 = page_get_flags(tb->pc);
             flags2 = page_get_flags(tb->pc + tb->size - 1);
@@ -816,7 +1144,7 @@ static inline void tb_reset_jump(TranslationBlock *tb, int n)
     tb_set_jmp_target(tb, n, (uintptr_t)(tb->tc_ptr + tb->tb_next_offset[n]));
 }
 
-/* invalidate one TB */
+/* invalidate one TB; must be called with tb_lock held */
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 {
     CPUArchState *env;
@@ -828,21 +1156,21 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     /* remove the TB from the hash list */
     phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
     h = tb_phys_hash_func(phys_pc);
-    tb_hash_remove(&tcg_ctx.tb_ctx.tb_phys_hash[h], tb);
+    tb_hash_remove(&tb_ctx.tb_phys_hash[h], tb);
 
     /* remove the TB from the page list */
     if (tb->page_addr[0] != page_addr) {
         p = page_find(tb->page_addr[0] >> TARGET_PAGE_BITS);
         tb_page_remove(&p->first_tb, tb);
-        invalidate_page_bitmap(p);
+        tb_page_lines_update(p, tb, 0, -1);
     }
     if (tb->page_addr[1] != -1 && tb->page_addr[1] != page_addr) {
         p = page_find(tb->page_addr[1] >> TARGET_PAGE_BITS);
         tb_page_remove(&p->first_tb, tb);
-        invalidate_page_bitmap(p);
+        tb_page_lines_update(p, tb, 1, -1);
     }
 
-    tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
+    tcg_ctx.tb_invalidated_flag = 1;
 
     /* remove the TB from the hash list */
     h = tb_jmp_cache_hash_func(tb->pc);
@@ -871,93 +1199,128 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
     tb->jmp_first = (TranslationBlock *)((uintptr_t)tb | 2); /* fail safe */
 
-    tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
+    tb->invalid = true;
+    tb_ctx.tb_phys_invalidate_count++;
 }
 
-static inline void set_bits(uint8_t *tab, int start, int len)
+/* Throw away the TBs of region 'r'.  Only they are unlinked and
+   invalidated; everything else, including the tb_jmp_cache entries
+   that point to other regions, stays valid.  */
+static void tb_evict_region(TBRegion *r)
 {
-    int end, mask, end1;
+    int i;
 
-    end = start + len;
-    tab += start >> 3;
-    mask = 0xff << (start & 7);
-    if ((start & ~7) == (end & ~7)) {
-        if (start < end) {
-            mask &= ~(0xff << (end & 7));
-            *tab |= mask;
-        }
-    } else {
-        *tab++ |= mask;
-        start = (start + 8) & ~7;
-        end1 = end & ~7;
-        while (start < end1) {
-            *tab++ = 0xff;
-            start += 8;
-        }
-        if (start < end) {
-            mask = ~(0xff << (end & 7));
-            *tab |= mask;
+    for (i = 0; i < r->nb_tbs; i++) {
+        if (!r->tbs[i].invalid) {
+            tb_phys_invalidate(&r->tbs[i], -1);
         }
     }
+    tb_ctx.nb_tbs -= r->nb_tbs;
+    r->nb_tbs = 0;
+    perf_report_unmap(r->code_start, r->code_ptr - r->code_start);
+    r->code_ptr = r->code_start;
+    tb_ctx.tb_evict_count++;
 }
 
-static void build_page_bitmap(PageDesc *p)
+/* Make room in region 'r', which the calling thread has claimed, by
+   throwing away the TBs it holds, or all of them if there is only one
+   region.  Other threads may be running that code or be about to jump
+   to it, so in user mode they are stopped first; tb_lock is dropped
+   while waiting for them.  */
+static void tb_region_recycle(CPUArchState *env, TBRegion *r)
 {
-    int n, tb_start, tb_end;
-    TranslationBlock *tb;
+#if defined(CONFIG_USER_ONLY)
+    CPUState *cpu = ENV_GET_CPU(env);
 
-    p->code_bitmap = g_malloc0(TARGET_PAGE_SIZE / 8);
+    tb_unlock();
+    cpu_exec_end(cpu);
+    start_exclusive();
+    tb_lock();
+#endif
+    if (tb_ctx.nb_regions > 1) {
+        tb_evict_region(r);
+    } else {
+        tb_flush_locked(env);
+    }
+#if defined(CONFIG_USER_ONLY)
+    tb_unlock();
+    end_exclusive();
+    cpu_exec_start(cpu);
+    tb_lock();
+#endif
+    /* Don't forget to invalidate previous TB info.  */
+    tcg_ctx.tb_invalidated_flag = 1;
+}
 
-    tb = p->first_tb;
-    while (tb != NULL) {
-        n = (uintptr_t)tb & 3;
-        tb = (TranslationBlock *)((uintptr_t)tb & ~3);
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        if (n == 0) {
-            /* NOTE: tb_end may be after the end of the page, but
-               it is not a problem */
-            tb_start = tb->pc & ~TARGET_PAGE_MASK;
-            tb_end = tb_start + tb->size;
-            if (tb_end > TARGET_PAGE_SIZE) {
-                tb_end = TARGET_PAGE_SIZE;
-            }
-        } else {
-            tb_start = 0;
-            tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
+/* Return a TB already in the hash table for the same code as 'tb',
+   which another thread translated meanwhile.  */
+static TranslationBlock *tb_find_twin(TranslationBlock *tb,
+                                     tb_page_addr_t phys_pc,
+                                     tb_page_addr_t phys_page2)
+{
+    TranslationBlock *tb1;
+
+    tb1 = tb_ctx.tb_phys_hash[tb_phys_hash_func(phys_pc)];
+    for (; tb1 != NULL; tb1 = tb1->phys_hash_next) {
+        if (tb1->pc == tb->pc &&
+            tb1->page_addr[0] == (phys_pc & TARGET_PAGE_MASK) &&
+            tb1->page_addr[1] == phys_page2 &&
+            tb1->cs_base == tb->cs_base &&
+            tb1->flags == tb->flags &&
+            tb1->cflags == 0) {
+            return tb1;
         }
-        set_bits(p->code_bitmap, tb_start, tb_end - tb_start);
-        tb = tb->page_next[n];
     }
+    return NULL;
 }
 
+/* Translate a block.  tb_lock is only held to claim a region of the
+   code buffer and, once the code is there, to publish the block, so
+   that threads can translate at the same time in different regions.
+   Must be called without tb_lock, nor in user mode the mmap lock.  */
 TranslationBlock *tb_gen_code(CPUArchState *env,
                               target_ulong pc, target_ulong cs_base,
                               int flags, int cflags)
 {
-    TranslationBlock *tb;
-    uint8_t *tc_ptr;
+    TranslationBlock *tb, *twin;
+    TBRegion *r;
     tb_page_addr_t phys_pc, phys_page2;
     target_ulong virt_page2;
     int code_gen_size;
+    bool recycle;
 
     phys_pc = get_page_addr_code(env, pc);
-    tb = tb_alloc(pc);
-    if (!tb) {
-        /* flush must be done */
-        tb_flush(env);
-        /* cannot fail at this point */
-        tb = tb_alloc(pc);
-        /* Don't forget to invalidate previous TB info.  */
-        tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
-    }
-    tc_ptr = tcg_ctx.code_gen_ptr;
-    tb->tc_ptr = tc_ptr;
+
+    tb_lock();
+    while (!(r = tb_region_claim(&recycle))) {
+        /* more threads are translating than there are regions; let
+           them stop us meanwhile, so the TB we come from may be gone */
+        tb_unlock();
+#if defined(CONFIG_USER_ONLY)
+        cpu_exec_end(ENV_GET_CPU(env));
+        sched_yield();
+        cpu_exec_start(ENV_GET_CPU(env));
+#endif
+        tcg_ctx.tb_invalidated_flag = 1;
+        tb_lock();
+    }
+    if (recycle) {
+        tb_region_recycle(env, r);
+    }
+    tb = tb_alloc(r, pc);
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
-    cpu_gen_code(env, tb, &code_gen_size);
-    tcg_ctx.code_gen_ptr = (void *)(((uintptr_t)tcg_ctx.code_gen_ptr +
-            code_gen_size + CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
+    if (tb_stats_enabled) {
+        tb->tb_stats = tb_get_stats(pc, cs_base, flags);
+    }
+    tb_pending = tb;
+    tb_unlock();
+
+    if (!tb_cache_restore(env, tb, &code_gen_size)) {
+        cpu_gen_code(env, tb, &code_gen_size);
+        tb_cache_store(env, tb, code_gen_size);
+    }
 
     /* check next page if needed */
     virt_page2 = (pc + tb->size - 1) & TARGET_PAGE_MASK;
@@ -965,7 +1328,30 @@ TranslationBlock *tb_gen_code(CPUArchState *env,
     if ((pc & TARGET_PAGE_MASK) != virt_page2) {
         phys_page2 = get_page_addr_code(env, virt_page2);
     }
-    tb_link_page(tb, phys_pc, phys_page2);
+
+    mmap_lock();
+    tb_lock();
+    tb_pending = NULL;
+    r->busy = false;
+    twin = cflags ? NULL : tb_find_twin(tb, phys_pc, phys_page2);
+    if (twin) {
+        /* nobody else could allocate in the region meanwhile */
+        r->nb_tbs--;
+        tb_ctx.nb_tbs--;
+        tb = twin;
+    } else {
+        r->code_ptr = (void *)(((uintptr_t)tb->tc_ptr + code_gen_size +
+                                CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
+        perf_report_code(pc, tb->size, tb->tc_ptr, code_gen_size);
+        if (tb->tb_stats) {
+            tb->tb_stats->translations++;
+            tb->tb_stats->guest_size = tb->size;
+            tb->tb_stats->host_size = code_gen_size;
+        }
+        tb_link_page(tb, phys_pc, phys_page2);
+    }
+    tb_unlock();
+    mmap_unlock();
     return tb;
 }
 
@@ -1015,15 +1401,10 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
     if (!p) {
         return;
     }
-    if (!p->code_bitmap &&
-        ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD &&
-        is_cpu_write_access) {
-        /* build code bitmap */
-        build_page_bitmap(p);
-    }
     if (env != NULL) {
         cpu = ENV_GET_CPU(env);
     }
+    tb_lock();
 
     /* we remove all the TBs in the range [start, end[ */
     /* XXX: see if in some cases it could be faster to invalidate all
@@ -1087,7 +1468,7 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
 #if !defined(CONFIG_USER_ONLY)
     /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
-        invalidate_page_bitmap(p);
+        invalidate_page_lines(p);
         if (is_cpu_write_access) {
             tlb_unprotect_code_phys(env, start, env->mem_io_vaddr);
         }
@@ -1099,17 +1480,19 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
            modifying the memory. It will ensure that it cannot modify
            itself */
         cpu->current_tb = NULL;
+        tb_unlock();
         tb_gen_code(env, current_pc, current_cs_base, current_flags, 1);
         cpu_resume_from_signal(env, NULL);
     }
 #endif
+    tb_unlock();
 }
 
 /* len must be <= 8 and start must be a multiple of len */
 void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
 {
     PageDesc *p;
-    int offset, b;
+    int offset;
 
 #if 0
     if (1) {
@@ -1124,16 +1507,16 @@ void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
     if (!p) {
         return;
     }
-    if (p->code_bitmap) {
-        offset = start & ~TARGET_PAGE_MASK;
-        b = p->code_bitmap[offset >> 3] >> (offset & 7);
-        if (b & ((1 << len) - 1)) {
-            goto do_invalidate;
-        }
-    } else {
-    do_invalidate:
-        tb_invalidate_phys_page_range(start, start + len, 1);
+    offset = start & ~TARGET_PAGE_MASK;
+    if (p->code_lines && !p->code_lines[offset >> SMC_LINE_BITS]) {
+        /* data write next to code: nothing to invalidate */
+        p->data_write_count++;
+        tb_ctx.smc_data_write_count++;
+        return;
     }
+    p->code_write_count++;
+    tb_ctx.smc_code_write_count++;
+    tb_invalidate_phys_page_range(start, start + len, 1);
 }
 
 #if !defined(CONFIG_SOFTMMU)
@@ -1158,6 +1541,7 @@ static void tb_invalidate_phys_page(tb_page_addr_t addr,
     if (!p) {
         return;
     }
+    tb_lock();
     tb = p->first_tb;
 #ifdef TARGET_HAS_PRECISE_SMC
     if (tb && pc != 0) {
@@ -1189,16 +1573,22 @@ static void tb_invalidate_phys_page(tb_page_addr_t addr,
         tb = tb->page_next[n];
     }
     p->first_tb = NULL;
+    invalidate_page_lines(p);
 #ifdef TARGET_HAS_PRECISE_SMC
     if (current_tb_modified) {
         /* we generate a block containing just the instruction
            modifying the memory. It will ensure that it cannot modify
            itself */
         cpu->current_tb = NULL;
+        /* page_unprotect() took the mmap lock and will not get to
+           release it */
+        tb_unlock();
+        mmap_unlock();
         tb_gen_code(env, current_pc, current_cs_base, current_flags, 1);
         cpu_resume_from_signal(env, puc);
     }
 #endif
+    tb_unlock();
 }
 #endif
 
@@ -1218,15 +1608,14 @@ static inline void tb_alloc_page(TranslationBlock *tb,
     page_already_protected = p->first_tb != NULL;
 #endif
     p->first_tb = (TranslationBlock *)((uintptr_t)tb | n);
-    invalidate_page_bitmap(p);
+    tb_page_lines_update(p, tb, n, 1);
 
 #if defined(TARGET_HAS_SMC) || 1
 
 #if defined(CONFIG_USER_ONLY)
-    if (p->flags & PAGE_WRITE) {
+    if (page_get_flags(page_addr) & PAGE_WRITE) {
         target_ulong addr;
-        PageDesc *p2;
-        int prot;
+        int flags, prot;
 
         /* force the host page as non writable (writes will have a
            page fault + mprotect overhead) */
@@ -1234,14 +1623,13 @@ static inline void tb_alloc_page(TranslationBlock *tb,
         prot = 0;
         for (addr = page_addr; addr < page_addr + qemu_host_page_size;
             addr += TARGET_PAGE_SIZE) {
-
-            p2 = page_find(addr >> TARGET_PAGE_BITS);
-            if (!p2) {
-                continue;
+            flags = page_get_flags(addr);
+            prot |= flags;
+            if (flags & PAGE_WRITE) {
+                page_flags_set(addr, addr + TARGET_PAGE_SIZE - 1,
+                               flags & ~PAGE_WRITE);
             }
-            prot |= p2->flags;
-            p2->flags &= ~PAGE_WRITE;
-          }
+        }
         mprotect(g2h(page_addr), qemu_host_page_size,
                  (prot & PAGE_BITS) & ~PAGE_WRITE);
 #ifdef DEBUG_TB_INVALIDATE
@@ -1262,22 +1650,14 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 }
 
 /* add a new TB and link it to the physical page tables. phys_page2 is
-   (-1) to indicate that only one page contains the TB. */
+   (-1) to indicate that only one page contains the TB.  Must be called
+   with the mmap lock and tb_lock held.  */
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2)
 {
     unsigned int h;
     TranslationBlock **ptb;
 
-    /* Grab the mmap lock to stop another thread invalidating this TB
-       before we are done.  */
-    mmap_lock();
-    /* add in the physical hash table */
-    h = tb_phys_hash_func(phys_pc);
-    ptb = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    tb->phys_hash_next = *ptb;
-    *ptb = tb;
-
     /* add in the page list */
     tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK);
     if (phys_page2 != -1) {
@@ -1297,11 +1677,19 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     if (tb->tb_next_offset[1] != 0xffff) {
         tb_reset_jump(tb, 1);
     }
+    tb->invalid = false;
+
+    /* add in the physical hash table last: lookups do not take tb_lock,
+       so the TB must be complete by the time they can find it */
+    h = tb_phys_hash_func(phys_pc);
+    ptb = &tb_ctx.tb_phys_hash[h];
+    tb->phys_hash_next = *ptb;
+    smp_wmb();
+    *ptb = tb;
 
 #ifdef DEBUG_TB_CHECK
     tb_page_check();
 #endif
-    mmap_unlock();
 }
 
 #if defined(CONFIG_QEMU_LDST_OPTIMIZATION) && defined(CONFIG_SOFTMMU)
@@ -1309,7 +1697,7 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
 bool is_tcg_gen_code(uintptr_t tc_ptr)
 {
     /* This can be called during code generation, code_gen_buffer_max_size
-       is used instead of code_gen_ptr for upper boundary checking */
+       is used instead of the regions' code_ptr for upper boundary checking */
     return (tc_ptr >= (uintptr_t)tcg_ctx.code_gen_buffer &&
             tc_ptr < (uintptr_t)(tcg_ctx.code_gen_buffer +
                     tcg_ctx.code_gen_buffer_max_size));
@@ -1323,20 +1711,26 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
     int m_min, m_max, m;
     uintptr_t v;
     TranslationBlock *tb;
+    TBRegion *r;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
+    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer) {
         return NULL;
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    m = (tc_ptr - (uintptr_t)tcg_ctx.code_gen_buffer) /
+        tb_ctx.region_size;
+    if (m >= tb_ctx.nb_regions) {
+        return NULL;
+    }
+    r = &tb_ctx.regions[m];
+    if (r->nb_tbs <= 0 || tc_ptr >= (uintptr_t)r->code_ptr) {
         return NULL;
     }
     /* binary search (cf Knuth) */
     m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_max = r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tcg_ctx.tb_ctx.tbs[m];
+        tb = &r->tbs[m];
         v = (uintptr_t)tb->tc_ptr;
         if (v == tc_ptr) {
             return tb;
@@ -1346,7 +1740,7 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tcg_ctx.tb_ctx.tbs[m_max];
+    return &r->tbs[m_max];
 }
 
 static void tb_reset_jump_recursive(TranslationBlock *tb);
@@ -1446,7 +1840,9 @@ void tb_check_watchpoint(CPUArchState *env)
                   (void *)env->mem_io_pc);
     }
     cpu_restore_state_from_tb(tb, env, env->mem_io_pc);
+    tb_lock();
     tb_phys_invalidate(tb, -1);
+    tb_unlock();
 }
 
 #ifndef CONFIG_USER_ONLY
@@ -1495,6 +1891,9 @@ void cpu_io_recompile(CPUArchState *env, uintptr_t retaddr)
         cpu_abort(env, "cpu_io_recompile: could not find TB for pc=%p",
                   (void *)retaddr);
     }
+    if (tb->tb_stats) {
+        tb->tb_stats->io_recompiles++;
+    }
     n = env->icount_decr.u16.low + tb->icount;
     cpu_restore_state_from_tb(tb, env, retaddr);
     /* Calculate how many instructions had been executed before the fault
@@ -1529,7 +1928,9 @@ void cpu_io_recompile(CPUArchState *env, uintptr_t retaddr)
     pc = tb->pc;
     cs_base = tb->cs_base;
     flags = tb->flags;
+    tb_lock();
     tb_phys_invalidate(tb, -1);
+    tb_unlock();
     /* FIXME: In theory this could raise an exception.  In practice
        we have already translated the block once so it's probably ok.  */
     tb_gen_code(env, pc, cs_base, flags, cflags);
@@ -1556,166 +1957,267 @@ void tb_flush_jmp_cache(CPUArchState *env, target_ulong addr)
            TB_JMP_PAGE_SIZE * sizeof(TranslationBlock *));
 }
 
+typedef struct SMCPageStats {
+    int nb_pages;
+    tb_page_addr_t hot_index;
+    unsigned int hot_code_writes;
+    unsigned int hot_data_writes;
+} SMCPageStats;
+
+static void smc_page_stats_1(int level, void **lp, tb_page_addr_t index,
+                             SMCPageStats *s)
+{
+    int i;
+
+    if (*lp == NULL) {
+        return;
+    }
+    if (level == 0) {
+        PageDesc *pd = *lp;
+
+        for (i = 0; i < L2_SIZE; ++i) {
+            if (pd[i].code_write_count == 0 && pd[i].data_write_count == 0) {
+                continue;
+            }
+            s->nb_pages++;
+            if (pd[i].code_write_count > s->hot_code_writes) {
+                s->hot_index = (index << L2_BITS) | i;
+                s->hot_code_writes = pd[i].code_write_count;
+                s->hot_data_writes = pd[i].data_write_count;
+            }
+        }
+    } else {
+        void **pp = *lp;
+
+        for (i = 0; i < L2_SIZE; ++i) {
+            smc_page_stats_1(level - 1, pp + i, (index << L2_BITS) | i, s);
+        }
+    }
+}
+
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    int i, target_code_size, max_target_code_size;
+    SMCPageStats smc;
+    int i, j, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    ptrdiff_t host_code_size;
     TranslationBlock *tb;
+    TBRegion *r;
 
     target_code_size = 0;
     max_target_code_size = 0;
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    host_code_size = 0;
+    for (j = 0; j < tb_ctx.nb_regions; j++) {
+        r = &tb_ctx.regions[j];
+        host_code_size += r->code_ptr - r->code_start;
+        for (i = 0; i < r->nb_tbs; i++) {
+            tb = &r->tbs[i];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
     cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_buffer_max_size);
+                host_code_size, tcg_ctx.code_gen_buffer_max_size);
+    cpu_fprintf(f, "code regions        %d (newest %d)\n",
+                tb_ctx.nb_regions, tb_ctx.cur_region);
     cpu_fprintf(f, "TB count            %d/%d\n",
-            tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
+            tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
-            tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
-                    tcg_ctx.tb_ctx.nb_tbs : 0,
+            tb_ctx.nb_tbs ? target_code_size /
+                    tb_ctx.nb_tbs : 0,
             max_target_code_size);
     cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
+            tb_ctx.nb_tbs ? host_code_size /
+                                     tb_ctx.nb_tbs : 0,
+                target_code_size ? (double) host_code_size /
                                              target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
-            tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
-                                    tcg_ctx.tb_ctx.nb_tbs : 0);
+            tb_ctx.nb_tbs ? (cross_page * 100) /
+                                    tb_ctx.nb_tbs : 0);
     cpu_fprintf(f, "direct jump count   %d (%d%%) (2 jumps=%d %d%%)\n",
                 direct_jmp_count,
-                tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp_count * 100) /
-                        tcg_ctx.tb_ctx.nb_tbs : 0,
+                tb_ctx.nb_tbs ? (direct_jmp_count * 100) /
+                        tb_ctx.nb_tbs : 0,
                 direct_jmp2_count,
-                tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
-                        tcg_ctx.tb_ctx.nb_tbs : 0);
+                tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
+                        tb_ctx.nb_tbs : 0);
     cpu_fprintf(f, "\nStatistics:\n");
-    cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB flush count      %d\n", tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB region evictions %d\n", tb_ctx.tb_evict_count);
     cpu_fprintf(f, "TB invalidate count %d\n",
-            tcg_ctx.tb_ctx.tb_phys_invalidate_count);
+            tb_ctx.tb_phys_invalidate_count);
+    cpu_fprintf(f, "SMC writes          %d to code, %d to data\n",
+                tb_ctx.smc_code_write_count,
+                tb_ctx.smc_data_write_count);
+    memset(&smc, 0, sizeof(smc));
+    for (i = 0; i < V_L1_SIZE; i++) {
+        smc_page_stats_1(V_L1_SHIFT / L2_BITS - 1, l1_map + i, i, &smc);
+    }
+    cpu_fprintf(f, "SMC pages           %d", smc.nb_pages);
+    if (smc.hot_code_writes) {
+        cpu_fprintf(f, " (hottest 0x%" PRIx64 ": %u code, %u data)",
+                    (uint64_t)smc.hot_index << TARGET_PAGE_BITS,
+                    smc.hot_code_writes, smc.hot_data_writes);
+    }
+    cpu_fprintf(f, "\n");
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
     tcg_dump_info(f, cpu_fprintf);
 }
 
-#else /* CONFIG_USER_ONLY */
-
-void cpu_interrupt(CPUArchState *env, int mask)
+static void tb_stats_collect(gpointer key, gpointer value, gpointer opaque)
 {
-    CPUState *cpu = ENV_GET_CPU(env);
-
-    env->interrupt_request |= mask;
-    cpu_unlink_tb(cpu);
+    g_array_append_val((GArray *)opaque, value);
 }
 
-/*
- * Walks guest process memory "regions" one by one
- * and calls callback function 'fn' for each region.
- */
-struct walk_memory_regions_data {
-    walk_memory_regions_fn fn;
-    void *priv;
-    uintptr_t start;
-    int prot;
-};
-
-static int walk_memory_regions_end(struct walk_memory_regions_data *data,
-                                   abi_ulong end, int new_prot)
-{
-    if (data->start != -1ul) {
-        int rc = data->fn(data->priv, data->start, end, data->prot);
-        if (rc != 0) {
-            return rc;
-        }
+static int tb_stats_cmp(const void *a, const void *b)
+{
+    const TBStatistics *ts1 = *(TBStatistics * const *)a;
+    const TBStatistics *ts2 = *(TBStatistics * const *)b;
+
+    if (ts1->exec_count != ts2->exec_count) {
+        return ts1->exec_count < ts2->exec_count ? 1 : -1;
     }
+    return ts1->pc < ts2->pc ? -1 : ts1->pc > ts2->pc;
+}
 
-    data->start = (new_prot ? end : -1ul);
-    data->prot = new_prot;
+/* Return the statistics of the hottest blocks first; the caller frees
+   the array but not the elements.  */
+static GArray *tb_stats_sorted(void)
+{
+    GArray *array = g_array_new(false, false, sizeof(TBStatistics *));
 
-    return 0;
+    if (tb_stats_table) {
+        g_hash_table_foreach(tb_stats_table, tb_stats_collect, array);
+        qsort(array->data, array->len, sizeof(TBStatistics *),
+              tb_stats_cmp);
+    }
+    return array;
 }
 
-static int walk_memory_regions_1(struct walk_memory_regions_data *data,
-                                 abi_ulong base, int level, void **lp)
+void dump_tb_stats(FILE *f, fprintf_function cpu_fprintf, int max)
 {
-    abi_ulong pa;
-    int i, rc;
+    GArray *array;
+    int i;
 
-    if (*lp == NULL) {
-        return walk_memory_regions_end(data, base, 0);
+    if (!tb_stats_enabled) {
+        cpu_fprintf(f, "\nTB statistics not enabled (use -tb-stats)\n");
+        return;
     }
 
-    if (level == 0) {
-        PageDesc *pd = *lp;
+    array = tb_stats_sorted();
+    cpu_fprintf(f, "\nHottest TBs (%u tracked):\n", array->len);
+    cpu_fprintf(f, "%-18s %8s %12s %12s %10s %8s %6s %5s %5s %5s\n",
+                "guest pc", "flags", "executed", "dispatched", "unchained",
+                "excp", "io", "xlat", "guest", "host");
+    for (i = 0; i < array->len && i < max; i++) {
+        TBStatistics *ts = g_array_index(array, TBStatistics *, i);
 
-        for (i = 0; i < L2_SIZE; ++i) {
-            int prot = pd[i].flags;
+        cpu_fprintf(f, "0x" TARGET_FMT_lx "%*s %8" PRIx64 " %12" PRIu64
+                    " %12" PRIu64 " %10" PRIu64 " %8" PRIu64 " %6" PRIu64
+                    " %5u %5u %5u\n",
+                    ts->pc, 16 - TARGET_LONG_BITS / 4, "", ts->flags,
+                    ts->exec_count, ts->dispatch_count, ts->unchained_exits,
+                    ts->exceptions, ts->io_recompiles, ts->translations,
+                    ts->guest_size, ts->host_size);
+    }
+    g_array_free(array, true);
+}
 
-            pa = base | (i << TARGET_PAGE_BITS);
-            if (prot != data->prot) {
-                rc = walk_memory_regions_end(data, pa, prot);
-                if (rc != 0) {
-                    return rc;
-                }
-            }
-        }
-    } else {
-        void **pp = *lp;
+TbStatsInfoList *qmp_query_tb_stats(bool has_count, int64_t count,
+                                    Error **errp)
+{
+    TbStatsInfoList *head = NULL, **plist = &head;
+    GArray *array;
+    int i;
 
-        for (i = 0; i < L2_SIZE; ++i) {
-            pa = base | ((abi_ulong)i <<
-                (TARGET_PAGE_BITS + L2_BITS * level));
-            rc = walk_memory_regions_1(data, pa, level - 1, pp + i);
-            if (rc != 0) {
-                return rc;
-            }
-        }
+    if (!tb_stats_enabled) {
+        error_set(errp, QERR_FEATURE_DISABLED, "tb-stats");
+        return NULL;
     }
-
-    return 0;
+    if (!has_count) {
+        count = 10;
+    }
+
+    array = tb_stats_sorted();
+    for (i = 0; i < array->len && i < count; i++) {
+        TBStatistics *ts = g_array_index(array, TBStatistics *, i);
+        TbStatsInfoList *entry = g_malloc0(sizeof(*entry));
+
+        entry->value = g_malloc0(sizeof(*entry->value));
+        entry->value->pc = ts->pc;
+        entry->value->cs_base = ts->cs_base;
+        entry->value->flags = ts->flags;
+        entry->value->exec_count = ts->exec_count;
+        entry->value->dispatch_count = ts->dispatch_count;
+        entry->value->unchained_exits = ts->unchained_exits;
+        entry->value->exceptions = ts->exceptions;
+        entry->value->io_recompiles = ts->io_recompiles;
+        entry->value->translations = ts->translations;
+        entry->value->guest_size = ts->guest_size;
+        entry->value->host_size = ts->host_size;
+        *plist = entry;
+        plist = &entry->next;
+    }
+    g_array_free(array, true);
+    return head;
 }
 
-int walk_memory_regions(void *priv, walk_memory_regions_fn fn)
+#else /* CONFIG_USER_ONLY */
+
+void cpu_interrupt(CPUArchState *env, int mask)
 {
-    struct walk_memory_regions_data data;
-    uintptr_t i;
+    CPUState *cpu = ENV_GET_CPU(env);
 
-    data.fn = fn;
-    data.priv = priv;
-    data.start = -1ul;
-    data.prot = 0;
+    env->interrupt_request |= mask;
+    cpu_unlink_tb(cpu);
+}
 
-    for (i = 0; i < V_L1_SIZE; i++) {
-        int rc = walk_memory_regions_1(&data, (abi_ulong)i << V_L1_SHIFT,
-                                       V_L1_SHIFT / L2_BITS - 1, l1_map + i);
+/*
+ * Walks guest process memory "regions" one by one
+ * and calls callback function 'fn' for each region.
+ */
+int walk_memory_regions(void *priv, walk_memory_regions_fn fn)
+{
+    const IntervalTreeNode *n;
+    uint64_t addr = 0, start, last;
+    unsigned long prot;
+    int rc;
 
-        if (rc != 0) {
-            return rc;
+    for (;;) {
+        pthread_rwlock_rdlock(&page_flags_lock);
+        n = interval_tree_find(&page_flags, addr);
+        start = n->start;
+        last = n->last;
+        prot = n->value;
+        pthread_rwlock_unlock(&page_flags_lock);
+
+        if (prot) {
+            rc = fn(priv, start, last + 1, prot);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+        if (last == PAGE_FLAGS_LAST) {
+            return 0;
         }
+        addr = last + 1;
     }
-
-    return walk_memory_regions_end(&data, 0, 0);
 }
 
 static int dump_region(void *priv, abi_ulong start,
@@ -1743,13 +2245,37 @@ void page_dump(FILE *f)
 
 int page_get_flags(target_ulong address)
 {
-    PageDesc *p;
+    int flags;
 
-    p = page_find(address >> TARGET_PAGE_BITS);
-    if (!p) {
+#if TARGET_LONG_BITS > L1_MAP_ADDR_SPACE_BITS
+    if (address > PAGE_FLAGS_LAST) {
         return 0;
     }
-    return p->flags;
+#endif
+    pthread_rwlock_rdlock(&page_flags_lock);
+    flags = interval_tree_find(&page_flags, address)->value;
+    pthread_rwlock_unlock(&page_flags_lock);
+    return flags;
+}
+
+/* Invalidate the code in the pages of [start, last].  */
+static void page_invalidate_code(target_ulong start, target_ulong last)
+{
+    tb_page_addr_t index;
+    PageDesc *p;
+
+    for (index = start >> TARGET_PAGE_BITS;
+         index <= last >> TARGET_PAGE_BITS; index++) {
+        p = page_find(index);
+        if (!p) {
+            /* no page of this part of l1_map was ever used */
+            index |= L2_SIZE - 1;
+            continue;
+        }
+        if (p->first_tb) {
+            tb_invalidate_phys_page(index << TARGET_PAGE_BITS, 0, NULL);
+        }
+    }
 }
 
 /* Modify the flags of a page and invalidate the code if necessary.
@@ -1757,7 +2283,8 @@ int page_get_flags(target_ulong address)
    on PAGE_WRITE.  The mmap_lock should already be held.  */
 void page_set_flags(target_ulong start, target_ulong end, int flags)
 {
-    target_ulong addr, len;
+    const IntervalTreeNode *n;
+    target_ulong last;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -1768,33 +2295,64 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
     assert(start < end);
 
     start = start & TARGET_PAGE_MASK;
-    end = TARGET_PAGE_ALIGN(end);
+    last = TARGET_PAGE_ALIGN(end) - 1;
+#if TARGET_LONG_BITS > L1_MAP_ADDR_SPACE_BITS
+    if (last > PAGE_FLAGS_LAST) {
+        last = PAGE_FLAGS_LAST;
+    }
+#endif
 
     if (flags & PAGE_WRITE) {
         flags |= PAGE_WRITE_ORG;
-    }
-
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        PageDesc *p = page_find_alloc(addr >> TARGET_PAGE_BITS, 1);
 
         /* If the write protection bit is set, then we invalidate
-           the code inside.  */
-        if (!(p->flags & PAGE_WRITE) &&
-            (flags & PAGE_WRITE) &&
-            p->first_tb) {
-            tb_invalidate_phys_page(addr, 0, NULL);
+           the code inside.  The lock is not needed to read the
+           flags, as we are the only ones to change them.  */
+        n = interval_tree_find(&page_flags, start);
+        for (;;) {
+            if ((n->value & PAGE_VALID) && !(n->value & PAGE_WRITE)) {
+                page_invalidate_code(MAX(n->start, start),
+                                     MIN(n->last, last));
+            }
+            if (n->last >= last) {
+                break;
+            }
+            n = interval_tree_find(&page_flags, n->last + 1);
         }
-        p->flags = flags;
     }
+    page_flags_set(start, last, flags);
+}
+
+/* Find 'len' bytes of guest address space between 'min' and 'max'
+   where no page is mapped, starting at a multiple of 'align'.  Return
+   the highest such address if 'top_down', else the lowest, or -1.  */
+target_ulong page_find_range_empty(target_ulong min, target_ulong max,
+                                   target_ulong len, target_ulong align,
+                                   bool top_down)
+{
+    uint64_t addr;
+    bool found;
+
+#if TARGET_LONG_BITS > L1_MAP_ADDR_SPACE_BITS
+    if (max > PAGE_FLAGS_LAST) {
+        max = PAGE_FLAGS_LAST;
+    }
+#endif
+    if (len == 0 || min > max) {
+        return -1;
+    }
+    pthread_rwlock_rdlock(&page_flags_lock);
+    found = interval_tree_find_free(&page_flags, min, max, len, align,
+                                    top_down, &addr);
+    pthread_rwlock_unlock(&page_flags_lock);
+    return found ? addr : -1;
 }
 
 int page_check_range(target_ulong start, target_ulong len, int flags)
 {
-    PageDesc *p;
-    target_ulong end;
-    target_ulong addr;
+    const IntervalTreeNode *n;
+    target_ulong last, run_last;
+    int run_flags;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -1810,40 +2368,45 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
         /* We've wrapped around.  */
         return -1;
     }
+    last = start + len - 1;
+#if TARGET_LONG_BITS > L1_MAP_ADDR_SPACE_BITS
+    if (last > PAGE_FLAGS_LAST) {
+        return -1;
+    }
+#endif
 
-    /* must do before we loose bits in the next step */
-    end = TARGET_PAGE_ALIGN(start + len);
-    start = start & TARGET_PAGE_MASK;
+    /* a run of pages at a time */
+    for (;;) {
+        pthread_rwlock_rdlock(&page_flags_lock);
+        n = interval_tree_find(&page_flags, start);
+        run_flags = n->value;
+        run_last = n->last;
+        pthread_rwlock_unlock(&page_flags_lock);
 
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        p = page_find(addr >> TARGET_PAGE_BITS);
-        if (!p) {
-            return -1;
-        }
-        if (!(p->flags & PAGE_VALID)) {
+        if (!(run_flags & PAGE_VALID)) {
             return -1;
         }
-
-        if ((flags & PAGE_READ) && !(p->flags & PAGE_READ)) {
+        if ((flags & PAGE_READ) && !(run_flags & PAGE_READ)) {
             return -1;
         }
         if (flags & PAGE_WRITE) {
-            if (!(p->flags & PAGE_WRITE_ORG)) {
+            if (!(run_flags & PAGE_WRITE_ORG)) {
                 return -1;
             }
-            /* unprotect the page if it was put read-only because it
-               contains translated code */
-            if (!(p->flags & PAGE_WRITE)) {
-                if (!page_unprotect(addr, 0, NULL)) {
+            /* unprotect the pages that were put read-only because they
+               contain translated code, and look at them again */
+            if (!(run_flags & PAGE_WRITE)) {
+                if (!page_unprotect(start, 0, NULL)) {
                     return -1;
                 }
+                continue;
             }
+        }
+        if (run_last >= last) {
             return 0;
         }
+        start = run_last + 1;
     }
-    return 0;
 }
 
 /* called from signal handler: invalidate the code and unprotect the
@@ -1851,46 +2414,70 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
 int page_unprotect(target_ulong address, uintptr_t pc, void *puc)
 {
     unsigned int prot;
-    PageDesc *p;
     target_ulong host_start, host_end, addr;
+    int flags;
 
     /* Technically this isn't safe inside a signal handler.  However we
        know this only ever happens in a synchronous SEGV handler, so in
        practice it seems to be ok.  */
     mmap_lock();
 
-    p = page_find(address >> TARGET_PAGE_BITS);
-    if (!p) {
-        mmap_unlock();
-        return 0;
-    }
+    flags = page_get_flags(address);
 
     /* if the page was really writable, then we change its
        protection back to writable */
-    if ((p->flags & PAGE_WRITE_ORG) && !(p->flags & PAGE_WRITE)) {
+    if ((flags & PAGE_WRITE_ORG) && !(flags & PAGE_WRITE)) {
         host_start = address & qemu_host_page_mask;
         host_end = host_start + qemu_host_page_size;
 
         prot = 0;
         for (addr = host_start ; addr < host_end ; addr += TARGET_PAGE_SIZE) {
-            p = page_find(addr >> TARGET_PAGE_BITS);
-            p->flags |= PAGE_WRITE;
-            prot |= p->flags;
+            flags = page_get_flags(addr);
+            if ((flags & PAGE_WRITE_ORG) && !(flags & PAGE_WRITE)) {
+                flags |= PAGE_WRITE;
+                page_flags_set(addr, addr + TARGET_PAGE_SIZE - 1, flags);
+            }
+            prot |= flags;
+        }
+        mprotect((void *)g2h(host_start), qemu_host_page_size,
+                 prot & PAGE_BITS);
 
-            /* and since the content will be modified, we must invalidate
-               the corresponding translated code. */
+        /* and since the content will be modified, we must invalidate
+           the corresponding translated code.  This comes last, as it
+           does not return if it invalidates the current TB.  */
+        for (addr = host_start ; addr < host_end ; addr += TARGET_PAGE_SIZE) {
             tb_invalidate_phys_page(addr, pc, puc);
 #ifdef DEBUG_TB_CHECK
             tb_invalidate_check(addr);
 #endif
         }
-        mprotect((void *)g2h(host_start), qemu_host_page_size,
-                 prot & PAGE_BITS);
 
         mmap_unlock();
         return 1;
     }
+    /* another thread may have unprotected the page after we saw it
+       read-only; the access can simply be retried */
+    if (flags & PAGE_WRITE) {
+        mmap_unlock();
+        return 1;
+    }
     mmap_unlock();
     return 0;
 }
+
+/* Called around fork(), so that the child does not inherit
+   page_flags_lock held by another thread.  */
+void page_fork_start(void)
+{
+    pthread_rwlock_wrlock(&page_flags_lock);
+}
+
+void page_fork_end(int child)
+{
+    if (child) {
+        pthread_rwlock_init(&page_flags_lock, NULL);
+    } else {
+        pthread_rwlock_unlock(&page_flags_lock);
+    }
+}
 #endif /* CONFIG_USER_ONLY */
@@ -168,8 +168,101 @@ static int nb_consoles = 0;
 
 void vga_hw_update(void)
 {
-    if (active_console && active_console->hw_update)
+    if (active_console && active_console->hw_update) {
         active_console->hw_update(active_console->hw);
+        dpy_gfx_damage_flush(active_console->ds);
+    }
+}
+
+static int64_t damage_area(const pixman_box32_t *b)
+{
+    return (int64_t)(b->x2 - b->x1) * (b->y2 - b->y1);
+}
+
+static void damage_union(pixman_box32_t *a, const pixman_box32_t *b)
+{
+    a->x1 = MIN(a->x1, b->x1);
+    a->y1 = MIN(a->y1, b->y1);
+    a->x2 = MAX(a->x2, b->x2);
+    a->y2 = MAX(a->y2, b->y2);
+}
+
+/* Merge B into A if their union is exactly a rectangle. */
+static bool damage_try_merge(pixman_box32_t *a, const pixman_box32_t *b)
+{
+    pixman_box32_t u = *a;
+
+    damage_union(&u, b);
+    if ((a->x1 == b->x1 && a->x2 == b->x2 &&
+         a->y1 <= b->y2 && b->y1 <= a->y2) ||
+        (a->y1 == b->y1 && a->y2 == b->y2 &&
+         a->x1 <= b->x2 && b->x1 <= a->x2) ||
+        damage_area(&u) == damage_area(a) ||
+        damage_area(&u) == damage_area(b)) {
+        *a = u;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Record that the device redrew the given area of the surface.  Called
+ * from the hw_update callback instead of dpy_gfx_update, so that the
+ * scanline runs found in the dirty log reach the listeners as a few
+ * merged rectangles once the pass is over.
+ */
+void dpy_gfx_damage(DisplayState *s, int x, int y, int w, int h)
+{
+    DisplayDamage *d = &s->damage;
+    pixman_box32_t box;
+    int64_t growth, best_growth = INT64_MAX;
+    int i, best = 0;
+
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+    box.x1 = x;
+    box.y1 = y;
+    box.x2 = x + w;
+    box.y2 = y + h;
+
+    /* a merged rectangle may in turn merge with one seen earlier */
+    for (i = 0; i < d->nb_rects; i++) {
+        if (damage_try_merge(&box, &d->rects[i])) {
+            d->rects[i] = d->rects[--d->nb_rects];
+            i = -1;
+        }
+    }
+    if (d->nb_rects < DPY_DAMAGE_MAX_RECTS) {
+        d->rects[d->nb_rects++] = box;
+        return;
+    }
+
+    /* out of room: grow the rectangle whose area increases the least */
+    for (i = 0; i < d->nb_rects; i++) {
+        pixman_box32_t u = d->rects[i];
+
+        damage_union(&u, &box);
+        growth = damage_area(&u) - damage_area(&d->rects[i]);
+        if (growth < best_growth) {
+            best_growth = growth;
+            best = i;
+        }
+    }
+    damage_union(&d->rects[best], &box);
+}
+
+void dpy_gfx_damage_flush(DisplayState *s)
+{
+    DisplayDamage *d = &s->damage;
+    int i, n = d->nb_rects;
+
+    d->nb_rects = 0;
+    for (i = 0; i < n; i++) {
+        pixman_box32_t *b = &d->rects[i];
+
+        dpy_gfx_update(s, b->x1, b->y1, b->x2 - b->x1, b->y2 - b->y1);
+    }
 }
 
 void vga_hw_invalidate(void)
@@ -1295,20 +1388,38 @@ static QemuConsole *new_console(DisplayState *ds, console_type_t console_type)
     return s;
 }
 
-static void qemu_alloc_display(DisplaySurface *surface, int width, int height,
-                               int linesize, PixelFormat pf, int newflags)
+static void qemu_free_display_data(pixman_image_t *image, void *opaque)
+{
+    DisplayState *ds = opaque;
+
+    ds->allocator->free(ds, pixman_image_get_data(image));
+}
+
+static void qemu_alloc_display(DisplayState *ds, DisplaySurface *surface,
+                               int width, int height, int linesize,
+                               PixelFormat pf, int newflags)
 {
+    void *data = NULL;
+
     surface->pf = pf;
 
     qemu_pixman_image_unref(surface->image);
     surface->image = NULL;
 
+    if (ds->allocator) {
+        data = ds->allocator->alloc(ds, (size_t)linesize * height);
+    }
+
     surface->format = qemu_pixman_get_format(&pf);
     assert(surface->format != 0);
     surface->image = pixman_image_create_bits(surface->format,
                                               width, height,
-                                              NULL, linesize);
+                                              data, linesize);
     assert(surface->image != NULL);
+    if (data) {
+        pixman_image_set_destroy_function(surface->image,
+                                          qemu_free_display_data, ds);
+    }
 
     surface->flags = newflags | QEMU_ALLOCATED_FLAG;
 #ifdef HOST_WORDS_BIGENDIAN
@@ -1322,7 +1433,7 @@ DisplaySurface *qemu_create_displaysurface(DisplayState *ds,
     DisplaySurface *surface = g_new0(DisplaySurface, 1);
 
     int linesize = width * 4;
-    qemu_alloc_display(surface, width, height, linesize,
+    qemu_alloc_display(ds, surface, width, height, linesize,
                        qemu_default_pixelformat(32), 0);
     return surface;
 }
@@ -1333,7 +1444,7 @@ DisplaySurface *qemu_resize_displaysurface(DisplayState *ds,
     int linesize = width * 4;
 
     trace_displaysurface_resize(ds, ds->surface, width, height);
-    qemu_alloc_display(ds->surface, width, height, linesize,
+    qemu_alloc_display(ds, ds->surface, width, height, linesize,
                        qemu_default_pixelformat(32), 0);
     return ds->surface;
 }
@@ -0,0 +1,595 @@
+/*
+ * QEMU shared memory display
+ *
+ * Exports the console framebuffer to local viewers through shared memory:
+ * surfaces that QEMU allocates are placed in shared memory segments
+ * directly, surfaces that point into device memory are mirrored into one.
+ * Viewers map the segment and are told over a Unix socket which parts of
+ * it changed, so no pixel data goes through the socket at all.  See
+ * include/ui/shm-display.h for the protocol.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include "qemu-common.h"
+#include "qemu/queue.h"
+#include "qemu/sockets.h"
+#include "qemu/main-loop.h"
+#include "qapi/error.h"
+#include "ui/console.h"
+#include "ui/shm-display.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+typedef struct ShmSegment ShmSegment;
+typedef struct ShmClient ShmClient;
+typedef struct ShmDisplay ShmDisplay;
+
+struct ShmSegment {
+    int fd;                     /* read-only if possible, passed to clients */
+    void *data;
+    size_t size;
+    QLIST_ENTRY(ShmSegment) next;
+};
+
+struct ShmClient {
+    ShmDisplay *sd;
+    int fd;
+
+    /* what still has to be told to the client */
+    bool need_surface;
+    bool need_cursor;
+    bool need_mouse;
+    int nb_rects;
+    pixman_box32_t rects[DPY_DAMAGE_MAX_RECTS];
+
+    /* messages being written; pass_fd goes out with the first byte */
+    uint8_t *buf;
+    size_t len;
+    size_t offset;
+    int pass_fd;
+
+    QLIST_ENTRY(ShmClient) next;
+};
+
+struct ShmDisplay {
+    DisplayState *ds;
+    DisplayChangeListener dcl;
+    int lsock;
+
+    /* segments backing QEMU-allocated surfaces */
+    QLIST_HEAD(, ShmSegment) segments;
+    /* the segment clients see: one of the above, or mirror */
+    ShmSegment *current;
+    ShmSegment *mirror;
+    pixman_image_t *mirror_image;
+
+    QEMUCursor *cursor;
+    int mouse_x, mouse_y, mouse_on;
+
+    QLIST_HEAD(, ShmClient) clients;
+};
+
+static ShmDisplay *shm_display;
+
+static int shm_segment_open(void)
+{
+    char *path;
+    int fd;
+
+#ifdef __NR_memfd_create
+    fd = syscall(__NR_memfd_create, "qemu-display",
+                 MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd >= 0) {
+        return fd;
+    }
+#endif
+    path = g_strdup("/dev/shm/qemu-display-XXXXXX");
+    fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+        qemu_set_cloexec(fd);
+    }
+    g_free(path);
+    return fd;
+}
+
+/*
+ * Keep clients from writing to the segment or resizing it under our feet,
+ * once it is mapped.  F_SEAL_FUTURE_WRITE still allows the mapping QEMU
+ * already has, unlike F_SEAL_WRITE; older kernels only get the size
+ * sealed.  In addition, clients receive a read-only descriptor.
+ */
+static int shm_segment_seal(int fd)
+{
+    char *path;
+    int ro_fd;
+
+#ifdef __NR_memfd_create
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+                               F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+    }
+#endif
+
+    path = g_strdup_printf("/proc/self/fd/%d", fd);
+    ro_fd = qemu_open(path, O_RDONLY);
+    g_free(path);
+    if (ro_fd < 0) {
+        return fd;
+    }
+    close(fd);
+    return ro_fd;
+}
+
+static ShmSegment *shm_segment_new(size_t size)
+{
+    ShmSegment *seg;
+    void *data;
+    int fd;
+
+    fd = shm_segment_open();
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    seg = g_malloc0(sizeof(*seg));
+    seg->fd = shm_segment_seal(fd);
+    seg->data = data;
+    seg->size = size;
+    return seg;
+}
+
+static void shm_segment_free(ShmSegment *seg)
+{
+    if (shm_display->current == seg) {
+        shm_display->current = NULL;
+    }
+    munmap(seg->data, seg->size);
+    close(seg->fd);
+    g_free(seg);
+}
+
+/* Surface allocator */
+
+static void *shm_display_alloc(DisplayState *ds, size_t size)
+{
+    ShmSegment *seg = shm_segment_new(size);
+
+    if (!seg) {
+        return NULL;
+    }
+    QLIST_INSERT_HEAD(&shm_display->segments, seg, next);
+    return seg->data;
+}
+
+static void shm_display_free(DisplayState *ds, void *data)
+{
+    ShmSegment *seg;
+
+    QLIST_FOREACH(seg, &shm_display->segments, next) {
+        if (seg->data == data) {
+            QLIST_REMOVE(seg, next);
+            shm_segment_free(seg);
+            return;
+        }
+    }
+    abort();
+}
+
+static const DisplayAllocator shm_display_allocator = {
+    .alloc = shm_display_alloc,
+    .free  = shm_display_free,
+};
+
+/* Clients */
+
+static void shm_client_disconnect(ShmClient *c)
+{
+    qemu_set_fd_handler2(c->fd, NULL, NULL, NULL, NULL);
+    closesocket(c->fd);
+    if (c->pass_fd >= 0) {
+        close(c->pass_fd);
+    }
+    QLIST_REMOVE(c, next);
+    g_free(c->buf);
+    g_free(c);
+}
+
+/* Clients never send anything, so this only notices them going away. */
+static void shm_client_read(void *opaque)
+{
+    ShmClient *c = opaque;
+    char buf[64];
+    ssize_t ret;
+
+    ret = recv(c->fd, buf, sizeof(buf), 0);
+    if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                     errno != EINTR)) {
+        shm_client_disconnect(c);
+    }
+}
+
+static void *shm_client_msg(ShmClient *c, uint32_t type, size_t size)
+{
+    ShmDisplayHeader *hdr;
+
+    c->buf = g_realloc(c->buf, c->len + sizeof(*hdr) + size);
+    hdr = (ShmDisplayHeader *)(c->buf + c->len);
+    hdr->type = type;
+    hdr->size = size;
+    c->len += sizeof(*hdr) + size;
+    return hdr + 1;
+}
+
+/* Turn what the client has not been told yet into messages. */
+static void shm_client_fill(ShmClient *c)
+{
+    ShmDisplay *sd = c->sd;
+    DisplayState *ds = sd->ds;
+    int i;
+
+    if (c->need_surface && sd->current) {
+        ShmDisplaySurface *msg;
+
+        msg = shm_client_msg(c, SHM_DISPLAY_SURFACE, sizeof(*msg));
+        msg->width = ds_get_width(ds);
+        msg->height = ds_get_height(ds);
+        if (sd->mirror_image) {
+            msg->stride = pixman_image_get_stride(sd->mirror_image);
+            msg->format = pixman_image_get_format(sd->mirror_image);
+        } else {
+            msg->stride = ds_get_linesize(ds);
+            msg->format = ds_get_format(ds);
+        }
+        msg->size = sd->current->size;
+        c->pass_fd = dup(sd->current->fd);
+
+        c->rects[0].x1 = c->rects[0].y1 = 0;
+        c->rects[0].x2 = msg->width;
+        c->rects[0].y2 = msg->height;
+        c->nb_rects = 1;
+        c->need_surface = false;
+    }
+
+    if (!c->need_surface) {
+        for (i = 0; i < c->nb_rects; i++) {
+            ShmDisplayUpdate *msg;
+
+            msg = shm_client_msg(c, SHM_DISPLAY_UPDATE, sizeof(*msg));
+            msg->x = c->rects[i].x1;
+            msg->y = c->rects[i].y1;
+            msg->width = c->rects[i].x2 - c->rects[i].x1;
+            msg->height = c->rects[i].y2 - c->rects[i].y1;
+        }
+        c->nb_rects = 0;
+    }
+
+    if (c->need_cursor && sd->cursor) {
+        QEMUCursor *cursor = sd->cursor;
+        size_t bytes = cursor->width * cursor->height * sizeof(uint32_t);
+        ShmDisplayCursor *msg;
+
+        msg = shm_client_msg(c, SHM_DISPLAY_CURSOR, sizeof(*msg) + bytes);
+        msg->width = cursor->width;
+        msg->height = cursor->height;
+        msg->hot_x = cursor->hot_x;
+        msg->hot_y = cursor->hot_y;
+        memcpy(msg + 1, cursor->data, bytes);
+        c->need_cursor = false;
+    }
+
+    if (c->need_mouse) {
+        ShmDisplayMouse *msg;
+
+        msg = shm_client_msg(c, SHM_DISPLAY_MOUSE, sizeof(*msg));
+        msg->x = sd->mouse_x;
+        msg->y = sd->mouse_y;
+        msg->visible = sd->mouse_on;
+        msg->pad = 0;
+        c->need_mouse = false;
+    }
+}
+
+static ssize_t shm_client_send(ShmClient *c)
+{
+    union {
+        struct cmsghdr cmsg;
+        char control[CMSG_SPACE(sizeof(int))];
+    } u;
+    struct msghdr msg;
+    struct iovec iov;
+
+    iov.iov_base = c->buf + c->offset;
+    iov.iov_len = c->len - c->offset;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (c->pass_fd >= 0) {
+        memset(&u, 0, sizeof(u));
+        msg.msg_control = u.control;
+        msg.msg_controllen = sizeof(u.control);
+        u.cmsg.cmsg_len = CMSG_LEN(sizeof(int));
+        u.cmsg.cmsg_level = SOL_SOCKET;
+        u.cmsg.cmsg_type = SCM_RIGHTS;
+        memcpy(CMSG_DATA(&u.cmsg), &c->pass_fd, sizeof(int));
+    }
+    return sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+}
+
+/*
+ * Write out pending messages until the socket is full.  Whatever cannot
+ * be written stays in the client's pending state, where later changes are
+ * merged into it.
+ */
+static void shm_client_flush(void *opaque)
+{
+    ShmClient *c = opaque;
+    ssize_t ret;
+
+    for (;;) {
+        if (c->offset == c->len) {
+            c->offset = c->len = 0;
+            shm_client_fill(c);
+            if (!c->len) {
+                break;
+            }
+        }
+
+        ret = shm_client_send(c);
+        if (ret < 0 && (errno == EINTR)) {
+            continue;
+        }
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            qemu_set_fd_handler2(c->fd, NULL, shm_client_read,
+                                 shm_client_flush, c);
+            return;
+        }
+        if (ret <= 0) {
+            shm_client_disconnect(c);
+            return;
+        }
+        if (c->pass_fd >= 0) {
+            close(c->pass_fd);
+            c->pass_fd = -1;
+        }
+        c->offset += ret;
+    }
+    qemu_set_fd_handler2(c->fd, NULL, shm_client_read, NULL, c);
+}
+
+static void shm_client_damage(ShmClient *c, int x, int y, int w, int h)
+{
+    pixman_box32_t *r;
+    int i;
+
+    if (c->need_surface) {
+        return;
+    }
+    if (c->nb_rects == DPY_DAMAGE_MAX_RECTS) {
+        /* the client is behind; one rectangle is enough to catch up */
+        r = &c->rects[0];
+        for (i = 1; i < c->nb_rects; i++) {
+            r->x1 = MIN(r->x1, c->rects[i].x1);
+            r->y1 = MIN(r->y1, c->rects[i].y1);
+            r->x2 = MAX(r->x2, c->rects[i].x2);
+            r->y2 = MAX(r->y2, c->rects[i].y2);
+        }
+        r->x1 = MIN(r->x1, x);
+        r->y1 = MIN(r->y1, y);
+        r->x2 = MAX(r->x2, x + w);
+        r->y2 = MAX(r->y2, y + h);
+        c->nb_rects = 1;
+        return;
+    }
+    r = &c->rects[c->nb_rects++];
+    r->x1 = x;
+    r->y1 = y;
+    r->x2 = x + w;
+    r->y2 = y + h;
+}
+
+static void shm_client_accept(void *opaque)
+{
+    ShmDisplay *sd = opaque;
+    struct sockaddr_un addr;
+    socklen_t addrlen = sizeof(addr);
+    ShmClient *c;
+    int fd;
+
+    fd = qemu_accept(sd->lsock, (struct sockaddr *)&addr, &addrlen);
+    if (fd < 0) {
+        return;
+    }
+    socket_set_nonblock(fd);
+
+    c = g_malloc0(sizeof(*c));
+    c->sd = sd;
+    c->fd = fd;
+    c->pass_fd = -1;
+    c->need_surface = true;
+    c->need_cursor = true;
+    c->need_mouse = true;
+    QLIST_INSERT_HEAD(&sd->clients, c, next);
+
+    /* the device has not drawn anything while nobody was watching */
+    vga_hw_invalidate();
+    shm_client_flush(c);
+}
+
+/* Display change listener */
+
+static void shm_display_flush_all(ShmDisplay *sd)
+{
+    ShmClient *c, *next;
+
+    QLIST_FOREACH_SAFE(c, &sd->clients, next, next) {
+        shm_client_flush(c);
+    }
+}
+
+static void shm_display_surface_changed(ShmDisplay *sd)
+{
+    DisplayState *ds = sd->ds;
+    void *data = ds_get_data(ds);
+    int width = ds_get_width(ds);
+    int height = ds_get_height(ds);
+    ShmSegment *seg;
+    ShmClient *c;
+
+    if (sd->mirror_image) {
+        qemu_pixman_image_unref(sd->mirror_image);
+        sd->mirror_image = NULL;
+        shm_segment_free(sd->mirror);
+        sd->mirror = NULL;
+    }
+
+    sd->current = NULL;
+    QLIST_FOREACH(seg, &sd->segments, next) {
+        if (seg->data == data) {
+            sd->current = seg;
+        }
+    }
+
+    if (!sd->current) {
+        /* device memory: keep an x8r8g8b8 copy in shared memory instead */
+        sd->mirror = shm_segment_new((size_t)width * height * 4);
+        if (sd->mirror) {
+            sd->mirror_image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+                                                        width, height,
+                                                        sd->mirror->data,
+                                                        width * 4);
+            pixman_image_composite(PIXMAN_OP_SRC, ds_get_image(ds), NULL,
+                                   sd->mirror_image, 0, 0, 0, 0, 0, 0,
+                                   width, height);
+            sd->current = sd->mirror;
+        }
+    }
+
+    QLIST_FOREACH(c, &sd->clients, next) {
+        c->need_surface = true;
+        c->nb_rects = 0;
+    }
+    shm_display_flush_all(sd);
+}
+
+static void shm_display_update(DisplayState *ds, int x, int y, int w, int h)
+{
+    ShmDisplay *sd = shm_display;
+    ShmClient *c;
+
+    if (sd->mirror_image) {
+        pixman_image_composite(PIXMAN_OP_SRC, ds_get_image(ds), NULL,
+                               sd->mirror_image, x, y, 0, 0, x, y, w, h);
+    }
+    QLIST_FOREACH(c, &sd->clients, next) {
+        shm_client_damage(c, x, y, w, h);
+    }
+    shm_display_flush_all(sd);
+}
+
+static void shm_display_resize(DisplayState *ds)
+{
+    shm_display_surface_changed(shm_display);
+}
+
+static void shm_display_refresh(DisplayState *ds)
+{
+    if (!QLIST_EMPTY(&shm_display->clients)) {
+        vga_hw_update();
+    }
+}
+
+static void shm_display_mouse_set(DisplayState *ds, int x, int y, int on)
+{
+    ShmDisplay *sd = shm_display;
+    ShmClient *c;
+
+    sd->mouse_x = x;
+    sd->mouse_y = y;
+    sd->mouse_on = on;
+    QLIST_FOREACH(c, &sd->clients, next) {
+        c->need_mouse = true;
+    }
+    shm_display_flush_all(sd);
+}
+
+static void shm_display_cursor_define(DisplayState *ds, QEMUCursor *cursor)
+{
+    ShmDisplay *sd = shm_display;
+    ShmClient *c;
+
+    cursor_get(cursor);
+    if (sd->cursor) {
+        cursor_put(sd->cursor);
+    }
+    sd->cursor = cursor;
+    QLIST_FOREACH(c, &sd->clients, next) {
+        c->need_cursor = true;
+    }
+    shm_display_flush_all(sd);
+}
+
+void shm_display_init(DisplayState *ds, const char *path, Error **errp)
+{
+    ShmDisplay *sd;
+    int lsock;
+
+    if (shm_display) {
+        error_setg(errp, "shared memory display already initialized");
+        return;
+    }
+
+    lsock = unix_listen(path, NULL, 0, errp);
+    if (lsock < 0) {
+        return;
+    }
+
+    sd = g_malloc0(sizeof(*sd));
+    sd->ds = ds;
+    sd->lsock = lsock;
+    QLIST_INIT(&sd->segments);
+    QLIST_INIT(&sd->clients);
+    shm_display = sd;
+
+    ds->allocator = &shm_display_allocator;
+
+    sd->dcl.dpy_refresh = shm_display_refresh;
+    sd->dcl.dpy_gfx_update = shm_display_update;
+    sd->dcl.dpy_gfx_resize = shm_display_resize;
+    sd->dcl.dpy_gfx_setdata = shm_display_resize;
+    sd->dcl.dpy_mouse_set = shm_display_mouse_set;
+    sd->dcl.dpy_cursor_define = shm_display_cursor_define;
+    register_displaychangelistener(ds, &sd->dcl);
+
+    qemu_set_fd_handler2(lsock, NULL, shm_client_accept, NULL, sd);
+}
@@ -0,0 +1,280 @@
+/*
+ * QEMU VNC display driver: adaptive encoding selection
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * For each client we measure how fast the socket drains and, for each
+ * encoding the client supports, how much time the encoder spends and how
+ * many bytes it produces per pixel.  Every framebuffer update then uses
+ * the encoding that minimizes encoding time plus transmission time:
+ * a client on a fast link gets cheap encodings, a client on a slow link
+ * gets the ones that compress best.  Encodings that have not been
+ * measured recently are tried from time to time so that the estimates
+ * follow changes of the link and of the screen contents.  To keep a bad
+ * guess cheap, this is only done on small updates or with encodings whose
+ * estimated cost is close to the best one; an encoding that was never
+ * measured is assumed to be as large as raw.
+ */
+
+#include "vnc.h"
+#include "vnc-jobs.h"
+#include "qemu/timer.h"
+
+/* Updates smaller than this say little about an encoder */
+#define VNC_ADAPTIVE_MIN_PIXELS   4096
+/* Transfers smaller than this are dominated by latency, not throughput */
+#define VNC_ADAPTIVE_MIN_BYTES    (64 * 1024)
+/* One update in VNC_ADAPTIVE_PROBE may try an encoding not measured for
+ * VNC_ADAPTIVE_STALE updates */
+#define VNC_ADAPTIVE_PROBE        16
+#define VNC_ADAPTIVE_STALE        512
+/* A probe must not cost much more than the best known encoding: it is
+ * only done on updates of at most VNC_ADAPTIVE_PROBE_PIXELS, or if the
+ * estimate for the encoding is within VNC_ADAPTIVE_PROBE_RATIO of the
+ * best one */
+#define VNC_ADAPTIVE_PROBE_PIXELS (128 * 128)
+#define VNC_ADAPTIVE_PROBE_RATIO  2
+/* Weight of a new sample in the running averages */
+#define VNC_ADAPTIVE_WEIGHT       0.25
+
+typedef struct VncAdaptiveMode {
+    const char *name;
+    int encoding;
+    int feature;            /* -1: every client supports it */
+    int compression;        /* -1: not applicable */
+    bool jpeg;
+} VncAdaptiveMode;
+
+static const VncAdaptiveMode vnc_adaptive_modes[VNC_ADAPTIVE_MODES] = {
+    { "raw",        VNC_ENCODING_RAW,     -1,                  -1, false },
+    { "hextile",    VNC_ENCODING_HEXTILE, VNC_FEATURE_HEXTILE, -1, false },
+    { "zlib-1",     VNC_ENCODING_ZLIB,    VNC_FEATURE_ZLIB,     1, false },
+    { "zlib-6",     VNC_ENCODING_ZLIB,    VNC_FEATURE_ZLIB,     6, false },
+    { "zlib-9",     VNC_ENCODING_ZLIB,    VNC_FEATURE_ZLIB,     9, false },
+    { "zrle",       VNC_ENCODING_ZRLE,    VNC_FEATURE_ZRLE,    -1, false },
+    { "tight-1",    VNC_ENCODING_TIGHT,   VNC_FEATURE_TIGHT,    1, false },
+    { "tight-9",    VNC_ENCODING_TIGHT,   VNC_FEATURE_TIGHT,    9, false },
+    { "tight-jpeg", VNC_ENCODING_TIGHT,   VNC_FEATURE_TIGHT,    9, true },
+};
+
+static bool vnc_adaptive_mode_usable(VncState *vs, const VncAdaptiveMode *m)
+{
+    if (m->feature >= 0 && !vnc_has_feature(vs, m->feature)) {
+        return false;
+    }
+    if (m->jpeg) {
+#ifdef CONFIG_VNC_JPEG
+        /* only if the client asked for lossy updates */
+        return vs->tight.quality != (uint8_t)-1;
+#else
+        return false;
+#endif
+    }
+    return true;
+}
+
+/* The mode matching the client's own choice, so that it gets measured too */
+static int vnc_adaptive_client_mode(VncState *vs)
+{
+    const VncAdaptiveMode *m;
+    int i;
+
+    for (i = 0; i < VNC_ADAPTIVE_MODES; i++) {
+        m = &vnc_adaptive_modes[i];
+        if (m->encoding != vs->vnc_encoding ||
+            !vnc_adaptive_mode_usable(vs, m)) {
+            continue;
+        }
+        if (m->compression >= 0 && m->compression != vs->tight.compression) {
+            continue;
+        }
+        if (m->encoding == VNC_ENCODING_TIGHT &&
+            m->jpeg != (vs->tight.quality != (uint8_t)-1)) {
+            continue;
+        }
+        return i;
+    }
+    return -1;
+}
+
+void vnc_adaptive_init(VncState *vs)
+{
+    memset(&vs->adaptive, 0, sizeof(vs->adaptive));
+    vs->adaptive.mode = -1;
+}
+
+/* Account for RET bytes written to the client socket. */
+void vnc_adaptive_sent(VncState *vs, long ret)
+{
+    VncAdaptive *a = &vs->adaptive;
+
+    if (ret <= 0) {
+        return;
+    }
+    if (!a->send_bytes) {
+        a->send_start = get_clock();
+    }
+    a->send_bytes += ret;
+}
+
+/*
+ * Called when the client asks for the next framebuffer update.  Clients
+ * do so once they have received and drawn the previous one, so the data
+ * written since the first byte of that update measures the end-to-end
+ * throughput of the connection, including any socket buffering along the
+ * way and the client's own decoding.
+ */
+void vnc_adaptive_request(VncState *vs)
+{
+    VncAdaptive *a = &vs->adaptive;
+    double sample;
+
+    if (a->send_bytes >= VNC_ADAPTIVE_MIN_BYTES) {
+        sample = a->send_bytes * 1e9 /
+                 MAX(get_clock() - a->send_start, SCALE_MS);
+        if (a->throughput) {
+            a->throughput += (sample - a->throughput) * VNC_ADAPTIVE_WEIGHT;
+        } else {
+            a->throughput = sample;
+        }
+    }
+    a->send_bytes = 0;
+}
+
+/*
+ * Pick the encoding for an update of PIXELS pixels and set it up in LOCAL,
+ * the worker's copy of VS.  Until the link has been measured the client's
+ * own choice is kept.  Returns the mode used, or -1 if it is not one of
+ * vnc_adaptive_modes[].
+ */
+int vnc_adaptive_select(VncState *vs, VncState *local, int pixels)
+{
+    VncAdaptive *a = &vs->adaptive;
+    const VncAdaptiveMode *m;
+    double throughput, cost[VNC_ADAPTIVE_MODES], best_cost = 0;
+    int64_t oldest = INT64_MAX;
+    int i, best = -1, probe = -1;
+
+    if (vs->vd->fixed_encoding) {
+        a->mode = -1;
+        return -1;
+    }
+
+    vnc_lock_output(vs);
+    throughput = a->throughput;
+    vnc_unlock_output(vs);
+
+    a->updates++;
+    for (i = 0; i < VNC_ADAPTIVE_MODES; i++) {
+        VncEncoderStat *st = &a->enc[i];
+
+        cost[i] = -1;
+        if (!vnc_adaptive_mode_usable(local, &vnc_adaptive_modes[i]) ||
+            !throughput) {
+            continue;
+        }
+        if (!st->last_update) {
+            /* Not measured yet: no encoding is much worse than raw */
+            cost[i] = (double)pixels * local->client_pf.bytes_per_pixel /
+                      throughput;
+            continue;
+        }
+        cost[i] = pixels * (st->ns_per_pixel * 1e-9 +
+                            st->bytes_per_pixel / throughput);
+        if (best < 0 || cost[i] < best_cost) {
+            best = i;
+            best_cost = cost[i];
+        }
+    }
+
+    if (a->updates % VNC_ADAPTIVE_PROBE == 0 &&
+        pixels >= VNC_ADAPTIVE_MIN_PIXELS) {
+        for (i = 0; i < VNC_ADAPTIVE_MODES; i++) {
+            VncEncoderStat *st = &a->enc[i];
+
+            if (!vnc_adaptive_mode_usable(local, &vnc_adaptive_modes[i]) ||
+                (st->last_update &&
+                 a->updates - st->last_update <= VNC_ADAPTIVE_STALE)) {
+                continue;
+            }
+            if (pixels > VNC_ADAPTIVE_PROBE_PIXELS &&
+                (cost[i] < 0 || best < 0 ||
+                 cost[i] > best_cost * VNC_ADAPTIVE_PROBE_RATIO)) {
+                continue;
+            }
+            if (st->last_update < oldest) {
+                oldest = st->last_update;
+                probe = i;
+            }
+        }
+        if (probe >= 0) {
+            best = probe;
+        }
+    }
+    if (best < 0) {
+        a->mode = vnc_adaptive_client_mode(local);
+        return a->mode;
+    }
+    a->mode = best;
+
+    m = &vnc_adaptive_modes[best];
+    local->vnc_encoding = m->encoding;
+    if (m->compression >= 0) {
+        local->tight.compression = m->compression;
+    }
+    if (m->encoding == VNC_ENCODING_TIGHT && !m->jpeg) {
+        local->tight.quality = -1;
+    }
+    return best;
+}
+
+/* Record that MODE took NS nanoseconds to encode PIXELS pixels in BYTES. */
+void vnc_adaptive_update(VncState *vs, int mode, int pixels, int64_t ns,
+                         size_t bytes)
+{
+    VncAdaptive *a = &vs->adaptive;
+    VncEncoderStat *st;
+    double ns_pp, bytes_pp;
+
+    if (mode < 0 || pixels < VNC_ADAPTIVE_MIN_PIXELS) {
+        return;
+    }
+
+    st = &a->enc[mode];
+    ns_pp = (double)ns / pixels;
+    bytes_pp = (double)bytes / pixels;
+    if (!st->last_update) {
+        st->ns_per_pixel = ns_pp;
+        st->bytes_per_pixel = bytes_pp;
+    } else {
+        st->ns_per_pixel += (ns_pp - st->ns_per_pixel) * VNC_ADAPTIVE_WEIGHT;
+        st->bytes_per_pixel +=
+            (bytes_pp - st->bytes_per_pixel) * VNC_ADAPTIVE_WEIGHT;
+    }
+    st->last_update = a->updates;
+}
+
+const char *vnc_adaptive_mode_name(const VncState *vs)
+{
+    int mode = vs->adaptive.mode;
+
+    return mode >= 0 ? vnc_adaptive_modes[mode].name : NULL;
+}
@@ -0,0 +1,136 @@
+/*
+ * QEMU VNC display driver: framebuffer diffing
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu-common.h"
+#include "qemu/bitops.h"
+#include "qemu/host-utils.h"
+#include "vnc-diff.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+/* Copy one chunk from SRC to DST if they differ; return true if so. */
+static inline bool vnc_diff_chunk(uint8_t *dst, const uint8_t *src)
+{
+    __m128i s0 = _mm_loadu_si128((const __m128i *)src);
+    __m128i s1 = _mm_loadu_si128((const __m128i *)src + 1);
+    __m128i s2 = _mm_loadu_si128((const __m128i *)src + 2);
+    __m128i s3 = _mm_loadu_si128((const __m128i *)src + 3);
+    __m128i eq;
+
+    eq = _mm_and_si128(
+        _mm_and_si128(_mm_cmpeq_epi8(s0, _mm_loadu_si128((__m128i *)dst)),
+                      _mm_cmpeq_epi8(s1, _mm_loadu_si128((__m128i *)dst + 1))),
+        _mm_and_si128(_mm_cmpeq_epi8(s2, _mm_loadu_si128((__m128i *)dst + 2)),
+                      _mm_cmpeq_epi8(s3, _mm_loadu_si128((__m128i *)dst + 3))));
+    if (_mm_movemask_epi8(eq) == 0xffff) {
+        return false;
+    }
+    _mm_storeu_si128((__m128i *)dst, s0);
+    _mm_storeu_si128((__m128i *)dst + 1, s1);
+    _mm_storeu_si128((__m128i *)dst + 2, s2);
+    _mm_storeu_si128((__m128i *)dst + 3, s3);
+    return true;
+}
+#else
+static inline bool vnc_diff_chunk(uint8_t *dst, const uint8_t *src)
+{
+    unsigned long s[VNC_DIFF_CHUNK_BYTES / sizeof(unsigned long)];
+    unsigned long d[VNC_DIFF_CHUNK_BYTES / sizeof(unsigned long)];
+    unsigned long diff = 0;
+    int i;
+
+    /* the compiler turns these into plain word loads */
+    memcpy(s, src, VNC_DIFF_CHUNK_BYTES);
+    memcpy(d, dst, VNC_DIFF_CHUNK_BYTES);
+    for (i = 0; i < ARRAY_SIZE(s); i++) {
+        diff |= s[i] ^ d[i];
+    }
+    if (!diff) {
+        return false;
+    }
+    memcpy(dst, s, VNC_DIFF_CHUNK_BYTES);
+    return true;
+}
+#endif
+
+/* Compare and copy one chunk of LEN bytes; return true if it differed. */
+static bool vnc_diff_chunks(uint8_t *dst, const uint8_t *src, int len)
+{
+    bool changed = false;
+    int ofs;
+
+    for (ofs = 0; ofs + VNC_DIFF_CHUNK_BYTES <= len;
+         ofs += VNC_DIFF_CHUNK_BYTES) {
+        changed |= vnc_diff_chunk(dst + ofs, src + ofs);
+    }
+    if (ofs < len && memcmp(dst + ofs, src + ofs, len - ofs)) {
+        memcpy(dst + ofs, src + ofs, len - ofs);
+        changed = true;
+    }
+    return changed;
+}
+
+/*
+ * Compare the chunks of a row that are marked in DIRTY against the
+ * server copy in DST, copy the ones that differ from SRC and mark them
+ * in CHANGED.  A chunk is CHUNK_BYTES long, a multiple of
+ * VNC_DIFF_CHUNK_BYTES, except for the last one of the row which ends at
+ * ROW_BYTES.  Bits of DIRTY for the chunks of the row are cleared.
+ * The bitmap is walked a word at a time, so clean runs cost nothing and
+ * dirty runs are compared back to back.
+ *
+ * Returns the number of chunks that changed.
+ */
+int vnc_diff_row(uint8_t *dst, const uint8_t *src, int row_bytes,
+                 int chunk_bytes, unsigned long *dirty,
+                 unsigned long *changed)
+{
+    int nchunks = DIV_ROUND_UP(row_bytes, chunk_bytes);
+    int i, n = 0;
+
+    for (i = 0; i * BITS_PER_LONG < nchunks; i++) {
+        unsigned long bits = dirty[i];
+        unsigned long set = 0;
+
+        if (nchunks - i * BITS_PER_LONG < BITS_PER_LONG) {
+            bits &= BIT(nchunks - i * BITS_PER_LONG) - 1;
+        }
+        if (!bits) {
+            continue;
+        }
+        dirty[i] &= ~bits;
+        do {
+            int b = ctzl(bits);
+            int ofs = (i * BITS_PER_LONG + b) * chunk_bytes;
+
+            bits &= bits - 1;
+            if (vnc_diff_chunks(dst + ofs, src + ofs,
+                                MIN(chunk_bytes, row_bytes - ofs))) {
+                set |= BIT(b);
+                n++;
+            }
+        } while (bits);
+        changed[i] |= set;
+    }
+    return n;
+}
@@ -29,6 +29,7 @@
 #include "vnc.h"
 #include "vnc-jobs.h"
 #include "qemu/sockets.h"
+#include "qemu/timer.h"
 
 /*
  * Locking:
@@ -41,19 +42,42 @@
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  *                          if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is held
- * to avoid screen corruption (this does not block vnc_refresh() because it
- * uses trylock()) but the output lock is not held because the thread works on
- * its own output buffer.
+ * A VNC worker thread holds the VncDisplay global lock only while it copies
+ * the rectangles of its job from the server surface to the snapshot of its
+ * client, to avoid screen corruption (this does not block vnc_refresh()
+ * because it uses trylock()), and while it merges the regions it sent lossy
+ * into vs->lossy_rect.  The encoders read the snapshot, so they run without
+ * the lock.  They also read the refresh statistics of the display unlocked;
+ * these only steer the choice of JPEG.  The output lock is not held while
+ * encoding because the thread works on its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * Parallel encoding:
+ *
+ * The queue is served by a pool of worker threads.  Jobs of different
+ * clients are encoded concurrently, while the jobs of one client are
+ * still encoded one at a time and in order, because most encodings keep
+ * zlib streams that must see the rectangles in sequence.  Raw and hextile
+ * do not, so the worker owning such a job cuts it into bands and
+ * publishes them in job->parts; idle workers pick bands up and encode
+ * them into per-band buffers.  The owner then reassembles the bands in
+ * order.  A single zlib, tight or zrle update is encoded by one worker.
+ */
+
+/* Upper bound on the size of the encoding thread pool */
+#define VNC_MAX_WORKERS 16
+
+/* Height of the bands a stateless update is cut into; a multiple of the
+ * hextile tile size so that the tiling does not change.
  */
+#define VNC_JOB_BAND_HEIGHT 64
 
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
-    Buffer buffer;
+    int nb_threads;
+    int running;
     bool exit;
     QTAILQ_HEAD(, VncJob) jobs;
 };
@@ -61,8 +85,8 @@ struct VncJobQueue {
 typedef struct VncJobQueue VncJobQueue;
 
 /*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
+ * We use a single global queue for all the clients, served by
+ * queue->nb_threads encoding threads
  */
 static VncJobQueue *queue;
 
@@ -102,6 +126,18 @@ int vnc_job_add_rect(VncJob *job, int x, int y, int w, int h)
     return 1;
 }
 
+static void vnc_job_free(VncJob *job)
+{
+    VncRectEntry *entry, *tmp;
+
+    QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
+        buffer_free(&entry->output);
+        g_free(entry);
+    }
+    g_free(job->parts);
+    g_free(job);
+}
+
 void vnc_job_push(VncJob *job)
 {
     vnc_lock_queue(queue);
@@ -142,8 +178,10 @@ void vnc_jobs_clear(VncState *vs)
 
     vnc_lock_queue(queue);
     QTAILQ_FOREACH_SAFE(job, &queue->jobs, next, tmp) {
-        if (job->vs == vs || !vs) {
+        /* jobs being encoded are removed by their worker */
+        if ((job->vs == vs || !vs) && !job->busy) {
             QTAILQ_REMOVE(&queue->jobs, job, next);
+            vnc_job_free(job);
         }
     }
     vnc_unlock_queue(queue);
@@ -179,7 +217,8 @@ void vnc_jobs_consume_buffer(VncState *vs)
 /*
  * Copy data for local use
  */
-static void vnc_async_encoding_start(VncState *orig, VncState *local)
+static void vnc_async_encoding_start(VncState *orig, VncState *local,
+                                     Buffer *output)
 {
     local->vnc_encoding = orig->vnc_encoding;
     local->features = orig->features;
@@ -193,7 +232,7 @@ static void vnc_async_encoding_start(VncState *orig, VncState *local)
     local->zlib = orig->zlib;
     local->hextile = orig->hextile;
     local->zrle = orig->zrle;
-    local->output =  queue->buffer;
+    local->output = *output;
     local->csock = -1; /* Don't do any network work on this thread */
 
     buffer_reset(&local->output);
@@ -205,30 +244,237 @@ static void vnc_async_encoding_end(VncState *orig, VncState *local)
     orig->zlib = local->zlib;
     orig->hextile = local->hextile;
     orig->zrle = local->zrle;
-    orig->lossy_rect = local->lossy_rect;
+}
+
+/* Copy the rectangles of the job from the server surface to the snapshot
+ * that the encoders read.  Called with the display lock held.
+ */
+static void vnc_job_snapshot(VncJob *job, VncState *local)
+{
+    VncDisplay *vd = job->vs->vd;
+    int width = pixman_image_get_width(vd->server);
+    int height = pixman_image_get_height(vd->server);
+    VncRectEntry *entry;
+    uint8_t *src, *dst;
+    int y;
+
+    if (!local->snapshot ||
+        pixman_image_get_width(local->snapshot) != width ||
+        pixman_image_get_height(local->snapshot) != height) {
+        qemu_pixman_image_unref(local->snapshot);
+        local->snapshot = pixman_image_create_bits(VNC_SERVER_FB_FORMAT,
+                                                   width, height, NULL, 0);
+    }
 
-    queue->buffer = local->output;
+    QLIST_FOREACH(entry, &job->rectangles, next) {
+        src = vnc_server_fb_ptr(vd, entry->rect.x, entry->rect.y);
+        dst = vnc_snapshot_ptr(local, entry->rect.x, entry->rect.y);
+        for (y = 0; y < entry->rect.h; y++) {
+            memcpy(dst, src, entry->rect.w * VNC_SERVER_FB_BYTES);
+            src += vnc_server_fb_stride(vd);
+            dst += vnc_snapshot_stride(local);
+        }
+    }
 }
 
-static int vnc_worker_thread_loop(VncJobQueue *queue)
+/* Mark the regions the job sent lossy in the lossy map of the client,
+ * which vnc_refresh() reads and clears under the display lock.
+ */
+static void vnc_job_merge_lossy(VncJob *job, uint8_t *lossy)
+{
+    VncDisplay *vd = job->vs->vd;
+    int i, n = vd->guest.stat_cols * vd->guest.stat_rows;
+
+    for (i = 0; i < n && !lossy[i]; i++) {
+    }
+    if (i == n) {
+        return;
+    }
+    vnc_lock_display(vd);
+    for (; i < n; i++) {
+        if (lossy[i]) {
+            job->vs->lossy_rect[i] = 1;
+        }
+    }
+    vnc_unlock_display(vd);
+}
+
+static bool vnc_encoding_is_stateless(int encoding)
+{
+    return encoding == VNC_ENCODING_RAW || encoding == VNC_ENCODING_HEXTILE;
+}
+
+/* Return the next unclaimed band of a job being encoded in parallel */
+static VncRectEntry *vnc_queue_take_part(VncJobQueue *queue, VncJob **pjob)
 {
     VncJob *job;
-    VncRectEntry *entry, *tmp;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (job->next_part < job->nb_parts) {
+            *pjob = job;
+            return job->parts[job->next_part++];
+        }
+    }
+    return NULL;
+}
+
+/* Return the oldest idle job whose client has no older job in the queue */
+static VncJob *vnc_queue_take_job(VncJobQueue *queue)
+{
+    VncJob *job, *prev;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (job->busy) {
+            continue;
+        }
+        QTAILQ_FOREACH(prev, &queue->jobs, next) {
+            if (prev == job || prev->vs == job->vs) {
+                break;
+            }
+        }
+        if (prev == job) {
+            job->busy = true;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void vnc_job_encode_part(VncJobQueue *queue, VncJob *job,
+                                VncRectEntry *entry)
+{
     VncState vs;
-    int n_rectangles;
-    int saved_offset;
+
+    vnc_async_encoding_start(job->local, &vs, &entry->output);
+    vs.snapshot = job->local->snapshot;
+    entry->n = vnc_send_framebuffer_update(&vs, entry->rect.x, entry->rect.y,
+                                           entry->rect.w, entry->rect.h);
+    entry->output = vs.output;
+
+    vnc_lock_queue(queue);
+    job->parts_done++;
+    vnc_unlock_queue(queue);
+    qemu_cond_broadcast(&queue->cond);
+}
+
+/*
+ * Cut the rectangles of a stateless job into bands and publish them to the
+ * other workers.  Returns false if the job is better encoded serially.
+ */
+static bool vnc_job_split(VncJobQueue *queue, VncJob *job, VncState *local)
+{
+    VncRectEntry *entry, *band;
+    int i, n = 0;
+
+    if (queue->nb_threads < 2 ||
+        !vnc_encoding_is_stateless(local->vnc_encoding)) {
+        return false;
+    }
+
+    QLIST_FOREACH(entry, &job->rectangles, next) {
+        while (entry->rect.h > VNC_JOB_BAND_HEIGHT) {
+            band = g_malloc0(sizeof(VncRectEntry));
+            band->rect = entry->rect;
+            band->rect.y += VNC_JOB_BAND_HEIGHT;
+            band->rect.h -= VNC_JOB_BAND_HEIGHT;
+            entry->rect.h = VNC_JOB_BAND_HEIGHT;
+            QLIST_INSERT_AFTER(entry, band, next);
+            entry = band;
+            n++;
+        }
+        n++;
+    }
+    if (n < 2) {
+        return false;
+    }
+
+    job->parts = g_new(VncRectEntry *, n);
+    i = 0;
+    QLIST_FOREACH(entry, &job->rectangles, next) {
+        job->parts[i++] = entry;
+    }
 
     vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
+    job->local = local;
+    job->nb_parts = n;
+    vnc_unlock_queue(queue);
+    qemu_cond_broadcast(&queue->cond);
+    return true;
+}
+
+/* Encode the published bands together with the idle workers, then
+ * append them to the owner's output in their original order.
+ */
+static int vnc_job_encode_parts(VncJobQueue *queue, VncJob *job,
+                                VncState *local)
+{
+    VncRectEntry *entry;
+    int i, n_rectangles = 0;
+
+    for (;;) {
+        vnc_lock_queue(queue);
+        entry = NULL;
+        if (job->next_part < job->nb_parts) {
+            entry = job->parts[job->next_part++];
+        }
+        vnc_unlock_queue(queue);
+        if (!entry) {
+            break;
+        }
+        vnc_job_encode_part(queue, job, entry);
+    }
+
+    vnc_lock_queue(queue);
+    while (job->parts_done < job->nb_parts) {
         qemu_cond_wait(&queue->cond, &queue->mutex);
     }
-    /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
     vnc_unlock_queue(queue);
 
-    if (queue->exit) {
-        return -1;
+    for (i = 0; i < job->nb_parts; i++) {
+        entry = job->parts[i];
+        if (entry->n >= 0) {
+            n_rectangles += entry->n;
+        }
+        buffer_reserve(&local->output, entry->output.offset);
+        buffer_append(&local->output, entry->output.buffer,
+                      entry->output.offset);
     }
+    return n_rectangles;
+}
+
+static int vnc_worker_thread_loop(VncJobQueue *queue, Buffer *buffer)
+{
+    VncJob *job;
+    VncRectEntry *entry, *tmp;
+    VncState *vs;
+    int n_rectangles;
+    int saved_offset;
+    bool connected = true;
+    uint8_t compression, quality;
+    int64_t start;
+    int mode, pixels = 0;
+    uint8_t *lossy;
+
+    vnc_lock_queue(queue);
+    for (;;) {
+        if (queue->exit) {
+            vnc_unlock_queue(queue);
+            return -1;
+        }
+        /* Helping with a job already in progress comes first */
+        entry = vnc_queue_take_part(queue, &job);
+        if (entry) {
+            vnc_unlock_queue(queue);
+            vnc_job_encode_part(queue, job, entry);
+            return 0;
+        }
+        job = vnc_queue_take_job(queue);
+        if (job) {
+            break;
+        }
+        qemu_cond_wait(&queue->cond, &queue->mutex);
+    }
+    vnc_unlock_queue(queue);
 
     vnc_lock_output(job->vs);
     if (job->vs->csock == -1 || job->vs->abort == true) {
@@ -238,56 +484,89 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     vnc_unlock_output(job->vs);
 
     /* Make a local copy of vs and switch output buffers */
-    vnc_async_encoding_start(job->vs, &vs);
+    if (!job->vs->jobs_local) {
+        job->vs->jobs_local = g_malloc0(sizeof(VncState));
+    }
+    vs = job->vs->jobs_local;
+    vnc_async_encoding_start(job->vs, vs, buffer);
+    /* the display has not been resized since the job was queued, because
+     * vnc_dpy_resize() waits for the jobs */
+    lossy = g_malloc0(vs->vd->guest.stat_cols * vs->vd->guest.stat_rows);
+    vs->lossy_rect = lossy;
+
+    /* The adaptive controller may override the client's compression and
+     * quality levels for this update only */
+    compression = vs->tight.compression;
+    quality = vs->tight.quality;
+    QLIST_FOREACH(entry, &job->rectangles, next) {
+        pixels += entry->rect.w * entry->rect.h;
+    }
+    mode = vnc_adaptive_select(job->vs, vs, pixels);
+    start = get_clock();
 
     /* Start sending rectangles */
     n_rectangles = 0;
-    vnc_write_u8(&vs, VNC_MSG_SERVER_FRAMEBUFFER_UPDATE);
-    vnc_write_u8(&vs, 0);
-    saved_offset = vs.output.offset;
-    vnc_write_u16(&vs, 0);
+    vnc_write_u8(vs, VNC_MSG_SERVER_FRAMEBUFFER_UPDATE);
+    vnc_write_u8(vs, 0);
+    saved_offset = vs->output.offset;
+    vnc_write_u16(vs, 0);
 
     vnc_lock_display(job->vs->vd);
-    QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
-        int n;
-
-        if (job->vs->csock == -1) {
-            vnc_unlock_display(job->vs->vd);
-            goto disconnected;
-        }
-
-        n = vnc_send_framebuffer_update(&vs, entry->rect.x, entry->rect.y,
-                                        entry->rect.w, entry->rect.h);
+    vnc_job_snapshot(job, vs);
+    vnc_unlock_display(job->vs->vd);
 
-        if (n >= 0) {
-            n_rectangles += n;
+    if (vnc_job_split(queue, job, vs)) {
+        n_rectangles = vnc_job_encode_parts(queue, job, vs);
+    } else {
+        QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
+            int n;
+
+            if (job->vs->csock == -1) {
+                connected = false;
+                break;
+            }
+
+            n = vnc_send_framebuffer_update(vs, entry->rect.x, entry->rect.y,
+                                            entry->rect.w, entry->rect.h);
+
+            if (n >= 0) {
+                n_rectangles += n;
+            }
+            QLIST_REMOVE(entry, next);
+            g_free(entry);
         }
-        g_free(entry);
     }
-    vnc_unlock_display(job->vs->vd);
+    vnc_job_merge_lossy(job, lossy);
+    g_free(lossy);
+
+    vnc_adaptive_update(job->vs, mode, pixels, get_clock() - start,
+                        vs->output.offset - saved_offset - 2);
+    vs->tight.compression = compression;
+    vs->tight.quality = quality;
 
     /* Put n_rectangles at the beginning of the message */
-    vs.output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
-    vs.output.buffer[saved_offset + 1] = n_rectangles & 0xFF;
+    vs->output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
+    vs->output.buffer[saved_offset + 1] = n_rectangles & 0xFF;
 
     vnc_lock_output(job->vs);
-    if (job->vs->csock != -1) {
-        buffer_reserve(&job->vs->jobs_buffer, vs.output.offset);
-        buffer_append(&job->vs->jobs_buffer, vs.output.buffer,
-                      vs.output.offset);
+    if (connected && job->vs->csock != -1) {
+        buffer_reserve(&job->vs->jobs_buffer, vs->output.offset);
+        buffer_append(&job->vs->jobs_buffer, vs->output.buffer,
+                      vs->output.offset);
         /* Copy persistent encoding data */
-        vnc_async_encoding_end(job->vs, &vs);
+        vnc_async_encoding_end(job->vs, vs);
 
 	qemu_bh_schedule(job->vs->bh);
     }
     vnc_unlock_output(job->vs);
+    *buffer = vs->output;
 
 disconnected:
     vnc_lock_queue(queue);
     QTAILQ_REMOVE(&queue->jobs, job, next);
     vnc_unlock_queue(queue);
     qemu_cond_broadcast(&queue->cond);
-    g_free(job);
+    vnc_job_free(job);
     return 0;
 }
 
@@ -305,7 +584,6 @@ static void vnc_queue_clear(VncJobQueue *q)
 {
     qemu_cond_destroy(&queue->cond);
     qemu_mutex_destroy(&queue->mutex);
-    buffer_free(&queue->buffer);
     g_free(q);
     queue = NULL; /* Unset global queue */
 }
@@ -313,11 +591,19 @@ static void vnc_queue_clear(VncJobQueue *q)
 static void *vnc_worker_thread(void *arg)
 {
     VncJobQueue *queue = arg;
+    Buffer buffer = { 0 };
+    bool last;
 
-    qemu_thread_get_self(&queue->thread);
+    while (!vnc_worker_thread_loop(queue, &buffer)) ;
+    buffer_free(&buffer);
 
-    while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
+    /* The last thread out frees the queue */
+    vnc_lock_queue(queue);
+    last = --queue->running == 0;
+    vnc_unlock_queue(queue);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
     return NULL;
 }
 
@@ -326,16 +612,33 @@ static bool vnc_worker_thread_running(void)
     return queue; /* Check global queue */
 }
 
+static int vnc_worker_thread_count(void)
+{
+    long n = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return MAX(1, MIN(n, VNC_MAX_WORKERS));
+}
+
 void vnc_start_worker_thread(void)
 {
     VncJobQueue *q;
+    QemuThread thread;
+    int i;
 
     if (vnc_worker_thread_running())
         return ;
 
     q = vnc_queue_init();
-    qemu_thread_create(&q->thread, vnc_worker_thread, q, QEMU_THREAD_DETACHED);
+    q->nb_threads = vnc_worker_thread_count();
+    q->running = q->nb_threads;
     queue = q; /* Set global queue */
+    for (i = 0; i < q->nb_threads; i++) {
+        qemu_thread_create(&thread, vnc_worker_thread, q,
+                           QEMU_THREAD_DETACHED);
+    }
 }
 
 void vnc_stop_worker_thread(void)
@@ -343,7 +646,7 @@ void vnc_stop_worker_thread(void)
     if (!vnc_worker_thread_running())
         return ;
 
-    /* Remove all jobs and wake up the thread */
+    /* Remove all jobs and wake up the threads */
     vnc_lock_queue(queue);
     queue->exit = true;
     vnc_unlock_queue(queue);
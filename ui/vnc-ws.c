@@ -50,8 +50,7 @@ void vncws_handshake_read(void *opaque)
 long vnc_client_read_ws(VncState *vs)
 {
     int ret, err;
-    uint8_t *payload;
-    size_t payload_size, frame_size;
+    size_t frame_size, consumed = 0;
     VNC_DEBUG("Read websocket %p size %zd offset %zd\n", vs->ws_input.buffer,
             vs->ws_input.capacity, vs->ws_input.offset);
     buffer_reserve(&vs->ws_input, 4096);
@@ -61,38 +60,64 @@ long vnc_client_read_ws(VncState *vs)
     }
     vs->ws_input.offset += ret;
 
-    /* make sure that nothing is left in the ws_input buffer */
+    /* unmask all complete frames straight into the input buffer */
     do {
-        err = vncws_decode_frame(&vs->ws_input, &payload,
-                              &payload_size, &frame_size);
-        if (err <= 0) {
-            return err;
+        err = vncws_decode_frame(vs->ws_input.buffer + consumed,
+                                 vs->ws_input.offset - consumed,
+                                 &vs->input, &frame_size);
+        if (err > 0) {
+            consumed += frame_size;
         }
+    } while (err > 0 && consumed < vs->ws_input.offset);
+    buffer_advance(&vs->ws_input, consumed);
 
-        buffer_reserve(&vs->input, payload_size);
-        buffer_append(&vs->input, payload, payload_size);
-
-        buffer_advance(&vs->ws_input, frame_size);
-    } while (vs->ws_input.offset > 0);
-
-    return ret;
+    if (err < 0) {
+        return err;
+    }
+    return consumed ? ret : 0;
 }
 
+/*
+ * The frame header is sent from vs->ws_header and the payload straight
+ * from vs->output, so the data is never copied.  A frame covers whatever
+ * was queued when it was started; everything queued while it is being
+ * sent goes out as a single frame after it.
+ */
 long vnc_client_write_ws(VncState *vs)
 {
+    struct iovec iov[2];
+    size_t header_left;
     long ret;
     VNC_DEBUG("Write WS: Pending output %p size %zd offset %zd\n",
               vs->output.buffer, vs->output.capacity, vs->output.offset);
-    vncws_encode_frame(&vs->ws_output, vs->output.buffer, vs->output.offset);
-    buffer_reset(&vs->output);
-    ret = vnc_client_write_buf(vs, vs->ws_output.buffer, vs->ws_output.offset);
+
+    if (!vs->ws_payload) {
+        vs->ws_header_len = vncws_encode_header(vs->ws_header,
+                                                vs->output.offset);
+        vs->ws_header_offset = 0;
+        vs->ws_payload = vs->output.offset;
+    }
+
+    header_left = vs->ws_header_len - vs->ws_header_offset;
+    iov[0].iov_base = vs->ws_header + vs->ws_header_offset;
+    iov[0].iov_len = header_left;
+    iov[1].iov_base = vs->output.buffer;
+    iov[1].iov_len = vs->ws_payload;
+    ret = vnc_client_writev_buf(vs, header_left ? iov : iov + 1,
+                                header_left ? 2 : 1);
     if (!ret) {
         return 0;
     }
 
-    buffer_advance(&vs->ws_output, ret);
+    if (ret <= header_left) {
+        vs->ws_header_offset += ret;
+    } else {
+        vs->ws_header_offset = vs->ws_header_len;
+        buffer_advance(&vs->output, ret - header_left);
+        vs->ws_payload -= ret - header_left;
+    }
 
-    if (vs->ws_output.offset == 0) {
+    if (vs->output.offset == 0) {
         qemu_set_fd_handler2(vs->csock, NULL, vnc_client_read, NULL, vs);
     }
 
@@ -177,50 +202,39 @@ void vncws_process_handshake(VncState *vs, uint8_t *line, size_t size)
     g_free(key);
 }
 
-void vncws_encode_frame(Buffer *output, const void *payload,
-        const size_t payload_size)
+size_t vncws_encode_header(uint8_t *buf, size_t payload_size)
 {
-    size_t header_size = 0;
     unsigned char opcode = WS_OPCODE_BINARY_FRAME;
-    union {
-        char buf[WS_HEAD_MAX_LEN];
-        WsHeader ws;
-    } header;
-
-    if (!payload_size) {
-        return;
-    }
+    WsHeader *header = (WsHeader *)buf;
 
-    header.ws.b0 = 0x80 | (opcode & 0x0f);
+    header->b0 = 0x80 | (opcode & 0x0f);
     if (payload_size <= 125) {
-        header.ws.b1 = (uint8_t)payload_size;
-        header_size = 2;
+        header->b1 = (uint8_t)payload_size;
+        return 2;
     } else if (payload_size < 65536) {
-        header.ws.b1 = 0x7e;
-        header.ws.u.s16.l16 = cpu_to_be16((uint16_t)payload_size);
-        header_size = 4;
+        header->b1 = 0x7e;
+        header->u.s16.l16 = cpu_to_be16((uint16_t)payload_size);
+        return 4;
     } else {
-        header.ws.b1 = 0x7f;
-        header.ws.u.s64.l64 = cpu_to_be64(payload_size);
-        header_size = 10;
+        header->b1 = 0x7f;
+        header->u.s64.l64 = cpu_to_be64(payload_size);
+        return 10;
     }
-
-    buffer_reserve(output, header_size + payload_size);
-    buffer_append(output, header.buf, header_size);
-    buffer_append(output, payload, payload_size);
 }
 
-int vncws_decode_frame(Buffer *input, uint8_t **payload,
-                           size_t *payload_size, size_t *frame_size)
+int vncws_decode_frame(const uint8_t *data, size_t size, Buffer *output,
+                       size_t *frame_size)
 {
     unsigned char opcode = 0, fin = 0, has_mask = 0;
-    size_t header_size = 0;
-    uint32_t *payload32;
-    WsHeader *header = (WsHeader *)input->buffer;
+    size_t header_size = 0, payload_size;
+    const uint8_t *payload;
+    const WsHeader *header = (const WsHeader *)data;
+    uint8_t *out;
     WsMask mask;
-    int i;
+    uint32_t word;
+    size_t i;
 
-    if (input->offset < WS_HEAD_MIN_LEN + 4) {
+    if (size < WS_HEAD_MIN_LEN + 4) {
         /* header not complete */
         return 0;
     }
@@ -228,7 +242,7 @@ int vncws_decode_frame(Buffer *input, uint8_t **payload,
     fin = (header->b0 & 0x80) >> 7;
     opcode = header->b0 & 0x0f;
     has_mask = (header->b1 & 0x80) >> 7;
-    *payload_size = header->b1 & 0x7f;
+    payload_size = header->b1 & 0x7f;
 
     if (opcode == WS_OPCODE_CLOSE) {
         /* disconnect */
@@ -245,15 +259,15 @@ int vncws_decode_frame(Buffer *input, uint8_t **payload,
         return -2;
     }
 
-    if (*payload_size < 126) {
+    if (payload_size < 126) {
         header_size = 6;
         mask = header->u.m;
-    } else if (*payload_size == 126 && input->offset >= 8) {
-        *payload_size = be16_to_cpu(header->u.s16.l16);
+    } else if (payload_size == 126 && size >= 8) {
+        payload_size = be16_to_cpu(header->u.s16.l16);
         header_size = 8;
         mask = header->u.s16.m16;
-    } else if (*payload_size == 127 && input->offset >= 14) {
-        *payload_size = be64_to_cpu(header->u.s64.l64);
+    } else if (payload_size == 127 && size >= 14) {
+        payload_size = be64_to_cpu(header->u.s64.l64);
         header_size = 14;
         mask = header->u.s64.m64;
     } else {
@@ -261,25 +275,26 @@ int vncws_decode_frame(Buffer *input, uint8_t **payload,
         return 0;
     }
 
-    *frame_size = header_size + *payload_size;
+    *frame_size = header_size + payload_size;
 
-    if (input->offset < *frame_size) {
+    if (size < *frame_size) {
         /* frame not complete */
         return 0;
     }
 
-    *payload = input->buffer + header_size;
-
-    /* unmask frame */
-    /* process 1 frame (32 bit op) */
-    payload32 = (uint32_t *)(*payload);
-    for (i = 0; i < *payload_size / 4; i++) {
-        payload32[i] ^= mask.u;
+    /* unmask the payload while copying it out, 32 bits at a time */
+    payload = data + header_size;
+    buffer_reserve(output, payload_size);
+    out = buffer_end(output);
+    for (i = 0; i + 4 <= payload_size; i += 4) {
+        memcpy(&word, payload + i, 4);
+        word ^= mask.u;
+        memcpy(out + i, &word, 4);
     }
-    /* process the remaining bytes (if any) */
-    for (i *= 4; i < *payload_size; i++) {
-        (*payload)[i] ^= mask.c[i % 4];
+    for (; i < payload_size; i++) {
+        out[i] = payload[i] ^ mask.c[i % 4];
     }
+    output->offset += payload_size;
 
     return 1;
 }
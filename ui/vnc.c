@@ -26,10 +26,12 @@
 
 #include "vnc.h"
 #include "vnc-jobs.h"
+#include "vnc-diff.h"
 #include "sysemu/sysemu.h"
 #include "qemu/sockets.h"
 #include "qemu/timer.h"
 #include "qemu/acl.h"
+#include "qemu/iov.h"
 #include "qapi/qmp/types.h"
 #include "qmp-commands.h"
 #include "qemu/osdep.h"
@@ -336,6 +338,14 @@ static VncClientInfo *qmp_query_vnc_client(const VncState *client)
         info->sasl_username = g_strdup(client->sasl.username);
     }
 #endif
+    if (vnc_adaptive_mode_name(client)) {
+        info->has_encoding = true;
+        info->encoding = g_strdup(vnc_adaptive_mode_name(client));
+    }
+    if (client->adaptive.throughput) {
+        info->has_throughput = true;
+        info->throughput = client->adaptive.throughput;
+    }
 
     return info;
 }
@@ -430,31 +440,77 @@ static void framebuffer_update_request(VncState *vs, int incremental,
 static void vnc_refresh(void *opaque);
 static int vnc_refresh_server_surface(VncDisplay *vd);
 
+void vnc_dirty_map_resize(VncDirtyMap *map, int tile, int width, int height)
+{
+    g_free(map->bits);
+    g_free(map->blocks);
+
+    map->tile = tile;
+    map->cols = DIV_ROUND_UP(width, tile);
+    map->rows = height;
+    map->stride = BITS_TO_LONGS(map->cols);
+    map->bits = g_new0(unsigned long, map->stride * height);
+    map->blocks = g_new0(unsigned long,
+                         BITS_TO_LONGS(DIV_ROUND_UP(height,
+                                                    VNC_DIRTY_BLOCK_ROWS)));
+}
+
+void vnc_dirty_map_free(VncDirtyMap *map)
+{
+    g_free(map->bits);
+    g_free(map->blocks);
+    memset(map, 0, sizeof(*map));
+}
+
+void vnc_dirty_map_set_all(VncDirtyMap *map)
+{
+    int y;
+
+    for (y = 0; y < map->rows; y++) {
+        bitmap_set(vnc_dirty_row(map, y), 0, map->cols);
+    }
+    bitmap_set(map->blocks, 0, DIV_ROUND_UP(map->rows, VNC_DIRTY_BLOCK_ROWS));
+}
+
+/*
+ * Clear the summary bit of the block holding row y if none of its rows
+ * has a dirty tile left.
+ */
+void vnc_dirty_block_update(VncDirtyMap *map, int y)
+{
+    int start = y - y % VNC_DIRTY_BLOCK_ROWS;
+    int end = MIN(start + VNC_DIRTY_BLOCK_ROWS, map->rows);
+
+    for (y = start; y < end; y++) {
+        if (!bitmap_empty(vnc_dirty_row(map, y), map->cols)) {
+            return;
+        }
+    }
+    clear_bit(start / VNC_DIRTY_BLOCK_ROWS, map->blocks);
+}
+
 static void vnc_dpy_update(DisplayState *ds, int x, int y, int w, int h)
 {
-    int i;
     VncDisplay *vd = ds->opaque;
-    struct VncSurface *s = &vd->guest;
-    int width = ds_get_width(ds);
-    int height = ds_get_height(ds);
+    VncDirtyMap *map = &vd->guest.dirty;
+    int width = MIN(ds_get_width(ds), map->cols * map->tile);
+    int height = MIN(ds_get_height(ds), map->rows);
+    int first, last;
 
     h += y;
 
-    /* round x down to ensure the loop only spans one 16-pixel block per,
-       iteration.  otherwise, if (x % 16) != 0, the last iteration may span
-       two 16-pixel blocks but we only mark the first as dirty
-    */
-    w += (x % 16);
-    x -= (x % 16);
-
-    x = MIN(x, width);
+    /* the first and last tiles may be only partially covered */
+    first = MIN(x, width) / map->tile;
+    last = DIV_ROUND_UP(MIN(x + w, width), map->tile);
     y = MIN(y, height);
-    w = MIN(x + w, width) - x;
     h = MIN(h, height);
 
-    for (; y < h; y++)
-        for (i = 0; i < w; i += 16)
-            set_bit((x + i) / 16, s->dirty[y]);
+    if (first >= last) {
+        return;
+    }
+    for (; y < h; y++) {
+        vnc_dirty_set(map, y, first, last - first);
+    }
 }
 
 void vnc_framebuffer_update(VncState *vs, int x, int y, int w, int h,
@@ -573,6 +629,32 @@ void *vnc_server_fb_ptr(VncDisplay *vd, int x, int y)
     return ptr;
 }
 
+int vnc_snapshot_stride(VncState *vs)
+{
+    return pixman_image_get_stride(vs->snapshot);
+}
+
+void *vnc_snapshot_ptr(VncState *vs, int x, int y)
+{
+    uint8_t *ptr;
+
+    ptr  = (uint8_t *)pixman_image_get_data(vs->snapshot);
+    ptr += y * vnc_snapshot_stride(vs);
+    ptr += x * VNC_SERVER_FB_BYTES;
+    return ptr;
+}
+
+/* Size the client's dirty map and lossy rect map to the current surface. */
+static void vnc_client_dirty_resize(VncState *vs)
+{
+    VncDisplay *vd = vs->vd;
+
+    vnc_dirty_map_resize(&vs->dirty, vd->dirty_tile,
+                         ds_get_width(vd->ds), ds_get_height(vd->ds));
+    g_free(vs->lossy_rect);
+    vs->lossy_rect = g_malloc0(vd->guest.stat_cols * vd->guest.stat_rows);
+}
+
 static void vnc_dpy_resize(DisplayState *ds)
 {
     VncDisplay *vd = ds->opaque;
@@ -595,7 +677,17 @@ static void vnc_dpy_resize(DisplayState *ds)
     qemu_pixman_image_unref(vd->guest.fb);
     vd->guest.fb = pixman_image_ref(ds->surface->image);
     vd->guest.format = ds->surface->format;
-    memset(vd->guest.dirty, 0xFF, sizeof(vd->guest.dirty));
+    vnc_dirty_map_resize(&vd->guest.dirty, vd->dirty_tile,
+                         ds_get_width(ds), ds_get_height(ds));
+    vnc_dirty_map_set_all(&vd->guest.dirty);
+    vnc_dirty_map_resize(&vd->server_dirty, vd->dirty_tile,
+                         ds_get_width(ds), ds_get_height(ds));
+
+    g_free(vd->guest.stats);
+    vd->guest.stat_cols = ds_get_width(ds) / VNC_STAT_RECT + 1;
+    vd->guest.stat_rows = ds_get_height(ds) / VNC_STAT_RECT + 1;
+    vd->guest.stats = g_new0(VncRectStat,
+                             vd->guest.stat_cols * vd->guest.stat_rows);
 
     QTAILQ_FOREACH(vs, &vd->clients, next) {
         vnc_colordepth(vs);
@@ -603,7 +695,8 @@ static void vnc_dpy_resize(DisplayState *ds)
         if (vs->vd->cursor) {
             vnc_cursor_define(vs);
         }
-        memset(vs->dirty, 0xFF, sizeof(vs->dirty));
+        vnc_client_dirty_resize(vs);
+        vnc_dirty_map_set_all(&vs->dirty);
     }
 }
 
@@ -679,12 +772,11 @@ int vnc_raw_send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
 {
     int i;
     uint8_t *row;
-    VncDisplay *vd = vs->vd;
 
-    row = vnc_server_fb_ptr(vd, x, y);
+    row = vnc_snapshot_ptr(vs, x, y);
     for (i = 0; i < h; i++) {
         vs->write_pixels(vs, row, w * VNC_SERVER_FB_BYTES);
-        row += vnc_server_fb_stride(vd);
+        row += vnc_snapshot_stride(vs);
     }
     return 1;
 }
@@ -743,6 +835,7 @@ static void vnc_dpy_copy(DisplayState *ds, int src_x, int src_y, int dst_x, int
     uint8_t *dst_row;
     int i, x, y, pitch, inc, w_lim, s;
     int cmp_bytes;
+    int tile = vd->dirty_tile;
 
     vnc_refresh_server_surface(vd);
     QTAILQ_FOREACH_SAFE(vs, &vd->clients, next, vn) {
@@ -767,11 +860,11 @@ static void vnc_dpy_copy(DisplayState *ds, int src_x, int src_y, int dst_x, int
         y = dst_y + h - 1;
         inc = -1;
     }
-    w_lim = w - (16 - (dst_x % 16));
+    w_lim = w - (tile - (dst_x % tile));
     if (w_lim < 0)
         w_lim = w;
     else
-        w_lim = w - (w_lim % 16);
+        w_lim = w - (w_lim % tile);
     for (i = 0; i < h; i++) {
         for (x = 0; x <= w_lim;
                 x += s, src_row += cmp_bytes, dst_row += cmp_bytes) {
@@ -779,10 +872,10 @@ static void vnc_dpy_copy(DisplayState *ds, int src_x, int src_y, int dst_x, int
                 if ((s = w - w_lim) == 0)
                     break;
             } else if (!x) {
-                s = (16 - (dst_x % 16));
+                s = (tile - (dst_x % tile));
                 s = MIN(s, w_lim);
             } else {
-                s = 16;
+                s = tile;
             }
             cmp_bytes = s * VNC_SERVER_FB_BYTES;
             if (memcmp(src_row, dst_row, cmp_bytes) == 0)
@@ -790,7 +883,7 @@ static void vnc_dpy_copy(DisplayState *ds, int src_x, int src_y, int dst_x, int
             memmove(dst_row, src_row, cmp_bytes);
             QTAILQ_FOREACH(vs, &vd->clients, next) {
                 if (!vnc_has_feature(vs, VNC_FEATURE_COPYRECT)) {
-                    set_bit(((x + dst_x) / 16), vs->dirty[y]);
+                    vnc_dirty_set(&vs->dirty, y, (x + dst_x) / tile, 1);
                 }
             }
         }
@@ -857,13 +950,16 @@ static int find_and_clear_dirty_height(struct VncState *vs,
     int h;
 
     for (h = 1; h < (height - y); h++) {
-        int tmp_x;
-        if (!test_bit(last_x, vs->dirty[y + h])) {
+        unsigned long *row;
+
+        if (vnc_dirty_block_clean(&vs->dirty, y + h)) {
             break;
         }
-        for (tmp_x = last_x; tmp_x < x; tmp_x++) {
-            clear_bit(tmp_x, vs->dirty[y + h]);
+        row = vnc_dirty_row(&vs->dirty, y + h);
+        if (!test_bit(last_x, row)) {
+            break;
         }
+        bitmap_clear(row, last_x, x - last_x);
     }
 
     return h;
@@ -880,9 +976,10 @@ static int vnc_update_client(VncState *vs, int has_dirty)
 {
     if (vs->need_update && vs->csock != -1) {
         VncDisplay *vd = vs->vd;
+        VncDirtyMap *map = &vs->dirty;
         VncJob *job;
         int y;
-        int width, height;
+        int width, height, cols;
         int n = 0;
 
 
@@ -903,30 +1000,33 @@ static int vnc_update_client(VncState *vs, int has_dirty)
 
         width = MIN(pixman_image_get_width(vd->server), vs->client_width);
         height = MIN(pixman_image_get_height(vd->server), vs->client_height);
+        height = MIN(height, map->rows);
+        cols = MIN(DIV_ROUND_UP(width, map->tile), map->cols);
 
         for (y = 0; y < height; y++) {
-            int x;
-            int last_x = -1;
-            for (x = 0; x < width / 16; x++) {
-                if (test_and_clear_bit(x, vs->dirty[y])) {
-                    if (last_x == -1) {
-                        last_x = x;
-                    }
-                } else {
-                    if (last_x != -1) {
-                        int h = find_and_clear_dirty_height(vs, y, last_x, x,
-                                                            height);
+            unsigned long *row;
+            int x, last_x;
 
-                        n += vnc_job_add_rect(job, last_x * 16, y,
-                                              (x - last_x) * 16, h);
-                    }
-                    last_x = -1;
-                }
+            if (vnc_dirty_block_clean(map, y)) {
+                /* skip to the first row of the next block */
+                y |= VNC_DIRTY_BLOCK_ROWS - 1;
+                continue;
             }
-            if (last_x != -1) {
-                int h = find_and_clear_dirty_height(vs, y, last_x, x, height);
-                n += vnc_job_add_rect(job, last_x * 16, y,
-                                      (x - last_x) * 16, h);
+            row = vnc_dirty_row(map, y);
+            for (last_x = find_next_bit(row, cols, 0); last_x < cols;
+                 last_x = find_next_bit(row, cols, x)) {
+                int h;
+
+                x = find_next_zero_bit(row, cols, last_x);
+                bitmap_clear(row, last_x, x - last_x);
+                h = find_and_clear_dirty_height(vs, y, last_x, x, height);
+                n += vnc_job_add_rect(job, last_x * map->tile, y,
+                                      MIN(x * map->tile, width) -
+                                      last_x * map->tile, h);
+            }
+            if (y % VNC_DIRTY_BLOCK_ROWS == VNC_DIRTY_BLOCK_ROWS - 1 ||
+                y == height - 1) {
+                vnc_dirty_block_update(map, y);
             }
         }
 
@@ -1024,8 +1124,6 @@ static void vnc_disconnect_start(VncState *vs)
 
 void vnc_disconnect_finish(VncState *vs)
 {
-    int i;
-
     vnc_jobs_join(vs); /* Wait encoding jobs */
 
     vnc_lock_output(vs);
@@ -1035,7 +1133,6 @@ void vnc_disconnect_finish(VncState *vs)
     buffer_free(&vs->output);
 #ifdef CONFIG_VNC_WS
     buffer_free(&vs->ws_input);
-    buffer_free(&vs->ws_output);
 #endif /* CONFIG_VNC_WS */
 
     qobject_decref(vs->info);
@@ -1072,10 +1169,12 @@ void vnc_disconnect_finish(VncState *vs)
         qemu_bh_delete(vs->bh);
     }
     buffer_free(&vs->jobs_buffer);
-
-    for (i = 0; i < VNC_STAT_ROWS; ++i) {
-        g_free(vs->lossy_rect[i]);
+    if (vs->jobs_local) {
+        qemu_pixman_image_unref(vs->jobs_local->snapshot);
+        g_free(vs->jobs_local);
     }
+
+    vnc_dirty_map_free(&vs->dirty);
     g_free(vs->lossy_rect);
     g_free(vs);
 }
@@ -1145,10 +1244,31 @@ long vnc_client_write_buf(VncState *vs, const uint8_t *data, size_t datalen)
 #endif /* CONFIG_VNC_TLS */
         ret = send(vs->csock, (const void *)data, datalen, 0);
     VNC_DEBUG("Wrote wire %p %zd -> %ld\n", data, datalen, ret);
-    return vnc_client_io_error(vs, ret, socket_error());
+    ret = vnc_client_io_error(vs, ret, socket_error());
+    vnc_adaptive_sent(vs, ret);
+    return ret;
 }
 
 
+/*
+ * Like vnc_client_write_buf, but gathers the data from IOVCNT buffers
+ * in a single system call.  With TLS only the first buffer is written.
+ */
+long vnc_client_writev_buf(VncState *vs, struct iovec *iov, int iovcnt)
+{
+    long ret;
+#ifdef CONFIG_VNC_TLS
+    if (vs->tls.session) {
+        return vnc_client_write_buf(vs, iov[0].iov_base, iov[0].iov_len);
+    }
+#endif /* CONFIG_VNC_TLS */
+    ret = iov_send(vs->csock, iov, iovcnt, 0, iov_size(iov, iovcnt));
+    VNC_DEBUG("Wrote wire %d buffers -> %ld\n", iovcnt, ret);
+    ret = vnc_client_io_error(vs, ret, socket_error());
+    vnc_adaptive_sent(vs, ret);
+    return ret;
+}
+
 /*
  * Called to write buffered data to the client socket, when not
  * using any SASL SSF encryption layers. Will write as much data
@@ -1223,11 +1343,7 @@ void vnc_client_write(void *opaque)
     VncState *vs = opaque;
 
     vnc_lock_output(vs);
-    if (vs->output.offset
-#ifdef CONFIG_VNC_WS
-            || vs->ws_output.offset
-#endif
-            ) {
+    if (vs->output.offset) {
         vnc_client_write_locked(opaque);
     } else if (vs->csock != -1) {
         qemu_set_fd_handler2(vs->csock, NULL, vnc_client_read, NULL, vs);
@@ -1406,11 +1522,7 @@ void vnc_write_u8(VncState *vs, uint8_t value)
 void vnc_flush(VncState *vs)
 {
     vnc_lock_output(vs);
-    if (vs->csock != -1 && (vs->output.offset
-#ifdef CONFIG_VNC_WS
-                || vs->ws_output.offset
-#endif
-                )) {
+    if (vs->csock != -1 && vs->output.offset) {
         vnc_client_write_locked(vs);
     }
     vnc_unlock_output(vs);
@@ -1771,20 +1883,21 @@ static void framebuffer_update_request(VncState *vs, int incremental,
                                        int w, int h)
 {
     int i;
-    const size_t width = ds_get_width(vs->ds) / 16;
 
     if (y_position > ds_get_height(vs->ds))
         y_position = ds_get_height(vs->ds);
     if (y_position + h >= ds_get_height(vs->ds))
         h = ds_get_height(vs->ds) - y_position;
 
+    vnc_lock_output(vs);
+    vnc_adaptive_request(vs);
+    vnc_unlock_output(vs);
+
     vs->need_update = 1;
     if (!incremental) {
         vs->force_update = 1;
         for (i = 0; i < h; i++) {
-            bitmap_set(vs->dirty[y_position + i], 0, width);
-            bitmap_clear(vs->dirty[y_position + i], width,
-                         VNC_DIRTY_BITS - width);
+            vnc_dirty_set(&vs->dirty, y_position + i, 0, vs->dirty.cols);
         }
     }
 }
@@ -2429,11 +2542,12 @@ static VncRectStat *vnc_stat_rect(VncDisplay *vd, int x, int y)
 {
     struct VncSurface *vs = &vd->guest;
 
-    return &vs->stats[y / VNC_STAT_RECT][x / VNC_STAT_RECT];
+    return &vs->stats[(y / VNC_STAT_RECT) * vs->stat_cols + x / VNC_STAT_RECT];
 }
 
 void vnc_sent_lossy_rect(VncState *vs, int x, int y, int w, int h)
 {
+    int cols = vs->vd->guest.stat_cols;
     int i, j;
 
     w = (x + w) / VNC_STAT_RECT;
@@ -2443,7 +2557,7 @@ void vnc_sent_lossy_rect(VncState *vs, int x, int y, int w, int h)
 
     for (j = y; j <= h; j++) {
         for (i = x; i <= w; i++) {
-            vs->lossy_rect[j][i] = 1;
+            vs->lossy_rect[j * cols + i] = 1;
         }
     }
 }
@@ -2459,6 +2573,9 @@ static int vnc_refresh_lossy_rect(VncDisplay *vd, int x, int y)
     x = x / VNC_STAT_RECT * VNC_STAT_RECT;
 
     QTAILQ_FOREACH(vs, &vd->clients, next) {
+        VncDirtyMap *map = &vs->dirty;
+        int col = x / map->tile;
+        int n = MIN(DIV_ROUND_UP(VNC_STAT_RECT, map->tile), map->cols - col);
         int j;
 
         /* kernel send buffers are full -> refresh later */
@@ -2466,13 +2583,13 @@ static int vnc_refresh_lossy_rect(VncDisplay *vd, int x, int y)
             continue;
         }
 
-        if (!vs->lossy_rect[sty][stx]) {
+        if (!vs->lossy_rect[sty * vd->guest.stat_cols + stx]) {
             continue;
         }
 
-        vs->lossy_rect[sty][stx] = 0;
-        for (j = 0; j < VNC_STAT_RECT; ++j) {
-            bitmap_set(vs->dirty[y + j], x / 16, VNC_STAT_RECT / 16);
+        vs->lossy_rect[sty * vd->guest.stat_cols + stx] = 0;
+        for (j = y; j < MIN(y + VNC_STAT_RECT, map->rows); ++j) {
+            vnc_dirty_set(map, j, col, n);
         }
         has_dirty++;
     }
@@ -2571,15 +2688,39 @@ static void vnc_rect_updated(VncDisplay *vd, int x, int y, struct timeval * tv)
     rect->updated = true;
 }
 
+/*
+ * Merge the chunks changed by the last refresh into the dirty map of each
+ * client, a row at a time, and reset the shared map.
+ */
+static void vnc_merge_server_dirty(VncDisplay *vd, int y, int end)
+{
+    VncDirtyMap *map = &vd->server_dirty;
+    VncState *vs;
+
+    for (; y < end; y++) {
+        unsigned long *row = vnc_dirty_row(map, y);
+
+        if (bitmap_empty(row, map->cols)) {
+            continue;
+        }
+        QTAILQ_FOREACH(vs, &vd->clients, next) {
+            unsigned long *dst = vnc_dirty_row(&vs->dirty, y);
+
+            bitmap_or(dst, dst, row, map->cols);
+            vnc_dirty_mark_row(&vs->dirty, y);
+        }
+        bitmap_zero(row, map->cols);
+    }
+}
+
 static int vnc_refresh_server_surface(VncDisplay *vd)
 {
+    VncDirtyMap *guest = &vd->guest.dirty;
     int width = pixman_image_get_width(vd->guest.fb);
     int height = pixman_image_get_height(vd->guest.fb);
-    int y;
+    int y, y_first = -1, y_last = -1;
     uint8_t *guest_row;
     uint8_t *server_row;
-    int cmp_bytes;
-    VncState *vs;
     int has_dirty = 0;
     pixman_image_t *tmpbuf = NULL;
 
@@ -2595,21 +2736,27 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
      * Check and copy modified bits from guest to server surface.
      * Update server dirty map.
      */
-    cmp_bytes = 64;
-    if (cmp_bytes > vnc_server_fb_stride(vd)) {
-        cmp_bytes = vnc_server_fb_stride(vd);
-    }
     if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
         int width = pixman_image_get_width(vd->server);
         tmpbuf = qemu_pixman_linebuf_create(VNC_SERVER_FB_FORMAT, width);
     }
-    guest_row = (uint8_t *)pixman_image_get_data(vd->guest.fb);
-    server_row = (uint8_t *)pixman_image_get_data(vd->server);
+    height = MIN(height, guest->rows);
     for (y = 0; y < height; y++) {
-        if (!bitmap_empty(vd->guest.dirty[y], VNC_DIRTY_BITS)) {
-            int x;
+        unsigned long *row;
+
+        if (vnc_dirty_block_clean(guest, y)) {
+            y |= VNC_DIRTY_BLOCK_ROWS - 1;
+            continue;
+        }
+        guest_row = (uint8_t *)pixman_image_get_data(vd->guest.fb) +
+            y * pixman_image_get_stride(vd->guest.fb);
+        server_row = (uint8_t *)pixman_image_get_data(vd->server) +
+            y * pixman_image_get_stride(vd->server);
+        row = vnc_dirty_row(guest, y);
+        if (!bitmap_empty(row, guest->cols)) {
+            unsigned long *changed = vnc_dirty_row(&vd->server_dirty, y);
             uint8_t *guest_ptr;
-            uint8_t *server_ptr;
+            int n;
 
             if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
                 qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
@@ -2617,27 +2764,38 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
             } else {
                 guest_ptr = guest_row;
             }
-            server_ptr = server_row;
 
-            for (x = 0; x + 15 < width;
-                    x += 16, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
-                if (!test_and_clear_bit((x / 16), vd->guest.dirty[y]))
-                    continue;
-                if (memcmp(server_ptr, guest_ptr, cmp_bytes) == 0)
-                    continue;
-                memcpy(server_ptr, guest_ptr, cmp_bytes);
-                if (!vd->non_adaptive)
-                    vnc_rect_updated(vd, x, y, &tv);
-                QTAILQ_FOREACH(vs, &vd->clients, next) {
-                    set_bit((x / 16), vs->dirty[y]);
+            n = vnc_diff_row(server_row, guest_ptr,
+                             width * VNC_SERVER_FB_BYTES,
+                             guest->tile * VNC_SERVER_FB_BYTES,
+                             row, changed);
+            if (n) {
+                if (!vd->non_adaptive) {
+                    int x;
+
+                    for (x = find_first_bit(changed, guest->cols);
+                         x < guest->cols;
+                         x = find_next_bit(changed, guest->cols, x + 1)) {
+                        vnc_rect_updated(vd, x * guest->tile, y, &tv);
+                    }
+                }
+                if (y_first < 0) {
+                    y_first = y;
                 }
-                has_dirty++;
+                y_last = y;
+                has_dirty += n;
             }
         }
-        guest_row  += pixman_image_get_stride(vd->guest.fb);
-        server_row += pixman_image_get_stride(vd->server);
+        /* every row of a block has been diffed once its last row is done */
+        if (y % VNC_DIRTY_BLOCK_ROWS == VNC_DIRTY_BLOCK_ROWS - 1 ||
+            y == height - 1) {
+            clear_bit(y / VNC_DIRTY_BLOCK_ROWS, guest->blocks);
+        }
     }
     qemu_pixman_image_unref(tmpbuf);
+    if (y_first >= 0) {
+        vnc_merge_server_dirty(vd, y_first, y_last + 1);
+    }
     return has_dirty;
 }
 
@@ -2703,7 +2861,6 @@ static void vnc_remove_timer(VncDisplay *vd)
 static void vnc_connect(VncDisplay *vd, int csock, int skipauth, bool websocket)
 {
     VncState *vs = g_malloc0(sizeof(VncState));
-    int i;
 
     vs->csock = csock;
 
@@ -2719,11 +2876,6 @@ static void vnc_connect(VncDisplay *vd, int csock, int skipauth, bool websocket)
 #endif
     }
 
-    vs->lossy_rect = g_malloc0(VNC_STAT_ROWS * sizeof (*vs->lossy_rect));
-    for (i = 0; i < VNC_STAT_ROWS; ++i) {
-        vs->lossy_rect[i] = g_malloc0(VNC_STAT_COLS * sizeof (uint8_t));
-    }
-
     VNC_DEBUG("New client on socket %d\n", csock);
     dcl->idle = 0;
     socket_set_nonblock(vs->csock);
@@ -2757,6 +2909,8 @@ void vnc_init_state(VncState *vs)
     VncDisplay *vd = vs->vd;
 
     vs->ds = vd->ds;
+    vnc_client_dirty_resize(vs);
+    vnc_adaptive_init(vs);
     vs->last_x = -1;
     vs->last_y = -1;
 
@@ -2838,6 +2992,7 @@ void vnc_display_init(DisplayState *ds)
 #endif
 
     vs->ds = ds;
+    vs->dirty_tile = VNC_DIRTY_TILE;
     QTAILQ_INIT(&vs->clients);
     vs->expires = TIME_MAX;
 
@@ -2975,6 +3130,7 @@ void vnc_display_open(DisplayState *ds, const char *display, Error **errp)
     int acl = 0;
 #endif
     int lock_key_sync = 1;
+    int tile = VNC_DIRTY_TILE;
 
     if (!vnc_display) {
         error_setg(errp, "VNC display not active");
@@ -3074,6 +3230,14 @@ void vnc_display_open(DisplayState *ds, const char *display, Error **errp)
             vs->lossy = true;
         } else if (strncmp(options, "non-adaptive", 12) == 0) {
             vs->non_adaptive = true;
+        } else if (strncmp(options, "fixed-encoding", 14) == 0) {
+            vs->fixed_encoding = true;
+        } else if (strncmp(options, "tile=", 5) == 0) {
+            tile = atoi(options + 5);
+            if (tile != 16 && tile != 32 && tile != 64) {
+                error_setg(errp, "vnc tile= must be 16, 32 or 64");
+                goto fail;
+            }
         } else if (strncmp(options, "share=", 6) == 0) {
             if (strncmp(options+6, "ignore", 6) == 0) {
                 vs->share_policy = VNC_SHARE_POLICY_IGNORE;
@@ -3088,6 +3252,11 @@ void vnc_display_open(DisplayState *ds, const char *display, Error **errp)
         }
     }
 
+    if (tile != vs->dirty_tile) {
+        vs->dirty_tile = tile;
+        vnc_dpy_resize(vs->ds);
+    }
+
 #ifdef CONFIG_VNC_TLS
     if (acl && x509 && vs->tls.x509verify) {
         if (!(vs->tls.acl = qemu_acl_init("vnc.x509dname"))) {
@@ -77,16 +77,15 @@ typedef void VncSendHextileTile(VncState *vs,
                                 void *last_fg,
                                 int *has_bg, int *has_fg);
 
-/* VNC_MAX_WIDTH must be a multiple of 16. */
-#define VNC_MAX_WIDTH 2560
-#define VNC_MAX_HEIGHT 2048
+/* Width in pixels covered by one dirty bit, unless the tile= option says
+ * otherwise.  The tile width must be a multiple of 16.
+ */
+#define VNC_DIRTY_TILE 16
 
-/* VNC_DIRTY_BITS is the number of bits in the dirty bitmap. */
-#define VNC_DIRTY_BITS (VNC_MAX_WIDTH / 16)
+/* Number of rows summarized by one bit of VncDirtyMap::blocks. */
+#define VNC_DIRTY_BLOCK_ROWS 16
 
 #define VNC_STAT_RECT  64
-#define VNC_STAT_COLS (VNC_MAX_WIDTH / VNC_STAT_RECT)
-#define VNC_STAT_ROWS (VNC_MAX_HEIGHT / VNC_STAT_RECT)
 
 #define VNC_AUTH_CHALLENGE_SIZE 16
 
@@ -103,6 +102,48 @@ typedef struct VncDisplay VncDisplay;
 #include "vnc-ws.h"
 #endif
 
+/*
+ * Dirty map of a surface: one bit per tile of 'tile' pixels of a row,
+ * sized to the surface.  A set bit in 'blocks' means some row of that
+ * block of VNC_DIRTY_BLOCK_ROWS rows may have dirty bits; a clear bit
+ * means all of them are clean, so scans can skip the block.
+ */
+typedef struct VncDirtyMap {
+    int tile;
+    int cols;
+    int rows;
+    int stride;             /* in longs */
+    unsigned long *bits;
+    unsigned long *blocks;
+} VncDirtyMap;
+
+void vnc_dirty_map_resize(VncDirtyMap *map, int tile, int width, int height);
+void vnc_dirty_map_free(VncDirtyMap *map);
+void vnc_dirty_map_set_all(VncDirtyMap *map);
+void vnc_dirty_block_update(VncDirtyMap *map, int y);
+
+static inline unsigned long *vnc_dirty_row(VncDirtyMap *map, int y)
+{
+    return map->bits + y * map->stride;
+}
+
+static inline bool vnc_dirty_block_clean(VncDirtyMap *map, int y)
+{
+    return !test_bit(y / VNC_DIRTY_BLOCK_ROWS, map->blocks);
+}
+
+static inline void vnc_dirty_mark_row(VncDirtyMap *map, int y)
+{
+    set_bit(y / VNC_DIRTY_BLOCK_ROWS, map->blocks);
+}
+
+/* Mark N tiles dirty starting at tile COL of row Y */
+static inline void vnc_dirty_set(VncDirtyMap *map, int y, int col, int n)
+{
+    bitmap_set(vnc_dirty_row(map, y), col, n);
+    vnc_dirty_mark_row(map, y);
+}
+
 struct VncRectStat
 {
     /* time of last 10 updates, to find update frequency */
@@ -118,8 +159,11 @@ typedef struct VncRectStat VncRectStat;
 struct VncSurface
 {
     struct timeval last_freq_check;
-    DECLARE_BITMAP(dirty[VNC_MAX_HEIGHT], VNC_MAX_WIDTH / 16);
-    VncRectStat stats[VNC_STAT_ROWS][VNC_STAT_COLS];
+    VncDirtyMap dirty;
+    /* one VncRectStat per VNC_STAT_RECT square, stat_cols per row */
+    VncRectStat *stats;
+    int stat_cols;
+    int stat_rows;
     pixman_image_t *fb;
     pixman_format_code_t format;
 };
@@ -161,6 +205,10 @@ struct VncDisplay
 
     struct VncSurface guest;   /* guest visible surface (aka ds->surface) */
     pixman_image_t *server;    /* vnc server surface */
+    /* server surface chunks changed by the last refresh, not yet merged
+     * into the clients' dirty maps */
+    VncDirtyMap server_dirty;
+    int dirty_tile;
 
     char *display;
     char *password;
@@ -168,6 +216,7 @@ struct VncDisplay
     int auth;
     bool lossy;
     bool non_adaptive;
+    bool fixed_encoding;
 #ifdef CONFIG_VNC_TLS
     int subauth; /* Used by VeNCrypt */
     VncDisplayTLS tls;
@@ -221,6 +270,28 @@ typedef struct VncZywrle {
     int buf[VNC_ZRLE_TILE_WIDTH * VNC_ZRLE_TILE_HEIGHT];
 } VncZywrle;
 
+/* Number of encoding/compression combinations the adaptive controller
+ * chooses from, see vnc_adaptive_modes[] */
+#define VNC_ADAPTIVE_MODES 9
+
+typedef struct VncEncoderStat {
+    double ns_per_pixel;        /* encoder time */
+    double bytes_per_pixel;     /* encoder output */
+    int64_t last_update;        /* update number of the last sample, or 0 */
+} VncEncoderStat;
+
+typedef struct VncAdaptive {
+    /* Socket side, under the output lock */
+    int64_t send_start;         /* first write since the last request */
+    size_t send_bytes;
+    double throughput;          /* bytes per second, 0 until measured */
+
+    /* Encoder side, only touched by the worker encoding for the client */
+    VncEncoderStat enc[VNC_ADAPTIVE_MODES];
+    int64_t updates;
+    int mode;                   /* mode of the last update, -1 if none */
+} VncAdaptive;
+
 struct VncRect
 {
     int x;
@@ -232,6 +303,9 @@ struct VncRect
 struct VncRectEntry
 {
     struct VncRect rect;
+    /* encoded rectangle, when the job is split between workers */
+    Buffer output;
+    int n;
     QLIST_ENTRY(VncRectEntry) next;
 };
 
@@ -241,6 +315,17 @@ struct VncJob
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
+
+    /* Set while a worker thread owns the job.  Rectangles of a job that
+     * uses a stateless encoding are published in parts[] so that idle
+     * workers can encode them in parallel with the owner.
+     */
+    bool busy;
+    VncState *local;
+    VncRectEntry **parts;
+    int nb_parts;
+    int next_part;
+    int parts_done;
 };
 
 struct VncState
@@ -248,9 +333,9 @@ struct VncState
     int csock;
 
     DisplayState *ds;
-    DECLARE_BITMAP(dirty[VNC_MAX_HEIGHT], VNC_DIRTY_BITS);
-    uint8_t **lossy_rect; /* Not an Array to avoid costly memcpy in
-                           * vnc-jobs-async.c */
+    VncDirtyMap dirty;
+    /* one flag per VNC_STAT_RECT square, vd->guest.stat_cols per row */
+    uint8_t *lossy_rect;
 
     VncDisplay *vd;
     int need_update;
@@ -288,7 +373,11 @@ struct VncState
     Buffer input;
 #ifdef CONFIG_VNC_WS
     Buffer ws_input;
-    Buffer ws_output;
+    /* header of the frame being sent; its payload starts output */
+    uint8_t ws_header[WS_HEAD_MAX_LEN];
+    size_t ws_header_len;
+    size_t ws_header_offset;
+    size_t ws_payload;
 #endif
     /* current output mode information */
     VncWritePixels *write_pixels;
@@ -310,6 +399,16 @@ struct VncState
     QemuMutex output_mutex;
     QEMUBH *bh;
     Buffer jobs_buffer;
+    /* Encoding state used by the worker threads.  It is allocated once
+     * because the zlib streams are bound to the address of their VncState.
+     */
+    VncState *jobs_local;
+    /* Copy of the server surface that the encoders read, so that they run
+     * without the display lock.  Only the rectangles of the job being
+     * encoded are up to date.  Used in jobs_local.
+     */
+    pixman_image_t *snapshot;
+    VncAdaptive adaptive;
 
     /* Encoding specific, if you add something here, don't forget to
      *  update vnc_async_encoding_start()
@@ -501,6 +600,7 @@ void vnc_client_write(void *opaque);
 
 long vnc_client_read_buf(VncState *vs, uint8_t *data, size_t datalen);
 long vnc_client_write_buf(VncState *vs, const uint8_t *data, size_t datalen);
+long vnc_client_writev_buf(VncState *vs, struct iovec *iov, int iovcnt);
 
 /* Protocol I/O functions */
 void vnc_write(VncState *vs, const void *data, size_t len);
@@ -553,6 +653,8 @@ void vnc_framebuffer_update(VncState *vs, int x, int y, int w, int h,
 
 void *vnc_server_fb_ptr(VncDisplay *vd, int x, int y);
 int vnc_server_fb_stride(VncDisplay *vd);
+void *vnc_snapshot_ptr(VncState *vs, int x, int y);
+int vnc_snapshot_stride(VncState *vs);
 
 void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v);
 double vnc_update_freq(VncState *vs, int x, int y, int w, int h);
@@ -581,4 +683,13 @@ int vnc_zrle_send_framebuffer_update(VncState *vs, int x, int y, int w, int h);
 int vnc_zywrle_send_framebuffer_update(VncState *vs, int x, int y, int w, int h);
 void vnc_zrle_clear(VncState *vs);
 
+/* Adaptive encoding selection */
+void vnc_adaptive_init(VncState *vs);
+void vnc_adaptive_sent(VncState *vs, long ret);
+void vnc_adaptive_request(VncState *vs);
+int vnc_adaptive_select(VncState *vs, VncState *local, int pixels);
+void vnc_adaptive_update(VncState *vs, int mode, int pixels, int64_t ns,
+                         size_t bytes);
+const char *vnc_adaptive_mode_name(const VncState *vs);
+
 #endif /* __QEMU_VNC_H */
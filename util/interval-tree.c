@@ -0,0 +1,297 @@
+/*
+ * Interval tree
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+/* The runs are kept in a treap: a binary search tree on the start of the
+ * runs, that is also a heap on random priorities so that its depth is
+ * O(log n) on average.  Splitting the treap at a point and joining two
+ * treaps follow a single path, and so does updating max_free, which lets
+ * the search for free space skip the subtrees without enough of it.
+ */
+
+static uint64_t run_length(const IntervalTreeNode *n)
+{
+    uint64_t len = n->last - n->start + 1;
+
+    return len ? len : UINT64_MAX;
+}
+
+static void node_update(IntervalTreeNode *n)
+{
+    n->max_free = n->value ? 0 : run_length(n);
+    if (n->left && n->left->max_free > n->max_free) {
+        n->max_free = n->left->max_free;
+    }
+    if (n->right && n->right->max_free > n->max_free) {
+        n->max_free = n->right->max_free;
+    }
+}
+
+static IntervalTreeNode *node_new(IntervalTree *tree, uint64_t start,
+                                  uint64_t last, unsigned long value)
+{
+    IntervalTreeNode *n = g_new0(IntervalTreeNode, 1);
+    uint32_t x = tree->seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    tree->seed = x;
+
+    n->start = start;
+    n->last = last;
+    n->value = value;
+    n->priority = x;
+    node_update(n);
+    return n;
+}
+
+static void node_free_all(IntervalTreeNode *n)
+{
+    if (n) {
+        node_free_all(n->left);
+        node_free_all(n->right);
+        g_free(n);
+    }
+}
+
+/* Split the treap 't' into the runs that start before 'point' and the
+   others.  */
+static void treap_split(IntervalTreeNode *t, uint64_t point,
+                        IntervalTreeNode **before, IntervalTreeNode **after)
+{
+    if (!t) {
+        *before = *after = NULL;
+        return;
+    }
+    if (t->start < point) {
+        treap_split(t->right, point, &t->right, after);
+        *before = t;
+    } else {
+        treap_split(t->left, point, before, &t->left);
+        *after = t;
+    }
+    node_update(t);
+}
+
+/* Join two treaps, the runs of 'a' all coming before those of 'b'.  */
+static IntervalTreeNode *treap_join(IntervalTreeNode *a, IntervalTreeNode *b)
+{
+    if (!a) {
+        return b;
+    }
+    if (!b) {
+        return a;
+    }
+    if (a->priority > b->priority) {
+        a->right = treap_join(a->right, b);
+        node_update(a);
+        return a;
+    } else {
+        b->left = treap_join(a, b->left);
+        node_update(b);
+        return b;
+    }
+}
+
+static IntervalTreeNode *treap_take_first(IntervalTreeNode **t)
+{
+    IntervalTreeNode *n = *t, *first;
+
+    if (n->left) {
+        first = treap_take_first(&n->left);
+        node_update(n);
+        return first;
+    }
+    *t = n->right;
+    return n;
+}
+
+static IntervalTreeNode *treap_take_last(IntervalTreeNode **t)
+{
+    IntervalTreeNode *n = *t, *last;
+
+    if (n->right) {
+        last = treap_take_last(&n->right);
+        node_update(n);
+        return last;
+    }
+    *t = n->left;
+    return n;
+}
+
+void interval_tree_init(IntervalTree *tree, uint64_t last)
+{
+    tree->seed = 0x9e3779b9;
+    tree->last = last;
+    tree->root = node_new(tree, 0, last, 0);
+}
+
+void interval_tree_destroy(IntervalTree *tree)
+{
+    node_free_all(tree->root);
+    tree->root = NULL;
+}
+
+const IntervalTreeNode *interval_tree_find(const IntervalTree *tree,
+                                           uint64_t point)
+{
+    const IntervalTreeNode *n = tree->root;
+
+    assert(point <= tree->last);
+    for (;;) {
+        if (point < n->start) {
+            n = n->left;
+        } else if (point > n->last) {
+            n = n->right;
+        } else {
+            return n;
+        }
+    }
+}
+
+void interval_tree_set(IntervalTree *tree, uint64_t start, uint64_t last,
+                       unsigned long value)
+{
+    const IntervalTreeNode *n;
+    IntervalTreeNode *before, *runs, *after, *neighbour;
+    uint64_t first_start, last_last;
+    unsigned long first_value, last_value;
+
+    assert(start <= last && last <= tree->last);
+
+    /* take out the runs that overlap [start, last] */
+    n = interval_tree_find(tree, start);
+    first_start = n->start;
+    first_value = n->value;
+    n = interval_tree_find(tree, last);
+    last_last = n->last;
+    last_value = n->value;
+
+    treap_split(tree->root, first_start, &before, &runs);
+    if (last_last == tree->last) {
+        after = NULL;
+    } else {
+        treap_split(runs, last_last + 1, &runs, &after);
+    }
+    node_free_all(runs);
+
+    /* extend [start, last] over the neighbouring points with its value,
+       in the old runs and beyond them */
+    if (first_value == value) {
+        start = first_start;
+    }
+    if (last_value == value) {
+        last = last_last;
+    }
+    if (before && start == first_start) {
+        for (neighbour = before; neighbour->right; ) {
+            neighbour = neighbour->right;
+        }
+        if (neighbour->value == value) {
+            neighbour = treap_take_last(&before);
+            start = neighbour->start;
+            g_free(neighbour);
+        }
+    }
+    if (after && last == last_last) {
+        for (neighbour = after; neighbour->left; ) {
+            neighbour = neighbour->left;
+        }
+        if (neighbour->value == value) {
+            neighbour = treap_take_first(&after);
+            last = neighbour->last;
+            g_free(neighbour);
+        }
+    }
+
+    runs = node_new(tree, start, last, value);
+    if (first_start < start) {
+        runs = treap_join(node_new(tree, first_start, start - 1, first_value),
+                          runs);
+    }
+    if (last < last_last) {
+        runs = treap_join(runs,
+                          node_new(tree, last + 1, last_last, last_value));
+    }
+    tree->root = treap_join(treap_join(before, runs), after);
+}
+
+static bool find_free_down(const IntervalTreeNode *n,
+                           uint64_t start, uint64_t last,
+                           uint64_t size, uint64_t align, uint64_t *result)
+{
+    uint64_t s, e, addr;
+
+    if (!n || n->max_free < size) {
+        return false;
+    }
+    if (n->last < last &&
+        find_free_down(n->right, start, last, size, align, result)) {
+        return true;
+    }
+    if (n->value == 0 && n->start <= last && n->last >= start) {
+        s = MAX(n->start, start);
+        e = MIN(n->last, last);
+        if (e - s >= size - 1) {
+            addr = (e - (size - 1)) & ~(align - 1);
+            if (addr >= s) {
+                *result = addr;
+                return true;
+            }
+        }
+    }
+    return n->start > start &&
+           find_free_down(n->left, start, last, size, align, result);
+}
+
+static bool find_free_up(const IntervalTreeNode *n,
+                         uint64_t start, uint64_t last,
+                         uint64_t size, uint64_t align, uint64_t *result)
+{
+    uint64_t s, e, addr;
+
+    if (!n || n->max_free < size) {
+        return false;
+    }
+    if (n->start > start &&
+        find_free_up(n->left, start, last, size, align, result)) {
+        return true;
+    }
+    if (n->value == 0 && n->start <= last && n->last >= start) {
+        s = MAX(n->start, start);
+        e = MIN(n->last, last);
+        addr = (s + align - 1) & ~(align - 1);
+        if (addr >= s && addr <= e && e - addr >= size - 1) {
+            *result = addr;
+            return true;
+        }
+    }
+    return n->last < last &&
+           find_free_up(n->right, start, last, size, align, result);
+}
+
+bool interval_tree_find_free(const IntervalTree *tree,
+                             uint64_t start, uint64_t last,
+                             uint64_t size, uint64_t align, bool top_down,
+                             uint64_t *result)
+{
+    assert(size != 0 && (align & (align - 1)) == 0);
+
+    if (start > last || last > tree->last) {
+        return false;
+    }
+    if (top_down) {
+        return find_free_down(tree->root, start, last, size, align, result);
+    } else {
+        return find_free_up(tree->root, start, last, size, align, result);
+    }
+}
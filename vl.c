@@ -155,6 +155,7 @@ int main(int argc, char **argv)
 #include "sysemu/qtest.h"
 
 #include "disas/disas.h"
+#include "tcg/perf.h"
 
 #include "qemu/sockets.h"
 
@@ -214,6 +215,9 @@ int smp_threads = 1;
 #ifdef CONFIG_VNC
 const char *vnc_display;
 #endif
+#ifdef CONFIG_POSIX
+static const char *shm_display_path;
+#endif
 int acpi_enabled = 1;
 int no_hpet = 0;
 int fd_bootchk = 1;
@@ -2199,6 +2203,20 @@ static DisplayType select_display(const char *p)
 #else
         fprintf(stderr, "VNC support is disabled\n");
         exit(1);
+#endif
+    } else if (strstart(p, "shm", &opts)) {
+#ifdef CONFIG_POSIX
+        display_remote++;
+
+        if (strstart(opts, "=", &opts) && *opts) {
+            shm_display_path = opts;
+        } else {
+            fprintf(stderr, "shm display requires a socket path shm=<path>\n");
+            exit(1);
+        }
+#else
+        fprintf(stderr, "shm display is not supported on this host\n");
+        exit(1);
 #endif
     } else if (strstart(p, "curses", &opts)) {
 #ifdef CONFIG_CURSES
@@ -3260,6 +3278,15 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_singlestep:
                 singlestep = 1;
                 break;
+            case QEMU_OPTION_perfmap:
+                perf_enable_perfmap();
+                break;
+            case QEMU_OPTION_jitdump:
+                perf_enable_jitdump();
+                break;
+            case QEMU_OPTION_tb_stats:
+                tb_stats_enable();
+                break;
             case QEMU_OPTION_S:
                 autostart = 0;
                 break;
@@ -4304,6 +4331,18 @@ int main(int argc, char **argv, char **envp)
         }
     }
 #endif
+#ifdef CONFIG_POSIX
+    if (shm_display_path) {
+        Error *local_err = NULL;
+        shm_display_init(ds, shm_display_path, &local_err);
+        if (local_err != NULL) {
+            fprintf(stderr, "Failed to start shm display on `%s': %s\n",
+                    shm_display_path, error_get_pretty(local_err));
+            error_free(local_err);
+            exit(1);
+        }
+    }
+#endif
 #ifdef CONFIG_SPICE
     if (using_spice && !qxl_enabled) {
         qemu_spice_display_init(ds);
@@ -4355,6 +4394,7 @@ int main(int argc, char **argv, char **envp)
     bdrv_close_all();
     pause_all_vcpus();
     res_free();
+    perf_exit();
 
     return 0;
 }